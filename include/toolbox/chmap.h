@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#ifndef _U_CHMAP_H_
+#define _U_CHMAP_H_
+
+#include <sys/types.h>
+#include <u/libu_conf.h>
+#include <u/toolbox/hmap.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  \addtogroup chmap
+ *  \{
+ */
+
+/** \brief default number of shards */
+#define U_CHMAP_SHARDS_DFL  16
+
+/** \brief Concurrent hmap */
+struct u_chmap_s;
+typedef struct u_chmap_s u_chmap_t;
+
+int u_chmap_new (u_hmap_opts_t *opts, size_t nshards, u_chmap_t **pchmap);
+void u_chmap_free (u_chmap_t *chmap);
+int u_chmap_put (u_chmap_t *chmap, const void *key, const void *val);
+int u_chmap_get (u_chmap_t *chmap, const void *key,
+        int (*f)(const void *val, void *arg), void *arg);
+int u_chmap_del (u_chmap_t *chmap, const void *key);
+void u_chmap_clear (u_chmap_t *chmap);
+ssize_t u_chmap_count (u_chmap_t *chmap);
+int u_chmap_stats (u_chmap_t *chmap, u_hmap_stats_t *stats);
+int u_chmap_foreach (u_chmap_t *chmap,
+        int f(const void *val, const void *arg), void *arg);
+
+/**
+ *  \}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_U_CHMAP_H_ */
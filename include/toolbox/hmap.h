@@ -6,6 +6,7 @@
 #define _U_HMAP_H_
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <u/libu_conf.h>
 #include <u/toolbox/str.h>
 
@@ -29,7 +30,8 @@ typedef enum {
 typedef enum {
     U_HMAP_TYPE_CHAIN = 0,  /**< separate chaining (default) */
     U_HMAP_TYPE_LINEAR,     /**< linear probing */
-    U_HMAP_TYPE_LAST = U_HMAP_TYPE_LINEAR           
+    U_HMAP_TYPE_ROBINHOOD,  /**< open addressing with Robin Hood probing */
+    U_HMAP_TYPE_LAST = U_HMAP_TYPE_ROBINHOOD
 } u_hmap_type_t;
 
 #define U_HMAP_IS_TYPE(t)   (t <= U_HMAP_TYPE_LAST)
@@ -38,9 +40,29 @@ typedef enum {
 typedef enum {
     U_HMAP_OPTS_OWNSDATA =      0x1,    /**< hmap owns memory */
     U_HMAP_OPTS_NO_OVERWRITE =  0x2,    /**< don't overwrite equal keys */
-    U_HMAP_OPTS_HASH_STRONG =   0x4     /**< custom hash function is strong */
+    U_HMAP_OPTS_HASH_STRONG =   0x4,    /**< custom hash function is strong */
+    U_HMAP_OPTS_HASH_RANDOM_SEED = 0x8, /**< random seed for the built-in
+                                          hash function */
+    U_HMAP_OPTS_STATS =         0x10    /**< collect u_hmap_stats()
+                                          counters */
 } u_hmap_options_t;
 
+/** \brief built-in hash functions for string keys */
+typedef enum {
+    U_HMAP_HASH_WYHASH = 0, /**< wyhash (default) */
+    U_HMAP_HASH_XXH64,      /**< XXH64 */
+    U_HMAP_HASH_OAAT,       /**< Jenkins' one-at-a-time (legacy) */
+    U_HMAP_HASH_LAST = U_HMAP_HASH_OAAT
+} u_hmap_hash_t;
+
+#define U_HMAP_IS_HASH(h)   (h <= U_HMAP_HASH_LAST)
+
+/** \brief what u_hmap_scan() does with an object after the callback */
+typedef enum {
+    U_HMAP_SCAN_KEEP = 0,   /**< leave it in the hmap */
+    U_HMAP_SCAN_DEL         /**< delete it */
+} u_hmap_scan_ret_t;
+
 /** \brief hmap data type for keys and values 
  * (only for U_HMAP_OPTS_OWNSDATA) */
 typedef enum {
@@ -80,13 +102,51 @@ typedef enum {
                         /* queue: <-> (front) ..[a-2][a-1][a] (back) */
 
     U_HMAP_PCY_CUSTOM,  /**< user policy via u_hmap_opts_set_policy_cmp() */
-                        /* queue: -> (front) [p][p-1][p-2].. (back) -> */
+                        /* heap: (top) [p] .. [p+k] */
+
+    U_HMAP_PCY_CLOCK,   /**< second chance: LRU approximation, a hit only
+                             sets a reference bit */
+                        /* ring: -> [t][t+1](hand)..[t-1] */
 
-    U_HMAP_PCY_LAST = U_HMAP_PCY_CUSTOM
+    U_HMAP_PCY_SLRU,    /**< segmented LRU: a hit moves the entry from the
+                             probationary to the protected segment */
+                        /* queues: -> probation.. -> | -> protected.. -> */
+
+    U_HMAP_PCY_2Q,      /**< 2Q: new entries go through a FIFO, keys seen
+                             again after eviction from it enter the LRU */
+                        /* queues: -> A1in.. -> ghost | -> Am.. -> */
+
+    U_HMAP_PCY_WTINYLFU,    /**< window LRU in front of a segmented LRU,
+                                 admission by estimated access frequency */
+                        /* queues: -> window.. -> ? -> probation/protected */
+
+    U_HMAP_PCY_LAST = U_HMAP_PCY_WTINYLFU
 } u_hmap_pcy_type_t;
 
 #define U_HMAP_IS_PCY(p)    (p <= U_HMAP_PCY_LAST)
 
+/** \brief hmap statistics (see u_hmap_stats()) */
+typedef struct
+{
+    /* counters, only updated with U_HMAP_OPTS_STATS */
+    uint64_t hits,          /**< lookups finding their key */
+             misses,        /**< lookups not finding it */
+             puts,          /**< insertions, overwrites included */
+             overwrites,    /**< insertions replacing an existing object */
+             evictions,     /**< objects discarded by the policy */
+             expirations,   /**< expired objects reaped */
+             resizes,       /**< table growths */
+             resize_ns;     /**< total time spent growing (nanoseconds) */
+    u_hmap_pcy_type_t policy;   /**< policy the evictions are due to */
+
+    /* current shape of the table */
+    size_t count,           /**< objects stored */
+           size;            /**< buckets or slots */
+    double load;            /**< count / size */
+    size_t probe_max;       /**< longest probe sequence (or chain) */
+    double probe_mean;      /**< mean keys compared to find an object */
+} u_hmap_stats_t;
+
 typedef struct u_hmap_s u_hmap_t;     
 typedef struct u_hmap_pcy_s u_hmap_pcy_t;     
 typedef struct u_hmap_o_s u_hmap_o_t;     
@@ -106,8 +166,19 @@ void u_hmap_easy_free (u_hmap_t *hmap);
 /* [u_hmap_*] */
 int u_hmap_new (u_hmap_opts_t *opts, u_hmap_t **phmap);
 int u_hmap_put (u_hmap_t *hmap, u_hmap_o_t *obj, u_hmap_o_t **old);
+int u_hmap_put_ttl (u_hmap_t *hmap, u_hmap_o_t *obj, uint64_t ttl,
+        u_hmap_o_t **old);
 int u_hmap_get (u_hmap_t *hmap, const void *key, u_hmap_o_t **obj);
+int u_hmap_get_n (u_hmap_t *hmap, const void *key, size_t klen,
+        u_hmap_o_t **obj);
 int u_hmap_del (u_hmap_t *hmap, const void *key, u_hmap_o_t **obj);
+ssize_t u_hmap_get_batch (u_hmap_t *hmap, const void * const *keys, size_t n,
+        u_hmap_o_t **objs);
+ssize_t u_hmap_put_batch (u_hmap_t *hmap, u_hmap_o_t **objs, size_t n,
+        u_hmap_o_t **olds, int *rcs);
+ssize_t u_hmap_del_batch (u_hmap_t *hmap, const void * const *keys, size_t n,
+        u_hmap_o_t **objs);
+int u_hmap_pcy_update (u_hmap_t *hmap, const void *key);
 int u_hmap_copy (u_hmap_t *to, u_hmap_t *from);
 void u_hmap_clear (u_hmap_t *hmap);
 void u_hmap_free (u_hmap_t *hmap);
@@ -116,7 +187,18 @@ int u_hmap_foreach_keyval (u_hmap_t *hmap, int f(const void *key,
             const void *val));
 int u_hmap_foreach_arg (u_hmap_t *hmap, int f(const void *val, 
             const void *arg), void *arg);
+size_t u_hmap_scan (u_hmap_t *hmap, size_t cursor, size_t count,
+        int f(u_hmap_o_t *obj, void *arg), void *arg);
+ssize_t u_hmap_expire (u_hmap_t *hmap, uint64_t now, size_t budget);
+int u_hmap_freeze (u_hmap_t *hmap, u_hmap_t **pfrozen);
+int u_hmap_save (u_hmap_t *hmap, const char *path);
+int u_hmap_load (const char *path, u_hmap_opts_t *opts, u_hmap_t **phmap);
 ssize_t u_hmap_count (u_hmap_t *hmap);
+int u_hmap_stats (u_hmap_t *hmap, u_hmap_stats_t *stats);
+size_t u_hmap_hash (u_hmap_t *hmap, const void *key);
+int u_hmap_pcy_tracks_get (u_hmap_t *hmap);
+int u_hmap_key_comp (u_hmap_t *hmap, const void *k1, const void *k2);
+int u_hmap_has_option (u_hmap_t *hmap, int option);
 const char *u_hmap_strerror (u_hmap_ret_t);
 
 /* [u_hmap_o_*] */
@@ -124,6 +206,7 @@ u_hmap_o_t *u_hmap_o_new (u_hmap_t *hmap, const void *key, const void *val);
 void *u_hmap_o_get_key (u_hmap_o_t *obj);
 void *u_hmap_o_get_val (u_hmap_o_t *obj);
 void u_hmap_o_free (u_hmap_o_t *obj);
+void u_hmap_o_dispose (u_hmap_t *hmap, u_hmap_o_t *obj);
 
 /* [u_hmap_opts_*] */
 int u_hmap_opts_new (u_hmap_opts_t **opts);
@@ -132,6 +215,13 @@ void u_hmap_opts_init (u_hmap_opts_t *opts);
 int u_hmap_opts_set_size (u_hmap_opts_t *opts, int sz);
 int u_hmap_opts_set_max (u_hmap_opts_t *opts, int max);
 int u_hmap_opts_set_type (u_hmap_opts_t *opts, u_hmap_type_t type);
+int u_hmap_opts_set_incremental_resize (u_hmap_opts_t *opts, int enable);
+int u_hmap_opts_set_slab (u_hmap_opts_t *opts, int enable);
+int u_hmap_opts_set_hash_type (u_hmap_opts_t *opts, u_hmap_hash_t hash);
+int u_hmap_opts_set_hash_seed (u_hmap_opts_t *opts, uint64_t seed);
+int u_hmap_opts_set_ttl (u_hmap_opts_t *opts, uint64_t ttl);
+int u_hmap_opts_set_clockfunc (u_hmap_opts_t *opts, uint64_t (*f_now)(void));
+int u_hmap_opts_set_mmap (u_hmap_opts_t *opts, int enable);
 int u_hmap_opts_set_policy (u_hmap_opts_t *opts, u_hmap_pcy_type_t policy);
 int u_hmap_opts_set_policy_cmp (u_hmap_opts_t *opts,
         int (*f_pcy_cmp)(void *o1, void *o2));
@@ -146,7 +236,7 @@ void u_hmap_opts_free (u_hmap_opts_t *opts);
 int u_hmap_opts_set_option (u_hmap_opts_t *opts, int option);
 int u_hmap_opts_unset_option (u_hmap_opts_t *opts, int option);
 int u_hmap_opts_set_hashfunc (u_hmap_opts_t *opts, 
-        size_t (*f_hash)(const void *key, size_t buckets));
+        size_t (*f_hash)(const void *key));
 int u_hmap_opts_set_compfunc (u_hmap_opts_t *opts, 
         int (*f_comp)(const void *k1, const void *k2));
 int u_hmap_opts_set_freefunc (u_hmap_opts_t *opts, 
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#ifndef _U_IMAP_H_
+#define _U_IMAP_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <u/libu_conf.h>
+#include <u/toolbox/memory.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  \defgroup imap IMap
+ *  \{
+ *      \par
+ *      The \ref imap module is a macro template, in the spirit of
+ *      \c queue.h, generating hash maps specialized for \c uint64_t keys:
+ *      \code
+ *          U_IMAP_GENERATE(name, vtype)
+ *      \endcode
+ *      defines the \c name_t type and its \c static functions, mapping
+ *      \c uint64_t keys to \c vtype values (any type that can be assigned).
+ *      Keys and values are kept by value in two flat arrays probed
+ *      linearly; the hash (::U_IMAP_HASH) and key comparison are inlined,
+ *      there is no per-object allocation and deleted entries leave no
+ *      tombstones (the following ones are shifted back).
+ *
+ *      \par
+ *      Two instances are ready to use: \c u_imap_t (\c uint64_t \c ->
+ *      \c void \c *) and \c u_imap64_t (\c uint64_t \c -> \c uint64_t).
+ *      Functions of \c u_imap_t (the same for any \c name, with \c vtype in
+ *      place of \c void \c *):
+ *          - <tt>int u_imap_new (size_t hint, u_imap_t **pm)</tt> creates a
+ *          map sized for \c hint entries;
+ *          - <tt>void u_imap_free (u_imap_t *m)</tt>;
+ *          - <tt>int u_imap_put (u_imap_t *m, uint64_t key, void *val)</tt>
+ *          inserts or overwrites;
+ *          - <tt>int u_imap_get (u_imap_t *m, uint64_t key, void **pval)</tt>
+ *          saves the value in \c *pval (if \c pval is not \c NULL);
+ *          - <tt>int u_imap_del (u_imap_t *m, uint64_t key, void **pval)</tt>
+ *          removes the entry and saves its value as u_imap_get() does;
+ *          - <tt>size_t u_imap_count (u_imap_t *m)</tt>;
+ *          - <tt>void u_imap_clear (u_imap_t *m)</tt>;
+ *          - <tt>int u_imap_foreach (u_imap_t *m, int f(uint64_t key,
+ *          void *val, void *arg), void *arg)</tt> stops when \c f returns
+ *          non-zero.
+ *
+ *      All functions returning \c int return \c 0 on success and \c ~0 on
+ *      failure or if the key is missing.
+ *
+ *      \code
+ *          static char answer[] = "answer";
+ *          u_imap_t *m = NULL;
+ *          void *v;
+ *
+ *          dbg_err_if (u_imap_new(0, &m));
+ *          dbg_err_if (u_imap_put(m, 42, answer));
+ *
+ *          if (u_imap_get(m, 42, &v) == 0)
+ *              u_con("42 is the %s", (const char *) v);
+ *      err:
+ *          U_FREEF(m, u_imap_free);
+ *      \endcode
+ */
+
+/** \brief hash of a 64-bit key: the MurmurHash3 finalizer, whose low bits
+ *         (the ones used to pick a slot) depend on all of the key bits;
+ *         may be redefined before including this header */
+#ifndef U_IMAP_HASH
+#define U_IMAP_HASH(k)  __u_imap_mix((uint64_t) (k))
+#endif
+
+/** \brief minimum number of slots (a power of two) */
+#define U_IMAP_MIN_SIZE     16
+
+/** \brief maximum load factor: slots * U_IMAP_LOAD_NUM / U_IMAP_LOAD_DEN */
+#define U_IMAP_LOAD_NUM     3
+#define U_IMAP_LOAD_DEN     4
+
+#if defined(__GNUC__)
+  #define U_IMAP_STATIC     static __inline__ __attribute__((__unused__))
+#else
+  #define U_IMAP_STATIC     static
+#endif
+
+U_IMAP_STATIC uint64_t __u_imap_mix (uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+/** \brief generate \c name_t, mapping \c uint64_t keys to \c vtype values,
+ *         and its functions (see \ref imap) */
+#define U_IMAP_GENERATE(name, vtype)                                        \
+                                                                            \
+/* key 0 marks an empty slot: its value (if any) is kept aside */           \
+typedef struct name##_s                                                     \
+{                                                                           \
+    uint64_t *keys;                                                         \
+    vtype *vals;                                                            \
+    size_t n,           /* entries (key 0 included) */                      \
+           mask,        /* slots - 1 */                                     \
+           max;         /* grow when n gets here */                         \
+    int zset;           /* key 0 is set */                                  \
+    vtype zval;         /* value of key 0 */                                \
+} name##_t;                                                                 \
+                                                                            \
+U_IMAP_STATIC int name##_alloc_ (name##_t *m, size_t size)                  \
+{                                                                           \
+    m->keys = (uint64_t *) u_zalloc(size * sizeof(uint64_t));               \
+    m->vals = (vtype *) u_malloc(size * sizeof(vtype));                     \
+                                                                            \
+    if (m->keys == NULL || m->vals == NULL)                                 \
+    {                                                                       \
+        u_free(m->keys);                                                    \
+        u_free(m->vals);                                                    \
+        return ~0;                                                          \
+    }                                                                       \
+                                                                            \
+    m->mask = size - 1;                                                     \
+    m->max = size / U_IMAP_LOAD_DEN * U_IMAP_LOAD_NUM;                      \
+                                                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/* double the slots and reinsert every entry (keys are all distinct) */     \
+U_IMAP_STATIC int name##_grow_ (name##_t *m)                                \
+{                                                                           \
+    uint64_t *okeys = m->keys;                                              \
+    vtype *ovals = m->vals;                                                 \
+    size_t i, j, osize = m->mask + 1;                                       \
+                                                                            \
+    if (osize > ((size_t) -1 >> 1) / sizeof(uint64_t) ||                    \
+            name##_alloc_(m, osize << 1))                                   \
+    {                                                                       \
+        m->keys = okeys;                                                    \
+        m->vals = ovals;                                                    \
+        return ~0;                                                          \
+    }                                                                       \
+                                                                            \
+    for (i = 0; i < osize; ++i)                                             \
+    {                                                                       \
+        if (okeys[i] == 0)                                                  \
+            continue;                                                       \
+                                                                            \
+        for (j = U_IMAP_HASH(okeys[i]) & m->mask; m->keys[j];               \
+                j = (j + 1) & m->mask)                                      \
+            ;                                                               \
+        m->keys[j] = okeys[i];                                              \
+        m->vals[j] = ovals[i];                                              \
+    }                                                                       \
+                                                                            \
+    u_free(okeys);                                                          \
+    u_free(ovals);                                                          \
+                                                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC int name##_new (size_t hint, name##_t **pm)                   \
+{                                                                           \
+    name##_t *m;                                                            \
+    size_t size = U_IMAP_MIN_SIZE;                                          \
+                                                                            \
+    if (pm == NULL)                                                         \
+        return ~0;                                                          \
+                                                                            \
+    for (; size / U_IMAP_LOAD_DEN * U_IMAP_LOAD_NUM < hint; size <<= 1)     \
+        if (size > ((size_t) -1 >> 1) / sizeof(uint64_t))                   \
+            return ~0;                                                      \
+                                                                            \
+    if ((m = (name##_t *) u_zalloc(sizeof(name##_t))) == NULL)              \
+        return ~0;                                                          \
+                                                                            \
+    if (name##_alloc_(m, size))                                             \
+    {                                                                       \
+        u_free(m);                                                          \
+        return ~0;                                                          \
+    }                                                                       \
+                                                                            \
+    *pm = m;                                                                \
+                                                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC void name##_free (name##_t *m)                                \
+{                                                                           \
+    if (m == NULL)                                                          \
+        return;                                                             \
+                                                                            \
+    u_free(m->keys);                                                        \
+    u_free(m->vals);                                                        \
+    u_free(m);                                                              \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC size_t name##_count (name##_t *m)                             \
+{                                                                           \
+    return m ? m->n : 0;                                                    \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC void name##_clear (name##_t *m)                               \
+{                                                                           \
+    if (m == NULL)                                                          \
+        return;                                                             \
+                                                                            \
+    memset(m->keys, 0, (m->mask + 1) * sizeof(uint64_t));                   \
+    m->n = 0;                                                               \
+    m->zset = 0;                                                            \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC int name##_get (name##_t *m, uint64_t key, vtype *pval)       \
+{                                                                           \
+    size_t i;                                                               \
+                                                                            \
+    if (key == 0)                                                           \
+    {                                                                       \
+        if (!m->zset)                                                       \
+            return ~0;                                                      \
+        if (pval)                                                           \
+            *pval = m->zval;                                                \
+        return 0;                                                           \
+    }                                                                       \
+                                                                            \
+    for (i = U_IMAP_HASH(key) & m->mask; m->keys[i]; i = (i + 1) & m->mask) \
+    {                                                                       \
+        if (m->keys[i] == key)                                              \
+        {                                                                   \
+            if (pval)                                                       \
+                *pval = m->vals[i];                                         \
+            return 0;                                                       \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return ~0;                                                              \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC int name##_put (name##_t *m, uint64_t key, vtype val)         \
+{                                                                           \
+    size_t i;                                                               \
+                                                                            \
+    if (key == 0)                                                           \
+    {                                                                       \
+        m->n += !m->zset;                                                   \
+        m->zset = 1;                                                        \
+        m->zval = val;                                                      \
+        return 0;                                                           \
+    }                                                                       \
+                                                                            \
+    for (i = U_IMAP_HASH(key) & m->mask; m->keys[i]; i = (i + 1) & m->mask) \
+    {                                                                       \
+        if (m->keys[i] == key)                                              \
+        {                                                                   \
+            m->vals[i] = val;                                               \
+            return 0;                                                       \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    /* new key: make room first if needed (and find its slot again) */     \
+    if (m->n >= m->max)                                                     \
+    {                                                                       \
+        if (name##_grow_(m))                                                \
+            return ~0;                                                      \
+                                                                            \
+        for (i = U_IMAP_HASH(key) & m->mask; m->keys[i];                    \
+                i = (i + 1) & m->mask)                                      \
+            ;                                                               \
+    }                                                                       \
+                                                                            \
+    m->keys[i] = key;                                                       \
+    m->vals[i] = val;                                                       \
+    m->n++;                                                                 \
+                                                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC int name##_del (name##_t *m, uint64_t key, vtype *pval)       \
+{                                                                           \
+    size_t i, j, h;                                                         \
+                                                                            \
+    if (key == 0)                                                           \
+    {                                                                       \
+        if (!m->zset)                                                       \
+            return ~0;                                                      \
+        if (pval)                                                           \
+            *pval = m->zval;                                                \
+        m->zset = 0;                                                        \
+        m->n--;                                                             \
+        return 0;                                                           \
+    }                                                                       \
+                                                                            \
+    for (i = U_IMAP_HASH(key) & m->mask; m->keys[i] != key;                 \
+            i = (i + 1) & m->mask)                                          \
+        if (m->keys[i] == 0)                                                \
+            return ~0;                                                      \
+                                                                            \
+    if (pval)                                                               \
+        *pval = m->vals[i];                                                 \
+                                                                            \
+    /* backward shift: move back every following entry of the cluster       \
+     * whose home slot is not between the hole and its current slot */      \
+    for (j = (i + 1) & m->mask; m->keys[j]; j = (j + 1) & m->mask)          \
+    {                                                                       \
+        h = U_IMAP_HASH(m->keys[j]) & m->mask;                              \
+                                                                            \
+        if (((j - h) & m->mask) >= ((j - i) & m->mask))                     \
+        {                                                                   \
+            m->keys[i] = m->keys[j];                                        \
+            m->vals[i] = m->vals[j];                                        \
+            i = j;                                                          \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    m->keys[i] = 0;                                                         \
+    m->n--;                                                                 \
+                                                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+U_IMAP_STATIC int name##_foreach (name##_t *m,                              \
+        int f(uint64_t key, vtype val, void *arg), void *arg)               \
+{                                                                           \
+    size_t i;                                                               \
+                                                                            \
+    if (m == NULL || f == NULL)                                             \
+        return ~0;                                                          \
+                                                                            \
+    if (m->zset && f(0, m->zval, arg))                                      \
+        return 0;                                                           \
+                                                                            \
+    for (i = 0; i <= m->mask; ++i)                                          \
+        if (m->keys[i] && f(m->keys[i], m->vals[i], arg))                   \
+            break;                                                          \
+                                                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+struct name##_s
+
+/** \brief \c uint64_t \c -> \c void \c * map */
+U_IMAP_GENERATE(u_imap, void *);
+
+/** \brief \c uint64_t \c -> \c uint64_t map */
+U_IMAP_GENERATE(u_imap64, uint64_t);
+
+/**
+ *  \}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_U_IMAP_H_ */
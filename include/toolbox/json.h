@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <u/libu_conf.h>
 #include <u/toolbox/lexer.h>
+#include <u/toolbox/buf.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +16,8 @@ extern "C" {
 
 /* Forward decls. */ 
 struct u_json_s;
+struct u_json_sax_s;
+struct u_json_ptr_s;
 
 /**
  *  \addtogroup json
@@ -27,12 +30,57 @@ typedef struct u_json_s u_json_t;
 /** \brief  Opaque iterator for traversing arrays and objects. */
 typedef struct { u_json_t *cur; } u_json_it_t;
 
+/** \brief  Streaming (SAX-style) JSON parser */
+typedef struct u_json_sax_s u_json_sax_t;
+
+/** \brief  Compiled path to a JSON node (see ::u_json_pointer_compile) */
+typedef struct u_json_ptr_s u_json_ptr_t;
+
+/** \brief  Streaming JSON parser callbacks.  Each of them returns \c 0 to 
+ *          go on with parsing, non-0 to stop it.  Strings and numbers are
+ *          passed as they are in the JSON text, and are not NUL-terminated. */
+typedef struct
+{
+    int (*on_object_start) (void *arg);     /**< '{' */
+    int (*on_object_end) (void *arg);       /**< '}' */
+    int (*on_array_start) (void *arg);      /**< '[' */
+    int (*on_array_end) (void *arg);        /**< ']' */
+    int (*on_key) (const char *key, size_t len, void *arg); /**< object key */
+    int (*on_string) (const char *val, size_t len, void *arg);  /**< string */
+    int (*on_number) (const char *val, size_t len, void *arg);  /**< number */
+    int (*on_bool) (char val, void *arg);   /**< \c true or \c false */
+    int (*on_null) (void *arg);             /**< \c null */
+} u_json_sax_cbs_t;
+
 /** \brief  Walk strategy when traversing JSON objects */
 enum { 
     U_JSON_WALK_PREORDER,   /**< pre-order tree walk */
     U_JSON_WALK_POSTORDER   /**< post-order tree walk */
 };
 
+/** \brief  Decoding options (see ::u_json_decode_ex) */
+enum {
+    U_JSON_DECODE_ARENA = 0x01, /**< allocate nodes and strings of the 
+                                     document from a single arena */
+    U_JSON_DECODE_LAZY  = 0x02  /**< decode containers on first access 
+                                     (implies ::U_JSON_DECODE_ARENA) */
+};
+
+/** \brief  Encoding options (see ::u_json_encode_ex) */
+enum {
+    U_JSON_ENCODE_COMPACT = 0x01,   /**< no white spaces at all */
+    U_JSON_ENCODE_PRETTY  = 0x02    /**< one value per line, indented */
+};
+
+/** \brief  Implementations of the structural scan done by ::u_json_validate_ex
+ *          (see ::u_json_set_scanner) */
+typedef enum {
+    U_JSON_SCANNER_AUTO = 0,    /**< the fastest one supported by the CPU */
+    U_JSON_SCANNER_SCALAR,      /**< portable C */
+    U_JSON_SCANNER_SSE2,        /**< x86 SSE2, 16 bytes per instruction */
+    U_JSON_SCANNER_AVX2         /**< x86 AVX2, 32 bytes per instruction */
+} u_json_scanner_t;
+
 /** \brief  JSON base types */
 typedef enum {
     U_JSON_TYPE_UNKNOWN = 0,
@@ -58,10 +106,35 @@ typedef enum {
 #define U_JSON_MAX_DEPTH   16
 #endif  /* !U_JSON_MAX_DEPTH */
 
+/** \brief  Size of the encoder output buffer: initial size when encoding to
+ *          a string, and default flush size of ::u_json_encode_fd (can be 
+ *          changed at compile time via \c -DU_JSON_ENCODE_BUFSZ=nnn flag) */
+#ifndef U_JSON_ENCODE_BUFSZ
+#define U_JSON_ENCODE_BUFSZ   4096
+#endif  /* !U_JSON_ENCODE_BUFSZ */
+
 /* Encode/Decode/Validate. */
 int u_json_decode (const char *json, u_json_t **pjo);
+int u_json_decode_ex (const char *json, int flags, u_json_t **pjo);
+int u_json_decode_insitu (char *json, size_t len, u_json_t **pjo);
 int u_json_encode (u_json_t *jo, char **ps);
+int u_json_encode_ex (u_json_t *jo, int flags, char **ps, size_t *plen);
+int u_json_encode_buf (u_json_t *jo, int flags, u_buf_t *ubuf);
+int u_json_encode_mem (u_json_t *jo, int flags, char *buf, size_t sz, 
+        size_t *plen);
+int u_json_encode_fd (u_json_t *jo, int flags, int fd, size_t bufsz);
 int u_json_validate (const char *json, char status[U_LEXER_ERR_SZ]);
+int u_json_validate_ex (const char *json, size_t len, 
+        char status[U_LEXER_ERR_SZ]);
+int u_json_set_scanner (u_json_scanner_t sc);
+u_json_scanner_t u_json_get_scanner (void);
+
+/* Streaming parser. */
+int u_json_sax_new (const u_json_sax_cbs_t *cbs, void *arg, u_json_sax_t **pp);
+int u_json_sax_feed (u_json_sax_t *p, const char *buf, size_t len);
+int u_json_sax_end (u_json_sax_t *p);
+const char *u_json_sax_geterr (u_json_sax_t *p);
+void u_json_sax_free (u_json_sax_t *p);
 
 /* Cache creation/destruction. */
 int u_json_index (u_json_t *jo);
@@ -77,6 +150,11 @@ int u_json_cache_get_bool (u_json_t *jo, const char *name, char *pval);
 int u_json_cache_set_tv (u_json_t *jo, const char *name, 
         u_json_type_t type, const char *val);
 
+/* Compiled paths (no cache needed). */
+int u_json_pointer_compile (const char *path, u_json_ptr_t **pptr);
+u_json_t *u_json_pointer_get (u_json_t *jo, const u_json_ptr_t *ptr);
+void u_json_pointer_free (u_json_ptr_t *ptr);
+
 /* JSON base objects [cd]tor. */
 int u_json_new (u_json_t **pjo);
 void u_json_free (u_json_t *jo);
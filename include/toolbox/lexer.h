@@ -55,6 +55,7 @@ typedef struct u_lexer_s u_lexer_t;
     } while (0)
 
 int u_lexer_new (const char *s, u_lexer_t **pl);
+int u_lexer_new_ref (char *s, size_t len, u_lexer_t **pl);
 void u_lexer_free (u_lexer_t *l);
 const char *u_lexer_geterr (u_lexer_t *l);
 
@@ -65,6 +66,7 @@ int u_lexer_seterr (u_lexer_t *l, const char *fmt, ...);
 void u_lexer_record_lmatch (u_lexer_t *l);
 void u_lexer_record_rmatch (u_lexer_t *l);
 char *u_lexer_get_match (u_lexer_t *l, char match[U_TOKEN_SZ]);
+char *u_lexer_get_match_ref (u_lexer_t *l, size_t *plen);
 int u_lexer_eot (u_lexer_t *l);
 int u_lexer_eat_ws (u_lexer_t *l);
 int u_lexer_expect_char (u_lexer_t *l, char expected);
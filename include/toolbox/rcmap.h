@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#ifndef _U_RCMAP_H_
+#define _U_RCMAP_H_
+
+#include <sys/types.h>
+#include <u/libu_conf.h>
+#include <u/toolbox/hmap.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  \addtogroup rcmap
+ *  \{
+ */
+
+/** \brief Read-copy-update hmap */
+struct u_rcmap_s;
+typedef struct u_rcmap_s u_rcmap_t;
+
+int u_rcmap_new (u_hmap_opts_t *opts, u_rcmap_t **prcmap);
+void u_rcmap_free (u_rcmap_t *rcmap);
+int u_rcmap_put (u_rcmap_t *rcmap, const void *key, const void *val);
+int u_rcmap_del (u_rcmap_t *rcmap, const void *key);
+ssize_t u_rcmap_count (u_rcmap_t *rcmap);
+
+/* read side */
+int u_rcmap_read_lock (u_rcmap_t *rcmap);
+void u_rcmap_read_unlock (u_rcmap_t *rcmap);
+void *u_rcmap_get (u_rcmap_t *rcmap, const void *key);
+int u_rcmap_foreach (u_rcmap_t *rcmap,
+        int f(const void *val, const void *arg), void *arg);
+
+/**
+ *  \}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_U_RCMAP_H_ */
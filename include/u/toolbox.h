@@ -12,6 +12,7 @@
 #include <u/toolbox/misc.h>
 #include <u/toolbox/buf.h>
 #include <u/toolbox/queue.h>
+#include <u/toolbox/imap.h>
 #include <u/toolbox/str.h>
 #include <u/toolbox/uri.h>
 #include <u/toolbox/log.h>
@@ -69,6 +70,14 @@
   #include <u/toolbox/json.h>
 #endif  /* !NO_JSON */
 
+#ifndef NO_CHMAP
+  #include <u/toolbox/chmap.h>
+#endif  /* !NO_CHMAP */
+
+#ifndef NO_RCMAP
+  #include <u/toolbox/rcmap.h>
+#endif  /* !NO_RCMAP */
+
 #ifndef NO_B64
   #include <u/toolbox/b64.h>
 #endif  /* !NO_B64 */
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <toolbox/memory.h>
+#include <toolbox/carpal.h>
+#include <toolbox/misc.h>
+#include <toolbox/hmap.h>
+#include <toolbox/chmap.h>
+
+/* shards are padded so that two locks never share a cache line */
+#define U_CHMAP_CACHELINE   64
+
+/* upper bound on the number of shards */
+#define U_CHMAP_SHARDS_MAX  4096
+
+struct u_chmap_shard_s
+{
+    pthread_rwlock_t lock;
+    u_hmap_t *hmap;
+
+    char pad[U_CHMAP_CACHELINE];
+};
+typedef struct u_chmap_shard_s u_chmap_shard_t;
+
+struct u_chmap_s
+{
+    size_t nshards;             /* power of two */
+    unsigned int shift;         /* bits of the hash left out of the shard
+                                   index */
+    int get_wrlock;             /* u_hmap_get() modifies a shard */
+
+    u_hmap_t *hproto;           /* empty map, never modified: used to hash
+                                   keys without holding any shard lock (a
+                                   resize replaces the shard's options) */
+    u_chmap_shard_t *shards;
+};
+
+static u_chmap_shard_t *__shard (u_chmap_t *chmap, const void *key);
+static int __rdlock_get (u_chmap_t *chmap, u_chmap_shard_t *sh);
+
+/**
+    \defgroup chmap Concurrent HMap
+    \{
+        The \ref chmap module provides a thread-safe hash map built upon
+        \ref hmap.  The map is split into a power of two number of shards,
+        each being an ::u_hmap_t protected by its own reader-writer lock:
+        the shard is picked from the hash of the key, so threads working on
+        different keys seldom contend for the same lock, and lookups only
+        take the lock in read mode unless the discard policy keeps track of
+        accesses (e.g. LRU, LFU), in which case they need exclusive access
+        to their shard.
+
+        All shards are created with the same options, so size, maximum number
+        of elements and discard policy (see ::u_hmap_opts_set_max and
+        ::u_hmap_opts_set_policy) apply to each shard separately.  The map
+        must own its data (::U_HMAP_OPTS_OWNSDATA, the default) since
+        objects are discarded or overwritten behind the caller's back.
+
+        Since a value may be overwritten or deleted by another thread as
+        soon as its shard is unlocked, values are never handed out: they are
+        accessed through a callback invoked under the shard lock.
+    \code
+    static int get_int (const void *val, void *arg)
+    {
+        *((int *) arg) = *((const int *) val);
+        return 0;
+    }
+    ...
+    u_hmap_opts_t *opts = NULL;
+    u_chmap_t *chmap = NULL;
+    int v = 42;
+
+    dbg_err_if (u_hmap_opts_new(&opts));
+    dbg_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    dbg_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    dbg_err_if (u_chmap_new(opts, 0, &chmap));
+
+    // (from any thread)
+    dbg_err_if (u_chmap_put(chmap, "answer", &v));
+    dbg_err_if (u_chmap_get(chmap, "answer", get_int, &v));
+    \endcode
+ */
+
+/**
+ *  \brief  Create a new concurrent hmap
+ *
+ *  Create a concurrent hmap made of (at least) \p nshards independently
+ *  locked ::u_hmap_t objects, each one created with options \p opts.
+ *
+ *  \param  opts    options applied to each shard (may be NULL)
+ *  \param  nshards number of shards, rounded up to a power of two (0 means
+ *                  ::U_CHMAP_SHARDS_DFL)
+ *  \param  pchmap  result argument
+ *
+ *  \retval U_HMAP_ERR_NONE on success
+ *  \retval U_HMAP_ERR_FAIL on failure
+ */
+int u_chmap_new (u_hmap_opts_t *opts, size_t nshards, u_chmap_t **pchmap)
+{
+    u_chmap_t *c = NULL;
+    size_t i, n = 1;
+    unsigned int bits = 0;
+
+    dbg_return_if (pchmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (nshards > U_CHMAP_SHARDS_MAX, U_HMAP_ERR_FAIL);
+
+    if (nshards == 0)
+        nshards = U_CHMAP_SHARDS_DFL;
+
+    for (; n < nshards; n <<= 1)
+        bits++;
+
+    dbg_err_sif ((c = u_zalloc(sizeof(u_chmap_t))) == NULL);
+    dbg_err_sif ((c->shards = u_calloc(n, sizeof(u_chmap_shard_t))) == NULL);
+
+    c->shift = (unsigned int) (sizeof(size_t) * 8) - bits;
+
+    dbg_err_if (u_hmap_new(opts, &c->hproto));
+
+    for (i = 0; i < n; ++i)
+    {
+        dbg_err_if (pthread_rwlock_init(&c->shards[i].lock, NULL));
+        c->nshards = i + 1;
+
+        dbg_err_if (u_hmap_new(opts, &c->shards[i].hmap));
+    }
+
+    c->get_wrlock = u_hmap_pcy_tracks_get(c->hproto);
+
+    *pchmap = c;
+
+    return U_HMAP_ERR_NONE;
+err:
+    u_chmap_free(c);
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ *  \brief  Free a concurrent hmap
+ *
+ *  Free \p chmap along with all its objects.  No other thread may be using
+ *  it.
+ *
+ *  \param  chmap   the concurrent hmap
+ */
+void u_chmap_free (u_chmap_t *chmap)
+{
+    size_t i;
+
+    nop_return_if (chmap == NULL, );
+
+    for (i = 0; i < chmap->nshards; ++i)
+    {
+        U_FREEF(chmap->shards[i].hmap, u_hmap_free);
+        (void) pthread_rwlock_destroy(&chmap->shards[i].lock);
+    }
+
+    U_FREEF(chmap->hproto, u_hmap_free);
+    u_free(chmap->shards);
+    u_free(chmap);
+}
+
+/**
+ *  \brief  Insert a (key, value) pair
+ *
+ *  Insert \p key and \p val into \p chmap.  Key and value are handled
+ *  according to the types set in the options (see ::u_hmap_o_new).
+ *
+ *  \param  chmap   the concurrent hmap
+ *  \param  key     the key
+ *  \param  val     the value
+ *
+ *  \retval U_HMAP_ERR_NONE     on success
+ *  \retval U_HMAP_ERR_EXISTS   if key already exists and overwrite is disabled
+ *  \retval U_HMAP_ERR_FAIL     on other failures
+ */
+int u_chmap_put (u_chmap_t *chmap, const void *key, const void *val)
+{
+    u_chmap_shard_t *sh;
+    u_hmap_o_t *obj;
+    int rc;
+
+    dbg_return_if (chmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+
+    sh = __shard(chmap, key);
+
+    dbg_return_if (pthread_rwlock_wrlock(&sh->lock), U_HMAP_ERR_FAIL);
+
+    /* the hmap owns obj from now on, even on failure */
+    if ((obj = u_hmap_o_new(sh->hmap, key, val)) == NULL)
+        rc = U_HMAP_ERR_FAIL;
+    else
+        rc = u_hmap_put(sh->hmap, obj, NULL);
+
+    (void) pthread_rwlock_unlock(&sh->lock);
+
+    return rc;
+}
+
+/**
+ *  \brief  Access a value
+ *
+ *  Look up \p key in \p chmap and, if found, call \p f on its value with
+ *  the shard lock held.  \p f must not call back into \p chmap and should
+ *  return quickly (e.g. copy out what it needs).
+ *
+ *  \param  chmap   the concurrent hmap
+ *  \param  key     the key
+ *  \param  f       function invoked on the value (may be NULL to just test
+ *                  the presence of \p key)
+ *  \param  arg     opaque argument passed to \p f
+ *
+ *  \retval U_HMAP_ERR_NONE     if \p key was found (and \p f returned 0)
+ *  \retval U_HMAP_ERR_FAIL     if not found or on failure
+ */
+int u_chmap_get (u_chmap_t *chmap, const void *key,
+        int (*f)(const void *val, void *arg), void *arg)
+{
+    u_chmap_shard_t *sh;
+    u_hmap_o_t *obj = NULL;
+    int rc;
+
+    dbg_return_if (chmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+
+    sh = __shard(chmap, key);
+
+    dbg_return_if (__rdlock_get(chmap, sh), U_HMAP_ERR_FAIL);
+
+    if ((rc = u_hmap_get(sh->hmap, key, &obj)) == U_HMAP_ERR_NONE && f)
+        rc = f(u_hmap_o_get_val(obj), arg) ? U_HMAP_ERR_FAIL : U_HMAP_ERR_NONE;
+
+    (void) pthread_rwlock_unlock(&sh->lock);
+
+    return rc;
+}
+
+/**
+ *  \brief  Delete a key
+ *
+ *  Delete \p key (and its value) from \p chmap.
+ *
+ *  \param  chmap   the concurrent hmap
+ *  \param  key     the key
+ *
+ *  \retval U_HMAP_ERR_NONE     on success
+ *  \retval U_HMAP_ERR_FAIL     if not found or on failure
+ */
+int u_chmap_del (u_chmap_t *chmap, const void *key)
+{
+    u_chmap_shard_t *sh;
+    int rc;
+
+    dbg_return_if (chmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+
+    sh = __shard(chmap, key);
+
+    dbg_return_if (pthread_rwlock_wrlock(&sh->lock), U_HMAP_ERR_FAIL);
+    rc = u_hmap_del(sh->hmap, key, NULL);
+    (void) pthread_rwlock_unlock(&sh->lock);
+
+    return rc;
+}
+
+/**
+ *  \brief  Remove all objects
+ *
+ *  Remove all objects from \p chmap, one shard at a time.
+ *
+ *  \param  chmap   the concurrent hmap
+ */
+void u_chmap_clear (u_chmap_t *chmap)
+{
+    size_t i;
+
+    dbg_return_if (chmap == NULL, );
+
+    for (i = 0; i < chmap->nshards; ++i)
+    {
+        dbg_ifb (pthread_rwlock_wrlock(&chmap->shards[i].lock))
+            continue;
+        u_hmap_clear(chmap->shards[i].hmap);
+        (void) pthread_rwlock_unlock(&chmap->shards[i].lock);
+    }
+}
+
+/**
+ *  \brief  Count objects
+ *
+ *  Return the number of objects stored in \p chmap.  With concurrent
+ *  writers the result is only a snapshot of each shard at a slightly
+ *  different time.
+ *
+ *  \param  chmap   the concurrent hmap
+ *
+ *  \return the number of objects, or -1 on error
+ */
+ssize_t u_chmap_count (u_chmap_t *chmap)
+{
+    ssize_t n = 0;
+    size_t i;
+
+    dbg_return_if (chmap == NULL, -1);
+
+    for (i = 0; i < chmap->nshards; ++i)
+    {
+        dbg_return_if (pthread_rwlock_rdlock(&chmap->shards[i].lock), -1);
+        n += u_hmap_count(chmap->shards[i].hmap);
+        (void) pthread_rwlock_unlock(&chmap->shards[i].lock);
+    }
+
+    return n;
+}
+
+/**
+ *  \brief  Get statistics
+ *
+ *  Sum up the statistics (see u_hmap_stats()) of the shards of \p chmap, 
+ *  which must have been created with the U_HMAP_OPTS_STATS option for the 
+ *  counters to be updated.  Lookups on such a map take the shard lock 
+ *  exclusively, as they bump the hit and miss counters.
+ *
+ *  \param  chmap   the concurrent hmap
+ *  \param  stats   the statistics
+ *
+ *  \retval U_HMAP_ERR_NONE on success
+ *  \retval U_HMAP_ERR_FAIL on failure
+ */
+int u_chmap_stats (u_chmap_t *chmap, u_hmap_stats_t *stats)
+{
+    u_hmap_stats_t st;
+    double probes = 0;
+    size_t i;
+    int rc;
+
+    dbg_return_if (chmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (stats == NULL, U_HMAP_ERR_FAIL);
+
+    memset(stats, 0, sizeof *stats);
+
+    for (i = 0; i < chmap->nshards; ++i)
+    {
+        dbg_return_if (pthread_rwlock_rdlock(&chmap->shards[i].lock), 
+                U_HMAP_ERR_FAIL);
+        rc = u_hmap_stats(chmap->shards[i].hmap, &st);
+        (void) pthread_rwlock_unlock(&chmap->shards[i].lock);
+        dbg_return_if (rc, U_HMAP_ERR_FAIL);
+
+        stats->hits += st.hits;
+        stats->misses += st.misses;
+        stats->puts += st.puts;
+        stats->overwrites += st.overwrites;
+        stats->evictions += st.evictions;
+        stats->expirations += st.expirations;
+        stats->resizes += st.resizes;
+        stats->resize_ns += st.resize_ns;
+        stats->policy = st.policy;
+        stats->count += st.count;
+        stats->size += st.size;
+        stats->probe_max = U_MAX(stats->probe_max, st.probe_max);
+        probes += st.probe_mean * st.count;
+    }
+
+    stats->load = stats->size ? (double) stats->count / stats->size : 0;
+    stats->probe_mean = stats->count ? probes / stats->count : 0;
+
+    return U_HMAP_ERR_NONE;
+}
+
+/**
+ *  \brief  Execute a function on all values
+ *
+ *  Call \p f on each value of \p chmap.  All shards are read-locked (in
+ *  index order) before the first call and released after the last one, so
+ *  \p f sees a consistent snapshot of the whole map while writers are kept
+ *  waiting.  \p f must not call back into \p chmap.
+ *
+ *  \param  chmap   the concurrent hmap
+ *  \param  f       function to be called, stops the iteration on non-zero
+ *  \param  arg     opaque argument passed to \p f
+ *
+ *  \retval U_HMAP_ERR_NONE on success
+ *  \retval U_HMAP_ERR_FAIL on failure
+ */
+int u_chmap_foreach (u_chmap_t *chmap,
+        int f(const void *val, const void *arg), void *arg)
+{
+    size_t i, locked = 0;
+    int rc = U_HMAP_ERR_NONE;
+
+    dbg_return_if (chmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (f == NULL, U_HMAP_ERR_FAIL);
+
+    /* writers hold one shard lock at a time, so acquiring them in order
+     * cannot deadlock */
+    for (; locked < chmap->nshards; ++locked)
+        dbg_err_if (pthread_rwlock_rdlock(&chmap->shards[locked].lock));
+
+    for (i = 0; i < chmap->nshards && rc == U_HMAP_ERR_NONE; ++i)
+        rc = u_hmap_foreach_arg(chmap->shards[i].hmap, f, arg);
+
+    while (locked)
+        (void) pthread_rwlock_unlock(&chmap->shards[--locked].lock);
+
+    return rc;
+err:
+    while (locked)
+        (void) pthread_rwlock_unlock(&chmap->shards[--locked].lock);
+
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ *  \}
+ */
+
+/* Pick the shard for key from the top bits of its (Fibonacci scrambled)
+ * hash, leaving the low bits used inside the shard uncorrelated */
+static u_chmap_shard_t *__shard (u_chmap_t *chmap, const void *key)
+{
+    size_t h;
+
+    if (chmap->nshards == 1)
+        return chmap->shards;
+
+    h = u_hmap_hash(chmap->hproto, key);
+
+#if SIZE_MAX > 0xffffffffUL
+    h *= (size_t) 0x9e3779b97f4a7c15ULL;
+#else
+    h *= (size_t) 0x9e3779b9UL;
+#endif
+
+    return &chmap->shards[h >> chmap->shift];
+}
+
+/* Lock a shard for a lookup: shared unless lookups update the policy or
+ * the statistics */
+static int __rdlock_get (u_chmap_t *chmap, u_chmap_shard_t *sh)
+{
+    if (chmap->get_wrlock)
+        return pthread_rwlock_wrlock(&sh->lock);
+
+    return pthread_rwlock_rdlock(&sh->lock);
+}
@@ -5,6 +5,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/stat.h>
 
 #include <toolbox/memory.h>
 #include <toolbox/carpal.h>
@@ -13,11 +19,95 @@
 #include <toolbox/str.h>
 #include <toolbox/misc.h>
 
+#ifdef HAVE_MMAP
+  #include <sys/mman.h>
+#endif
+
 /* default limits handled by policies */
 #define U_HMAP_MAX_SIZE      512
 #define U_HMAP_MAX_ELEMS     U_HMAP_MAX_SIZE
 #define U_HMAP_RATE_FULL     0.75
 #define U_HMAP_RATE_RESIZE   3
+#define U_HMAP_MIN_SIZE      16
+
+/* bucket of full hash h in an array of sz (a power of two) buckets */
+#define __IDX(h, sz)         ((h) & ((sz) - 1))
+
+/* incremental resize: old buckets migrated per write operation (at most ten
+ * times as many empty ones are skipped) */
+#define U_HMAP_REHASH_STEP   4
+
+/* slab allocation: chunks per block, chunk alignment and room reserved in
+ * each object chunk for short keys and values */
+#define U_HMAP_SLAB_CHUNKS   128
+#define U_HMAP_SLAB_ALIGN    16
+#define U_HMAP_SLAB_INLINE   48
+#define U_HMAP_SLAB_ROUND(sz)    \
+    (((sz) + U_HMAP_SLAB_ALIGN - 1) & ~((size_t) U_HMAP_SLAB_ALIGN - 1))
+
+/* batch operations: keys whose buckets are prefetched together */
+#define U_HMAP_BATCH         32
+
+#if defined(__GNUC__)
+  #define U_HMAP_PREFETCH(p)    __builtin_prefetch(p)
+#else
+  #define U_HMAP_PREFETCH(p)    do { (void) (p); } while (0)
+#endif
+
+/* key length for keys compared with f_comp() (NUL-terminated strings or
+ * custom types) */
+#define U_HMAP_NOLEN         ((size_t) -1)
+
+/* TTL timing wheel: levels of slots, each slot of level k spanning
+ * U_HMAP_TW_SLOTS^k milliseconds; expired objects reaped per put */
+#define U_HMAP_TW_BITS       6
+#define U_HMAP_TW_SLOTS      (1 << U_HMAP_TW_BITS)
+#define U_HMAP_TW_MASK       (U_HMAP_TW_SLOTS - 1)
+#define U_HMAP_TW_LEVELS     5
+#define U_HMAP_TTL_STEP      4
+
+/* snapshot files (see u_hmap_save()) */
+#define U_HMAP_IMG_MAGIC     "LIBUHMAP"
+#define U_HMAP_IMG_VERSION   1
+#define U_HMAP_IMG_ORDER     0x01020304     /* tells the byte order */
+#define U_HMAP_IMG_CHUNK     65536          /* checksummed block size */
+#define U_HMAP_IMG_SAMPLE    16             /* hashes checked on load */
+#define __IMG_KEY(r)         ((unsigned char *) (r) + sizeof(u_hmap_img_rec_t))
+#define __IMG_VAL(r)         (__IMG_KEY(r) + U_HMAP_ALIGN8((r)->klen))
+
+/* frozen hmaps (see u_hmap_freeze()): mean keys per displacement bucket */
+#define U_HMAP_FRZ_LAMBDA    4
+/* multiply-shift reduction of a 32-bit x to [0, n) */
+#define __FRZ_RANGE(x, n)    \
+    ((size_t) (((uint64_t) (uint32_t) (x) * (uint64_t) (n)) >> 32))
+
+#define U_HMAP_ALIGN8(sz)    (((sz) + 7) & ~((size_t) 7))
+
+/* lookups only (see u_hmap_load() and u_hmap_freeze()) */
+#define __RDONLY(hmap)       ((hmap)->img != NULL || (hmap)->frz != NULL)
+
+/* bump statistics counter c (only if U_HMAP_OPTS_STATS is set) */
+#define __STATS(hmap, c)     \
+    do { if ((hmap)->opts->options & U_HMAP_OPTS_STATS) (hmap)->st.c++; } \
+    while (0)
+
+/* open addressing (U_HMAP_TYPE_ROBINHOOD) tolerates higher load factors */
+#define U_HMAP_RH_MIN_SIZE   8
+#define U_HMAP_RH_THRESHOLD(sz)  ((sz) - ((sz) >> 3))
+
+/* Distance of slot 'i' from the home slot of hash 'h' */
+#define __RH_DIST(hmap, h, i)   (((i) - ((h) & (hmap)->mask)) & (hmap)->mask)
+
+/* W-TinyLFU count-min sketch: rows and counter saturation value */
+#define U_HMAP_CMS_DEPTH     4
+#define U_HMAP_CMS_MAXCOUNT  15
+
+/* object flags */
+enum {
+    U_HMAP_O_SLAB       = 0x1,  /* object chunk comes from the slab */
+    U_HMAP_O_KEY_INLINE = 0x2,  /* key is stored within the chunk */
+    U_HMAP_O_VAL_INLINE = 0x4   /* value is stored within the chunk */
+};
 
 /* types of operation used for handling policies */
 enum {
@@ -25,25 +115,96 @@ enum {
     U_HMAP_PCY_OP_GET = 0x2
 };
 
+/* queue segments used by CLOCK, SLRU, 2Q and W-TinyLFU */
+enum {
+    U_HMAP_SEG_IN = 0,  /* CLOCK ring, SLRU probation, 2Q A1in, W-TinyLFU
+                           window */
+    U_HMAP_SEG_MAIN,    /* SLRU protected, 2Q Am, W-TinyLFU probation */
+    U_HMAP_SEG_PROT,    /* W-TinyLFU protected */
+    U_HMAP_SEG_NUM
+};
+
 /* policy queue object */
 struct u_hmap_q_s
 {
     u_hmap_o_t *ho;     /**< reference to hmap object */
-    void *data;         /**< internal policy data */
+
+    size_t count;               /**< number of accesses (LFU), insertion
+                                  sequence (CUSTOM) */
+    struct u_hmap_fb_s *fb;     /**< frequency bucket it belongs to (LFU) */
+    size_t hpos;                /**< position in the heap (CUSTOM) */
+    size_t hash;                /**< full hash of the object key (2Q,
+                                  W-TinyLFU) */
+    unsigned char seg;          /**< segment it belongs to */
+    unsigned char ref;          /**< reference bit (CLOCK) */
 
     TAILQ_ENTRY(u_hmap_q_s) next;
 };
 typedef struct u_hmap_q_s u_hmap_q_t;
 
+/* LFU frequency bucket: objects sharing the same access count, in LRU order
+ * (least recently used first) */
+struct u_hmap_fb_s
+{
+    size_t count;
+
+    TAILQ_HEAD(u_hmap_fbq_h_s, u_hmap_q_s) queue;
+    TAILQ_ENTRY(u_hmap_fb_s) next;
+};
+typedef struct u_hmap_fb_s u_hmap_fb_t;
+
+/* policy queue segment, most recently used entry first */
+struct u_hmap_seg_s
+{
+    TAILQ_HEAD(u_hmap_q_h_s, u_hmap_q_s) queue;
+    size_t n,           /* number of entries */
+           max;         /* target size */
+};
+typedef struct u_hmap_seg_s u_hmap_seg_t;
+
+/* 2Q ghost entry: hash of a key recently discarded from A1in */
+struct u_hmap_ghost_s
+{
+    size_t hash;
+    size_t next;        /* ring index + 1 of the next entry in the same
+                           bucket, 0 ends the chain */
+};
+typedef struct u_hmap_ghost_s u_hmap_ghost_t;
+
 /* hmap policy representation */
 struct u_hmap_pcy_s
 {
     int (*pop)(u_hmap_t *hmap, u_hmap_o_t **obj);
-    int (*push)(u_hmap_t *hmap, u_hmap_o_t *obj,
-            u_hmap_q_t **data);
+    int (*push)(u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+            u_hmap_q_t **data);     /* hash: full hash of the object key */
+    int (*del)(u_hmap_t *hmap, u_hmap_o_t *obj);
     int ops;    /* bitwise inclusive OR of U_HMAP_PCY_OP_* values */
 
-    TAILQ_HEAD(u_hmap_q_h_s, u_hmap_q_s) queue;
+    struct u_hmap_q_h_s queue;
+
+    /* LFU: frequency buckets sorted by increasing count */
+    TAILQ_HEAD(u_hmap_fb_h_s, u_hmap_fb_s) fbs;
+
+    /* CUSTOM: binary heap with the next victim on top */
+    u_hmap_q_t **heap;
+    size_t heap_n,      /* number of entries */
+           heap_sz,     /* allocated entries */
+           seq;         /* insertion counter (breaks ties) */
+
+    /* CLOCK, SLRU, 2Q, W-TinyLFU: queue segments */
+    u_hmap_seg_t seg[U_HMAP_SEG_NUM];
+    u_hmap_q_t *hand;   /* CLOCK: next entry to inspect (NULL: ring head) */
+
+    /* 2Q: ring of ghost entries (oldest at 'ghead') hashed into 'gbkt' */
+    u_hmap_ghost_t *ghost;
+    size_t *gbkt;
+    size_t gn, gmax, ghead, gmask;
+
+    /* W-TinyLFU: count-min sketch of access frequencies */
+    unsigned char *cms;
+    size_t cms_mask,    /* row width - 1 */
+           cms_adds,    /* increments since last aging */
+           cms_reset;   /* halve all counters when cms_adds gets here */
 };
 typedef struct u_hmap_q_h_s u_hmap_q_h_t;
 
@@ -58,7 +219,145 @@ struct u_hmap_o_s
     u_hmap_q_t *pqe;
 
     u_hmap_t *hmap;
+
+    struct u_hmap_tmr_s *tmr;   /* expiration timer (NULL: no TTL) */
+
+    unsigned char flags;    /* see U_HMAP_O_* */
+};
+
+/* fixed size chunks carved out of blocks that are only released along with
+ * the hmap; free chunks are linked through their first word */
+struct u_hmap_slab_s
+{
+    size_t sz;          /* chunk size (0 if slab allocation is disabled) */
+    void *free;         /* freelist */
+    void *blocks;       /* allocated blocks */
+};
+typedef struct u_hmap_slab_s u_hmap_slab_t;
+
+/* expiration timer of an object */
+struct u_hmap_tmr_s
+{
+    u_hmap_o_t *ho;         /* reference to hmap object */
+    uint64_t expire;        /* expiration time (ms) */
+    unsigned char level,    /* wheel level and slot it sits in */
+                  slot;
+
+    LIST_ENTRY(u_hmap_tmr_s) next;
+};
+typedef struct u_hmap_tmr_s u_hmap_tmr_t;
+
+/* hierarchical timing wheel: level k holds the timers expiring within the
+ * current level k + 1 slot, in the slot they expire in */
+struct u_hmap_tw_s
+{
+    uint64_t now;           /* wheel time: earlier timers have been reaped */
+    size_t n;               /* number of timers */
+    int busy;               /* reaping in progress */
+    uint64_t bm[U_HMAP_TW_LEVELS];  /* non-empty slots bitmaps */
+    LIST_HEAD(u_hmap_tw_h_s, u_hmap_tmr_s)
+        slot[U_HMAP_TW_LEVELS][U_HMAP_TW_SLOTS];
+};
+typedef struct u_hmap_tw_s u_hmap_tw_t;
+
+/* snapshot file header, in host byte order (see U_HMAP_IMG_ORDER); it is
+ * followed by the records and then by the index */
+struct u_hmap_img_hdr_s
+{
+    char magic[8];
+    uint32_t version,
+             order;
+    uint64_t key_type,      /* key and value datatypes and sizes */
+             val_type,
+             key_sz,
+             val_sz,
+             hash_type,     /* built-in hash function and seed */
+             hash_seed,
+             count,         /* number of records */
+             nslots,        /* index slots (power of two) */
+             index,         /* offset of the index */
+             size,          /* file size */
+             cksum,         /* chained XXH64 of the U_HMAP_IMG_CHUNK blocks
+                               following the header */
+             hcksum;        /* XXH64 of the header up to here */
+};
+typedef struct u_hmap_img_hdr_s u_hmap_img_hdr_t;
+
+/* record: key and value follow, each padded to a multiple of 8 bytes */
+struct u_hmap_img_rec_s
+{
+    uint32_t klen,          /* key and value sizes (strings: with the NUL) */
+             vlen;
+};
+typedef struct u_hmap_img_rec_s u_hmap_img_rec_t;
+
+/* index slot: linear probing on the full hash of the key */
+struct u_hmap_img_slot_s
+{
+    uint64_t hash,
+             off;           /* record offset (0: empty slot) */
+};
+typedef struct u_hmap_img_slot_s u_hmap_img_slot_t;
+
+/* snapshot file served by a read-only hmap */
+struct u_hmap_img_s
+{
+    unsigned char *base;        /* file contents */
+    size_t len;
+    int mapped;                 /* base is mmap'd (malloc'd otherwise) */
+    const u_hmap_img_hdr_t *hdr;
+    const u_hmap_img_slot_t *slots;
+    size_t mask;                /* nslots - 1 */
+    u_hmap_o_t *objs;           /* objects handed out, by slot (set up on
+                                   first access) */
+};
+typedef struct u_hmap_img_s u_hmap_img_t;
+
+/* snapshot writer: data goes out in checksummed U_HMAP_IMG_CHUNK blocks */
+struct u_hmap_imgw_s
+{
+    int fd;
+    uint64_t off,           /* file offset of the next byte */
+             cksum;         /* checksum of the blocks written */
+    u_hmap_img_slot_t *slots;   /* index being built */
+    size_t mask,            /* index slots - 1 */
+           count;           /* records written */
+    size_t len;             /* buffered bytes */
+    unsigned char buf[U_HMAP_IMG_CHUNK];
+};
+typedef struct u_hmap_imgw_s u_hmap_imgw_t;
+
+/* frozen hmap: CHD minimal perfect hash, the key hash picks a bucket whose
+ * displacement picks the slot; one allocation holds this header, the
+ * displacements, the objects (by slot) and their packed keys and values */
+struct u_hmap_frz_s
+{
+    size_t n,               /* number of objects (and slots) */
+           nb;              /* number of buckets */
+    uint32_t *disp;         /* bucket displacements */
+    u_hmap_o_t *objs;       /* objects, by slot */
+};
+typedef struct u_hmap_frz_s u_hmap_frz_t;
+
+/* objects collected by u_hmap_freeze() */
+struct u_hmap_frz_bld_s
+{
+    size_t n, max;
+    uint64_t *h;            /* mixed hashes */
+    u_hmap_o_t **o;
+    size_t data;            /* bytes of packed keys and values */
+};
+typedef struct u_hmap_frz_bld_s u_hmap_frz_bld_t;
+
+/* open addressing slot (U_HMAP_TYPE_ROBINHOOD) */
+struct u_hmap_slot_s
+{
+    size_t hash;        /**< cached full hash of the key */
+    void *key;          /**< alias of o->key */
+    void *val;          /**< alias of o->val */
+    u_hmap_o_t *o;      /**< stored object (NULL if the slot is empty) */
 };
+typedef struct u_hmap_slot_s u_hmap_slot_t;
 
 /* Map options */
 struct u_hmap_opts_s
@@ -79,8 +378,8 @@ struct u_hmap_opts_s
     size_t key_sz;                      /* size of key (if OPAQUE) */
     size_t val_sz;                      /* size of value (if OPAQUE) */
 
-    /** hash function to be used in hashhmap */
-    size_t (*f_hash)(const void *key, size_t buckets);
+    /** hash function to be used in hashhmap (full width, not reduced) */
+    size_t (*f_hash)(const void *key);
     /** function for key comparison */
     int (*f_comp)(const void *k1, const void *k2);
     /** function for freeing an object */
@@ -99,6 +398,17 @@ struct u_hmap_opts_s
     unsigned char val_free_set; /**< whether value free function has been set -
                                   used in easy interface to force the call
                                   (internal) */
+    unsigned char incremental;  /**< resize incrementally (chain only) */
+    unsigned char slab;         /**< recycle objects through a slab */
+    unsigned char mmap;         /**< u_hmap_load() serves lookups from the
+                                  file */
+
+    u_hmap_hash_t hash_type;    /**< built-in string hash function */
+    uint64_t hash_seed;         /**< seed of the built-in hash function */
+
+    uint64_t ttl;               /**< default time to live (ms, 0: none) */
+    /** clock used for expirations (milliseconds) */
+    uint64_t (*f_now)(void);
 };
 
 /* hmap representation */
@@ -108,16 +418,50 @@ struct u_hmap_s
 
     size_t sz,                  /* current size */
            size,                /* array size */
-           threshold,           /* when to resize */
-           px;                  /* index into prime numbers array */
+           threshold;           /* when to resize */
 
     u_hmap_pcy_t pcy;    /* discard policy */
 
     LIST_HEAD(u_hmap_e_s, u_hmap_o_s) *hmap;    /* the hashmap */
+
+    struct u_hmap_e_s *ohmap;   /* buckets being migrated (incremental
+                                   resize in progress) */
+    size_t osize,               /* size of ohmap */
+           ridx;                /* next ohmap bucket to migrate */
+
+    size_t mask;                /* size - 1 (U_HMAP_TYPE_ROBINHOOD) */
+    u_hmap_slot_t *slots;       /* slot array (U_HMAP_TYPE_ROBINHOOD) */
+
+    u_hmap_slab_t oslab,        /* owned objects (with inline data) */
+                  qslab,        /* policy queue objects */
+                  tslab;        /* expiration timers */
+
+    u_hmap_tw_t *tw;            /* expiration timers (allocated with the
+                                   first one) */
+
+    u_hmap_img_t *img;          /* file image of a read-only hmap (see
+                                   u_hmap_load()) */
+    u_hmap_frz_t *frz;          /* perfect hash of a frozen hmap (see
+                                   u_hmap_freeze()) */
+
+    u_hmap_stats_t st;          /* counters (see u_hmap_stats()) */
 };
 typedef struct u_hmap_e_s u_hmap_e_t;
 
 static int __get (u_hmap_t *hmap, const void *key, u_hmap_o_t **o);
+static int __get_h (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, u_hmap_o_t **o);
+static int __put (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        uint64_t expire, u_hmap_o_t **old);
+static int __insert (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_o_t **old);
+static int __del (u_hmap_t *hmap, const void *key, size_t hash,
+        u_hmap_o_t **obj);
+static size_t __hash (u_hmap_t *hmap, const void *key);
+static size_t __hash_n (u_hmap_t *hmap, const void *key, size_t klen);
+static int __key_comp (u_hmap_t *hmap, const void *key, size_t klen,
+        const void *okey);
+static void __prefetch (u_hmap_t *hmap, const size_t *hashes, size_t n);
 
 static int __opts_check (u_hmap_opts_t *opts);
 static int __pcy_setup (u_hmap_t *hmap);
@@ -125,26 +469,136 @@ static const char *__pcy2str(u_hmap_pcy_type_t policy);
 
 static void __o_free (u_hmap_t *hmap, u_hmap_o_t *obj);
 static int __o_overwrite (u_hmap_t *hmap, u_hmap_o_t *o, u_hmap_o_t *obj,
-        u_hmap_o_t **old);
-
-static u_hmap_q_t *__q_o_new (u_hmap_o_t *ho);
-static void __q_o_free (u_hmap_q_t *s);
-
-static size_t __f_hash (const void *key, size_t size);
+        size_t hash, u_hmap_o_t **old);
+
+static u_hmap_q_t *__q_o_new (u_hmap_t *hmap, u_hmap_o_t *ho);
+static void __q_o_free (u_hmap_t *hmap, u_hmap_q_t *s);
+
+static void *__slab_alloc (u_hmap_slab_t *slab);
+static void __slab_free (u_hmap_slab_t *slab, void *p);
+static void __slab_destroy (u_hmap_slab_t *slab);
+static void *__o_inline (u_hmap_o_t *obj, size_t *off, const void *p,
+        size_t len);
+
+static size_t __f_hash (const void *key);
+static size_t __f_mix (size_t h);
+static uint64_t __h_oaat (const unsigned char *p, size_t len, uint64_t seed);
+static uint64_t __h_xxh64 (const unsigned char *p, size_t len, uint64_t seed);
+static uint64_t __h_wy (const unsigned char *p, size_t len, uint64_t seed);
+static uint64_t __seed_random (void);
 static int __f_comp (const void *k1, const void *k2);
 static u_string_t *__f_str (u_hmap_o_t *obj);
 
-static int __queue_push (u_hmap_t *hmap, u_hmap_o_t *obj, u_hmap_q_t **data);
-static int __queue_push_count (u_hmap_t *hmap, u_hmap_o_t *obj,
-        u_hmap_q_t **counts);
-static int __queue_push_cmp (u_hmap_t *hmap, u_hmap_o_t *obj,
-        u_hmap_q_t **counts);
-static int __queue_pop_front (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __queue_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
 static int __queue_pop_back (u_hmap_t *hmap, u_hmap_o_t **obj);
 static int __queue_del (u_hmap_t *hmap, u_hmap_o_t *obj);
-
+static void __pcy_clear (u_hmap_t *hmap);
+
+static int __lfu_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
+static int __lfu_pop (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __lfu_del (u_hmap_t *hmap, u_hmap_o_t *obj);
+static int __lfu_bucket (u_hmap_t *hmap, u_hmap_fb_t *prev, size_t count,
+        u_hmap_fb_t **pfb);
+static void __lfu_unlink (u_hmap_t *hmap, u_hmap_q_t *q);
+
+static int __heap_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
+static int __heap_pop (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __heap_del (u_hmap_t *hmap, u_hmap_o_t *obj);
+static void __heap_fix (u_hmap_t *hmap, size_t i);
+
+static int __seg_del (u_hmap_t *hmap, u_hmap_o_t *obj);
+static int __clock_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
+static int __clock_pop (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __slru_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
+static int __slru_pop (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __2q_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
+static int __2q_pop (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __wtlfu_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data);
+static int __wtlfu_pop (u_hmap_t *hmap, u_hmap_o_t **obj);
+static int __ghost_init (u_hmap_t *hmap, size_t n);
+static int __cms_init (u_hmap_t *hmap);
+static void __pcy_free (u_hmap_t *hmap);
+
+static int __grow (u_hmap_t *hmap);
 static int __resize(u_hmap_t *hmap);
-static int __next_prime(size_t *prime, size_t sz, size_t *idx);
+static int __copy (u_hmap_t *to, u_hmap_t *from, int timers);
+static int __copy_o (u_hmap_t *to, u_hmap_t *from, u_hmap_o_t *obj,
+        int timers);
+static int __rehash_start (u_hmap_t *hmap);
+static void __rehash_step (u_hmap_t *hmap, size_t n);
+static u_hmap_e_t *__bucket_at (u_hmap_t *hmap, size_t i);
+static u_hmap_o_t *__chain_find (u_hmap_t *hmap, u_hmap_e_t *x,
+        const void *key, size_t klen);
+static u_hmap_o_t *__chain_insert (u_hmap_t *hmap, u_hmap_e_t *x,
+        u_hmap_o_t *obj);
+static int __next_size (size_t *psz, size_t sz);
+
+static int __rh_resize (u_hmap_t *hmap, size_t size);
+static int __rh_find (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, size_t *pidx);
+static void __rh_insert (u_hmap_t *hmap, u_hmap_slot_t cur);
+static void __rh_remove (u_hmap_t *hmap, size_t i);
+static void __lin_remove (u_hmap_t *hmap, size_t i);
+
+static size_t __rev_bits (size_t v);
+static void __scan_remove (u_hmap_t *hmap, u_hmap_o_t *o);
+static void __scan_chain (u_hmap_t *hmap, u_hmap_e_t *x,
+        int f(u_hmap_o_t *obj, void *arg), void *arg);
+static void __scan_home (u_hmap_t *hmap, size_t h,
+        int f(u_hmap_o_t *obj, void *arg), void *arg);
+static void __scan_lin (u_hmap_t *hmap, size_t h,
+        int f(u_hmap_o_t *obj, void *arg), void *arg);
+
+static uint64_t __f_now (void);
+static int __expired (u_hmap_t *hmap, u_hmap_o_t *o);
+static u_hmap_tmr_t *__tmr_new (u_hmap_t *hmap);
+static void __tmr_del (u_hmap_t *hmap, u_hmap_o_t *o);
+static void __tw_add (u_hmap_tw_t *tw, u_hmap_tmr_t *t);
+static void __tw_cascade (u_hmap_tw_t *tw);
+static size_t __tw_advance (u_hmap_t *hmap, uint64_t to, size_t budget);
+static void __tw_tick (u_hmap_t *hmap);
+static void __tw_free (u_hmap_t *hmap);
+static int __ctz64 (uint64_t v);
+
+static int __img_open (const char *path, u_hmap_img_t **pimg);
+static void __img_free (u_hmap_img_t *img);
+static int __img_check (u_hmap_t *hmap);
+static int __img_load (u_hmap_t *hmap, u_hmap_img_t *img);
+static u_hmap_img_rec_t *__img_rec (u_hmap_t *hmap, u_hmap_img_t *img,
+        uint64_t off);
+static u_hmap_o_t *__img_o (u_hmap_t *hmap, size_t i);
+static int __img_get (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, u_hmap_o_t **o);
+static int __img_put (u_hmap_t *hmap, u_hmap_o_t *obj, void *arg);
+static int __img_write (u_hmap_imgw_t *w, const void *p, size_t n);
+static int __img_flush (u_hmap_imgw_t *w);
+static size_t __img_len (u_hmap_options_datatype_t type, size_t sz,
+        const void *p);
+
+static int __walk (u_hmap_t *hmap,
+        int (*f)(u_hmap_t *hmap, u_hmap_o_t *obj, void *arg), void *arg);
+static u_hmap_o_t *__ro_o (u_hmap_t *hmap, size_t i);
+static size_t __ro_size (u_hmap_t *hmap);
+
+static int __frz_add (u_hmap_t *hmap, u_hmap_o_t *obj, void *arg);
+static int __frz_build (u_hmap_frz_bld_t *b, size_t nb, uint32_t *disp,
+        size_t *pos);
+static void *__frz_pack (unsigned char **pd, u_hmap_options_datatype_t type,
+        size_t sz, void *p);
+static uint64_t __frz_mix (uint64_t h);
+static size_t __frz_slot (uint64_t h, uint32_t d, size_t n);
+static int __frz_get (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, u_hmap_o_t **o);
+
+static void __probes (u_hmap_t *hmap, size_t *pmax, size_t *psum);
+static uint64_t __ns_now (void);
 
 static const char *__datatype2str(u_hmap_options_datatype_t datatype);
 
@@ -154,13 +608,13 @@ static const char *__datatype2str(u_hmap_options_datatype_t datatype);
  *      \par
  *      The \ref hmap module provides a flexible hash-map implementation
  *      featuring:
- *          - hash bucket chaining or linear probing \link hmap::u_hmap_type_t
- *          operating modes\endlink;
+ *          - hash bucket chaining, linear probing or Robin Hood open
+ *          addressing \link hmap::u_hmap_type_t operating modes\endlink;
  *          - pointer, string or opaque \link hmap::u_hmap_options_datatype_t
  *          data types\endlink for both keys and values;
  *          - optional cache-style usage by specifying \link
- *          hmap::u_hmap_pcy_type_t discard policies\endlink (FIFO, LRU, LFU
- *          and CUSTOM);
+ *          hmap::u_hmap_pcy_type_t discard policies\endlink (FIFO, LRU, LFU,
+ *          CUSTOM and the scan resistant CLOCK, SLRU, 2Q and W-TinyLFU);
  *          - choice between user or hmap memory \link hmap::u_hmap_options_t
  *          ownership\endlink;
  *          - custom hash function, comparison function and object free
@@ -228,7 +682,17 @@ static const char *__datatype2str(u_hmap_options_datatype_t datatype);
  *          - U_HMAP_PCY_FIFO: First In First Out discard policy;
  *          - U_HMAP_PCY_LRU: Least Recently Used discard policy;
  *          - U_HMAP_PCY_LFU: Least Frequently Used discard policy;
- *          - U_HMAP_PCY_CUSTOM: Custom discard policy.
+ *          - U_HMAP_PCY_CUSTOM: Custom discard policy;
+ *          - U_HMAP_PCY_CLOCK: second chance approximation of LRU which
+ *          does not reorder anything on hits;
+ *          - U_HMAP_PCY_SLRU: Segmented LRU (20% probationary, 80%
+ *          protected);
+ *          - U_HMAP_PCY_2Q: 2Q (25% FIFO for new entries, ghost history of
+ *          50%, LRU for the rest);
+ *          - U_HMAP_PCY_WTINYLFU: W-TinyLFU (1% LRU window, SLRU main area,
+ *          count-min sketch admission filter).
+ *      The last four keep one-off accesses, such as periodic full scans,
+ *      from flushing the frequently used entries.
  *      For a basic illustration of how each of these work, take a look at
  *      the source code of the \ref hmap::u_hmap_pcy_type_t definition.
  *      For a sample usage please refer to test/hmap.c.
@@ -378,6 +842,22 @@ err:
 void *u_hmap_easy_get (u_hmap_t *hmap, const char *key)
 {
     u_hmap_o_t *obj = NULL;
+    size_t i;
+
+    /* no policy bookkeeping needed: read the value straight off the slot */
+    if (hmap && key && hmap->opts->type == U_HMAP_TYPE_ROBINHOOD &&
+            !(hmap->pcy.ops & U_HMAP_PCY_OP_GET) && hmap->tw == NULL &&
+            !__RDONLY(hmap))
+    {
+        if (__rh_find(hmap, key, U_HMAP_NOLEN, __hash(hmap, key), &i))
+        {
+            __STATS(hmap, misses);
+            return NULL;
+        }
+
+        __STATS(hmap, hits);
+        return hmap->slots[i].val;
+    }
 
     nop_return_if (u_hmap_get(hmap, key, &obj), NULL);
 
@@ -404,8 +884,9 @@ int u_hmap_easy_del (u_hmap_t *hmap, const char *key)
  *      \}
  */
 
-/* Default hash function */
-static size_t __f_hash (const void *key, size_t size)
+/* Default hash function (Jenkins' one-at-a-time, unseeded): __hash()
+ * recognises it and runs the built-in function selected in the options */
+static size_t __f_hash (const void *key)
 {
     size_t h = 0;
     const unsigned char *k = (const unsigned char *) key;
@@ -422,7 +903,270 @@ static size_t __f_hash (const void *key, size_t size)
     h += (h << 3);
     h ^= (h >> 11);
 
-    return (h + (h << 15)) % size;
+    return (h + (h << 15));
+}
+
+/* Avalanche finalizer (MurmurHash3 fmix) applied to custom hash functions not
+ * marked as U_HMAP_OPTS_HASH_STRONG, so that every input bit affects the low
+ * bits used to pick the bucket */
+static size_t __f_mix (size_t h)
+{
+#if SIZE_MAX > 0xffffffffUL
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+#else
+    h ^= h >> 16;
+    h *= 0x85ebca6bUL;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35UL;
+    h ^= h >> 16;
+#endif
+
+    return h;
+}
+
+/* Built-in string hash functions: 'p' may not be NUL-terminated and
+ * the 64-bit words are read in host byte order */
+
+/* Jenkins' one-at-a-time, one byte per step (U_HMAP_HASH_OAAT) */
+static uint64_t __h_oaat (const unsigned char *p, size_t len, uint64_t seed)
+{
+    size_t h = (size_t) seed;
+
+    while (len--)
+    {
+        h += *p++;
+        h += (h << 10);
+        h ^= (h >> 6);
+    }
+
+    h += (h << 3);
+    h ^= (h >> 11);
+
+    return (h + (h << 15));
+}
+
+static uint64_t __rd64 (const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof v);
+
+    return v;
+}
+
+static uint64_t __rd32 (const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof v);
+
+    return v;
+}
+
+static uint64_t __rotl64 (uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+#define XXH_P1  0x9e3779b185ebca87ULL
+#define XXH_P2  0xc2b2ae3d27d4eb4fULL
+#define XXH_P3  0x165667b19e3779f9ULL
+#define XXH_P4  0x85ebca77c2b2ae63ULL
+#define XXH_P5  0x27d4eb2f165667c5ULL
+
+static uint64_t __xxh_round (uint64_t acc, uint64_t in)
+{
+    acc += in * XXH_P2;
+    acc = __rotl64(acc, 31);
+
+    return acc * XXH_P1;
+}
+
+static uint64_t __xxh_merge (uint64_t h, uint64_t v)
+{
+    h ^= __xxh_round(0, v);
+
+    return h * XXH_P1 + XXH_P4;
+}
+
+/* XXH64: four independent lanes, 32 bytes per step (U_HMAP_HASH_XXH64) */
+static uint64_t __h_xxh64 (const unsigned char *p, size_t len, uint64_t seed)
+{
+    const unsigned char *end = p + len;
+    uint64_t h, v1, v2, v3, v4;
+
+    if (len >= 32)
+    {
+        v1 = seed + XXH_P1 + XXH_P2;
+        v2 = seed + XXH_P2;
+        v3 = seed;
+        v4 = seed - XXH_P1;
+
+        do {
+            v1 = __xxh_round(v1, __rd64(p));
+            v2 = __xxh_round(v2, __rd64(p + 8));
+            v3 = __xxh_round(v3, __rd64(p + 16));
+            v4 = __xxh_round(v4, __rd64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = __rotl64(v1, 1) + __rotl64(v2, 7) + __rotl64(v3, 12) +
+            __rotl64(v4, 18);
+        h = __xxh_merge(h, v1);
+        h = __xxh_merge(h, v2);
+        h = __xxh_merge(h, v3);
+        h = __xxh_merge(h, v4);
+    }
+    else
+        h = seed + XXH_P5;
+
+    h += (uint64_t) len;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= __xxh_round(0, __rd64(p));
+        h = __rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= __rd32(p) * XXH_P1;
+        h = __rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+
+    for (; p < end; ++p)
+    {
+        h ^= *p * XXH_P5;
+        h = __rotl64(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/* 64x64 -> 128 bit multiplication, low half in *a and high half in *b */
+static void __wy_mum (uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) *a * *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32,
+             la = (uint32_t) *a, lb = (uint32_t) *b,
+             rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb,
+             t = rl + (rm0 << 32), c = (t < rl), lo;
+
+    lo = t + (rm1 << 32);
+    c += (lo < t);
+
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t __wy_mix (uint64_t a, uint64_t b)
+{
+    __wy_mum(&a, &b);
+
+    return a ^ b;
+}
+
+static const uint64_t __wy_p[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+/* wyhash: 128-bit multiply-xor mixing, 16 bytes per step and 48 bytes
+ * (three lanes) per step on long keys (U_HMAP_HASH_WYHASH) */
+static uint64_t __h_wy (const unsigned char *p, size_t len, uint64_t seed)
+{
+    uint64_t a, b, s1, s2;
+    size_t i = len;
+
+    seed ^= __wy_mix(seed ^ __wy_p[0], __wy_p[1]);
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (__rd32(p) << 32) | __rd32(p + ((len >> 3) << 2));
+            b = (__rd32(p + len - 4) << 32) |
+                __rd32(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) |
+                p[len - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        if (i > 48)
+        {
+            s1 = s2 = seed;
+
+            do {
+                seed = __wy_mix(__rd64(p) ^ __wy_p[1], __rd64(p + 8) ^ seed);
+                s1 = __wy_mix(__rd64(p + 16) ^ __wy_p[2], __rd64(p + 24) ^ s1);
+                s2 = __wy_mix(__rd64(p + 32) ^ __wy_p[3], __rd64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= s1 ^ s2;
+        }
+
+        for (; i > 16; i -= 16, p += 16)
+            seed = __wy_mix(__rd64(p) ^ __wy_p[1], __rd64(p + 8) ^ seed);
+
+        a = __rd64(p + i - 16);
+        b = __rd64(p + i - 8);
+    }
+
+    a ^= __wy_p[1];
+    b ^= seed;
+    __wy_mum(&a, &b);
+
+    return __wy_mix(a ^ __wy_p[0] ^ (uint64_t) len, b ^ __wy_p[1]);
+}
+
+/* Seed for U_HMAP_OPTS_HASH_RANDOM_SEED: from the system entropy pool when
+ * available, otherwise from time, pid and addresses */
+static uint64_t __seed_random (void)
+{
+    uint64_t seed = 0;
+    int fd;
+
+    if ((fd = open("/dev/urandom", O_RDONLY)) >= 0)
+    {
+        if (read(fd, &seed, sizeof seed) != (ssize_t) sizeof seed)
+            seed = 0;
+        (void) close(fd);
+    }
+
+    if (seed == 0)
+    {
+        seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32) ^
+            (uint64_t) (uintptr_t) &seed;
+        seed = __h_wy((const unsigned char *) &seed, sizeof seed, 0);
+    }
+
+    return seed;
 }
 
 /* Default comparison function for key comparison */
@@ -466,11 +1210,12 @@ static int __opts_check (u_hmap_opts_t *opts)
 
     dbg_err_if (opts->size == 0);
     dbg_err_if (opts->max == 0);
-    dbg_err_if (opts->type != U_HMAP_TYPE_CHAIN &&
-            opts->type != U_HMAP_TYPE_LINEAR);
+    dbg_err_if (!U_HMAP_IS_TYPE(opts->type));
     dbg_err_if (!U_HMAP_IS_PCY(opts->policy));
     dbg_err_if (opts->f_hash == NULL);
     dbg_err_if (opts->f_comp == NULL);
+    dbg_err_if (!U_HMAP_IS_HASH(opts->hash_type));
+    dbg_err_if (opts->f_now == NULL);
 
     /* in the hmap_easy interface, in case of pointer values (default),
        we force setting the value free function to avoid developer mistakes;
@@ -485,6 +1230,10 @@ static int __opts_check (u_hmap_opts_t *opts)
             opts->f_pcy_cmp == NULL,
                 "comparison function must be set for custom policy!");
 
+    /* expired objects are freed behind the user's back */
+    dbg_err_ifm (opts->ttl && !(opts->options & U_HMAP_OPTS_OWNSDATA),
+                "TTLs need hmap owned data!");
+
     return U_HMAP_ERR_NONE;
 err:
     return U_HMAP_ERR_FAIL;
@@ -493,41 +1242,85 @@ err:
 /* Setup policy parameters */
 static int __pcy_setup (u_hmap_t *hmap)
 {
+    size_t max, win;
+
     dbg_return_if (hmap == NULL, ~0);
 
+    max = hmap->opts->max;
+
     switch (hmap->opts->policy)
     {
         case U_HMAP_PCY_NONE:
             hmap->pcy.push = NULL;
             hmap->pcy.pop = NULL;
+            hmap->pcy.del = NULL;
             hmap->pcy.ops = 0;
             break;
         case U_HMAP_PCY_FIFO:
             hmap->pcy.push = __queue_push;
             hmap->pcy.pop = __queue_pop_back;
+            hmap->pcy.del = __queue_del;
             hmap->pcy.ops = U_HMAP_PCY_OP_PUT;
             break;
         case U_HMAP_PCY_LRU:
             hmap->pcy.push = __queue_push;
             hmap->pcy.pop = __queue_pop_back;
+            hmap->pcy.del = __queue_del;
             hmap->pcy.ops = U_HMAP_PCY_OP_PUT | U_HMAP_PCY_OP_GET;
             break;
         case U_HMAP_PCY_LFU:
-            hmap->pcy.push = __queue_push_count;
-            hmap->pcy.pop = __queue_pop_front;
+            hmap->pcy.push = __lfu_push;
+            hmap->pcy.pop = __lfu_pop;
+            hmap->pcy.del = __lfu_del;
             hmap->pcy.ops = U_HMAP_PCY_OP_PUT | U_HMAP_PCY_OP_GET;
             break;
         case U_HMAP_PCY_CUSTOM:
-            hmap->pcy.push = __queue_push_cmp;
-            hmap->pcy.pop = __queue_pop_back;
+            hmap->pcy.push = __heap_push;
+            hmap->pcy.pop = __heap_pop;
+            hmap->pcy.del = __heap_del;
             hmap->pcy.ops = U_HMAP_PCY_OP_PUT;
             break;
+        case U_HMAP_PCY_CLOCK:
+            hmap->pcy.push = __clock_push;
+            hmap->pcy.pop = __clock_pop;
+            hmap->pcy.del = __seg_del;
+            hmap->pcy.ops = U_HMAP_PCY_OP_PUT | U_HMAP_PCY_OP_GET;
+            break;
+        case U_HMAP_PCY_SLRU:
+            hmap->pcy.push = __slru_push;
+            hmap->pcy.pop = __slru_pop;
+            hmap->pcy.del = __seg_del;
+            hmap->pcy.ops = U_HMAP_PCY_OP_PUT | U_HMAP_PCY_OP_GET;
+            hmap->pcy.seg[U_HMAP_SEG_MAIN].max = U_MAX(max - max / 5, 1);
+            break;
+        case U_HMAP_PCY_2Q:
+            hmap->pcy.push = __2q_push;
+            hmap->pcy.pop = __2q_pop;
+            hmap->pcy.del = __seg_del;
+            hmap->pcy.ops = U_HMAP_PCY_OP_PUT | U_HMAP_PCY_OP_GET;
+            hmap->pcy.seg[U_HMAP_SEG_IN].max = U_MAX(max / 4, 1);
+            dbg_err_if (__ghost_init(hmap, U_MAX(max / 2, 1)));
+            break;
+        case U_HMAP_PCY_WTINYLFU:
+            hmap->pcy.push = __wtlfu_push;
+            hmap->pcy.pop = __wtlfu_pop;
+            hmap->pcy.del = __seg_del;
+            hmap->pcy.ops = U_HMAP_PCY_OP_PUT | U_HMAP_PCY_OP_GET;
+            win = U_MAX(max / 100, 1);
+            hmap->pcy.seg[U_HMAP_SEG_IN].max = win;
+            hmap->pcy.seg[U_HMAP_SEG_PROT].max =
+                U_MAX((max > win ? max - win : 1) * 4 / 5, 1);
+            dbg_err_if (__cms_init(hmap));
+            break;
         default:
             u_dbg("Invalid policy: %d", hmap->opts->policy);
             return U_HMAP_ERR_FAIL;
     }
 
     return U_HMAP_ERR_NONE;
+err:
+    __pcy_free(hmap);
+    return U_HMAP_ERR_FAIL;
 }
 
 /**
@@ -573,19 +1366,53 @@ int u_hmap_new (u_hmap_opts_t *opts, u_hmap_t **phmap)
     u_hmap_opts_dbg(c->opts);
     dbg_err_if (__pcy_setup(c));
 
-    c->size = c->opts->size;
-    dbg_err_if (__next_prime(&c->size, c->size, &c->px));
-    c->threshold = (size_t) (U_HMAP_RATE_FULL * c->size);
+    /* pick the seed once: hmaps derived from this one (e.g. on resize) copy
+     * its options and must hash the same way */
+    if (c->opts->options & U_HMAP_OPTS_HASH_RANDOM_SEED)
+    {
+        c->opts->hash_seed = __seed_random();
+        c->opts->options &= ~U_HMAP_OPTS_HASH_RANDOM_SEED;
+    }
+
+    if (c->opts->slab)
+    {
+        /* user owned objects may outlive the hmap, so only those the hmap
+         * owns are recycled */
+        if (c->opts->options & U_HMAP_OPTS_OWNSDATA)
+            c->oslab.sz = U_HMAP_SLAB_ROUND(sizeof(u_hmap_o_t)) +
+                U_HMAP_SLAB_INLINE;
+        c->qslab.sz = U_HMAP_SLAB_ROUND(sizeof(u_hmap_q_t));
+        c->tslab.sz = U_HMAP_SLAB_ROUND(sizeof(u_hmap_tmr_t));
+    }
+
+    if (c->opts->type == U_HMAP_TYPE_ROBINHOOD)
+    {
+        /* a discard policy bounds the number of elements: size the slot
+         * array for 'max' of them up front so that it never grows */
+        i = c->opts->size;
+        if (c->opts->policy != U_HMAP_PCY_NONE)
+            i = U_MAX(i, c->opts->max + (c->opts->max >> 2) + 1);
+        dbg_err_if (__rh_resize(c, i));
+    }
+    else
+    {
+        c->size = c->opts->size;
+        dbg_err_if (__next_size(&c->size, c->size));
+        c->threshold = (size_t) (U_HMAP_RATE_FULL * c->size);
 
-    dbg_err_sif ((c->hmap = (u_hmap_e_t *)
-                u_zalloc(sizeof(u_hmap_e_t) *
-                    c->size)) == NULL);
+        dbg_err_sif ((c->hmap = (u_hmap_e_t *)
+                    u_zalloc(sizeof(u_hmap_e_t) *
+                        c->size)) == NULL);
 
-    /* initialise entries */
-    for (i = 0; i < c->size; ++i)
-        LIST_INIT(&c->hmap[i]);
+        /* initialise entries */
+        for (i = 0; i < c->size; ++i)
+            LIST_INIT(&c->hmap[i]);
+    }
 
     TAILQ_INIT(&c->pcy.queue);
+    TAILQ_INIT(&c->pcy.fbs);
+    for (i = 0; i < U_HMAP_SEG_NUM; ++i)
+        TAILQ_INIT(&c->pcy.seg[i].queue);
 
     u_dbg("[hmap]");
     u_dbg("threshold: %u", c->threshold);
@@ -611,15 +1438,27 @@ err:
 void u_hmap_clear (u_hmap_t *hmap)
 {
     u_hmap_o_t *obj;
-    u_hmap_q_t *data;
     size_t i;
 
     dbg_ifb (hmap == NULL) return;
+    dbg_ifb (__RDONLY(hmap)) return;
+
+    /* drop expiration timers */
+    __tw_free(hmap);
 
     /* free the hashhmap */
-    for (i = 0; i < hmap->size; ++i)
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
     {
-        while ((obj = LIST_FIRST(&hmap->hmap[i])) != NULL)
+        if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            obj = hmap->slots[i].o;
+            memset(&hmap->slots[i], 0, sizeof(u_hmap_slot_t));
+            if (obj && (hmap->opts->options & U_HMAP_OPTS_OWNSDATA))
+                __o_free(hmap, obj);
+            continue;
+        }
+
+        while ((obj = LIST_FIRST(__bucket_at(hmap, i))) != NULL)
         {
             LIST_REMOVE(obj, next);
             if (hmap->opts->options & U_HMAP_OPTS_OWNSDATA)
@@ -627,12 +1466,14 @@ void u_hmap_clear (u_hmap_t *hmap)
         }
     }
 
+    /* no migration left to do */
+    U_FREE(hmap->ohmap);
+    hmap->osize = hmap->ridx = 0;
+
     /* free the policy queue */
-    while ((data = TAILQ_FIRST(&hmap->pcy.queue)) != NULL)
-    {
-        TAILQ_REMOVE(&hmap->pcy.queue, data, next);
-        __q_o_free(data);
-    }
+    __pcy_clear(hmap);
+
+    hmap->sz = 0;
 }
 
 /**
@@ -648,8 +1489,19 @@ void u_hmap_free (u_hmap_t *hmap)
 {
     dbg_ifb (hmap == NULL) return;
 
+    __img_free(hmap->img);
+    hmap->img = NULL;
+    U_FREE(hmap->frz);
+    hmap->sz = 0;
+
     u_hmap_clear(hmap);
     u_free(hmap->hmap);
+    u_free(hmap->ohmap);
+    u_free(hmap->slots);
+    __pcy_free(hmap);
+    __slab_destroy(&hmap->oslab);
+    __slab_destroy(&hmap->qslab);
+    __slab_destroy(&hmap->tslab);
     u_hmap_opts_free(hmap->opts);
     u_free(hmap);
 }
@@ -673,78 +1525,177 @@ void u_hmap_free (u_hmap_t *hmap)
  */
 int u_hmap_put (u_hmap_t *hmap, u_hmap_o_t *obj, u_hmap_o_t **old)
 {
-    u_hmap_o_t *o;
-    u_hmap_e_t *x;
-    int comp;
-    int rc;
-    size_t hash;
-    size_t last;
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (obj == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_ifm (__RDONLY(hmap), U_HMAP_ERR_FAIL, "read-only hmap");
 
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (obj == NULL);
+    __tw_tick(hmap);
 
-    if (old)
-        *old = NULL;
+    return __put(hmap, obj, __hash(hmap, obj->key),
+            hmap->opts->ttl ? hmap->opts->f_now() + hmap->opts->ttl : 0, old);
+}
 
-    if (hmap->sz >= hmap->threshold &&
-            hmap->opts->policy == U_HMAP_PCY_NONE)
-        dbg_err_if (__resize(hmap));
+/**
+ * \brief   Insert an object into the hmap with a time to live
+ *
+ * Same as u_hmap_put() but \p obj expires \p ttl milliseconds from now
+ * (according to the u_hmap_opts_set_clockfunc() clock), overriding the
+ * default set with u_hmap_opts_set_ttl(); a 0 \p ttl never expires.
+ *
+ * Expired objects are not returned by lookups and do not prevent the
+ * insertion of an object with the same key, but they still count in
+ * u_hmap_count() and are seen by the iteration functions until they are
+ * freed: this is done a few at a time by each put, or by u_hmap_expire().
+ * Only hmaps owning their data (U_HMAP_OPTS_OWNSDATA) support TTLs.
+ *
+ * \param   hmap      hmap object
+ * \param   obj       key to be inserted
+ * \param   ttl       time to live in milliseconds (0: no expiration)
+ * \param   old       returned old value
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_EXISTS   if key already exists
+ * \retval  U_HMAP_ERR_FAIL     on other failures
+ */
+int u_hmap_put_ttl (u_hmap_t *hmap, u_hmap_o_t *obj, uint64_t ttl,
+        u_hmap_o_t **old)
+{
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (obj == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_ifm (!(hmap->opts->options & U_HMAP_OPTS_OWNSDATA),
+            U_HMAP_ERR_FAIL, "TTLs need hmap owned data!");
+    dbg_return_ifm (__RDONLY(hmap), U_HMAP_ERR_FAIL, "read-only hmap");
 
-    hash = hmap->opts->f_hash(obj->key, hmap->size);
+    __tw_tick(hmap);
 
-    /* rehash if strong hash is required */
-    if (hmap->opts->f_hash != &__f_hash &&
-            !(hmap->opts->options & U_HMAP_OPTS_HASH_STRONG))
-    {
-        enum { MAX_INT = 20 };
-        char h[MAX_INT];
+    return __put(hmap, obj, __hash(hmap, obj->key),
+            ttl ? hmap->opts->f_now() + ttl : 0, old);
+}
 
-        u_snprintf(h, MAX_INT, "%u", hash);
-        hash = __f_hash(h, hmap->size);
-    }
+/* Insert obj, with full hash 'h', expiring at time 'expire' (0: never) */
+static int __put (u_hmap_t *hmap, u_hmap_o_t *obj, size_t h,
+        uint64_t expire, u_hmap_o_t **old)
+{
+    u_hmap_tmr_t *t = NULL;
+    u_hmap_o_t *o;
+    int rc;
 
-    x = &hmap->hmap[hash];
+    /* an expired object is as good as gone: it makes room for the new one */
+    if (hmap->tw && __get_h(hmap, obj->key, U_HMAP_NOLEN, h, &o) ==
+            U_HMAP_ERR_NONE && __expired(hmap, o))
+        dbg_err_if (__del(hmap, obj->key, h, NULL));
 
-    switch (hmap->opts->type)
-    {
-        case U_HMAP_TYPE_CHAIN:
+    if (expire)
+        dbg_err_if ((t = __tmr_new(hmap)) == NULL);
 
-            if (LIST_EMPTY(x))
+    rc = __insert(hmap, obj, h, old);
+
+    if (t)
+    {
+        if (rc == U_HMAP_ERR_NONE)
+        {
+            t->ho = obj;
+            t->expire = expire;
+            obj->tmr = t;
+            __tw_add(hmap->tw, t);
+        }
+        else if (hmap->tslab.sz)
+            __slab_free(&hmap->tslab, t);
+        else
+            u_free(t);
+    }
+
+    return rc;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Insert obj, whose key has full hash h */
+static int __insert (u_hmap_t *hmap, u_hmap_o_t *obj, size_t h,
+        u_hmap_o_t **old)
+{
+    u_hmap_o_t *o;
+    u_hmap_e_t *x;
+    u_hmap_slot_t s;
+    int rc;
+    size_t hash;
+    size_t last;
+
+    if (old)
+        *old = NULL;
+
+    if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+    {
+        /* open addressing needs at least one free slot, whatever the policy */
+        if (hmap->sz >= hmap->threshold)
+            dbg_err_if (__grow(hmap));
+
+        hash = h;
+
+        if (__rh_find(hmap, obj->key, U_HMAP_NOLEN, hash, &last) ==
+                U_HMAP_ERR_NONE)
+        {
+            rc = __o_overwrite(hmap, hmap->slots[last].o, obj, h, old);
+            dbg_err_if (rc && rc != U_HMAP_ERR_EXISTS);
+
+            if (rc == U_HMAP_ERR_NONE)
             {
-                LIST_INSERT_HEAD(x, obj, next);
-                goto end;
+                hmap->slots[last].key = obj->key;
+                hmap->slots[last].val = obj->val;
+                hmap->slots[last].o = obj;
             }
+            return rc;
+        }
+
+        s.hash = hash;
+        s.key = obj->key;
+        s.val = obj->val;
+        s.o = obj;
+        __rh_insert(hmap, s);
+        goto end;
+    }
 
-            LIST_FOREACH(o, x, next)
+    if (hmap->ohmap)
+        __rehash_step(hmap, U_HMAP_REHASH_STEP);
+
+    if (hmap->sz >= hmap->threshold &&
+            hmap->opts->policy == U_HMAP_PCY_NONE)
+        dbg_err_if (__grow(hmap));
+
+    hash = h;
+
+    /* the key may still sit in a bucket not migrated yet */
+    if (hmap->ohmap &&
+            (o = __chain_find(hmap, &hmap->ohmap[__IDX(hash, hmap->osize)],
+                              obj->key, U_HMAP_NOLEN)) != NULL)
+    {
+        rc = __o_overwrite(hmap, o, obj, h, old);
+        dbg_err_if (rc && rc != U_HMAP_ERR_EXISTS);
+        return rc;
+    }
+
+    hash = __IDX(hash, hmap->size);
+
+    x = &hmap->hmap[hash];
+
+    switch (hmap->opts->type)
+    {
+        case U_HMAP_TYPE_CHAIN:
+
+            /* object already hmapd */
+            if ((o = __chain_insert(hmap, x, obj)) != NULL)
             {
-                /* object already hmapd */
-                if ((comp = hmap->opts->f_comp(obj->key, o->key)) == 0)
-                {
-                    rc = __o_overwrite(hmap, o, obj, old);
-                    dbg_err_if (rc && rc != U_HMAP_ERR_EXISTS);
-                    return rc;
-                }
-                else
-                {
-                    if (comp < 0)
-                    {
-                        LIST_INSERT_BEFORE(o, obj, next);
-                        goto end;
-                    }
-                    else if (!LIST_NEXT(o, next))
-                    {
-                        LIST_INSERT_AFTER(o, obj, next);
-                        goto end;
-                    }
-                }
+                rc = __o_overwrite(hmap, o, obj, h, old);
+                dbg_err_if (rc && rc != U_HMAP_ERR_EXISTS);
+                return rc;
             }
-            break;
+            goto end;
 
         case U_HMAP_TYPE_LINEAR:
 
-            last = ((hash + hmap->size-1) % hmap->size);
+            last = __IDX(hash + hmap->size - 1, hmap->size);
 
-            for (; hash != last; hash = ((hash+1) % hmap->size),
+            for (; hash != last; hash = __IDX(hash + 1, hmap->size),
                     x = &hmap->hmap[hash])
             {
                 if (LIST_EMPTY(x))
@@ -759,12 +1710,15 @@ int u_hmap_put (u_hmap_t *hmap, u_hmap_o_t *obj, u_hmap_o_t **old)
                 /* object already hmapd */
                 if (hmap->opts->f_comp(o->key, obj->key) == 0)
                 {
-                    rc = __o_overwrite(hmap, o, obj, old);
+                    rc = __o_overwrite(hmap, o, obj, h, old);
                     dbg_err_if (rc && rc != U_HMAP_ERR_EXISTS);
                     return rc;
                 }
             }
             break;
+
+        default:
+            break;
     }
 
 err:
@@ -778,11 +1732,13 @@ end:
         u_dbg("Cache full - freeing according to policy '%s'",
                 __pcy2str(hmap->opts->policy));
         dbg_err_if (hmap->pcy.pop(hmap, old));
+        __STATS(hmap, evictions);
     }
 
     if (hmap->pcy.ops & U_HMAP_PCY_OP_PUT)
-        dbg_err_if (hmap->pcy.push(hmap, obj, &obj->pqe));
+        dbg_err_if (hmap->pcy.push(hmap, obj, h, &obj->pqe));
     hmap->sz++;
+    __STATS(hmap, puts);
 
     return U_HMAP_ERR_NONE;
 }
@@ -803,19 +1759,27 @@ end:
  */
 int u_hmap_get (u_hmap_t *hmap, const void *key, u_hmap_o_t **obj)
 {
+    size_t h;
+
     dbg_err_if (hmap == NULL);
     dbg_err_if (key == NULL);
     dbg_err_if (obj == NULL);
 
-    if (__get(hmap, key, obj))
+    /* (the hash is also handed to the policy, e.g. 2Q ghosts are hashes) */
+    h = __hash(hmap, key);
+
+    if (__get_h(hmap, key, U_HMAP_NOLEN, h, obj) ||
+            (hmap->tw && __expired(hmap, *obj)))
     {
+        __STATS(hmap, misses);
         *obj = NULL;
         return U_HMAP_ERR_FAIL;
     }
     dbg_err_if (obj == NULL);
+    __STATS(hmap, hits);
 
     if (hmap->pcy.ops & U_HMAP_PCY_OP_GET)
-        dbg_err_if (hmap->pcy.push(hmap, *obj, &(*obj)->pqe));
+        dbg_err_if (hmap->pcy.push(hmap, *obj, h, &(*obj)->pqe));
 
     return U_HMAP_ERR_NONE;
 
@@ -823,6 +1787,71 @@ err:
     return U_HMAP_ERR_FAIL;
 }
 
+/**
+ * \brief   Retrieve an object given a key and its length
+ *
+ * Same as u_hmap_get() for a string key given as \p klen bytes at \p key,
+ * which need not be NUL-terminated (e.g. a token inside a larger buffer).
+ * With the built-in hash and comparison functions the key is neither
+ * copied nor scanned for its length; with custom ones it is copied into a
+ * NUL-terminated buffer first.
+ *
+ * \param   hmap      hmap object
+ * \param   key       key to be retrieved
+ * \param   klen      length of \p key
+ * \param   obj       returned object
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_get_n (u_hmap_t *hmap, const void *key, size_t klen,
+        u_hmap_o_t **obj)
+{
+    enum { KEY_BUF_SZ = 256 };
+    char buf[KEY_BUF_SZ], *k = buf;
+    int rc;
+    size_t h;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (key == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (klen == U_HMAP_NOLEN);
+
+    if (hmap->opts->f_hash != &__f_hash || hmap->opts->f_comp != &__f_comp)
+    {
+        if (klen >= sizeof buf)
+            dbg_err_sif ((k = u_malloc(klen + 1)) == NULL);
+
+        memcpy(k, key, klen);
+        k[klen] = '\0';
+
+        rc = u_hmap_get(hmap, k, obj);
+
+        if (k != buf)
+            u_free(k);
+
+        return rc;
+    }
+
+    h = __hash_n(hmap, key, klen);
+
+    if (__get_h(hmap, key, klen, h, obj) ||
+            (hmap->tw && __expired(hmap, *obj)))
+    {
+        __STATS(hmap, misses);
+        *obj = NULL;
+        return U_HMAP_ERR_FAIL;
+    }
+    __STATS(hmap, hits);
+
+    if (hmap->pcy.ops & U_HMAP_PCY_OP_GET)
+        dbg_err_if (hmap->pcy.push(hmap, *obj, h, &(*obj)->pqe));
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
 /**
  * \brief   Delete an object from the hmap
  *
@@ -838,19 +1867,57 @@ err:
  */
 int u_hmap_del (u_hmap_t *hmap, const void *key, u_hmap_o_t **obj)
 {
-    u_hmap_o_t *o = NULL;
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_ifm (__RDONLY(hmap), U_HMAP_ERR_FAIL, "read-only hmap");
 
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (key == NULL);
+    return __del(hmap, key, __hash(hmap, key), obj);
+}
+
+/* Delete key, whose full hash is hash */
+static int __del (u_hmap_t *hmap, const void *key, size_t hash,
+        u_hmap_o_t **obj)
+{
+    u_hmap_o_t *o = NULL;
+    size_t i;
 
     if (obj)
         *obj = NULL;
 
-    if (__get(hmap, key, &o))
-        return U_HMAP_ERR_FAIL;
+    if (hmap->ohmap)
+        __rehash_step(hmap, U_HMAP_REHASH_STEP);
 
-    dbg_err_if (o == NULL);
-    LIST_REMOVE(o, next);
+    if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+    {
+        if (__rh_find(hmap, key, U_HMAP_NOLEN, hash, &i))
+            return U_HMAP_ERR_FAIL;
+
+        o = hmap->slots[i].o;
+        __rh_remove(hmap, i);
+    }
+    else
+    {
+        if (__get_h(hmap, key, U_HMAP_NOLEN, hash, &o))
+            return U_HMAP_ERR_FAIL;
+
+        dbg_err_if (o == NULL);
+
+        if (hmap->opts->type == U_HMAP_TYPE_LINEAR)
+        {
+            /* o sits along the run of buckets starting at its home */
+            for (i = __IDX(hash, hmap->size); LIST_FIRST(&hmap->hmap[i]) != o;
+                    i = __IDX(i + 1, hmap->size))
+                ;
+            __lin_remove(hmap, i);
+        }
+        else
+            LIST_REMOVE(o, next);
+    }
+
+    /* drop its policy reference and timer, if any */
+    if (o->pqe)
+        dbg_err_if (hmap->pcy.del(hmap, o));
+    __tmr_del(hmap, o);
 
     if (hmap->opts->options & U_HMAP_OPTS_OWNSDATA)
         __o_free(hmap, o);
@@ -866,6 +1933,201 @@ err:
     return U_HMAP_ERR_FAIL;
 }
 
+/**
+ * \brief   Retrieve several objects from the hmap
+ *
+ * Look up the \p n keys in \p keys and save the matching objects in
+ * \p objs (\c NULL for missing keys), with the same semantics as
+ * u_hmap_get().  Keys are processed in groups: all hashes of a group are
+ * computed and the buckets they point to prefetched before any of them is
+ * resolved, so that independent cache misses overlap instead of being paid
+ * one after the other.
+ *
+ * \param   hmap      hmap object
+ * \param   keys      keys to be retrieved
+ * \param   n         number of keys
+ * \param   objs      array of \p n returned objects
+ *
+ * \return the number of keys found, or -1 on error
+ */
+ssize_t u_hmap_get_batch (u_hmap_t *hmap, const void * const *keys, size_t n,
+        u_hmap_o_t **objs)
+{
+    size_t h[U_HMAP_BATCH], i, j, m;
+    ssize_t found = 0;
+
+    dbg_return_if (hmap == NULL, -1);
+    dbg_return_if (keys == NULL && n, -1);
+    dbg_return_if (objs == NULL && n, -1);
+
+    for (i = 0; i < n; i += m)
+    {
+        m = U_MIN(n - i, U_HMAP_BATCH);
+
+        for (j = 0; j < m; ++j)
+            h[j] = __hash(hmap, keys[i + j]);
+
+        __prefetch(hmap, h, m);
+
+        for (j = 0; j < m; ++j)
+        {
+            if (__get_h(hmap, keys[i + j], U_HMAP_NOLEN, h[j],
+                        &objs[i + j]) ||
+                    (hmap->tw && __expired(hmap, objs[i + j])))
+            {
+                __STATS(hmap, misses);
+                objs[i + j] = NULL;
+                continue;
+            }
+            __STATS(hmap, hits);
+
+            if (hmap->pcy.ops & U_HMAP_PCY_OP_GET)
+                dbg_err_if (hmap->pcy.push(hmap, objs[i + j], h[j],
+                            &objs[i + j]->pqe));
+            ++found;
+        }
+    }
+
+    return found;
+err:
+    return -1;
+}
+
+/**
+ * \brief   Insert several objects into the hmap
+ *
+ * Insert the \p n objects in \p objs, with the same semantics as
+ * u_hmap_put() and the prefetching scheme of u_hmap_get_batch().  A failed
+ * insertion does not stop the following ones.
+ *
+ * \param   hmap      hmap object
+ * \param   objs      objects to be inserted
+ * \param   n         number of objects
+ * \param   olds      array of \p n returned old values (may be \c NULL)
+ * \param   rcs       array of \p n u_hmap_put() return codes (may be
+ *                    \c NULL)
+ *
+ * \return the number of objects inserted, or -1 on error
+ */
+ssize_t u_hmap_put_batch (u_hmap_t *hmap, u_hmap_o_t **objs, size_t n,
+        u_hmap_o_t **olds, int *rcs)
+{
+    size_t h[U_HMAP_BATCH], i, j, m;
+    ssize_t done = 0;
+    int rc;
+
+    dbg_return_if (hmap == NULL, -1);
+    dbg_return_if (objs == NULL && n, -1);
+    dbg_return_ifm (__RDONLY(hmap), -1, "read-only hmap");
+
+    __tw_tick(hmap);
+
+    for (i = 0; i < n; i += m)
+    {
+        m = U_MIN(n - i, U_HMAP_BATCH);
+
+        for (j = 0; j < m; ++j)
+            h[j] = objs[i + j] ? __hash(hmap, objs[i + j]->key) : 0;
+
+        __prefetch(hmap, h, m);
+
+        for (j = 0; j < m; ++j)
+        {
+            if (objs[i + j] == NULL)
+            {
+                rc = U_HMAP_ERR_FAIL;
+                if (olds)
+                    olds[i + j] = NULL;
+            }
+            else
+                rc = __put(hmap, objs[i + j], h[j], hmap->opts->ttl ?
+                        hmap->opts->f_now() + hmap->opts->ttl : 0,
+                        olds ? &olds[i + j] : NULL);
+
+            if (rc == U_HMAP_ERR_NONE)
+                ++done;
+            if (rcs)
+                rcs[i + j] = rc;
+        }
+    }
+
+    return done;
+}
+
+/**
+ * \brief   Delete several objects from the hmap
+ *
+ * Delete the \p n keys in \p keys, with the same semantics as u_hmap_del()
+ * and the prefetching scheme of u_hmap_get_batch().
+ *
+ * \param   hmap      hmap object
+ * \param   keys      keys of the objects to be deleted
+ * \param   n         number of keys
+ * \param   objs      array of \p n deleted objects, if owned by the user
+ *                    (may be \c NULL)
+ *
+ * \return the number of objects deleted, or -1 on error
+ */
+ssize_t u_hmap_del_batch (u_hmap_t *hmap, const void * const *keys, size_t n,
+        u_hmap_o_t **objs)
+{
+    size_t h[U_HMAP_BATCH], i, j, m;
+    ssize_t done = 0;
+
+    dbg_return_if (hmap == NULL, -1);
+    dbg_return_if (keys == NULL && n, -1);
+    dbg_return_ifm (__RDONLY(hmap), -1, "read-only hmap");
+
+    for (i = 0; i < n; i += m)
+    {
+        m = U_MIN(n - i, U_HMAP_BATCH);
+
+        for (j = 0; j < m; ++j)
+            h[j] = __hash(hmap, keys[i + j]);
+
+        __prefetch(hmap, h, m);
+
+        for (j = 0; j < m; ++j)
+            if (__del(hmap, keys[i + j], h[j],
+                        objs ? &objs[i + j] : NULL) == U_HMAP_ERR_NONE)
+                ++done;
+    }
+
+    return done;
+}
+
+/**
+ * \brief   Re-prioritize an object
+ *
+ * Tell a U_HMAP_PCY_CUSTOM \p hmap that the priority of the object with the
+ * given \p key has changed, e.g. because its value was modified in place.
+ * The object keeps its place among objects of equal priority.
+ *
+ * \param   hmap      hmap object
+ * \param   key       key of the modified object
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure (or if \p key is not found)
+ */
+int u_hmap_pcy_update (u_hmap_t *hmap, const void *key)
+{
+    u_hmap_o_t *o = NULL;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (key == NULL);
+    dbg_err_if (hmap->opts->policy != U_HMAP_PCY_CUSTOM);
+
+    if (__get(hmap, key, &o))
+        return U_HMAP_ERR_FAIL;
+
+    dbg_err_if (o->pqe == NULL);
+    __heap_fix(hmap, o->pqe->hpos);
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
 /**
  * \brief   Create a data object (<b>unused for hmap_easy interface</b>)
  *
@@ -882,43 +2144,66 @@ err:
 u_hmap_o_t *u_hmap_o_new (u_hmap_t *hmap, const void *key, const void *val)
 {
     u_hmap_o_t *obj = NULL;
+    size_t off = U_HMAP_SLAB_ROUND(sizeof(u_hmap_o_t)), len;
 
     dbg_return_if (hmap == NULL, NULL);
     dbg_return_if (key == NULL, NULL);
     dbg_return_if (val == NULL, NULL);
 
-    dbg_err_sif ((obj = (u_hmap_o_t *) u_zalloc(sizeof(u_hmap_o_t))) == NULL);
+    if (hmap->oslab.sz)
+    {
+        dbg_err_if ((obj = (u_hmap_o_t *) __slab_alloc(&hmap->oslab)) == NULL);
+        memset(obj, 0, sizeof(u_hmap_o_t));
+        obj->flags = U_HMAP_O_SLAB;
+
+        /* a custom f_free() expects keys and values of its own */
+        if (hmap->opts->f_free)
+            off += U_HMAP_SLAB_INLINE + 1;
+    }
+    else
+        dbg_err_sif ((obj = (u_hmap_o_t *) u_zalloc(sizeof(u_hmap_o_t)))
+                == NULL);
     obj->hmap = hmap;
 
     if (hmap->opts->options & U_HMAP_OPTS_OWNSDATA)
     {
-        /* internalise key */
+        /* internalise key (inline if it fits) */
         switch (hmap->opts->key_type)
         {
             case U_HMAP_OPTS_DATATYPE_POINTER:
                 memcpy(&obj->key, &key, sizeof(void **));
                 break;
             case U_HMAP_OPTS_DATATYPE_STRING:
-                dbg_err_if ((obj->key = u_strdup((const char *) key)) == NULL);
-                break;
             case U_HMAP_OPTS_DATATYPE_OPAQUE:
-                dbg_err_if ((obj->key = u_zalloc(hmap->opts->key_sz)) == NULL);
-                memcpy(obj->key, key, hmap->opts->key_sz);
+                len = (hmap->opts->key_type == U_HMAP_OPTS_DATATYPE_STRING) ?
+                    strlen((const char *) key) + 1 : hmap->opts->key_sz;
+                if ((obj->key = __o_inline(obj, &off, key, len)) != NULL)
+                    obj->flags |= U_HMAP_O_KEY_INLINE;
+                else
+                {
+                    dbg_err_if ((obj->key = u_malloc(len)) == NULL);
+                    memcpy(obj->key, key, len);
+                }
                 break;
         }
 
-        /* internalise value */
+        /* internalise value (inline if it fits) */
         switch (hmap->opts->val_type)
         {
             case U_HMAP_OPTS_DATATYPE_POINTER:
                 memcpy(&obj->val, &val, sizeof(void **));
                 break;
             case U_HMAP_OPTS_DATATYPE_STRING:
-                dbg_err_if ((obj->val = u_strdup((const char *) val)) == NULL);
-                break;
             case U_HMAP_OPTS_DATATYPE_OPAQUE:
-                dbg_err_if ((obj->val = u_zalloc(hmap->opts->val_sz)) == NULL);
-                memcpy(obj->val, val, hmap->opts->val_sz);
+                len = (hmap->opts->val_type == U_HMAP_OPTS_DATATYPE_STRING) ?
+                    strlen((const char *) val) + 1 : hmap->opts->val_sz;
+                if ((obj->val = __o_inline(obj, &off, val, len)) != NULL)
+                    obj->flags |= U_HMAP_O_VAL_INLINE;
+                else
+                {
+                    dbg_err_if ((obj->val = u_malloc(len)) == NULL);
+                    memcpy(obj->val, val, len);
+                }
                 break;
         }
     }
@@ -933,6 +2218,10 @@ u_hmap_o_t *u_hmap_o_new (u_hmap_t *hmap, const void *key, const void *val)
     return obj;
 
 err:
+    if (obj && (hmap->opts->options & U_HMAP_OPTS_OWNSDATA) &&
+            hmap->opts->key_type != U_HMAP_OPTS_DATATYPE_POINTER &&
+            !(obj->flags & U_HMAP_O_KEY_INLINE))
+        u_free(obj->key);
     U_FREEF(obj, u_hmap_o_free);
 
     return NULL;
@@ -953,7 +2242,10 @@ void u_hmap_o_free (u_hmap_o_t *obj)
 {
     dbg_ifb (obj == NULL) return;
 
-    u_free(obj);
+    if (obj->flags & U_HMAP_O_SLAB)
+        __slab_free(&obj->hmap->oslab, obj);
+    else
+        u_free(obj);
 }
 
 /** \brief  Access the key of the hmap element pointed to by \p obj. */
@@ -968,6 +2260,26 @@ void *u_hmap_o_get_val (u_hmap_o_t *obj)
     return obj->val;
 }
 
+/**
+ *  \brief  Dispose of an object not (or no longer) stored in the hmap
+ *
+ *  Free \p obj, created with u_hmap_o_new() on \p hmap, along with its key
+ *  and value if \p hmap owns data (otherwise they are left to the user).
+ *
+ *  \param  hmap    hmap object \p obj was created with
+ *  \param  obj     the object
+ */
+void u_hmap_o_dispose (u_hmap_t *hmap, u_hmap_o_t *obj)
+{
+    dbg_ifb (hmap == NULL) return;
+    nop_return_if (obj == NULL, );
+
+    if (hmap->opts->options & U_HMAP_OPTS_OWNSDATA)
+        __o_free(hmap, obj);
+    else
+        u_hmap_o_free(obj);
+}
+
 /* Free a data object including content (only if U_HMAP_OPTS_OWNSDATA) */
 static void __o_free (u_hmap_t *hmap, u_hmap_o_t *obj)
 {
@@ -988,7 +2300,8 @@ static void __o_free (u_hmap_t *hmap, u_hmap_o_t *obj)
                 break;
             case U_HMAP_OPTS_DATATYPE_STRING:
             case U_HMAP_OPTS_DATATYPE_OPAQUE:
-                u_free(obj->key);
+                if (!(obj->flags & U_HMAP_O_KEY_INLINE))
+                    u_free(obj->key);
                 break;
         }
         switch (hmap->opts->val_type)
@@ -999,7 +2312,8 @@ static void __o_free (u_hmap_t *hmap, u_hmap_o_t *obj)
                 break;
             case U_HMAP_OPTS_DATATYPE_STRING:
             case U_HMAP_OPTS_DATATYPE_OPAQUE:
-                u_free(obj->val);
+                if (!(obj->flags & U_HMAP_O_VAL_INLINE))
+                    u_free(obj->val);
                 break;
         }
     }
@@ -1008,7 +2322,7 @@ static void __o_free (u_hmap_t *hmap, u_hmap_o_t *obj)
 }
 
 static int __o_overwrite (u_hmap_t *hmap, u_hmap_o_t *o, u_hmap_o_t *obj,
-        u_hmap_o_t **old)
+        size_t hash, u_hmap_o_t **old)
 {
     /* overwrite */
     if (!(hmap->opts->options &
@@ -1017,13 +2331,18 @@ static int __o_overwrite (u_hmap_t *hmap, u_hmap_o_t *o, u_hmap_o_t *obj,
         if (hmap->pcy.ops & U_HMAP_PCY_OP_PUT)
         {
             /* delete old object and enqueue new one */
-            dbg_err_if (__queue_del(hmap, o));
-            dbg_err_if (hmap->pcy.push(hmap, obj, &obj->pqe));
+            dbg_err_if (hmap->pcy.del(hmap, o));
+            dbg_err_if (hmap->pcy.push(hmap, obj, hash, &obj->pqe));
         }
 
-        /* replace object in hmap list */
-        LIST_INSERT_AFTER(o, obj, next);
-        LIST_REMOVE(o, next);
+        /* replace object in hmap list (slots are updated by the caller) */
+        if (hmap->opts->type != U_HMAP_TYPE_ROBINHOOD)
+        {
+            LIST_INSERT_AFTER(o, obj, next);
+            LIST_REMOVE(o, next);
+        }
+
+        __tmr_del(hmap, o);
 
         if (hmap->opts->options & U_HMAP_OPTS_OWNSDATA)
             __o_free(hmap, o);
@@ -1031,6 +2350,9 @@ static int __o_overwrite (u_hmap_t *hmap, u_hmap_o_t *o, u_hmap_o_t *obj,
             if (old)
                 *old = o;
 
+        __STATS(hmap, puts);
+        __STATS(hmap, overwrites);
+
         return U_HMAP_ERR_NONE;
     }
     else  /* don't overwrite */
@@ -1064,22 +2386,145 @@ ssize_t u_hmap_count (u_hmap_t *hmap)
 }
 
 /**
- *      \}
- */
-
-/**
- *      \defgroup hmap_opts Options
- *      \{
- */
-
-/**
- * \brief   Create new hmap options
+ *  \brief  Get hmap statistics
  *
- * Create a new hmap options object and save its pointer to \p *opts.
- * The fields within the object can be manipulated publicly according to the
- * description in the header file.
+ *  Fill \p stats with the counters collected by \p hmap and with a picture
+ *  of its table: number of objects, size, load factor and the longest and
+ *  mean probe sequence, i.e. the number of keys compared when looking up a
+ *  stored object (its position in the chain for U_HMAP_TYPE_CHAIN hmaps).
  *
- * \param   opts      on success contains the hmap options object
+ *  Counters are only updated if the hmap was created with the
+ *  U_HMAP_OPTS_STATS option (they are zero otherwise) and are never reset,
+ *  not even by u_hmap_clear().  With incremental resizing, \c resize_ns only
+ *  accounts for the start of each resize, not for the migration spread over
+ *  the following writes.  The table picture costs a full scan of the table
+ *  (and rehashing every key of U_HMAP_TYPE_LINEAR hmaps).
+ *
+ *  \param  hmap    hmap object
+ *  \param  stats   the statistics
+ *
+ *  \retval U_HMAP_ERR_NONE     on success
+ *  \retval U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_stats (u_hmap_t *hmap, u_hmap_stats_t *stats)
+{
+    size_t sum = 0;
+
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (stats == NULL, U_HMAP_ERR_FAIL);
+
+    *stats = hmap->st;
+    stats->policy = hmap->opts->policy;
+    stats->count = hmap->sz;
+
+    if (hmap->frz)
+        stats->size = hmap->frz->n;
+    else if (hmap->img)
+        stats->size = hmap->img->mask + 1;
+    else
+        stats->size = hmap->size + hmap->osize;
+
+    stats->load = stats->size ? (double) stats->count / stats->size : 0;
+
+    __probes(hmap, &stats->probe_max, &sum);
+    stats->probe_mean = stats->count ? (double) sum / stats->count : 0;
+
+    return U_HMAP_ERR_NONE;
+}
+
+/**
+ *  \brief  Hash a key
+ *
+ *  Return the hash of \p key as used by \p hmap, before it is reduced to the
+ *  size of the table (useful e.g. for partitioning keys among several maps)
+ *
+ *  \param  hmap    hmap object
+ *  \param  key     the key
+ *
+ *  \return the hash value
+ */
+size_t u_hmap_hash (u_hmap_t *hmap, const void *key)
+{
+    dbg_return_if (hmap == NULL, 0);
+    dbg_return_if (key == NULL, 0);
+
+    return __hash(hmap, key);
+}
+
+/**
+ *  \brief  Tell if lookups modify the hmap
+ *
+ *  Return non-zero if the discard policy of \p hmap keeps track of accesses
+ *  (e.g. LRU, LFU), or if it counts hits and misses (U_HMAP_OPTS_STATS), so 
+ *  that u_hmap_get() modifies the hmap and concurrent lookups need exclusive
+ *  access to it.
+ *
+ *  \param  hmap    hmap object
+ *
+ *  \return non-zero if u_hmap_get() is not a read-only operation
+ */
+int u_hmap_pcy_tracks_get (u_hmap_t *hmap)
+{
+    dbg_return_if (hmap == NULL, 1);
+
+    return ((hmap->pcy.ops & U_HMAP_PCY_OP_GET) ||
+            (hmap->opts->options & U_HMAP_OPTS_STATS)) ? 1 : 0;
+}
+
+/**
+ *  \brief  Compare two keys
+ *
+ *  Compare keys \p k1 and \p k2 with the comparison function of \p hmap.
+ *
+ *  \param  hmap    hmap object
+ *  \param  k1      first key
+ *  \param  k2      second key
+ *
+ *  \return 0 if the keys are equal, non-zero otherwise
+ */
+int u_hmap_key_comp (u_hmap_t *hmap, const void *k1, const void *k2)
+{
+    dbg_return_if (hmap == NULL, -1);
+    dbg_return_if (k1 == NULL, -1);
+    dbg_return_if (k2 == NULL, -1);
+
+    return hmap->opts->f_comp(k1, k2);
+}
+
+/**
+ *  \brief  Tell if an option is set
+ *
+ *  Return non-zero if \p option (see ::u_hmap_options_t) is set for \p hmap.
+ *
+ *  \param  hmap    hmap object
+ *  \param  option  the option
+ *
+ *  \return non-zero if \p option is set, 0 otherwise
+ */
+int u_hmap_has_option (u_hmap_t *hmap, int option)
+{
+    dbg_return_if (hmap == NULL, 0);
+
+    return (hmap->opts->options & option) ? 1 : 0;
+}
+
+/**
+ *      \}
+ */
+
+/**
+ *      \defgroup hmap_opts Options
+ *      \{
+ */
+
+/**
+ * \brief   Create new hmap options
+ *
+ * Create a new hmap options object and save its pointer to \p *opts.
+ * The fields within the object can be manipulated publicly according to the
+ * description in the header file.
+ *
+ * \param   opts      on success contains the hmap options object
  *
  * \retval  U_HMAP_ERR_NONE     on success
  * \retval  U_HMAP_ERR_FAIL     on failure
@@ -1135,6 +2580,8 @@ void u_hmap_opts_init (u_hmap_opts_t *opts)
     opts->options = U_HMAP_OPTS_NO_OVERWRITE | U_HMAP_OPTS_OWNSDATA;
     opts->f_hash = &__f_hash;
     opts->f_comp = &__f_comp;
+    opts->hash_type = U_HMAP_HASH_WYHASH;
+    opts->hash_seed = 0;
     opts->f_free = NULL;
     opts->key_type = U_HMAP_OPTS_DATATYPE_STRING;
     opts->val_type = U_HMAP_OPTS_DATATYPE_POINTER;
@@ -1145,6 +2592,11 @@ void u_hmap_opts_init (u_hmap_opts_t *opts)
     opts->key_sz = sizeof(void *);
     opts->val_sz = sizeof(void *);
     opts->easy = 0;
+    opts->incremental = 0;
+    opts->slab = 0;
+    opts->mmap = 0;
+    opts->ttl = 0;
+    opts->f_now = &__f_now;
 
     return;
 }
@@ -1198,6 +2650,7 @@ void u_hmap_opts_dbg (u_hmap_opts_t *opts)
             (opts->options & U_HMAP_OPTS_NO_OVERWRITE) ? "no" : "yes");
     u_dbg("  key type: %s", __datatype2str(opts->key_type));
     u_dbg("  value type: %s", __datatype2str(opts->val_type));
+    u_dbg("  default ttl: %llu ms", (unsigned long long) opts->ttl);
     u_dbg("</hmap_options>");
 
     return;
@@ -1244,6 +2697,137 @@ err:
     return U_HMAP_ERR_FAIL;
 }
 
+/** \brief Enable or disable incremental resizing
+ *
+ * When a U_HMAP_TYPE_CHAIN hmap without discard policy outgrows its bucket
+ * array, the new (larger) array is allocated and the old one is kept aside:
+ * each subsequent put or delete migrates a few old buckets, so that no
+ * single operation pays for rehashing the whole map.  Lookups check both
+ * arrays meanwhile but never migrate, so they remain read-only.  Other
+ * hmap types always resize at once.
+ */
+int u_hmap_opts_set_incremental_resize (u_hmap_opts_t *opts, int enable)
+{
+    dbg_err_if (opts == NULL);
+
+    opts->incremental = enable ? 1 : 0;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/** \brief Enable or disable slab allocation
+ *
+ * Objects owned by the hmap (U_HMAP_OPTS_OWNSDATA) and policy queue entries
+ * are carved out of per-hmap blocks and recycled through freelists instead
+ * of going back to the allocator.  String and opaque keys and values that
+ * fit in a few dozen bytes are stored inline in the object allocation (not
+ * if a custom \c f_free is set), so a put costs at most one allocation and
+ * usually none.  Memory is only returned to the system by u_hmap_free(), and
+ * objects must be disposed of by the hmap they were created on.
+ */
+int u_hmap_opts_set_slab (u_hmap_opts_t *opts, int enable)
+{
+    dbg_err_if (opts == NULL);
+
+    opts->slab = enable ? 1 : 0;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/** \brief Select the built-in string hash function
+ *
+ * Used with the default hash function (i.e. unless u_hmap_opts_set_hashfunc()
+ * is called): U_HMAP_HASH_WYHASH (default) and U_HMAP_HASH_XXH64 digest
+ * 8 to 48 bytes per step, U_HMAP_HASH_OAAT is the legacy one byte at a time
+ * Jenkins hash.
+ */
+int u_hmap_opts_set_hash_type (u_hmap_opts_t *opts, u_hmap_hash_t hash)
+{
+    dbg_err_if (opts == NULL);
+    dbg_err_if (!U_HMAP_IS_HASH(hash));
+
+    opts->hash_type = hash;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/** \brief Set the seed of the built-in string hash function
+ *
+ * See also U_HMAP_OPTS_HASH_RANDOM_SEED to get a random one for each hmap,
+ * which makes it hard to craft colliding keys.
+ */
+int u_hmap_opts_set_hash_seed (u_hmap_opts_t *opts, uint64_t seed)
+{
+    dbg_err_if (opts == NULL);
+
+    opts->hash_seed = seed;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/** \brief Set the default time to live of objects (milliseconds)
+ *
+ * Objects inserted with u_hmap_put() expire \p ttl milliseconds later,
+ * see u_hmap_put_ttl().  0 (default) disables expiration.  Requires
+ * U_HMAP_OPTS_OWNSDATA.
+ */
+int u_hmap_opts_set_ttl (u_hmap_opts_t *opts, uint64_t ttl)
+{
+    dbg_err_if (opts == NULL);
+
+    opts->ttl = ttl;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/** \brief Set the clock used for expirations
+ *
+ * \p f_now returns a monotonic time in milliseconds; the default one is
+ * based on CLOCK_MONOTONIC.  A custom clock may e.g. return the time cached
+ * by an event loop.
+ */
+int u_hmap_opts_set_clockfunc (u_hmap_opts_t *opts, uint64_t (*f_now)(void))
+{
+    dbg_err_if (opts == NULL);
+    dbg_err_if (f_now == NULL);
+
+    opts->f_now = f_now;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/** \brief Serve u_hmap_load() lookups straight from the file
+ *
+ * Instead of inserting the saved objects into a new hmap, u_hmap_load()
+ * maps the file in memory (or reads it, where mmap(2) is not available) and
+ * looks keys up in place: loading costs a checksum pass over the file
+ * whatever the number of objects, and the pages are shared with the other
+ * processes mapping it.  The resulting hmap is read-only.  Ignored by
+ * u_hmap_new().
+ */
+int u_hmap_opts_set_mmap (u_hmap_opts_t *opts, int enable)
+{
+    dbg_err_if (opts == NULL);
+
+    opts->mmap = enable ? 1 : 0;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
 /** \brief Set option in options mask
   (<b>hmap_easy interface cannot operate on U_HMAP_OPTS_OWNSDATA</b>) */
 int u_hmap_opts_set_option (u_hmap_opts_t *opts, int option)
@@ -1252,7 +2836,9 @@ int u_hmap_opts_set_option (u_hmap_opts_t *opts, int option)
 
     dbg_err_if ((option != U_HMAP_OPTS_OWNSDATA &&
             option != U_HMAP_OPTS_NO_OVERWRITE &&
-            option != U_HMAP_OPTS_HASH_STRONG));
+            option != U_HMAP_OPTS_HASH_STRONG &&
+            option != U_HMAP_OPTS_HASH_RANDOM_SEED &&
+            option != U_HMAP_OPTS_STATS));
 
     dbg_err_if (opts->easy &&
             option == U_HMAP_OPTS_OWNSDATA);
@@ -1272,7 +2858,9 @@ int u_hmap_opts_unset_option (u_hmap_opts_t *opts, int option)
 
     dbg_err_if ((option != U_HMAP_OPTS_OWNSDATA &&
             option != U_HMAP_OPTS_NO_OVERWRITE &&
-            option != U_HMAP_OPTS_HASH_STRONG));
+            option != U_HMAP_OPTS_HASH_STRONG &&
+            option != U_HMAP_OPTS_HASH_RANDOM_SEED &&
+            option != U_HMAP_OPTS_STATS));
 
     dbg_err_if (opts->easy &&
             option == U_HMAP_OPTS_OWNSDATA);
@@ -1284,9 +2872,16 @@ err:
     return U_HMAP_ERR_FAIL;
 }
 
-/** \brief Set a custom hash function */
+/** \brief Set a custom hash function
+ *
+ * \p f_hash must return the full width hash of \p key: reduction to the
+ * table range is done by the hmap itself.  Unless U_HMAP_OPTS_HASH_STRONG is
+ * set, the returned value is further scrambled by an integer avalanche mix,
+ * which makes trivial functions (e.g. the identity on integer keys) safe to
+ * use.
+ */
 int u_hmap_opts_set_hashfunc (u_hmap_opts_t *opts,
-        size_t (*f_hash)(const void *key, size_t buckets))
+        size_t (*f_hash)(const void *key))
 {
     dbg_err_if (opts == NULL || f_hash == NULL);
 
@@ -1457,7 +3052,10 @@ err:
  *
  * Sets the object comparison function for U_HMAP_PCY_CUSTOM discard policy.
  * The function should return 1 if \p o1 has higher priority than \p o2, 0 if
- * it is equal and -1 if the priority is lower.
+ * it is equal and -1 if the priority is lower. The object with the lowest
+ * priority is discarded first (the oldest one among equals). Objects are kept
+ * in a binary heap, so insertion, deletion and discard take O(log n); if a
+ * value is changed in place use u_hmap_pcy_update() to re-prioritize it.
  */
 int u_hmap_opts_set_policy_cmp (u_hmap_opts_t *opts,
         int (*f_pcy_cmp)(void *o1, void *o2))
@@ -1515,19 +3113,37 @@ const char *u_hmap_strerror (u_hmap_ret_t rc)
  * \retval  U_HMAP_ERR_FAIL     on failure
  */
 int u_hmap_copy (u_hmap_t *to, u_hmap_t *from)
+{
+    dbg_return_if (to == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (from == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_ifm (__RDONLY(to) || __RDONLY(from), U_HMAP_ERR_FAIL,
+            "read-only hmap");
+
+    return __copy(to, from, 1);
+}
+
+/* Move all objects of 'from' to 'to'; if 'timers' is set their expiration
+ * timers move along, otherwise they are left in place (see __resize()) */
+static int __copy (u_hmap_t *to, u_hmap_t *from, int timers)
 {
     u_hmap_o_t *obj;
     size_t i;
 
-    dbg_err_if (to == NULL);
-    dbg_err_if (from == NULL);
-
-    for (i = 0; i < from->size; ++i)
+    for (i = 0; i < from->size + from->osize; ++i)
     {
-        while ((obj = LIST_FIRST(&from->hmap[i])) != NULL)
+        if (from->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            if ((obj = from->slots[i].o) == NULL)
+                continue;
+            memset(&from->slots[i], 0, sizeof(u_hmap_slot_t));
+            dbg_err_if (__copy_o(to, from, obj, timers));
+            continue;
+        }
+
+        while ((obj = LIST_FIRST(__bucket_at(from, i))) != NULL)
         {
             LIST_REMOVE(obj, next);
-            dbg_err_if (u_hmap_put(to, obj, NULL));
+            dbg_err_if (__copy_o(to, from, obj, timers));
         }
     }
 
@@ -1537,90 +3153,158 @@ err:
     return U_HMAP_ERR_FAIL;
 }
 
+/* Insert into 'to' object 'obj' unlinked from 'from' */
+static int __copy_o (u_hmap_t *to, u_hmap_t *from, u_hmap_o_t *obj,
+        int timers)
+{
+    uint64_t expire = 0;
+
+    if (timers && obj->tmr)
+    {
+        if (to->opts->options & U_HMAP_OPTS_OWNSDATA)
+            expire = obj->tmr->expire;
+        __tmr_del(from, obj);
+    }
+
+    return __put(to, obj, __hash(to, obj->key), expire, NULL);
+}
+
+/* Compute the full hash of key (range reduction is up to the caller) */
+static size_t __hash (u_hmap_t *hmap, const void *key)
+{
+    size_t hash;
+
+    /* built-in string hash */
+    if (hmap->opts->f_hash == &__f_hash)
+        return __hash_n(hmap, key, strlen((const char *) key));
+
+    hash = hmap->opts->f_hash(key);
+
+    /* mix if strong hash is required */
+    if (hmap->opts->f_hash != &__f_hash &&
+            !(hmap->opts->options & U_HMAP_OPTS_HASH_STRONG))
+        hash = __f_mix(hash);
+
+    return hash;
+}
+
+/* Built-in hash of klen bytes at key */
+static size_t __hash_n (u_hmap_t *hmap, const void *key, size_t klen)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    uint64_t seed = hmap->opts->hash_seed;
+
+    switch (hmap->opts->hash_type)
+    {
+        case U_HMAP_HASH_OAAT:
+            return (size_t) __h_oaat(p, klen, seed);
+        case U_HMAP_HASH_XXH64:
+            return (size_t) __h_xxh64(p, klen, seed);
+        case U_HMAP_HASH_WYHASH:
+        default:
+            return (size_t) __h_wy(p, klen, seed);
+    }
+}
+
+/* Compare key with stored key okey: with f_comp() if klen is U_HMAP_NOLEN,
+ * otherwise key is klen bytes (not NUL-terminated) and okey a string, which
+ * are ordered as strcmp() would */
+static int __key_comp (u_hmap_t *hmap, const void *key, size_t klen,
+        const void *okey)
+{
+    int comp;
+
+    if (klen == U_HMAP_NOLEN)
+        return hmap->opts->f_comp(key, okey);
+
+    /* stops at the end of okey */
+    if ((comp = strncmp((const char *) key, (const char *) okey, klen)) != 0)
+        return comp;
+
+    /* a NUL within key matched the end of okey: key is longer */
+    if (memchr(key, '\0', klen) != NULL)
+        return 1;
+
+    return ((const char *) okey)[klen] ? -1 : 0;
+}
+
 /* Retrieve an hmap element given a key */
 static int __get (u_hmap_t *hmap, const void *key, u_hmap_o_t **o)
+{
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+
+    return __get_h(hmap, key, U_HMAP_NOLEN, __hash(hmap, key), o);
+}
+
+/* Retrieve an hmap element given a key (of klen bytes, see __key_comp()) and
+ * its full hash */
+static int __get_h (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, u_hmap_o_t **o)
 {
     u_hmap_o_t *obj;
     u_hmap_e_t *x;
-    int comp;
-    size_t hash;
     size_t last;
 
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (key == NULL);
     dbg_err_if (o == NULL);
 
-    hash = hmap->opts->f_hash(key, hmap->size);
+    if (hmap->frz)
+        return __frz_get(hmap, key, klen, hash, o);
+    if (hmap->img)
+        return __img_get(hmap, key, klen, hash, o);
 
-    if (hmap->opts->f_hash != &__f_hash &&
-            !(hmap->opts->options & U_HMAP_OPTS_HASH_STRONG))
+    if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
     {
-        enum { MAX_INT = 20 };
-        char h[MAX_INT];
+        if (__rh_find(hmap, key, klen, hash, &last))
+            return U_HMAP_ERR_FAIL;
 
-        u_snprintf(h, MAX_INT, "%u", hash);
-        hash = __f_hash(h, hmap->size);
+        *o = hmap->slots[last].o;
+        return U_HMAP_ERR_NONE;
     }
 
+    /* lookups never migrate buckets, so they don't modify the hmap */
+    if (hmap->ohmap &&
+            (*o = __chain_find(hmap, &hmap->ohmap[__IDX(hash, hmap->osize)],
+                               key, klen)) != NULL)
+        return U_HMAP_ERR_NONE;
+
+    hash = __IDX(hash, hmap->size);
+
     x = &hmap->hmap[hash];
 
     switch (hmap->opts->type)
     {
         case U_HMAP_TYPE_CHAIN:
 
-            LIST_FOREACH(obj, x, next)
-            {
-                if ((comp = hmap->opts->f_comp(key, obj->key)) == 0)
-                { /* object found */
-                    *o = obj;
-                    return U_HMAP_ERR_NONE;
-                }
-                else if (comp < 0)  /* cannot be in list (ordered) */
-                {
-                    *o = NULL;
-                    break;
-                }
-            }
+            if ((*o = __chain_find(hmap, x, key, klen)) != NULL)
+                return U_HMAP_ERR_NONE;
             break;
 
         case U_HMAP_TYPE_LINEAR:
 
-            last = ((hash + hmap->size -1) % hmap->size);
+            last = __IDX(hash + hmap->size - 1, hmap->size);
 
-            for (; hash != last; hash = ((hash +1) % hmap->size),
+            for (; hash != last; hash = __IDX(hash + 1, hmap->size),
                     x = &hmap->hmap[hash])
             {
-                if (!LIST_EMPTY(x))
-                {
-                    obj = LIST_FIRST(x);
+                /* no holes from the home bucket on (see __lin_remove) */
+                if (LIST_EMPTY(x))
+                    break;
+
+                obj = LIST_FIRST(x);
 
-                    if ((hmap->opts->f_comp(key, obj->key)) == 0)
-                    {
-                        *o = obj;
-                        return U_HMAP_ERR_NONE;
-                    }
+                if (__key_comp(hmap, key, klen, obj->key) == 0)
+                {
+                    *o = obj;
+                    return U_HMAP_ERR_NONE;
                 }
             }
             break;
-    }
-
-err:
-    return U_HMAP_ERR_FAIL;
-}
-
-/* pop the front of an object queue */
-static int __queue_pop_front (u_hmap_t *hmap, u_hmap_o_t **obj)
-{
-    u_hmap_q_t *first;
-
-    dbg_err_if (hmap == NULL);
 
-    dbg_err_if ((first = TAILQ_FIRST(&hmap->pcy.queue)) == NULL);
-    dbg_err_if (u_hmap_del(hmap, first->ho->key, obj));
-    TAILQ_REMOVE(&hmap->pcy.queue, first, next);
-    __q_o_free(first);
+        default:
+            break;
+    }
 
-    return U_HMAP_ERR_NONE;
 err:
     return U_HMAP_ERR_FAIL;
 }
@@ -1634,9 +3318,9 @@ static int __queue_pop_back (u_hmap_t *hmap, u_hmap_o_t **obj)
 
     dbg_err_if ((last = TAILQ_LAST(&hmap->pcy.queue, u_hmap_q_h_s))
             == NULL);
+
+    /* also drops the queue entry */
     dbg_err_if (u_hmap_del(hmap, last->ho->key, obj));
-    TAILQ_REMOVE(&hmap->pcy.queue, last, next);
-    __q_o_free(last);
 
     return U_HMAP_ERR_NONE;
 
@@ -1645,11 +3329,13 @@ err:
 }
 
 /* push object data onto queue */
-static int __queue_push (u_hmap_t *hmap, u_hmap_o_t *obj,
+static int __queue_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
         u_hmap_q_t **data)
 {
     u_hmap_q_t *new;
 
+    u_unused_args(hash);
+
     dbg_err_if (hmap == NULL);
     dbg_err_if (obj == NULL);
     dbg_err_if (data == NULL);
@@ -1657,7 +3343,7 @@ static int __queue_push (u_hmap_t *hmap, u_hmap_o_t *obj,
     if (*data == NULL)
     {  /* no existing reference to queue entry -> push to head
           (FIFO will always enter here) */
-        dbg_err_if ((new = __q_o_new(obj)) == NULL);
+        dbg_err_if ((new = __q_o_new(hmap, obj)) == NULL);
         TAILQ_INSERT_HEAD(&hmap->pcy.queue, new, next);
         *data = new;
     } else {
@@ -1672,441 +3358,2329 @@ err:
     return U_HMAP_ERR_FAIL;
 }
 
-/* Increment count data object and push onto queue (LFU) */
-static int __queue_push_count (u_hmap_t *hmap, u_hmap_o_t *obj,
-        u_hmap_q_t **counts)
+/* Delete a specific queue element */
+static int __queue_del (u_hmap_t *hmap, u_hmap_o_t *obj)
 {
-    u_hmap_q_t *new, *q;
-    int *count;
-
     dbg_err_if (hmap == NULL);
     dbg_err_if (obj == NULL);
-    dbg_err_if (counts == NULL);
 
-    if (*counts == NULL)
-    {
-        /* no reference to queue entry -> count == 0 */
-        dbg_err_if ((new = __q_o_new(obj)) == NULL);
-        TAILQ_INSERT_HEAD(&hmap->pcy.queue, new, next);
-        dbg_err_sif ((count = (int *) u_zalloc(sizeof(int))) == NULL);
-        new->data = (void *) count;
-        *counts = new;
-        /*
-        u_dbg(">k: %s, p: %d", new->ho->key, *((int *)new->data));
-        */
-    }
-    else
-    {
-        /* we already have an element in the queue -> increment count
-         and reposition it accordingly */
-        count = (int *) (*counts)->data;
-        *count = *count + 1;
-        /*
-        u_dbg("[");
-        TAILQ_FOREACH(q, &hmap->pcy.queue, next)
-            u_dbg("k: %s, p: %d", q->ho->key, *((int *)q->data));
-        u_dbg("]");
-        */
-        for (q = TAILQ_NEXT(*counts, next);
-                q && ((*count) >= *((int *) q->data));
-                q = TAILQ_NEXT(q, next))
-            ;
-        TAILQ_REMOVE(&hmap->pcy.queue, *counts, next);
-        if (q)  /* found an object with >= count -> insert just before */
-            TAILQ_INSERT_BEFORE(q, *counts, next);
-        else  /* we have the largest count -> last element */
-            TAILQ_INSERT_TAIL(&hmap->pcy.queue, *counts, next);
-    }
+    TAILQ_REMOVE(&hmap->pcy.queue, obj->pqe, next);
+    __q_o_free(hmap, obj->pqe);
+    obj->pqe = NULL;
 
     return U_HMAP_ERR_NONE;
 err:
     return U_HMAP_ERR_FAIL;
 }
 
-/* Push elements onto priority queue according to custom comparison function */
-static int __queue_push_cmp (u_hmap_t *hmap, u_hmap_o_t *obj,
-        u_hmap_q_t **data)
+/* Free all policy entries (the referenced objects are left untouched) */
+static void __pcy_clear (u_hmap_t *hmap)
 {
-    u_hmap_q_t *new, *q;
-
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (obj == NULL);
-    dbg_err_if (data == NULL);
-
-    /* no internal policy object should exist since it is managed externally */
-    dbg_err_if (*data != NULL);
+    u_hmap_q_t *q;
+    u_hmap_fb_t *fb;
+    size_t i;
 
-    dbg_err_if ((new = __q_o_new(obj)) == NULL);
+    while ((q = TAILQ_FIRST(&hmap->pcy.queue)) != NULL)
+    {
+        TAILQ_REMOVE(&hmap->pcy.queue, q, next);
+        __q_o_free(hmap, q);
+    }
 
-    if (TAILQ_EMPTY(&hmap->pcy.queue))
+    while ((fb = TAILQ_FIRST(&hmap->pcy.fbs)) != NULL)
     {
-       TAILQ_INSERT_HEAD(&hmap->pcy.queue, new, next);
+        while ((q = TAILQ_FIRST(&fb->queue)) != NULL)
+        {
+            TAILQ_REMOVE(&fb->queue, q, next);
+            __q_o_free(hmap, q);
+        }
+        TAILQ_REMOVE(&hmap->pcy.fbs, fb, next);
+        u_free(fb);
     }
-    else
+
+    while (hmap->pcy.heap_n)
+        __q_o_free(hmap, hmap->pcy.heap[--hmap->pcy.heap_n]);
+
+    for (i = 0; i < U_HMAP_SEG_NUM; ++i)
     {
-        TAILQ_FOREACH(q, &hmap->pcy.queue, next)
+        while ((q = TAILQ_FIRST(&hmap->pcy.seg[i].queue)) != NULL)
         {
-            /* found an object with >= priority -> insert just before */
-            if (hmap->opts->f_pcy_cmp(obj->val, q->ho->val) >= 0)
-            {
-                TAILQ_INSERT_BEFORE(q, new, next);
-                break;
-            }
+            TAILQ_REMOVE(&hmap->pcy.seg[i].queue, q, next);
+            __q_o_free(hmap, q);
         }
-        if (q == NULL)  /* reached end - append */
-            TAILQ_INSERT_TAIL(&hmap->pcy.queue, new, next);
+        hmap->pcy.seg[i].n = 0;
     }
+    hmap->pcy.hand = NULL;
 
-    *data = new;
+    if (hmap->pcy.gbkt)
+        memset(hmap->pcy.gbkt, 0, (hmap->pcy.gmask + 1) * sizeof(size_t));
+    hmap->pcy.gn = hmap->pcy.ghead = 0;
 
-    return U_HMAP_ERR_NONE;
-err:
-    return U_HMAP_ERR_FAIL;
+    if (hmap->pcy.cms)
+        memset(hmap->pcy.cms, 0, U_HMAP_CMS_DEPTH * (hmap->pcy.cms_mask + 1));
+    hmap->pcy.cms_adds = 0;
 }
 
-/* Delete a specific queue element */
-static int __queue_del (u_hmap_t *hmap, u_hmap_o_t *obj)
+/* Release policy memory (entries must have been freed by __pcy_clear) */
+static void __pcy_free (u_hmap_t *hmap)
 {
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (obj == NULL);
-
-    TAILQ_REMOVE(&hmap->pcy.queue, obj->pqe, next);
-    __q_o_free(obj->pqe);
-    obj->pqe = NULL;
-
-    return U_HMAP_ERR_NONE;
-err:
-    return U_HMAP_ERR_FAIL;
+    U_FREE(hmap->pcy.heap);
+    U_FREE(hmap->pcy.ghost);
+    U_FREE(hmap->pcy.gbkt);
+    U_FREE(hmap->pcy.cms);
 }
 
-/**
- * \brief   Perform an operation on all objects
- *
- * Execute function \p f on all objects within \p hmap. These functions should
- * return U_HMAP_ERR_NONE on success, and take an object as a parameter.
- *
- * \param   hmap      hmap object
- * \param   f         function
- *
- * \retval  U_HMAP_ERR_NONE     on success
- * \retval  U_HMAP_ERR_FAIL     on failure
- */
-int u_hmap_foreach (u_hmap_t *hmap, int f(const void *val))
+/* Get the bucket for 'count', which follows 'prev' (NULL means list head);
+ * create it if missing */
+static int __lfu_bucket (u_hmap_t *hmap, u_hmap_fb_t *prev, size_t count,
+        u_hmap_fb_t **pfb)
 {
-    u_hmap_o_t *obj;
-    size_t i;
+    u_hmap_fb_t *fb;
 
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (f == NULL);
+    fb = prev ? TAILQ_NEXT(prev, next) : TAILQ_FIRST(&hmap->pcy.fbs);
 
-    for (i = 0; i < hmap->size; ++i)
+    if (fb == NULL || fb->count != count)
     {
-        LIST_FOREACH(obj, &hmap->hmap[i], next)
-            dbg_err_if (f(obj->val));
+        dbg_err_sif ((fb = (u_hmap_fb_t *) u_zalloc(sizeof(u_hmap_fb_t)))
+                == NULL);
+        fb->count = count;
+        TAILQ_INIT(&fb->queue);
+
+        if (prev)
+        {
+            TAILQ_INSERT_AFTER(&hmap->pcy.fbs, prev, fb, next);
+        }
+        else
+        {
+            TAILQ_INSERT_HEAD(&hmap->pcy.fbs, fb, next);
+        }
     }
 
+    *pfb = fb;
+
     return U_HMAP_ERR_NONE;
 err:
     return U_HMAP_ERR_FAIL;
 }
 
-/**
- * \brief   \c u_hmap_foreach with user supplied parameter
- *
- * Execute function \p f on all objects within \p hmap supplying \p arg
- * as custom argument.  These functions should return \c U_HMAP_ERR_NONE on
- * success, and take an hmap object and \p arg as parameters.
- *
- * \param   hmap      hmap object
- * \param   f         function
- * \param   arg       custom arg that will be supplied to \p f
- *
- * \retval  U_HMAP_ERR_NONE     on success
- * \retval  U_HMAP_ERR_FAIL     on failure
- */
-int u_hmap_foreach_arg (u_hmap_t *hmap,
-        int f(const void *val, const void *arg), void *arg)
+/* Detach q from its bucket, releasing the bucket if left empty */
+static void __lfu_unlink (u_hmap_t *hmap, u_hmap_q_t *q)
 {
-    size_t i;
-    u_hmap_o_t *obj;
+    u_hmap_fb_t *fb = q->fb;
 
-    dbg_err_if (hmap == NULL);
-    dbg_err_if (f == NULL);
+    TAILQ_REMOVE(&fb->queue, q, next);
+    q->fb = NULL;
 
-    for (i = 0; i < hmap->size; ++i)
+    if (TAILQ_EMPTY(&fb->queue))
     {
-        LIST_FOREACH(obj, &hmap->hmap[i], next)
-            dbg_err_if (f(obj->val, arg));
+        TAILQ_REMOVE(&hmap->pcy.fbs, fb, next);
+        u_free(fb);
     }
-
-    return U_HMAP_ERR_NONE;
-err:
-    return U_HMAP_ERR_FAIL;
 }
 
-/**
- * \brief   Perform an operation on all objects
- *
- * Execute function \p f on all objects within \p hmap. These functions should
- * return U_HMAP_ERR_NONE on success, and take an object as a parameter.
- *
- * \param   hmap      hmap object
- * \param   f         function, must accept key and val params
- *
- * \retval  U_HMAP_ERR_NONE     on success
- * \retval  U_HMAP_ERR_FAIL     on failure
- */
-int u_hmap_foreach_keyval(u_hmap_t *hmap,
-        int f(const void *key, const void *val))
+/* Count an access (LFU): move the object to the tail (most recently used
+ * end) of the next frequency bucket */
+static int __lfu_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data)
 {
-    struct u_hmap_o_s *obj;
-    size_t i;
+    u_hmap_q_t *q;
+    u_hmap_fb_t *fb;
+
+    u_unused_args(hash);
 
     dbg_err_if (hmap == NULL);
-    dbg_err_if (f == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (data == NULL);
 
-    for (i = 0; i < hmap->size; ++i)
+    if ((q = *data) == NULL)
     {
-        LIST_FOREACH(obj, &hmap->hmap[i], next)
-            dbg_err_if (f(obj->key, obj->val));
-    }
-
-    return U_HMAP_ERR_NONE;
-err:
-    return U_HMAP_ERR_FAIL;
-}
-
-/**
- * \brief Debug Hmap
- *
- * Print out information on an hmap.
- *
- * \param   hmap  hmap object
- */
-void u_hmap_dbg (u_hmap_t *hmap)
-{
-    enum { MAX_LINE = 255 };
-    u_string_t *s = NULL, *st = NULL;
-    u_hmap_o_t *obj;
-    size_t i;
+        /* first insertion -> count == 0 */
+        dbg_err_if ((q = __q_o_new(hmap, obj)) == NULL);
 
-    dbg_ifb (hmap == NULL) return;
+        if (__lfu_bucket(hmap, NULL, 0, &fb))
+        {
+            __q_o_free(hmap, q);
+            goto err;
+        }
 
-    for (i = 0; i < hmap->size; ++i)
+        *data = q;
+    }
+    else
     {
-        if (LIST_FIRST(&hmap->hmap[i]) == NULL)
-            continue;
-
-        dbg_ifb (u_string_create("", 1, &s)) return;
-        dbg_err_if (u_string_clear(s));
-        dbg_err_if (u_string_aprintf(s, "%5d ", i));
-
-        LIST_FOREACH(obj, &hmap->hmap[i], next)
+        /* sole member of its bucket and no bucket for count+1 yet: just
+         * bump the bucket count in place */
+        if (TAILQ_FIRST(&q->fb->queue) == q && TAILQ_NEXT(q, next) == NULL &&
+                (TAILQ_NEXT(q->fb, next) == NULL ||
+                 TAILQ_NEXT(q->fb, next)->count != q->count + 1))
         {
-            if (hmap->opts->f_str == NULL)
-            {
-                dbg_err_if (u_string_cat(s, "[]"));
-            }
-            else
-            {
-                st = hmap->opts->f_str(obj);
-                dbg_err_if (u_string_append(s, u_string_c(st),
-                            u_string_len(st)-1));
-                u_string_free(st);
-            }
+            q->fb->count = ++q->count;
+            return U_HMAP_ERR_NONE;
         }
-        u_dbg(u_string_c(s));
-        u_string_free(s);
+
+        dbg_err_if (__lfu_bucket(hmap, q->fb, q->count + 1, &fb));
+        __lfu_unlink(hmap, q);
+        q->count++;
     }
 
-    return;
+    TAILQ_INSERT_TAIL(&fb->queue, q, next);
+    q->fb = fb;
+
+    return U_HMAP_ERR_NONE;
 err:
-    U_FREEF(st, u_string_free);
-    U_FREEF(s, u_string_free);
-    return;
+    return U_HMAP_ERR_FAIL;
 }
 
-/**
- * \brief Debug policy
- *
- * Print out policy information.
- *
- * \param hmap  hmap object
- */
-void u_hmap_pcy_dbg (u_hmap_t *hmap)
+/* Discard the least recently used among the least frequently used objects */
+static int __lfu_pop (u_hmap_t *hmap, u_hmap_o_t **obj)
 {
-    u_hmap_q_t *q;
-    u_string_t *s = NULL, *s2 = NULL;
-
-    dbg_ifb (hmap == NULL) return;
+    u_hmap_fb_t *fb;
+    u_hmap_q_t *first;
 
-    dbg_ifb (u_string_create("", 1, &s)) return;
-    dbg_err_if (u_string_clear(s));
-    dbg_err_if (u_string_cat(s, "Policy: "));
+    dbg_err_if (hmap == NULL);
 
-    TAILQ_FOREACH(q, &hmap->pcy.queue, next)
-    {
-        s2 = hmap->opts->f_str(q->ho);
-        dbg_err_if (u_string_cat(s, u_string_c(s2)));
-        if (hmap->opts->policy == U_HMAP_PCY_LFU)  /* print count */
-            dbg_err_if (u_string_aprintf(s, "-%d", *((int *)q->data)));
-        u_string_free(s2);
-    }
+    dbg_err_if ((fb = TAILQ_FIRST(&hmap->pcy.fbs)) == NULL);
+    dbg_err_if ((first = TAILQ_FIRST(&fb->queue)) == NULL);
 
-    u_dbg(u_string_c(s));
-    u_string_free(s);
+    /* also drops the queue entry */
+    dbg_err_if (u_hmap_del(hmap, first->ho->key, obj));
 
-    return;
+    return U_HMAP_ERR_NONE;
 err:
-    U_FREEF(s, u_string_free);
-    U_FREEF(s2, u_string_free);
-    return;
+    return U_HMAP_ERR_FAIL;
 }
 
-/* Allocate a new queue data object */
-static u_hmap_q_t *__q_o_new (u_hmap_o_t *ho)
+/* Delete a specific LFU entry */
+static int __lfu_del (u_hmap_t *hmap, u_hmap_o_t *obj)
 {
-    u_hmap_q_t *qo = NULL;
-
-    dbg_return_if (ho == NULL, NULL);
-
-    dbg_err_sif ((qo = (u_hmap_q_t *)
-                u_zalloc(sizeof(u_hmap_q_t))) == NULL);
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
 
-    qo->ho = ho;
-    qo->data = NULL;
+    __lfu_unlink(hmap, obj->pqe);
+    __q_o_free(hmap, obj->pqe);
+    obj->pqe = NULL;
 
-    return qo;
+    return U_HMAP_ERR_NONE;
 err:
-    u_free(qo);
-    return NULL;
+    return U_HMAP_ERR_FAIL;
 }
 
-/* Free a data queue object */
-static void __q_o_free (u_hmap_q_t *qo)
+/* Whether heap entry 'a' must be discarded before 'b': lower priority first,
+ * then the one inserted longest ago */
+static int __heap_before (u_hmap_t *hmap, u_hmap_q_t *a, u_hmap_q_t *b)
 {
-    dbg_ifb (qo == NULL) return;
+    int rc = hmap->opts->f_pcy_cmp(a->ho->val, b->ho->val);
 
-    if (qo->data)
-        u_free(qo->data);
-    u_free(qo);
+    return rc ? (rc < 0) : (a->count < b->count);
 }
 
-/* Get a string representation of a policy */
-static const char *__pcy2str (u_hmap_pcy_type_t policy)
+static void __heap_set (u_hmap_t *hmap, size_t i, u_hmap_q_t *q)
 {
-    switch (policy)
+    hmap->pcy.heap[i] = q;
+    q->hpos = i;
+}
+
+/* Move entry 'i' towards the root while it precedes its parent */
+static size_t __heap_up (u_hmap_t *hmap, size_t i)
+{
+    u_hmap_q_t *q = hmap->pcy.heap[i];
+    size_t p;
+
+    for (; i > 0; i = p)
     {
-        case U_HMAP_PCY_NONE:
-            return "none";
-        case U_HMAP_PCY_FIFO:
-            return "fifo";
-        case U_HMAP_PCY_LRU:
-            return "lru";
-        case U_HMAP_PCY_LFU:
-            return "lfu";
-        case U_HMAP_PCY_CUSTOM:
-            return "custom";
+        p = (i - 1) / 2;
+        if (!__heap_before(hmap, q, hmap->pcy.heap[p]))
+            break;
+        __heap_set(hmap, i, hmap->pcy.heap[p]);
     }
-    return NULL;
+    __heap_set(hmap, i, q);
+
+    return i;
 }
 
-/* Get a string representation of a policy */
-static const char *__datatype2str(u_hmap_options_datatype_t datatype)
+/* Move entry 'i' towards the leaves while one of its children precedes it */
+static void __heap_down (u_hmap_t *hmap, size_t i)
 {
-    switch (datatype)
+    u_hmap_q_t *q = hmap->pcy.heap[i];
+    size_t c, n = hmap->pcy.heap_n;
+
+    while ((c = 2 * i + 1) < n)
     {
-        case U_HMAP_OPTS_DATATYPE_POINTER:
-            return "pointer";
-        case U_HMAP_OPTS_DATATYPE_STRING:
-            return "string";
-        case U_HMAP_OPTS_DATATYPE_OPAQUE:
-            return "opaque";
+        if (c + 1 < n &&
+                __heap_before(hmap, hmap->pcy.heap[c + 1], hmap->pcy.heap[c]))
+            c++;
+        if (!__heap_before(hmap, hmap->pcy.heap[c], q))
+            break;
+        __heap_set(hmap, i, hmap->pcy.heap[c]);
+        i = c;
     }
+    __heap_set(hmap, i, q);
+}
 
-    return NULL;
+/* Restore heap order around entry 'i' after its priority changed */
+static void __heap_fix (u_hmap_t *hmap, size_t i)
+{
+    if (__heap_up(hmap, i) == i)
+        __heap_down(hmap, i);
 }
 
-static int __next_prime(size_t *prime, size_t sz, size_t *idx)
+/* Push an object onto the heap according to the custom comparison function */
+static int __heap_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data)
 {
-    static size_t primes[] = {
-        13, 19, 29, 41, 59, 79, 107, 149, 197, 263, 347, 457, 599, 787, 1031,
-        1361, 1777, 2333, 3037, 3967, 5167, 6719, 8737, 11369, 14783, 19219,
-        24989, 32491, 42257, 54941, 71429, 92861, 120721, 156941, 204047,
-        265271, 344857, 448321, 582821, 757693, 985003, 1280519, 1664681,
-        2164111, 2813353, 3657361, 4754591, 6180989, 8035301, 10445899,
-        13579681, 17653589, 22949669, 29834603, 38784989, 50420551, 65546729,
-        85210757, 110774011, 144006217, 187208107, 243370577, 316381771,
-        411296309, 534685237, 695090819, 903618083, 1174703521, 1527114613,
-        1837299131, 2147483647
-    };
+    enum { HEAP_MIN_SZ = 64 };
+    u_hmap_q_t *new, **heap;
+    size_t sz;
 
-    size_t i;
+    u_unused_args(hash);
 
-    dbg_err_if (prime == NULL);
-    dbg_err_if (sz == 0);
-    dbg_err_if (idx == NULL);
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (data == NULL);
 
-    for (i = *idx; i < sizeof(primes)/sizeof(size_t); ++i)
+    /* priority only changes via u_hmap_pcy_update() */
+    dbg_err_if (*data != NULL);
+
+    if (hmap->pcy.heap_n == hmap->pcy.heap_sz)
     {
-        if (primes[i] >= sz)
-        {
-            *idx = i;
-            *prime = primes[i];
-            goto ok;
-        }
+        sz = hmap->pcy.heap_sz ? 2 * hmap->pcy.heap_sz : HEAP_MIN_SZ;
+        dbg_err_sif ((heap = (u_hmap_q_t **) u_realloc(hmap->pcy.heap,
+                        sz * sizeof(u_hmap_q_t *))) == NULL);
+        hmap->pcy.heap = heap;
+        hmap->pcy.heap_sz = sz;
     }
-    dbg_err_ifm (1, "hmap size limit exceeded");
 
-ok:
-    return 0;
+    dbg_err_if ((new = __q_o_new(hmap, obj)) == NULL);
+    new->count = hmap->pcy.seq++;
+
+    __heap_set(hmap, hmap->pcy.heap_n++, new);
+    (void) __heap_up(hmap, new->hpos);
+
+    *data = new;
 
+    return U_HMAP_ERR_NONE;
 err:
-    return ~0;
+    return U_HMAP_ERR_FAIL;
 }
 
-static int __resize(u_hmap_t *hmap)
+/* Discard the object on top of the heap */
+static int __heap_pop (u_hmap_t *hmap, u_hmap_o_t **obj)
+{
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (hmap->pcy.heap_n == 0);
+
+    /* also drops the heap entry */
+    dbg_err_if (u_hmap_del(hmap, hmap->pcy.heap[0]->ho->key, obj));
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Delete a specific heap entry, filling the hole with the last one */
+static int __heap_del (u_hmap_t *hmap, u_hmap_o_t *obj)
+{
+    size_t i;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+
+    i = obj->pqe->hpos;
+
+    if (i != --hmap->pcy.heap_n)
+    {
+        __heap_set(hmap, i, hmap->pcy.heap[hmap->pcy.heap_n]);
+        __heap_fix(hmap, i);
+    }
+
+    __q_o_free(hmap, obj->pqe);
+    obj->pqe = NULL;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Least recently used entry of segment 's' (NULL if empty) */
+#define __SEG_LRU(hmap, s)  \
+    TAILQ_LAST(&(hmap)->pcy.seg[s].queue, u_hmap_q_h_s)
+
+/* Insert q at the most recently used end of segment 'seg' */
+static void __seg_push (u_hmap_t *hmap, u_hmap_q_t *q, int seg)
+{
+    TAILQ_INSERT_HEAD(&hmap->pcy.seg[seg].queue, q, next);
+    hmap->pcy.seg[seg].n++;
+    q->seg = seg;
+}
+
+/* Detach q from its segment */
+static void __seg_unlink (u_hmap_t *hmap, u_hmap_q_t *q)
+{
+    /* CLOCK: never leave the hand on a removed entry */
+    if (hmap->pcy.hand == q)
+        hmap->pcy.hand = TAILQ_NEXT(q, next);
+
+    TAILQ_REMOVE(&hmap->pcy.seg[q->seg].queue, q, next);
+    hmap->pcy.seg[q->seg].n--;
+}
+
+/* Move q to the most recently used end of segment 'seg' */
+static void __seg_move (u_hmap_t *hmap, u_hmap_q_t *q, int seg)
+{
+    __seg_unlink(hmap, q);
+    __seg_push(hmap, q, seg);
+}
+
+/* Delete a specific segment entry */
+static int __seg_del (u_hmap_t *hmap, u_hmap_o_t *obj)
+{
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+
+    __seg_unlink(hmap, obj->pqe);
+    __q_o_free(hmap, obj->pqe);
+    obj->pqe = NULL;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Discard the object referenced by q */
+static int __seg_evict (u_hmap_t *hmap, u_hmap_q_t *q, u_hmap_o_t **obj)
+{
+    dbg_err_if (q == NULL);
+
+    /* also drops the queue entry */
+    dbg_err_if (u_hmap_del(hmap, q->ho->key, obj));
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Allocate a new entry for obj and insert it into segment 'seg' */
+static int __seg_new (u_hmap_t *hmap, u_hmap_o_t *obj, u_hmap_q_t **data,
+        int seg)
+{
+    u_hmap_q_t *q;
+
+    dbg_err_if ((q = __q_o_new(hmap, obj)) == NULL);
+    __seg_push(hmap, q, seg);
+    *data = q;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* CLOCK: new objects enter right behind the hand, a hit only sets the
+ * reference bit */
+static int __clock_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data)
+{
+    u_hmap_q_t *q;
+
+    u_unused_args(hash);
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (data == NULL);
+
+    if ((q = *data) != NULL)
+    {
+        q->ref = 1;
+        return U_HMAP_ERR_NONE;
+    }
+
+    dbg_err_if ((q = __q_o_new(hmap, obj)) == NULL);
+
+    if (hmap->pcy.hand)
+    {
+        TAILQ_INSERT_BEFORE(hmap->pcy.hand, q, next);
+    }
+    else
+    {
+        TAILQ_INSERT_TAIL(&hmap->pcy.seg[U_HMAP_SEG_IN].queue, q, next);
+    }
+
+    hmap->pcy.seg[U_HMAP_SEG_IN].n++;
+    q->seg = U_HMAP_SEG_IN;
+    *data = q;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* CLOCK: sweep the ring clearing reference bits, discard the first object
+ * which has not been referenced since the hand last passed over it */
+static int __clock_pop (u_hmap_t *hmap, u_hmap_o_t **obj)
+{
+    u_hmap_q_t *q;
+
+    dbg_err_if (hmap == NULL);
+
+    for (;;)
+    {
+        if ((q = hmap->pcy.hand) == NULL)
+            dbg_err_if ((q = TAILQ_FIRST(&hmap->pcy.seg[U_HMAP_SEG_IN].queue))
+                    == NULL);
+
+        if (!q->ref)
+            break;
+
+        q->ref = 0;
+        hmap->pcy.hand = TAILQ_NEXT(q, next);
+    }
+
+    return __seg_evict(hmap, q, obj);
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* SLRU hit: promote q to the protected segment 'prot', demoting its least
+ * recently used entry to the probationary segment 'prob' on overflow */
+static void __slru_hit (u_hmap_t *hmap, u_hmap_q_t *q, int prob, int prot)
+{
+    u_hmap_q_t *lru;
+
+    __seg_move(hmap, q, prot);
+
+    if (hmap->pcy.seg[prot].n > hmap->pcy.seg[prot].max &&
+            (lru = __SEG_LRU(hmap, prot)) != NULL)
+        __seg_move(hmap, lru, prob);
+}
+
+/* SLRU: new objects are probationary until their first hit */
+static int __slru_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data)
+{
+    u_unused_args(hash);
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (data == NULL);
+
+    if (*data)
+    {
+        __slru_hit(hmap, *data, U_HMAP_SEG_IN, U_HMAP_SEG_MAIN);
+        return U_HMAP_ERR_NONE;
+    }
+
+    return __seg_new(hmap, obj, data, U_HMAP_SEG_IN);
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* SLRU: discard from the probationary segment first */
+static int __slru_pop (u_hmap_t *hmap, u_hmap_o_t **obj)
+{
+    u_hmap_q_t *q;
+
+    dbg_err_if (hmap == NULL);
+
+    if ((q = __SEG_LRU(hmap, U_HMAP_SEG_IN)) == NULL)
+        q = __SEG_LRU(hmap, U_HMAP_SEG_MAIN);
+
+    return __seg_evict(hmap, q, obj);
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* 2Q: setup a ghost ring of 'n' entries */
+static int __ghost_init (u_hmap_t *hmap, size_t n)
+{
+    size_t nb = 16;
+
+    while (nb < n)
+        nb <<= 1;
+
+    dbg_err_sif ((hmap->pcy.ghost = (u_hmap_ghost_t *)
+                u_zalloc(n * sizeof(u_hmap_ghost_t))) == NULL);
+    dbg_err_sif ((hmap->pcy.gbkt = (size_t *)
+                u_zalloc(nb * sizeof(size_t))) == NULL);
+
+    hmap->pcy.gmax = n;
+    hmap->pcy.gmask = nb - 1;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* 2Q: whether a key with hash h has been discarded from A1in recently */
+static int __ghost_find (u_hmap_t *hmap, size_t h)
+{
+    u_hmap_pcy_t *p = &hmap->pcy;
+    size_t j;
+
+    for (j = p->gbkt[h & p->gmask]; j; j = p->ghost[j - 1].next)
+        if (p->ghost[j - 1].hash == h)
+            return 1;
+
+    return 0;
+}
+
+/* 2Q: remember hash h, forgetting the oldest ghost if the ring is full */
+static void __ghost_add (u_hmap_t *hmap, size_t h)
+{
+    u_hmap_pcy_t *p = &hmap->pcy;
+    size_t i, *pj;
+
+    if (p->gn == p->gmax)
+    {
+        i = p->ghead;
+
+        for (pj = &p->gbkt[p->ghost[i].hash & p->gmask]; *pj != i + 1;
+                pj = &p->ghost[*pj - 1].next)
+            ;
+        *pj = p->ghost[i].next;
+
+        p->ghead = (i + 1) % p->gmax;
+        p->gn--;
+    }
+
+    i = (p->ghead + p->gn) % p->gmax;
+    p->ghost[i].hash = h;
+    p->ghost[i].next = p->gbkt[h & p->gmask];
+    p->gbkt[h & p->gmask] = i + 1;
+    p->gn++;
+}
+
+/* 2Q: new objects go to the A1in FIFO unless their key is a ghost, in which
+ * case they have proven to be reused and enter the Am LRU directly */
+static int __2q_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data)
+{
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (data == NULL);
+
+    if (*data)
+    {
+        /* hits in A1in are considered correlated and don't count */
+        if ((*data)->seg == U_HMAP_SEG_MAIN)
+            __seg_move(hmap, *data, U_HMAP_SEG_MAIN);
+        return U_HMAP_ERR_NONE;
+    }
+
+    dbg_err_if (__seg_new(hmap, obj, data,
+                __ghost_find(hmap, hash) ? U_HMAP_SEG_MAIN : U_HMAP_SEG_IN));
+    (*data)->hash = hash;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* 2Q: discard from A1in (leaving a ghost behind) when it exceeds its share,
+ * from Am otherwise */
+static int __2q_pop (u_hmap_t *hmap, u_hmap_o_t **obj)
+{
+    u_hmap_seg_t *a1in;
+    u_hmap_q_t *q;
+
+    dbg_err_if (hmap == NULL);
+
+    a1in = &hmap->pcy.seg[U_HMAP_SEG_IN];
+
+    if (a1in->n && (a1in->n > a1in->max ||
+                hmap->pcy.seg[U_HMAP_SEG_MAIN].n == 0))
+    {
+        q = __SEG_LRU(hmap, U_HMAP_SEG_IN);
+        __ghost_add(hmap, q->hash);
+    }
+    else
+        q = __SEG_LRU(hmap, U_HMAP_SEG_MAIN);
+
+    /* also drops the queue entry */
+    return __del(hmap, q->ho->key, q->hash, obj);
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* W-TinyLFU: setup the count-min sketch (one counter per entry and row) */
+static int __cms_init (u_hmap_t *hmap)
+{
+    size_t w = 16;
+
+    while (w < hmap->opts->max)
+        w <<= 1;
+
+    dbg_err_sif ((hmap->pcy.cms = (unsigned char *)
+                u_zalloc(U_HMAP_CMS_DEPTH * w)) == NULL);
+
+    hmap->pcy.cms_mask = w - 1;
+    hmap->pcy.cms_reset = 10 * hmap->opts->max;
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Counter of hash h in row r of the sketch */
+#define __CMS_CTR(hmap, h, r)                                           \
+    (hmap)->pcy.cms[(r) * ((hmap)->pcy.cms_mask + 1) +                  \
+        (__f_mix((h) + (r) * (size_t) 0x9e3779b9) & (hmap)->pcy.cms_mask)]
+
+/* W-TinyLFU: count an access to a key with hash h */
+static void __cms_add (u_hmap_t *hmap, size_t h)
+{
+    size_t r, i;
+
+    for (r = 0; r < U_HMAP_CMS_DEPTH; ++r)
+        if (__CMS_CTR(hmap, h, r) < U_HMAP_CMS_MAXCOUNT)
+            __CMS_CTR(hmap, h, r)++;
+
+    /* aging: halve all counters so that past popularity fades */
+    if (++hmap->pcy.cms_adds >= hmap->pcy.cms_reset)
+    {
+        for (i = 0; i < U_HMAP_CMS_DEPTH * (hmap->pcy.cms_mask + 1); ++i)
+            hmap->pcy.cms[i] >>= 1;
+        hmap->pcy.cms_adds /= 2;
+    }
+}
+
+/* W-TinyLFU: estimated access frequency of a key with hash h */
+static unsigned int __cms_freq (u_hmap_t *hmap, size_t h)
+{
+    unsigned int c, f = U_HMAP_CMS_MAXCOUNT;
+    size_t r;
+
+    for (r = 0; r < U_HMAP_CMS_DEPTH; ++r)
+        if ((c = __CMS_CTR(hmap, h, r)) < f)
+            f = c;
+
+    return f;
+}
+
+/* W-TinyLFU: every access is counted in the sketch; new objects enter the
+ * window, hits are handled as in LRU (window) or SLRU (main area) */
+static int __wtlfu_push (u_hmap_t *hmap, u_hmap_o_t *obj, size_t hash,
+        u_hmap_q_t **data)
+{
+    u_hmap_seg_t *win;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (obj == NULL);
+    dbg_err_if (data == NULL);
+
+    /* misses are accounted for by the put which usually follows them */
+    __cms_add(hmap, hash);
+
+    if (*data)
+    {
+        if ((*data)->seg == U_HMAP_SEG_IN)
+            __seg_move(hmap, *data, U_HMAP_SEG_IN);
+        else
+            __slru_hit(hmap, *data, U_HMAP_SEG_MAIN, U_HMAP_SEG_PROT);
+        return U_HMAP_ERR_NONE;
+    }
+
+    dbg_err_if (__seg_new(hmap, obj, data, U_HMAP_SEG_IN));
+    (*data)->hash = hash;
+
+    /* while the cache is filling up the window overflows into the main area
+     * (when full, __wtlfu_pop() makes room in the window beforehand) */
+    win = &hmap->pcy.seg[U_HMAP_SEG_IN];
+    if (win->n > win->max)
+        __seg_move(hmap, __SEG_LRU(hmap, U_HMAP_SEG_IN), U_HMAP_SEG_MAIN);
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/* W-TinyLFU: once the window is full its least recently used object competes
+ * with the main area victim, and is admitted only if estimated to be accessed
+ * more often */
+static int __wtlfu_pop (u_hmap_t *hmap, u_hmap_o_t **obj)
+{
+    u_hmap_q_t *cand, *victim;
+
+    dbg_err_if (hmap == NULL);
+
+    if ((victim = __SEG_LRU(hmap, U_HMAP_SEG_MAIN)) == NULL)
+        victim = __SEG_LRU(hmap, U_HMAP_SEG_PROT);
+
+    if (victim == NULL ||
+            hmap->pcy.seg[U_HMAP_SEG_IN].n >= hmap->pcy.seg[U_HMAP_SEG_IN].max)
+    {
+        dbg_err_if ((cand = __SEG_LRU(hmap, U_HMAP_SEG_IN)) == NULL);
+
+        if (victim && __cms_freq(hmap, cand->hash) >
+                __cms_freq(hmap, victim->hash))
+            __seg_move(hmap, cand, U_HMAP_SEG_MAIN);
+        else
+            victim = cand;
+    }
+
+    /* also drops the queue entry */
+    return __del(hmap, victim->ho->key, victim->hash, obj);
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief   Perform an operation on all objects
+ *
+ * Execute function \p f on all objects within \p hmap. These functions should
+ * return U_HMAP_ERR_NONE on success, and take an object as a parameter.
+ *
+ * \param   hmap      hmap object
+ * \param   f         function
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_foreach (u_hmap_t *hmap, int f(const void *val))
+{
+    u_hmap_o_t *obj;
+    size_t i;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (f == NULL);
+
+    if (__RDONLY(hmap))
+    {
+        for (i = 0; i < __ro_size(hmap); ++i)
+        {
+            if ((obj = __ro_o(hmap, i)) != NULL)
+                dbg_err_if (f(obj->val));
+        }
+        return U_HMAP_ERR_NONE;
+    }
+
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
+    {
+        if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            if (hmap->slots[i].o)
+                dbg_err_if (f(hmap->slots[i].val));
+            continue;
+        }
+
+        LIST_FOREACH(obj, __bucket_at(hmap, i), next)
+            dbg_err_if (f(obj->val));
+    }
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief   \c u_hmap_foreach with user supplied parameter
+ *
+ * Execute function \p f on all objects within \p hmap supplying \p arg
+ * as custom argument.  These functions should return \c U_HMAP_ERR_NONE on
+ * success, and take an hmap object and \p arg as parameters.
+ *
+ * \param   hmap      hmap object
+ * \param   f         function
+ * \param   arg       custom arg that will be supplied to \p f
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_foreach_arg (u_hmap_t *hmap,
+        int f(const void *val, const void *arg), void *arg)
+{
+    size_t i;
+    u_hmap_o_t *obj;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (f == NULL);
+
+    if (__RDONLY(hmap))
+    {
+        for (i = 0; i < __ro_size(hmap); ++i)
+        {
+            if ((obj = __ro_o(hmap, i)) != NULL)
+                dbg_err_if (f(obj->val, arg));
+        }
+        return U_HMAP_ERR_NONE;
+    }
+
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
+    {
+        if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            if (hmap->slots[i].o)
+                dbg_err_if (f(hmap->slots[i].val, arg));
+            continue;
+        }
+
+        LIST_FOREACH(obj, __bucket_at(hmap, i), next)
+            dbg_err_if (f(obj->val, arg));
+    }
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief   Perform an operation on all objects
+ *
+ * Execute function \p f on all objects within \p hmap. These functions should
+ * return U_HMAP_ERR_NONE on success, and take an object as a parameter.
+ *
+ * \param   hmap      hmap object
+ * \param   f         function, must accept key and val params
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_foreach_keyval(u_hmap_t *hmap,
+        int f(const void *key, const void *val))
+{
+    struct u_hmap_o_s *obj;
+    size_t i;
+
+    dbg_err_if (hmap == NULL);
+    dbg_err_if (f == NULL);
+
+    if (__RDONLY(hmap))
+    {
+        for (i = 0; i < __ro_size(hmap); ++i)
+        {
+            if ((obj = __ro_o(hmap, i)) != NULL)
+                dbg_err_if (f(obj->key, obj->val));
+        }
+        return U_HMAP_ERR_NONE;
+    }
+
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
+    {
+        if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            if (hmap->slots[i].o)
+                dbg_err_if (f(hmap->slots[i].key, hmap->slots[i].val));
+            continue;
+        }
+
+        LIST_FOREACH(obj, __bucket_at(hmap, i), next)
+            dbg_err_if (f(obj->key, obj->val));
+    }
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief   Iterate over the hmap a few buckets at a time
+ *
+ * Visit \p count buckets of \p hmap starting at \p cursor and call \p f on
+ * each object found.  Start with a 0 cursor and call again with the returned
+ * one until 0 is returned: each object stored for the whole duration of the
+ * scan is visited at least once, whatever is inserted, deleted or resized
+ * in between (objects may be visited more than once though).
+ *
+ * As in Redis' SCAN, the cursor is a bucket index incremented in its high
+ * bits first (reversed binary), so that when the bucket array is grown or
+ * the buckets are being migrated to a larger array, the buckets already
+ * visited map to buckets already visited in the new layout.  Open addressing
+ * (Robin Hood and U_HMAP_TYPE_LINEAR) hmaps are scanned by home slot, i.e. 
+ * the cursor picks the objects hashing to a slot rather than those stored 
+ * in it.
+ *
+ * \p f must not modify \p hmap but it may ask for the object to be deleted by
+ * returning U_HMAP_SCAN_DEL (U_HMAP_SCAN_KEEP otherwise).  The object is
+ * then freed as by u_hmap_del(); when the user owns data, only the object
+ * is freed and \p f is responsible for its key and value.
+ *
+ * \param   hmap      hmap object
+ * \param   cursor    0 to start a new scan, or the value returned by the
+ *                    previous call
+ * \param   count     number of buckets to visit
+ * \param   f         function called on each object
+ * \param   arg       argument passed to \p f
+ *
+ * \return the cursor for the next call, 0 when the scan is over (or on error)
+ */
+size_t u_hmap_scan (u_hmap_t *hmap, size_t cursor, size_t count,
+        int f(u_hmap_o_t *obj, void *arg), void *arg)
+{
+    size_t v = cursor, m0, m1;
+
+    dbg_return_if (hmap == NULL, 0);
+    dbg_return_if (f == NULL, 0);
+    dbg_return_ifm (__RDONLY(hmap), 0, "read-only hmap");
+
+    do {
+        if (hmap->ohmap == NULL)
+        {
+            m0 = hmap->size - 1;
+
+            if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+                __scan_home(hmap, v & m0, f, arg);
+            else if (hmap->opts->type == U_HMAP_TYPE_LINEAR)
+                __scan_lin(hmap, v & m0, f, arg);
+            else
+                __scan_chain(hmap, &hmap->hmap[v & m0], f, arg);
+
+            v |= ~m0;
+            v = __rev_bits(__rev_bits(v) + 1);
+        }
+        else
+        {
+            /* migration in progress: the old bucket and all the new buckets
+             * its objects are being moved to */
+            m0 = hmap->osize - 1;
+            m1 = hmap->size - 1;
+
+            __scan_chain(hmap, &hmap->ohmap[v & m0], f, arg);
+
+            do {
+                __scan_chain(hmap, &hmap->hmap[v & m1], f, arg);
+
+                v |= ~m1;
+                v = __rev_bits(__rev_bits(v) + 1);
+            } while (v & (m0 ^ m1));
+        }
+    } while (--count > 0 && v != 0);
+
+    return v;
+}
+
+/**
+ * \brief   Free expired objects
+ *
+ * Free up to \p budget (0: no limit) objects of \p hmap expired at time
+ * \p now, which comes from the same clock as the hmap one (see
+ * u_hmap_opts_set_clockfunc()).  Timers are kept in a hierarchical timing
+ * wheel, so the cost is proportional to the number of objects freed rather
+ * than to the size of the hmap.
+ *
+ * \param   hmap      hmap object
+ * \param   now       current time (milliseconds)
+ * \param   budget    maximum number of objects to free (0: no limit)
+ *
+ * \return the number of objects freed, or -1 on error
+ */
+ssize_t u_hmap_expire (u_hmap_t *hmap, uint64_t now, size_t budget)
+{
+    dbg_return_if (hmap == NULL, -1);
+
+    return (ssize_t) __tw_advance(hmap, now, budget);
+}
+
+/**
+ * \brief   Build a read-only copy of the hmap optimised for lookups
+ *
+ * Create in \p *pfrozen a read-only copy of \p hmap indexed by a minimal
+ * perfect hash function (CHD: keys are spread over small buckets, and each
+ * bucket gets a displacement which sends all its keys to distinct free
+ * slots).  A lookup costs one hash of the key, one probe of the slot it maps
+ * to and one key comparison, with no chains or probe sequences to follow.
+ * The objects and their string or opaque keys and values are packed in a
+ * single allocation; pointer keys and values are copied as such and the
+ * data they point to must outlive the frozen hmap, which never frees it.
+ *
+ * The frozen hmap works with u_hmap_get(), u_hmap_get_n(),
+ * u_hmap_get_batch(), u_hmap_easy_get(), the foreach functions,
+ * u_hmap_count() and u_hmap_save(), while insertions, deletions and scans
+ * fail.  It has the options of \p hmap, less the discard policy and TTLs.
+ * \p hmap itself is not modified (its expired objects are not copied).
+ *
+ * \param   hmap      hmap object
+ * \param   pfrozen   result argument
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure (e.g. two keys with the same hash)
+ */
+int u_hmap_freeze (u_hmap_t *hmap, u_hmap_t **pfrozen)
+{
+    u_hmap_opts_t o;
+    u_hmap_frz_bld_t b;
+    u_hmap_frz_t *frz;
+    u_hmap_t *f = NULL;
+    u_hmap_o_t *obj;
+    unsigned char *d;
+    size_t i, nb, *pos = NULL, off_disp, off_objs, off_data;
+
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (pfrozen == NULL, U_HMAP_ERR_FAIL);
+
+    memset(&b, 0, sizeof b);
+    b.max = hmap->sz;
+    dbg_err_sif ((b.h = u_calloc(b.max + 1, sizeof(uint64_t))) == NULL);
+    dbg_err_sif ((b.o = u_calloc(b.max + 1, sizeof(u_hmap_o_t *))) == NULL);
+    dbg_err_sif ((pos = u_calloc(b.max + 1, sizeof(size_t))) == NULL);
+    dbg_err_if (__walk(hmap, __frz_add, &b));
+
+    u_hmap_opts_init(&o);
+    dbg_err_if (u_hmap_opts_copy(&o, hmap->opts));
+    o.policy = U_HMAP_PCY_NONE;
+    o.ttl = 0;
+    o.size = 1;
+    o.incremental = 0;
+    o.mmap = 0;
+    dbg_err_if (u_hmap_new(&o, &f));
+
+    /* header, displacements, objects, keys and values */
+    nb = b.n / U_HMAP_FRZ_LAMBDA + 1;
+    off_disp = U_HMAP_ALIGN8(sizeof(u_hmap_frz_t));
+    off_objs = off_disp + U_HMAP_ALIGN8(nb * sizeof(uint32_t));
+    off_data = off_objs + U_HMAP_ALIGN8(b.n * sizeof(u_hmap_o_t));
+
+    dbg_err_sif ((frz = u_zalloc(off_data + b.data)) == NULL);
+    f->frz = frz;
+    frz->n = b.n;
+    frz->nb = nb;
+    frz->disp = (uint32_t *) ((unsigned char *) frz + off_disp);
+    frz->objs = (u_hmap_o_t *) ((unsigned char *) frz + off_objs);
+
+    dbg_err_if (__frz_build(&b, nb, frz->disp, pos));
+
+    for (i = 0, d = (unsigned char *) frz + off_data; i < b.n; ++i)
+    {
+        obj = &frz->objs[pos[i]];
+        obj->key = __frz_pack(&d, o.key_type, o.key_sz, b.o[i]->key);
+        obj->val = __frz_pack(&d, o.val_type, o.val_sz, b.o[i]->val);
+        obj->hmap = f;
+    }
+
+    f->sz = b.n;
+    *pfrozen = f;
+
+    u_free(b.h);
+    u_free(b.o);
+    u_free(pos);
+
+    return U_HMAP_ERR_NONE;
+err:
+    U_FREE(b.h);
+    U_FREE(b.o);
+    U_FREE(pos);
+    if (f)
+        u_hmap_free(f);
+    *pfrozen = NULL;
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief   Save the hmap to a file
+ *
+ * Write the objects of \p hmap to \p path, to be read back with
+ * u_hmap_load().  Keys and values must be strings or opaque data
+ * (U_HMAP_OPTS_DATATYPE_STRING or U_HMAP_OPTS_DATATYPE_OPAQUE); expired
+ * objects are skipped.  The file is written under a temporary name and
+ * renamed to \p path once complete, so an existing \p path is replaced
+ * atomically.
+ *
+ * The file holds a versioned header (datatypes, built-in hash function and
+ * seed, sizes), the (key, value) records and an open addressing index of
+ * their hashes, which lets u_hmap_load() look keys up in place; header and
+ * contents are checksummed.  Numbers are stored in host byte order, so
+ * files cannot be moved across machines of different endianness.
+ *
+ * \param   hmap      hmap object
+ * \param   path      file name
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_save (u_hmap_t *hmap, const char *path)
+{
+    char tmp[U_FILENAME_MAX];
+    u_hmap_img_hdr_t hdr;
+    u_hmap_img_slot_t *slots = NULL;
+    u_hmap_imgw_t *w = NULL;
+    uint64_t index;
+    size_t nslots;
+
+    dbg_return_if (hmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (path == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_ifm (hmap->opts->key_type == U_HMAP_OPTS_DATATYPE_POINTER ||
+            hmap->opts->val_type == U_HMAP_OPTS_DATATYPE_POINTER,
+            U_HMAP_ERR_FAIL, "pointer keys and values cannot be saved");
+
+    dbg_err_if (u_snprintf(tmp, sizeof tmp, "%s.tmp", path));
+
+    /* keep the index at most half full */
+    dbg_err_if (__next_size(&nslots, 2 * (size_t) hmap->sz + 1));
+
+    dbg_err_sif ((slots = u_calloc(nslots,
+                    sizeof(u_hmap_img_slot_t))) == NULL);
+    dbg_err_sif ((w = u_malloc(sizeof(u_hmap_imgw_t))) == NULL);
+    w->off = sizeof(u_hmap_img_hdr_t);
+    w->cksum = 0;
+    w->slots = slots;
+    w->mask = nslots - 1;
+    w->count = 0;
+    w->len = 0;
+
+    dbg_err_sif ((w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0);
+    dbg_err_sif (lseek(w->fd, (off_t) w->off, SEEK_SET) < 0);
+
+    dbg_err_if (__walk(hmap, __img_put, w));
+
+    index = w->off;
+    dbg_err_if (__img_write(w, slots, nslots * sizeof(u_hmap_img_slot_t)));
+    dbg_err_if (__img_flush(w));
+
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, U_HMAP_IMG_MAGIC, sizeof hdr.magic);
+    hdr.version = U_HMAP_IMG_VERSION;
+    hdr.order = U_HMAP_IMG_ORDER;
+    hdr.key_type = hmap->opts->key_type;
+    hdr.val_type = hmap->opts->val_type;
+    hdr.key_sz = hmap->opts->key_sz;
+    hdr.val_sz = hmap->opts->val_sz;
+    hdr.hash_type = hmap->opts->hash_type;
+    hdr.hash_seed = hmap->opts->hash_seed;
+    hdr.count = w->count;
+    hdr.nslots = nslots;
+    hdr.index = index;
+    hdr.size = w->off;
+    hdr.cksum = w->cksum;
+    hdr.hcksum = __h_xxh64((const unsigned char *) &hdr,
+            offsetof(u_hmap_img_hdr_t, hcksum), 0);
+
+    dbg_err_sif (lseek(w->fd, 0, SEEK_SET) < 0);
+    dbg_err_sif (u_write(w->fd, &hdr, sizeof hdr) < 0);
+    dbg_err_sif (fsync(w->fd));
+    dbg_err_sif (close(w->fd));
+    w->fd = -1;
+
+    dbg_err_sif (rename(tmp, path));
+
+    u_free(w);
+    u_free(slots);
+
+    return U_HMAP_ERR_NONE;
+err:
+    if (w && w->fd >= 0)
+    {
+        (void) close(w->fd);
+        (void) unlink(tmp);
+    }
+    U_FREE(w);
+    U_FREE(slots);
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief   Load an hmap from a file
+ *
+ * Create in \p *phmap a new hmap with the objects saved by u_hmap_save() in
+ * \p path.  Key and value datatypes and sizes, and the built-in hash
+ * function and seed, come from the file, everything else from \p opts
+ * (which may be \c NULL); a custom hash function must be the one the saved
+ * hmap used.  Files with a different version, byte order or checksum are
+ * rejected.
+ *
+ * By default the objects are inserted into a regular hmap, which must own
+ * its data (U_HMAP_OPTS_OWNSDATA).  If u_hmap_opts_set_mmap() is enabled
+ * the file is instead mapped in memory and lookups (u_hmap_get(),
+ * u_hmap_get_n(), u_hmap_get_batch(), u_hmap_easy_get()), iterations and
+ * u_hmap_count() are served straight from its pages, with no
+ * deserialization: keys and values point into the mapping and stay valid
+ * until u_hmap_free().  Such an hmap is read-only: insertions, deletions
+ * and scans fail, and it may not have a discard policy or TTLs.
+ *
+ * \param   path      file name
+ * \param   opts      hmap options (may be \c NULL)
+ * \param   phmap     result argument
+ *
+ * \retval  U_HMAP_ERR_NONE     on success
+ * \retval  U_HMAP_ERR_FAIL     on failure
+ */
+int u_hmap_load (const char *path, u_hmap_opts_t *opts, u_hmap_t **phmap)
+{
+    u_hmap_opts_t o;
+    u_hmap_img_t *img = NULL;
+    u_hmap_t *hmap = NULL;
+    const u_hmap_img_hdr_t *hdr;
+
+    dbg_return_if (path == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (phmap == NULL, U_HMAP_ERR_FAIL);
+
+    u_hmap_opts_init(&o);
+    if (opts)
+        dbg_err_if (u_hmap_opts_copy(&o, opts));
+
+    dbg_err_if (__img_open(path, &img));
+    hdr = img->hdr;
+
+    o.key_type = (u_hmap_options_datatype_t) hdr->key_type;
+    o.val_type = (u_hmap_options_datatype_t) hdr->val_type;
+    o.key_sz = (size_t) hdr->key_sz;
+    o.val_sz = (size_t) hdr->val_sz;
+    o.hash_type = (u_hmap_hash_t) hdr->hash_type;
+    o.hash_seed = hdr->hash_seed;
+    o.options &= ~U_HMAP_OPTS_HASH_RANDOM_SEED;
+
+    if (o.mmap)
+    {
+        dbg_err_ifm (o.policy != U_HMAP_PCY_NONE || o.ttl,
+                "read-only hmaps have neither discard policy nor TTLs");
+
+        dbg_err_if (u_hmap_new(&o, &hmap));
+        dbg_err_sif ((img->objs = u_calloc(img->mask + 1,
+                        sizeof(u_hmap_o_t))) == NULL);
+        hmap->img = img;
+        hmap->sz = (size_t) hdr->count;
+        img = NULL;
+
+        dbg_err_ifm (__img_check(hmap), "%s: hash function mismatch", path);
+    }
+    else
+    {
+        dbg_err_ifm (!(o.options & U_HMAP_OPTS_OWNSDATA),
+                "loaded hmaps must own their data");
+
+        /* room for all the objects up front */
+        if (o.policy == U_HMAP_PCY_NONE)
+            o.size = U_MAX(o.size,
+                    (size_t) (hdr->count / U_HMAP_RATE_FULL) + 1);
+
+        dbg_err_if (u_hmap_new(&o, &hmap));
+        dbg_err_if (__img_load(hmap, img));
+        __img_free(img);
+        img = NULL;
+    }
+
+    *phmap = hmap;
+
+    return U_HMAP_ERR_NONE;
+err:
+    __img_free(img);
+    if (hmap)
+        u_hmap_free(hmap);
+    *phmap = NULL;
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ * \brief Debug Hmap
+ *
+ * Print out information on an hmap.
+ *
+ * \param   hmap  hmap object
+ */
+void u_hmap_dbg (u_hmap_t *hmap)
+{
+    enum { MAX_LINE = 255 };
+    u_string_t *s = NULL, *st = NULL;
+    u_hmap_o_t *obj;
+    size_t i;
+
+    dbg_ifb (hmap == NULL) return;
+
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
+    {
+        if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            if (hmap->slots[i].o == NULL)
+                continue;
+        }
+        else if (LIST_FIRST(__bucket_at(hmap, i)) == NULL)
+            continue;
+
+        dbg_ifb (u_string_create("", 1, &s)) return;
+        dbg_err_if (u_string_clear(s));
+        dbg_err_if (u_string_aprintf(s, "%5d ", i));
+
+        obj = (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD) ?
+            hmap->slots[i].o : LIST_FIRST(__bucket_at(hmap, i));
+
+        /* a slot holds one object, a bucket a list of them */
+        for (; obj != NULL; obj = (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD) ?
+                NULL : LIST_NEXT(obj, next))
+        {
+            if (hmap->opts->f_str == NULL)
+            {
+                dbg_err_if (u_string_cat(s, "[]"));
+            }
+            else
+            {
+                st = hmap->opts->f_str(obj);
+                dbg_err_if (u_string_append(s, u_string_c(st),
+                            u_string_len(st)-1));
+                u_string_free(st);
+            }
+        }
+        u_dbg(u_string_c(s));
+        u_string_free(s);
+    }
+
+    return;
+err:
+    U_FREEF(st, u_string_free);
+    U_FREEF(s, u_string_free);
+    return;
+}
+
+/**
+ * \brief Debug policy
+ *
+ * Print out policy information.
+ *
+ * \param hmap  hmap object
+ */
+void u_hmap_pcy_dbg (u_hmap_t *hmap)
+{
+    u_hmap_q_t *q;
+    u_hmap_fb_t *fb;
+    size_t i;
+    u_string_t *s = NULL, *s2 = NULL;
+
+    dbg_ifb (hmap == NULL) return;
+
+    dbg_ifb (u_string_create("", 1, &s)) return;
+    dbg_err_if (u_string_clear(s));
+    dbg_err_if (u_string_cat(s, "Policy: "));
+
+    TAILQ_FOREACH(q, &hmap->pcy.queue, next)
+    {
+        s2 = hmap->opts->f_str(q->ho);
+        dbg_err_if (u_string_cat(s, u_string_c(s2)));
+        u_string_free(s2);
+    }
+
+    /* LFU: print buckets from the least frequently used */
+    TAILQ_FOREACH(fb, &hmap->pcy.fbs, next)
+    {
+        TAILQ_FOREACH(q, &fb->queue, next)
+        {
+            s2 = hmap->opts->f_str(q->ho);
+            dbg_err_if (u_string_cat(s, u_string_c(s2)));
+            dbg_err_if (u_string_aprintf(s, "-%zu", q->count));
+            u_string_free(s2);
+        }
+    }
+
+    /* segmented policies: print segments from the first one */
+    for (i = 0; i < U_HMAP_SEG_NUM; ++i)
+    {
+        if (i && hmap->pcy.seg[i].n)
+            dbg_err_if (u_string_cat(s, " |"));
+        TAILQ_FOREACH(q, &hmap->pcy.seg[i].queue, next)
+        {
+            s2 = hmap->opts->f_str(q->ho);
+            dbg_err_if (u_string_cat(s, u_string_c(s2)));
+            if (q->ref)
+                dbg_err_if (u_string_cat(s, "*"));
+            u_string_free(s2);
+        }
+    }
+
+    /* CUSTOM: print the heap array, next victim first */
+    for (i = 0; i < hmap->pcy.heap_n; ++i)
+    {
+        s2 = hmap->opts->f_str(hmap->pcy.heap[i]->ho);
+        dbg_err_if (u_string_cat(s, u_string_c(s2)));
+        u_string_free(s2);
+    }
+
+    u_dbg(u_string_c(s));
+    u_string_free(s);
+
+    return;
+err:
+    U_FREEF(s, u_string_free);
+    U_FREEF(s2, u_string_free);
+    return;
+}
+
+/* Allocate a new queue data object */
+static u_hmap_q_t *__q_o_new (u_hmap_t *hmap, u_hmap_o_t *ho)
+{
+    u_hmap_q_t *qo = NULL;
+
+    dbg_return_if (hmap == NULL, NULL);
+    dbg_return_if (ho == NULL, NULL);
+
+    if (hmap->qslab.sz)
+        dbg_err_if ((qo = (u_hmap_q_t *) __slab_alloc(&hmap->qslab)) == NULL);
+    else
+        dbg_err_sif ((qo = (u_hmap_q_t *)
+                    u_zalloc(sizeof(u_hmap_q_t))) == NULL);
+
+    qo->ho = ho;
+    qo->count = 0;
+    qo->fb = NULL;
+    qo->hpos = 0;
+    qo->hash = 0;
+    qo->seg = 0;
+    qo->ref = 0;
+
+    return qo;
+err:
+    return NULL;
+}
+
+/* Free a data queue object */
+static void __q_o_free (u_hmap_t *hmap, u_hmap_q_t *qo)
+{
+    dbg_ifb (hmap == NULL) return;
+    dbg_ifb (qo == NULL) return;
+
+    if (hmap->qslab.sz)
+        __slab_free(&hmap->qslab, qo);
+    else
+        u_free(qo);
+}
+
+/* Get a chunk from the slab, carving a new block if the freelist is empty */
+static void *__slab_alloc (u_hmap_slab_t *slab)
+{
+    char *b, *c;
+    size_t i;
+
+    if (slab->free == NULL)
+    {
+        dbg_err_sif ((b = u_malloc(U_HMAP_SLAB_ALIGN +
+                        U_HMAP_SLAB_CHUNKS * slab->sz)) == NULL);
+
+        *((void **) b) = slab->blocks;
+        slab->blocks = b;
+
+        /* lowest addresses first */
+        for (i = U_HMAP_SLAB_CHUNKS; i > 0; --i)
+        {
+            c = b + U_HMAP_SLAB_ALIGN + (i - 1) * slab->sz;
+            *((void **) c) = slab->free;
+            slab->free = c;
+        }
+    }
+
+    c = slab->free;
+    slab->free = *((void **) c);
+
+    return c;
+err:
+    return NULL;
+}
+
+/* Give a chunk back to the slab (most recently freed is reused first) */
+static void __slab_free (u_hmap_slab_t *slab, void *p)
+{
+    *((void **) p) = slab->free;
+    slab->free = p;
+}
+
+/* Release all blocks of the slab */
+static void __slab_destroy (u_hmap_slab_t *slab)
+{
+    void *b;
+
+    while ((b = slab->blocks) != NULL)
+    {
+        slab->blocks = *((void **) b);
+        u_free(b);
+    }
+
+    slab->free = NULL;
+}
+
+/* Copy 'len' bytes from 'p' into the spare room of slab object 'obj' starting
+ * at '*off', if they fit */
+static void *__o_inline (u_hmap_o_t *obj, size_t *off, const void *p,
+        size_t len)
+{
+    void *dst;
+    size_t end = U_HMAP_SLAB_ROUND(sizeof(u_hmap_o_t)) + U_HMAP_SLAB_INLINE;
+
+    if (!(obj->flags & U_HMAP_O_SLAB) || *off + len > end)
+        return NULL;
+
+    dst = (char *) obj + *off;
+    memcpy(dst, p, len);
+    *off += U_HMAP_SLAB_ROUND(len);
+
+    return dst;
+}
+
+/* Get a string representation of a policy */
+static const char *__pcy2str (u_hmap_pcy_type_t policy)
+{
+    switch (policy)
+    {
+        case U_HMAP_PCY_NONE:
+            return "none";
+        case U_HMAP_PCY_FIFO:
+            return "fifo";
+        case U_HMAP_PCY_LRU:
+            return "lru";
+        case U_HMAP_PCY_LFU:
+            return "lfu";
+        case U_HMAP_PCY_CUSTOM:
+            return "custom";
+        case U_HMAP_PCY_CLOCK:
+            return "clock";
+        case U_HMAP_PCY_SLRU:
+            return "slru";
+        case U_HMAP_PCY_2Q:
+            return "2q";
+        case U_HMAP_PCY_WTINYLFU:
+            return "w-tinylfu";
+    }
+    return NULL;
+}
+
+/* Get a string representation of a policy */
+static const char *__datatype2str(u_hmap_options_datatype_t datatype)
+{
+    switch (datatype)
+    {
+        case U_HMAP_OPTS_DATATYPE_POINTER:
+            return "pointer";
+        case U_HMAP_OPTS_DATATYPE_STRING:
+            return "string";
+        case U_HMAP_OPTS_DATATYPE_OPAQUE:
+            return "opaque";
+    }
+
+    return NULL;
+}
+
+/* Smallest power of two (and at least U_HMAP_MIN_SIZE) not below sz:
+ * buckets are picked by masking the full hash, which must then be good in
+ * its low bits (see U_HMAP_OPTS_HASH_STRONG) */
+static int __next_size (size_t *psz, size_t sz)
+{
+    size_t n = U_HMAP_MIN_SIZE;
+
+    dbg_err_if (psz == NULL);
+    dbg_err_if (sz == 0);
+
+    for (; n < sz && n != 0; n <<= 1)
+        ;
+    dbg_err_ifm (n == 0, "hmap size limit exceeded");
+
+    *psz = n;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Make room for more objects: the way depends on the hmap type (policy
+ * hmaps never get here, except Robin Hood ones which need a free slot) */
+static int __grow (u_hmap_t *hmap)
+{
+    uint64_t t0 = 0;
+
+    if (hmap->opts->options & U_HMAP_OPTS_STATS)
+        t0 = __ns_now();
+
+    if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        dbg_err_if (__rh_resize(hmap, hmap->size << 1));
+    else if (hmap->opts->incremental && hmap->opts->type == U_HMAP_TYPE_CHAIN)
+        dbg_err_if (__rehash_start(hmap));  /* migration is spread over the
+                                               following writes */
+    else
+        dbg_err_if (__resize(hmap));
+
+    if (hmap->opts->options & U_HMAP_OPTS_STATS)
+    {
+        hmap->st.resizes++;
+        hmap->st.resize_ns += __ns_now() - t0;
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+static int __resize(u_hmap_t *hmap)
 {
     u_hmap_opts_t *newopts = NULL;
     u_hmap_t *newmap = NULL;
+    u_hmap_slab_t oslab, qslab, tslab;
+    u_hmap_stats_t st;
+    u_hmap_tw_t *tw;
+
+    dbg_err_if (hmap == NULL);
+
+    if (hmap->opts->policy != U_HMAP_PCY_NONE)
+        return 0;
+
+    u_dbg("resize from: %u", hmap->size);
+
+    /* copy old options */
+    dbg_err_if (u_hmap_opts_new(&newopts));
+    dbg_err_if (u_hmap_opts_copy(newopts, hmap->opts));
+
+    /* set rate and create the new hashmap */
+    dbg_err_if (__next_size(&newopts->size,
+            U_HMAP_RATE_RESIZE * newopts->size));
+    dbg_err_if (u_hmap_new(newopts, &newmap));
+    u_hmap_opts_free(newopts);
+
+    /* remove any ownership from old map to copy elements */
+    hmap->opts->options &= !U_HMAP_OPTS_OWNSDATA;
+
+    /* copy old elements to new map policy (objects keep their timers) */
+    dbg_err_if (__copy(newmap, hmap, 0));
+
+    /* free old allocated objects */
+    u_hmap_opts_free(hmap->opts);
+    u_free(hmap->hmap);
+
+    /* copy new map to this hmap, keeping the slabs objects come from (the
+     * new map has none allocated yet), the expiration timers and the
+     * statistics */
+    oslab = hmap->oslab;
+    qslab = hmap->qslab;
+    tslab = hmap->tslab;
+    tw = hmap->tw;
+    st = hmap->st;
+    memcpy(hmap, newmap, sizeof(u_hmap_t));
+    hmap->oslab = oslab;
+    hmap->qslab = qslab;
+    hmap->tslab = tslab;
+    hmap->tw = tw;
+    hmap->st = st;
+    u_free(newmap);
+
+    u_dbg("resized to: %u", hmap->size);
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Start an incremental resize: the current buckets are set aside and
+ * migrated a few at a time by subsequent writes (see __rehash_step) */
+static int __rehash_start (u_hmap_t *hmap)
+{
+    u_hmap_e_t *nhmap = NULL;
+    size_t size;
+
+    /* a previous resize still running (unlikely given the growth rate) */
+    if (hmap->ohmap)
+        __rehash_step(hmap, hmap->osize);
+
+    dbg_err_if (__next_size(&size, U_HMAP_RATE_RESIZE * hmap->size));
+
+    /* zeroed memory is a set of empty lists */
+    dbg_err_sif ((nhmap = u_zalloc(sizeof(u_hmap_e_t) * size)) == NULL);
+
+    u_dbg("incremental resize from: %u to: %u", hmap->size, size);
+
+    hmap->ohmap = hmap->hmap;
+    hmap->osize = hmap->size;
+    hmap->ridx = 0;
+
+    hmap->hmap = nhmap;
+    hmap->opts->size = hmap->size = size;
+    hmap->threshold = (size_t) (U_HMAP_RATE_FULL * size);
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Migrate (at most) n non-empty old buckets to the new array */
+static void __rehash_step (u_hmap_t *hmap, size_t n)
+{
+    u_hmap_o_t *obj;
+    u_hmap_e_t *x;
+    size_t empty = n * 10;
+
+    for (; n && hmap->ridx < hmap->osize; hmap->ridx++)
+    {
+        x = &hmap->ohmap[hmap->ridx];
+
+        if (LIST_EMPTY(x))
+        {
+            if (--empty == 0)
+                return;
+            continue;
+        }
+
+        while ((obj = LIST_FIRST(x)) != NULL)
+        {
+            LIST_REMOVE(obj, next);
+            (void) __chain_insert(hmap,
+                    &hmap->hmap[__IDX(__hash(hmap, obj->key), hmap->size)], obj);
+        }
+
+        --n;
+    }
+
+    if (hmap->ridx == hmap->osize)
+    {
+        u_dbg("incremental resize done");
+        U_FREE(hmap->ohmap);
+        hmap->osize = hmap->ridx = 0;
+    }
+}
+
+/* Prefetch the home buckets of n hashed keys, then what they point to
+ * (first chained object, or the key of a Robin Hood slot): the second pass
+ * finds most of the first round of loads completed */
+static void __prefetch (u_hmap_t *hmap, const size_t *hashes, size_t n)
+{
+    size_t j;
+
+    if (hmap->frz)
+    {
+        for (j = 0; j < n; ++j)
+            U_HMAP_PREFETCH(&hmap->frz->disp[__FRZ_RANGE(
+                        __frz_mix(hashes[j]) >> 32, hmap->frz->nb)]);
+        return;
+    }
+
+    if (hmap->img)
+    {
+        for (j = 0; j < n; ++j)
+            U_HMAP_PREFETCH(&hmap->img->slots[hashes[j] & hmap->img->mask]);
+        return;
+    }
+
+    if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+    {
+        for (j = 0; j < n; ++j)
+            U_HMAP_PREFETCH(&hmap->slots[hashes[j] & hmap->mask]);
+        for (j = 0; j < n; ++j)
+            U_HMAP_PREFETCH(hmap->slots[hashes[j] & hmap->mask].key);
+        return;
+    }
+
+    for (j = 0; j < n; ++j)
+    {
+        U_HMAP_PREFETCH(&hmap->hmap[__IDX(hashes[j], hmap->size)]);
+        if (hmap->ohmap)
+            U_HMAP_PREFETCH(&hmap->ohmap[__IDX(hashes[j], hmap->osize)]);
+    }
+    for (j = 0; j < n; ++j)
+        U_HMAP_PREFETCH(LIST_FIRST(&hmap->hmap[__IDX(hashes[j],
+                        hmap->size)]));
+}
+
+/* Default clock: monotonic milliseconds */
+static uint64_t __f_now (void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+    return (uint64_t) time(NULL) * 1000;
+}
+
+/* Whether object o has expired (but not been reaped yet) */
+static int __expired (u_hmap_t *hmap, u_hmap_o_t *o)
+{
+    return o->tmr && o->tmr->expire <= hmap->opts->f_now();
+}
+
+/* Allocate a timer (and the wheel along with the first one) */
+static u_hmap_tmr_t *__tmr_new (u_hmap_t *hmap)
+{
+    u_hmap_tw_t *tw;
+    u_hmap_tmr_t *t;
+    size_t k, i;
+
+    if (hmap->tw == NULL)
+    {
+        dbg_err_sif ((tw = u_zalloc(sizeof(u_hmap_tw_t))) == NULL);
+
+        for (k = 0; k < U_HMAP_TW_LEVELS; ++k)
+            for (i = 0; i < U_HMAP_TW_SLOTS; ++i)
+                LIST_INIT(&tw->slot[k][i]);
+        tw->now = hmap->opts->f_now();
+
+        hmap->tw = tw;
+    }
+
+    if (hmap->tslab.sz)
+        dbg_err_if ((t = __slab_alloc(&hmap->tslab)) == NULL);
+    else
+        dbg_err_sif ((t = u_malloc(sizeof(u_hmap_tmr_t))) == NULL);
+
+    return t;
+err:
+    return NULL;
+}
+
+/* Remove the timer of object o, if any */
+static void __tmr_del (u_hmap_t *hmap, u_hmap_o_t *o)
+{
+    u_hmap_tmr_t *t = o->tmr;
+    u_hmap_tw_t *tw = hmap->tw;
+
+    if (t == NULL)
+        return;
+
+    LIST_REMOVE(t, next);
+    if (LIST_EMPTY(&tw->slot[t->level][t->slot]))
+        tw->bm[t->level] &= ~(1ULL << t->slot);
+    tw->n--;
+
+    o->tmr = NULL;
+
+    if (hmap->tslab.sz)
+        __slab_free(&hmap->tslab, t);
+    else
+        u_free(t);
+}
+
+/* Put timer t in the slot it expires in, at the lowest level whose slots
+ * are still ahead of the wheel time (expired timers go to the current one) */
+static void __tw_add (u_hmap_tw_t *tw, u_hmap_tmr_t *t)
+{
+    uint64_t e = U_MAX(t->expire, tw->now);
+    size_t k;
+
+    for (k = 0; k < U_HMAP_TW_LEVELS - 1; ++k)
+        if ((e >> (U_HMAP_TW_BITS * (k + 1))) ==
+                (tw->now >> (U_HMAP_TW_BITS * (k + 1))))
+            break;
+
+    /* beyond the top level range timers wrap around and get re-added by
+     * the cascade until they fit */
+    t->level = (unsigned char) k;
+    t->slot = (unsigned char) ((e >> (U_HMAP_TW_BITS * k)) & U_HMAP_TW_MASK);
+
+    LIST_INSERT_HEAD(&tw->slot[k][t->slot], t, next);
+    tw->bm[k] |= 1ULL << t->slot;
+    tw->n++;
+}
+
+/* The wheel time has just entered a new level 0 slot range: spread the
+ * timers of the upper level slots starting at the same time over the lower
+ * levels, top level first */
+static void __tw_cascade (u_hmap_tw_t *tw)
+{
+    struct u_hmap_tw_h_s list;
+    u_hmap_tmr_t *t;
+    size_t k, i;
+
+    for (k = 1; k < U_HMAP_TW_LEVELS - 1; ++k)
+        if ((tw->now >> (U_HMAP_TW_BITS * k)) & U_HMAP_TW_MASK)
+            break;
+
+    for (; k > 0; --k)
+    {
+        i = (tw->now >> (U_HMAP_TW_BITS * k)) & U_HMAP_TW_MASK;
+
+        /* empty the slot first: timers too far away for the top level may
+         * land in it again */
+        LIST_INIT(&list);
+        while ((t = LIST_FIRST(&tw->slot[k][i])) != NULL)
+        {
+            LIST_REMOVE(t, next);
+            LIST_INSERT_HEAD(&list, t, next);
+            tw->n--;
+        }
+        tw->bm[k] &= ~(1ULL << i);
+
+        while ((t = LIST_FIRST(&list)) != NULL)
+        {
+            LIST_REMOVE(t, next);
+            __tw_add(tw, t);
+        }
+    }
+}
+
+/* Move the wheel time forward to 'to', freeing up to 'budget' (0: no limit)
+ * expired objects on the way; empty slots are skipped through the bitmaps */
+static size_t __tw_advance (u_hmap_t *hmap, uint64_t to, size_t budget)
+{
+    u_hmap_tw_t *tw = hmap->tw;
+    u_hmap_tmr_t *t;
+    u_hmap_o_t *o;
+    uint64_t bits, next;
+    size_t reaped = 0, i, k;
+
+    /* no reentrance via the deletions below */
+    if (tw == NULL || tw->busy || to < tw->now)
+        return 0;
+
+    tw->busy = 1;
+
+    for (;;)
+    {
+        /* whatever is in the current slot has expired */
+        i = tw->now & U_HMAP_TW_MASK;
+
+        while ((t = LIST_FIRST(&tw->slot[0][i])) != NULL)
+        {
+            if (budget && reaped == budget)
+                goto end;
+
+            /* (if deletion ever failed, don't loop forever) */
+            o = t->ho;
+            dbg_ifb (__del(hmap, o->key, __hash(hmap, o->key), NULL))
+                __tmr_del(hmap, o);
+            __STATS(hmap, expirations);
+            ++reaped;
+        }
+
+        if (tw->now == to)
+            break;
+
+        if (tw->n == 0)
+        {
+            tw->now = to;
+            continue;
+        }
+
+        /* next busy slot in the current level 0 range */
+        if (i < U_HMAP_TW_MASK &&
+                (bits = tw->bm[0] & (~0ULL << (i + 1))) != 0)
+        {
+            tw->now += U_MIN((uint64_t) (__ctz64(bits) - i), to - tw->now);
+            continue;
+        }
+
+        /* else the next range of the lowest non-empty level */
+        for (k = 1; k < U_HMAP_TW_LEVELS - 1 && tw->bm[k] == 0; ++k)
+            ;
+
+        next = ((tw->now >> (U_HMAP_TW_BITS * k)) + 1) <<
+            (U_HMAP_TW_BITS * k);
+
+        if (next > to)
+            tw->now = to;
+        else
+        {
+            tw->now = next;
+            __tw_cascade(tw);
+        }
+    }
+
+end:
+    tw->busy = 0;
+
+    return reaped;
+}
+
+/* Reap a few expired objects on behalf of a put */
+static void __tw_tick (u_hmap_t *hmap)
+{
+    if (hmap->tw && hmap->tw->n)
+        (void) __tw_advance(hmap, hmap->opts->f_now(), U_HMAP_TTL_STEP);
+}
+
+/* Release the wheel along with its timers */
+static void __tw_free (u_hmap_t *hmap)
+{
+    u_hmap_tw_t *tw = hmap->tw;
+    u_hmap_tmr_t *t;
+    size_t k, i;
+
+    if (tw == NULL)
+        return;
+
+    for (k = 0; k < U_HMAP_TW_LEVELS; ++k)
+        for (i = 0; i < U_HMAP_TW_SLOTS; ++i)
+            while ((t = LIST_FIRST(&tw->slot[k][i])) != NULL)
+                __tmr_del(hmap, t->ho);
+
+    u_free(tw);
+    hmap->tw = NULL;
+}
+
+/* Index of the lowest bit set in v (v != 0) */
+static int __ctz64 (uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+
+    for (; !(v & 1); v >>= 1)
+        ++n;
+
+    return n;
+#endif
+}
+
+/* Reverse the bits of v */
+static size_t __rev_bits (size_t v)
+{
+    size_t s = CHAR_BIT * sizeof(v), mask = ~((size_t) 0);
+
+    while ((s >>= 1) > 0)
+    {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+
+    return v;
+}
+
+/* Dispose of object o, already unlinked by u_hmap_scan() */
+static void __scan_remove (u_hmap_t *hmap, u_hmap_o_t *o)
+{
+    if (o->pqe)
+        dbg_if (hmap->pcy.del(hmap, o));
+    __tmr_del(hmap, o);
+
+    if (hmap->opts->options & U_HMAP_OPTS_OWNSDATA)
+        __o_free(hmap, o);
+    else
+        u_hmap_o_free(o);
+
+    hmap->sz--;
+}
+
+/* Scan all objects of chain x */
+static void __scan_chain (u_hmap_t *hmap, u_hmap_e_t *x,
+        int f(u_hmap_o_t *obj, void *arg), void *arg)
+{
+    u_hmap_o_t *o, *next;
+
+    for (o = LIST_FIRST(x); o != NULL; o = next)
+    {
+        next = LIST_NEXT(o, next);
+
+        if (f(o, arg) == U_HMAP_SCAN_DEL)
+        {
+            LIST_REMOVE(o, next);
+            __scan_remove(hmap, o);
+        }
+    }
+}
+
+/* Scan the Robin Hood entries whose home slot is h: they are found along
+ * the probe sequence starting at h */
+static void __scan_home (u_hmap_t *hmap, size_t h,
+        int f(u_hmap_o_t *obj, void *arg), void *arg)
+{
+    u_hmap_slot_t *s;
+    u_hmap_o_t *o;
+    size_t i, d, sd;
+
+    for (i = h, d = 0; ; )
+    {
+        s = &hmap->slots[i];
+
+        /* past the entries of home h (kept together by Robin Hood) */
+        if (s->o == NULL || (sd = __RH_DIST(hmap, s->hash, i)) < d)
+            return;
+
+        if (sd == d && f(s->o, arg) == U_HMAP_SCAN_DEL)
+        {
+            o = s->o;
+            __rh_remove(hmap, i);
+            __scan_remove(hmap, o);
+            continue;   /* the next entry has been shifted into i */
+        }
+
+        i = (i + 1) & hmap->mask;
+        ++d;
+    }
+}
+
+/* Scan the linear probing objects whose home bucket is h: they are found
+ * along the run of non-empty buckets starting at h */
+static void __scan_lin (u_hmap_t *hmap, size_t h,
+        int f(u_hmap_o_t *obj, void *arg), void *arg)
+{
+    u_hmap_o_t *o;
+    size_t i, n;
+
+    for (i = h, n = 0; n < hmap->size &&
+            (o = LIST_FIRST(&hmap->hmap[i])) != NULL; )
+    {
+        if (__IDX(__hash(hmap, o->key), hmap->size) == h &&
+                f(o, arg) == U_HMAP_SCAN_DEL)
+        {
+            __lin_remove(hmap, i);
+            __scan_remove(hmap, o);
+            continue;   /* the next object may have been shifted into i */
+        }
+
+        i = __IDX(i + 1, hmap->size);
+        ++n;
+    }
+}
+
+/* Unlink the object in bucket i of a linear probing hmap, then move back
+ * the following objects of the run which may take its place, so that no
+ * object is ever separated from its home bucket by an empty one */
+static void __lin_remove (u_hmap_t *hmap, size_t i)
+{
+    u_hmap_o_t *o;
+    size_t j, k;
+
+    LIST_REMOVE(LIST_FIRST(&hmap->hmap[i]), next);
+
+    /* (bucket i is empty from now on, which ends the loop) */
+    for (j = __IDX(i + 1, hmap->size);
+            (o = LIST_FIRST(&hmap->hmap[j])) != NULL;
+            j = __IDX(j + 1, hmap->size))
+    {
+        k = __IDX(__hash(hmap, o->key), hmap->size);
+
+        /* o may fill the hole unless its home lies between the two */
+        if (__IDX(j - k, hmap->size) < __IDX(j - i, hmap->size))
+            continue;
+
+        LIST_REMOVE(o, next);
+        LIST_INSERT_HEAD(&hmap->hmap[i], o, next);
+        i = j;
+    }
+}
+
+/* i-th bucket counting the ones being migrated after the current array */
+static u_hmap_e_t *__bucket_at (u_hmap_t *hmap, size_t i)
+{
+    return (i < hmap->size) ? &hmap->hmap[i] : &hmap->ohmap[i - hmap->size];
+}
+
+/* Look for key in chain x (kept sorted by key) */
+static u_hmap_o_t *__chain_find (u_hmap_t *hmap, u_hmap_e_t *x,
+        const void *key, size_t klen)
+{
+    u_hmap_o_t *obj;
+    int comp;
+
+    LIST_FOREACH(obj, x, next)
+    {
+        if ((comp = __key_comp(hmap, key, klen, obj->key)) == 0)
+            return obj;
+        else if (comp < 0)  /* cannot be in list (ordered) */
+            break;
+    }
+
+    return NULL;
+}
+
+/* Insert obj in order in chain x, unless its key is already there: return
+ * the object holding it in that case, NULL otherwise */
+static u_hmap_o_t *__chain_insert (u_hmap_t *hmap, u_hmap_e_t *x,
+        u_hmap_o_t *obj)
+{
+    u_hmap_o_t *o;
+    int comp;
+
+    if (LIST_EMPTY(x))
+    {
+        LIST_INSERT_HEAD(x, obj, next);
+        return NULL;
+    }
+
+    LIST_FOREACH(o, x, next)
+    {
+        if ((comp = hmap->opts->f_comp(obj->key, o->key)) == 0)
+            return o;
+        else if (comp < 0)
+        {
+            LIST_INSERT_BEFORE(o, obj, next);
+            return NULL;
+        }
+        else if (!LIST_NEXT(o, next))
+        {
+            LIST_INSERT_AFTER(o, obj, next);
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* (Re)allocate the slot array to hold at least 'size' slots (rounded up to
+ * a power of two) and reinsert any existing entry using its cached hash */
+static int __rh_resize (u_hmap_t *hmap, size_t size)
+{
+    u_hmap_slot_t *old = hmap->slots, *slots;
+    size_t i, oldsz = hmap->size, newsz = U_HMAP_RH_MIN_SIZE;
+
+    for (; newsz < size && newsz != 0; newsz <<= 1)
+        ;
+    dbg_err_ifm (newsz == 0, "hmap size limit exceeded");
+
+    dbg_err_sif ((slots = (u_hmap_slot_t *)
+                u_zalloc(newsz * sizeof(u_hmap_slot_t))) == NULL);
+
+    hmap->slots = slots;
+    hmap->size = newsz;
+    hmap->mask = newsz - 1;
+    hmap->threshold = U_HMAP_RH_THRESHOLD(newsz);
+
+    if (old)
+    {
+        u_dbg("resize from: %u", oldsz);
+
+        for (i = 0; i < oldsz; ++i)
+            if (old[i].o)
+                __rh_insert(hmap, old[i]);
+
+        u_free(old);
+    }
+
+    return U_HMAP_ERR_NONE;
+err:
+    return U_HMAP_ERR_FAIL;
+}
 
-    dbg_err_if (hmap == NULL);
+/* Look for 'key' (whose full hash is 'hash') in the slot array and save its
+ * position in '*pidx' */
+static int __rh_find (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, size_t *pidx)
+{
+    u_hmap_slot_t *s;
+    size_t i, d;
 
-    if (hmap->opts->policy != U_HMAP_PCY_NONE)
-        return 0;
+    for (i = hash & hmap->mask, d = 0; ; i = (i + 1) & hmap->mask, ++d)
+    {
+        s = &hmap->slots[i];
 
-    u_dbg("resize from: %u", hmap->size);
+        /* an empty slot or a "richer" entry means the key is not here */
+        if (s->o == NULL || __RH_DIST(hmap, s->hash, i) < d)
+            return U_HMAP_ERR_FAIL;
 
-    /* copy old options */
-    dbg_err_if (u_hmap_opts_new(&newopts));
-    dbg_err_if (u_hmap_opts_copy(newopts, hmap->opts));
+        /* cached hash filters out most comparisons */
+        if (s->hash == hash && __key_comp(hmap, key, klen, s->key) == 0)
+        {
+            *pidx = i;
+            return U_HMAP_ERR_NONE;
+        }
+    }
+}
 
-    /* set rate and create the new hashmap */
-    dbg_err_if (__next_prime(&newopts->size,
-            U_HMAP_RATE_RESIZE * newopts->size,
-            &hmap->px));
-    dbg_err_if (u_hmap_new(newopts, &newmap));
-    u_hmap_opts_free(newopts);
+/* Insert a new entry (key must not be in the map already): whenever the
+ * entry is farther from home than the resident, it takes the resident's place
+ * and the displaced one carries on probing */
+static void __rh_insert (u_hmap_t *hmap, u_hmap_slot_t cur)
+{
+    u_hmap_slot_t tmp, *s;
+    size_t i, d, sd;
 
-    /* remove any ownership from old map to copy elements */
-    hmap->opts->options &= !U_HMAP_OPTS_OWNSDATA;
+    for (i = cur.hash & hmap->mask, d = 0; ; i = (i + 1) & hmap->mask, ++d)
+    {
+        s = &hmap->slots[i];
 
-    /* copy old elements to new map policy */
-    dbg_err_if (u_hmap_copy(newmap, hmap));
+        if (s->o == NULL)
+        {
+            *s = cur;
+            return;
+        }
 
-    /* free old allocated objects */
-    u_hmap_opts_free(hmap->opts);
-    u_free(hmap->hmap);
+        if ((sd = __RH_DIST(hmap, s->hash, i)) < d)
+        {
+            tmp = *s;
+            *s = cur;
+            cur = tmp;
+            d = sd;
+        }
+    }
+}
 
-    /* copy new map to this hmap */
-    memcpy(hmap, newmap, sizeof(u_hmap_t));
-    u_free(newmap);
+/* Remove slot 'i' by shifting back the following entries of its cluster
+ * (no tombstones needed) */
+static void __rh_remove (u_hmap_t *hmap, size_t i)
+{
+    size_t j;
 
-    u_dbg("resized to: %u", hmap->size);
+    for (j = (i + 1) & hmap->mask;
+            hmap->slots[j].o != NULL &&
+            __RH_DIST(hmap, hmap->slots[j].hash, j) != 0;
+            i = j, j = (j + 1) & hmap->mask)
+        hmap->slots[i] = hmap->slots[j];
 
-    return 0;
-err:
-    return ~0;
+    memset(&hmap->slots[i], 0, sizeof(u_hmap_slot_t));
 }
 
 /**
@@ -2116,3 +5690,603 @@ err:
 /**
  *   \}
  */
+
+/* Map (or read) snapshot file path and validate it */
+static int __img_open (const char *path, u_hmap_img_t **pimg)
+{
+    u_hmap_img_t *img = NULL;
+    const u_hmap_img_hdr_t *hdr;
+    struct stat st;
+    uint64_t cksum = 0;
+#ifdef HAVE_MMAP
+    void *p;
+#endif
+    size_t off;
+    int fd = -1;
+
+    dbg_err_sif ((img = u_zalloc(sizeof(u_hmap_img_t))) == NULL);
+
+    dbg_err_sif ((fd = open(path, O_RDONLY)) < 0);
+    dbg_err_sif (fstat(fd, &st));
+    dbg_err_ifm (st.st_size < (off_t) sizeof(u_hmap_img_hdr_t),
+            "%s: not an hmap file", path);
+    img->len = (size_t) st.st_size;
+
+#ifdef HAVE_MMAP
+    p = mmap(NULL, img->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    dbg_err_sif (p == MAP_FAILED);
+    img->base = (unsigned char *) p;
+    img->mapped = 1;
+#else
+    dbg_err_sif ((img->base = u_malloc(img->len)) == NULL);
+    dbg_err_sif (u_read(fd, img->base, img->len) != (ssize_t) img->len);
+#endif
+
+    (void) close(fd);
+    fd = -1;
+
+    img->hdr = hdr = (const u_hmap_img_hdr_t *) img->base;
+
+    dbg_err_ifm (memcmp(hdr->magic, U_HMAP_IMG_MAGIC, sizeof hdr->magic),
+            "%s: not an hmap file", path);
+    dbg_err_ifm (hdr->order != U_HMAP_IMG_ORDER,
+            "%s: byte order mismatch", path);
+    dbg_err_ifm (hdr->version != U_HMAP_IMG_VERSION,
+            "%s: unsupported version %u", path, hdr->version);
+    dbg_err_ifm (hdr->hcksum != __h_xxh64(img->base,
+                offsetof(u_hmap_img_hdr_t, hcksum), 0),
+            "%s: bad header checksum", path);
+    dbg_err_ifm (hdr->size != img->len, "%s: truncated file", path);
+
+    /* a sane layout is all lookups rely on */
+    dbg_err_ifm ((hdr->key_type != U_HMAP_OPTS_DATATYPE_STRING &&
+                hdr->key_type != U_HMAP_OPTS_DATATYPE_OPAQUE) ||
+            (hdr->val_type != U_HMAP_OPTS_DATATYPE_STRING &&
+                hdr->val_type != U_HMAP_OPTS_DATATYPE_OPAQUE) ||
+            !U_HMAP_IS_HASH(hdr->hash_type) ||
+            hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) ||
+            hdr->count >= hdr->nslots ||
+            hdr->index < sizeof(u_hmap_img_hdr_t) || hdr->index % 8 ||
+            hdr->nslots > (hdr->size - hdr->index) /
+                sizeof(u_hmap_img_slot_t) ||
+            hdr->index + hdr->nslots * sizeof(u_hmap_img_slot_t) !=
+                hdr->size,
+            "%s: bad header", path);
+
+    for (off = sizeof(u_hmap_img_hdr_t); off < img->len;
+            off += U_HMAP_IMG_CHUNK)
+        cksum = __h_xxh64(img->base + off,
+                U_MIN(img->len - off, U_HMAP_IMG_CHUNK), cksum);
+    dbg_err_ifm (cksum != hdr->cksum, "%s: bad checksum", path);
+
+    img->slots = (const u_hmap_img_slot_t *) (img->base + hdr->index);
+    img->mask = (size_t) hdr->nslots - 1;
+
+    *pimg = img;
+
+    return 0;
+err:
+    if (fd >= 0)
+        (void) close(fd);
+    __img_free(img);
+    return ~0;
+}
+
+static void __img_free (u_hmap_img_t *img)
+{
+    nop_return_if (img == NULL, );
+
+    u_free(img->objs);
+
+#ifdef HAVE_MMAP
+    if (img->mapped && img->base)
+        (void) munmap(img->base, img->len);
+#endif
+    if (!img->mapped)
+        u_free(img->base);
+
+    u_free(img);
+}
+
+/* Recompute the hashes of a few records: lookups would silently fail with
+ * a hash function other than the one of the saved hmap */
+static int __img_check (u_hmap_t *hmap)
+{
+    u_hmap_img_t *img = hmap->img;
+    u_hmap_o_t *o;
+    size_t i, n = 0;
+
+    for (i = 0; i <= img->mask && n < U_HMAP_IMG_SAMPLE; ++i)
+    {
+        if (img->slots[i].off == 0)
+            continue;
+
+        dbg_err_if ((o = __img_o(hmap, i)) == NULL);
+        dbg_err_if ((uint64_t) __hash(hmap, o->key) != img->slots[i].hash);
+        ++n;
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Insert into hmap copies of all the records of img */
+static int __img_load (u_hmap_t *hmap, u_hmap_img_t *img)
+{
+    u_hmap_img_rec_t *r;
+    u_hmap_o_t *obj;
+    uint64_t off, n = 0;
+
+    for (off = sizeof(u_hmap_img_hdr_t); off < img->hdr->index; ++n)
+    {
+        dbg_err_if ((r = __img_rec(hmap, img, off)) == NULL);
+        dbg_err_if ((obj = u_hmap_o_new(hmap, __IMG_KEY(r),
+                        __IMG_VAL(r))) == NULL);
+        dbg_err_if (u_hmap_put(hmap, obj, NULL));
+
+        off += sizeof(u_hmap_img_rec_t) + U_HMAP_ALIGN8(r->klen) +
+            U_HMAP_ALIGN8(r->vlen);
+    }
+
+    dbg_err_if (n != img->hdr->count);
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Record at offset off of img (NULL if it doesn't fit among the records or
+ * doesn't match the hmap datatypes) */
+static u_hmap_img_rec_t *__img_rec (u_hmap_t *hmap, u_hmap_img_t *img,
+        uint64_t off)
+{
+    u_hmap_img_rec_t *r;
+    uint64_t end = img->hdr->index;
+
+    dbg_return_if (off < sizeof(u_hmap_img_hdr_t) || off % 8 ||
+            off + sizeof(u_hmap_img_rec_t) > end, NULL);
+
+    r = (u_hmap_img_rec_t *) (img->base + off);
+
+    dbg_return_if (sizeof(u_hmap_img_rec_t) + U_HMAP_ALIGN8(r->klen) +
+            U_HMAP_ALIGN8(r->vlen) > end - off, NULL);
+    dbg_return_if (hmap->opts->key_type == U_HMAP_OPTS_DATATYPE_STRING ?
+            (r->klen == 0 || __IMG_KEY(r)[r->klen - 1] != '\0') :
+            r->klen != hmap->opts->key_sz, NULL);
+    dbg_return_if (hmap->opts->val_type == U_HMAP_OPTS_DATATYPE_STRING ?
+            (r->vlen == 0 || __IMG_VAL(r)[r->vlen - 1] != '\0') :
+            r->vlen != hmap->opts->val_sz, NULL);
+
+    return r;
+}
+
+/* Object of index slot i (NULL if the slot is empty): set up on first
+ * access, concurrent lookups just store the same pointers twice */
+static u_hmap_o_t *__img_o (u_hmap_t *hmap, size_t i)
+{
+    u_hmap_img_t *img = hmap->img;
+    u_hmap_o_t *o = &img->objs[i];
+    u_hmap_img_rec_t *r;
+
+    if (o->hmap == NULL)
+    {
+        nop_return_if (img->slots[i].off == 0, NULL);
+        dbg_return_if ((r = __img_rec(hmap, img, img->slots[i].off)) == NULL,
+                NULL);
+
+        o->key = __IMG_KEY(r);
+        o->val = __IMG_VAL(r);
+        o->hmap = hmap;
+    }
+
+    return o;
+}
+
+/* Look up key (see __get_h()) in the index of a read-only hmap */
+static int __img_get (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, u_hmap_o_t **o)
+{
+    u_hmap_img_t *img = hmap->img;
+    u_hmap_o_t *obj;
+    size_t i;
+
+    /* the index is at most half full: there is always an empty slot */
+    for (i = hash & img->mask; img->slots[i].off; i = (i + 1) & img->mask)
+    {
+        if (img->slots[i].hash != (uint64_t) hash ||
+                (obj = __img_o(hmap, i)) == NULL ||
+                __key_comp(hmap, key, klen, obj->key))
+            continue;
+
+        *o = obj;
+        return U_HMAP_ERR_NONE;
+    }
+
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Write the record of obj and add it to the index (see __walk()) */
+static int __img_put (u_hmap_t *hmap, u_hmap_o_t *obj, void *arg)
+{
+    static const unsigned char pad[8];
+    u_hmap_imgw_t *w = (u_hmap_imgw_t *) arg;
+    u_hmap_img_rec_t r;
+    size_t klen, vlen, h, i;
+
+    dbg_err_ifm (obj->key == NULL || obj->val == NULL,
+            "NULL keys and values cannot be saved");
+
+    klen = __img_len(hmap->opts->key_type, hmap->opts->key_sz, obj->key);
+    vlen = __img_len(hmap->opts->val_type, hmap->opts->val_sz, obj->val);
+    dbg_err_ifm (klen > UINT32_MAX - 8 || vlen > UINT32_MAX - 8,
+            "key or value too big");
+    r.klen = (uint32_t) klen;
+    r.vlen = (uint32_t) vlen;
+
+    h = __hash(hmap, obj->key);
+    for (i = h & w->mask; w->slots[i].off; i = (i + 1) & w->mask)
+        ;
+    w->slots[i].hash = h;
+    w->slots[i].off = w->off;
+    w->count++;
+
+    dbg_err_if (__img_write(w, &r, sizeof r));
+    dbg_err_if (__img_write(w, obj->key, klen));
+    dbg_err_if (__img_write(w, pad, U_HMAP_ALIGN8(klen) - klen));
+    dbg_err_if (__img_write(w, obj->val, vlen));
+    dbg_err_if (__img_write(w, pad, U_HMAP_ALIGN8(vlen) - vlen));
+
+    return 0;
+err:
+    return ~0;
+}
+
+static int __img_write (u_hmap_imgw_t *w, const void *p, size_t n)
+{
+    const unsigned char *s = (const unsigned char *) p;
+    size_t m;
+
+    for (; n > 0; n -= m, s += m)
+    {
+        m = U_MIN(n, sizeof w->buf - w->len);
+        memcpy(w->buf + w->len, s, m);
+        w->len += m;
+        w->off += m;
+
+        if (w->len == sizeof w->buf)
+            dbg_err_if (__img_flush(w));
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Checksum and write out the buffered block (only the last one may be
+ * short, see __img_open()) */
+static int __img_flush (u_hmap_imgw_t *w)
+{
+    nop_return_if (w->len == 0, 0);
+
+    w->cksum = __h_xxh64(w->buf, w->len, w->cksum);
+    dbg_err_sif (u_write(w->fd, w->buf, w->len) < 0);
+    w->len = 0;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Size of key or value p of the given datatype */
+static size_t __img_len (u_hmap_options_datatype_t type, size_t sz,
+        const void *p)
+{
+    return (type == U_HMAP_OPTS_DATATYPE_STRING) ?
+        strlen((const char *) p) + 1 : sz;
+}
+
+/* Call f on each live (not expired) object of hmap, stop on failure */
+static int __walk (u_hmap_t *hmap,
+        int (*f)(u_hmap_t *hmap, u_hmap_o_t *obj, void *arg), void *arg)
+{
+    u_hmap_o_t *obj;
+    size_t i;
+
+    if (__RDONLY(hmap))
+    {
+        for (i = 0; i < __ro_size(hmap); ++i)
+        {
+            if ((obj = __ro_o(hmap, i)) != NULL)
+                dbg_err_if (f(hmap, obj, arg));
+        }
+        return 0;
+    }
+
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
+    {
+        if (hmap->opts->type == U_HMAP_TYPE_ROBINHOOD)
+        {
+            if ((obj = hmap->slots[i].o) != NULL &&
+                    !(hmap->tw && __expired(hmap, obj)))
+                dbg_err_if (f(hmap, obj, arg));
+            continue;
+        }
+
+        LIST_FOREACH(obj, __bucket_at(hmap, i), next)
+        {
+            if (!(hmap->tw && __expired(hmap, obj)))
+                dbg_err_if (f(hmap, obj, arg));
+        }
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Object in slot i of a read-only hmap (NULL if empty) */
+static u_hmap_o_t *__ro_o (u_hmap_t *hmap, size_t i)
+{
+    return hmap->frz ? &hmap->frz->objs[i] : __img_o(hmap, i);
+}
+
+/* Number of slots of a read-only hmap */
+static size_t __ro_size (u_hmap_t *hmap)
+{
+    return hmap->frz ? hmap->frz->n : hmap->img->mask + 1;
+}
+
+/* Collect obj into the u_hmap_frz_bld_t at arg (see __walk()) */
+static int __frz_add (u_hmap_t *hmap, u_hmap_o_t *obj, void *arg)
+{
+    u_hmap_frz_bld_t *b = (u_hmap_frz_bld_t *) arg;
+    u_hmap_opts_t *o = hmap->opts;
+
+    dbg_err_if (b->n == b->max);
+
+    b->h[b->n] = __frz_mix(__hash(hmap, obj->key));
+    b->o[b->n++] = obj;
+
+    if (o->key_type != U_HMAP_OPTS_DATATYPE_POINTER)
+        b->data += U_HMAP_ALIGN8(__img_len(o->key_type, o->key_sz, obj->key));
+    if (o->val_type != U_HMAP_OPTS_DATATYPE_POINTER && obj->val)
+        b->data += U_HMAP_ALIGN8(__img_len(o->val_type, o->val_sz, obj->val));
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* CHD: place the keys of the buckets, largest first, each bucket trying
+ * displacements until its keys all land on free slots; pos[i] is the slot
+ * of the i-th key */
+static int __frz_build (u_hmap_frz_bld_t *b, size_t nb, uint32_t *disp,
+        size_t *pos)
+{
+    size_t *first = NULL, *keys = NULL, *order = NULL, *cnt = NULL, *slot;
+    unsigned char *taken = NULL;
+    size_t i, j, k, bi, sz, maxsz = 0, n = b->n;
+    uint64_t d, tries;
+
+    nop_return_if (n == 0, 0);
+
+    dbg_err_sif ((first = u_calloc(nb + 1, sizeof(size_t))) == NULL);
+    dbg_err_sif ((keys = u_calloc(n, sizeof(size_t))) == NULL);
+    dbg_err_sif ((order = u_calloc(nb, sizeof(size_t))) == NULL);
+    dbg_err_sif ((taken = u_calloc(n, 1)) == NULL);
+
+    /* keys grouped by bucket (counting sort) */
+    for (i = 0; i < n; ++i)
+        first[__FRZ_RANGE(b->h[i] >> 32, nb) + 1]++;
+    for (bi = 0; bi < nb; ++bi)
+    {
+        maxsz = U_MAX(maxsz, first[bi + 1]);
+        first[bi + 1] += first[bi];
+    }
+    for (i = 0; i < n; ++i)
+        keys[first[__FRZ_RANGE(b->h[i] >> 32, nb)]++] = i;
+    for (bi = nb; bi > 0; --bi)
+        first[bi] = first[bi - 1];
+    first[0] = 0;
+
+    /* buckets by decreasing size (counting sort again) */
+    dbg_err_sif ((cnt = u_calloc(maxsz + 2, sizeof(size_t))) == NULL);
+    for (bi = 0; bi < nb; ++bi)
+        cnt[maxsz - (first[bi + 1] - first[bi]) + 1]++;
+    for (sz = 0; sz <= maxsz; ++sz)
+        cnt[sz + 1] += cnt[sz];
+    for (bi = 0; bi < nb; ++bi)
+        order[cnt[maxsz - (first[bi + 1] - first[bi])]++] = bi;
+
+    /* scratch space for the slots of a bucket */
+    slot = cnt;
+
+    /* enough for the last keys to find the last free slots */
+    tries = 64 * (uint64_t) n + 1024;
+
+    for (i = 0; i < nb; ++i)
+    {
+        bi = order[i];
+        if ((sz = first[bi + 1] - first[bi]) == 0)
+            break;
+
+        /* equal hashes can't be told apart by any displacement */
+        for (j = first[bi]; j < first[bi + 1]; ++j)
+            for (k = j + 1; k < first[bi + 1]; ++k)
+                dbg_err_ifm (b->h[keys[j]] == b->h[keys[k]],
+                        "keys with the same hash can't be frozen");
+
+        for (d = 0; ; ++d)
+        {
+            dbg_err_ifm (d == tries || d > UINT32_MAX,
+                    "no perfect hash found");
+
+            for (j = 0; j < sz; ++j)
+            {
+                slot[j] = __frz_slot(b->h[keys[first[bi] + j]], (uint32_t) d,
+                        n);
+                if (taken[slot[j]])
+                    break;
+                for (k = 0; k < j && slot[k] != slot[j]; ++k)
+                    ;
+                if (k < j)
+                    break;
+            }
+
+            if (j == sz)
+                break;
+        }
+
+        disp[bi] = (uint32_t) d;
+        for (j = 0; j < sz; ++j)
+        {
+            taken[slot[j]] = 1;
+            pos[keys[first[bi] + j]] = slot[j];
+        }
+    }
+
+    u_free(first);
+    u_free(keys);
+    u_free(order);
+    u_free(taken);
+    u_free(cnt);
+
+    return 0;
+err:
+    U_FREE(first);
+    U_FREE(keys);
+    U_FREE(order);
+    U_FREE(taken);
+    U_FREE(cnt);
+    return ~0;
+}
+
+/* Copy key or value p at *pd (unless it is a pointer), return its copy */
+static void *__frz_pack (unsigned char **pd, u_hmap_options_datatype_t type,
+        size_t sz, void *p)
+{
+    void *c = *pd;
+    size_t len;
+
+    nop_return_if (type == U_HMAP_OPTS_DATATYPE_POINTER || p == NULL, p);
+
+    len = __img_len(type, sz, p);
+    memcpy(*pd, p, len);
+    *pd += U_HMAP_ALIGN8(len);
+
+    return c;
+}
+
+/* 64-bit finalizer (MurmurHash3 fmix64): the high half picks the bucket, so
+ * it must depend on all bits of the (possibly 32-bit) key hash */
+static uint64_t __frz_mix (uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* Slot of mixed hash h in a table of n slots with displacement d */
+static size_t __frz_slot (uint64_t h, uint32_t d, size_t n)
+{
+    return __FRZ_RANGE(__frz_mix(h + d * 0x9e3779b97f4a7c15ULL), n);
+}
+
+/* Look up key (see __get_h()) in a frozen hmap */
+static int __frz_get (u_hmap_t *hmap, const void *key, size_t klen,
+        size_t hash, u_hmap_o_t **o)
+{
+    u_hmap_frz_t *frz = hmap->frz;
+    u_hmap_o_t *obj;
+    uint64_t h;
+
+    nop_return_if (frz->n == 0, U_HMAP_ERR_FAIL);
+
+    h = __frz_mix(hash);
+    obj = &frz->objs[__frz_slot(h, frz->disp[__FRZ_RANGE(h >> 32, frz->nb)],
+            frz->n)];
+
+    nop_return_if (__key_comp(hmap, key, klen, obj->key), U_HMAP_ERR_FAIL);
+
+    *o = obj;
+
+    return U_HMAP_ERR_NONE;
+}
+
+/* Longest probe sequence and total probes over all the stored objects */
+static void __probes (u_hmap_t *hmap, size_t *pmax, size_t *psum)
+{
+    u_hmap_o_t *o;
+    size_t i, d;
+
+    *pmax = *psum = 0;
+
+    /* every key sits where its displacement sends it */
+    if (hmap->frz)
+    {
+        *pmax = hmap->frz->n ? 1 : 0;
+        *psum = hmap->frz->n;
+        return;
+    }
+
+    if (hmap->img)
+    {
+        for (i = 0; i <= hmap->img->mask; ++i)
+        {
+            if (hmap->img->slots[i].off == 0)
+                continue;
+
+            d = ((i - hmap->img->slots[i].hash) & hmap->img->mask) + 1;
+            *pmax = U_MAX(*pmax, d);
+            *psum += d;
+        }
+        return;
+    }
+
+    for (i = 0; i < hmap->size + hmap->osize; ++i)
+    {
+        switch (hmap->opts->type)
+        {
+            case U_HMAP_TYPE_ROBINHOOD:
+                if (hmap->slots[i].o == NULL)
+                    continue;
+                d = __RH_DIST(hmap, hmap->slots[i].hash, i) + 1;
+                break;
+
+            case U_HMAP_TYPE_LINEAR:
+                if ((o = LIST_FIRST(&hmap->hmap[i])) == NULL)
+                    continue;
+                d = __IDX(i - __hash(hmap, o->key), hmap->size) + 1;
+                break;
+
+            default:
+                /* the n-th object of a chain takes n comparisons */
+                d = 0;
+                LIST_FOREACH(o, __bucket_at(hmap, i), next)
+                    *psum += ++d;
+                break;
+        }
+
+        *pmax = U_MAX(*pmax, d);
+
+        if (hmap->opts->type != U_HMAP_TYPE_CHAIN)
+            *psum += d;
+    }
+}
+
+/* Monotonic time in nanoseconds (resize timing) */
+static uint64_t __ns_now (void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return (uint64_t) time(NULL) * 1000000000;
+}
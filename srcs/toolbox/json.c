@@ -6,6 +6,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include <toolbox/json.h>
 #include <toolbox/carpal.h>
@@ -13,14 +15,77 @@
 #include <toolbox/memory.h>
 #include <toolbox/lexer.h>
 
+/* Size of the first arena chunk, and cap for the following (doubling) ones. */
+#ifndef U_JSON_ARENA_CHUNK_MIN
+#define U_JSON_ARENA_CHUNK_MIN  4096
+#endif  /* !U_JSON_ARENA_CHUNK_MIN */
+
+#ifndef U_JSON_ARENA_CHUNK_MAX
+#define U_JSON_ARENA_CHUNK_MAX  (1024 * 1024)
+#endif  /* !U_JSON_ARENA_CHUNK_MAX */
+
+/* Private decode flag: strings are unescaped and referenced in place. */
+#define U_JSON_DECODE_INSITU    0x8000
+
+/* Node flags: key/value hold the unescaped text (as opposed to the JSON 
+ * escaped form), which must be escaped again on encoding. */
+#define U_JSON_F_KEY_UNESC      0x01
+#define U_JSON_F_VAL_UNESC      0x02
+
+/* Node flag: container not decoded yet, .val and .vlen hold its JSON text 
+ * (brackets included). */
+#define U_JSON_F_LAZY           0x04
+
+/* Decode the children of a lazy container before looking at them. */
+#define U_JSON_LOAD(jo) \
+        (((jo)->flags & U_JSON_F_LAZY) ? u_json_lazy_load(jo) : 0)
+
+/* Arena chunk: data follows the header.  Aligned blocks (nodes) are taken 
+ * from the bottom and strings from the top, so that no padding is wasted
+ * between them. */
+typedef struct u_json_chunk_s
+{
+    struct u_json_chunk_s *next;
+    size_t lo, hi;              /* Bounds of the free data area. */
+} u_json_chunk_t;
+
+/* Per-document memory arena: nodes and strings of a decoded document are 
+ * carved out of a list of chunks which are given back all at once. */
+typedef struct u_json_arena_s
+{
+    u_json_chunk_t *chunks;     /* Current chunk is on top. */
+    size_t next_sz;             /* Size of the next chunk. */
+    struct u_json_s *owner;     /* The node which releases the arena. */
+    size_t nforeign;            /* Non-arena nodes grafted into the tree. */
+    char insitu;                /* Strings point into the decoded text. */
+} u_json_arena_t;
+
+/* Encoder output window: when full it is either grown (string output) or
+ * drained to the final destination (u_buf_t, file descriptor). */
+typedef struct u_json_wr_s
+{
+    char *buf;                  /* Output window ... */
+    size_t len, sz;             /* ... its used and available bytes. */
+    int (*drain) (struct u_json_wr_s *w, const char *s, size_t len);
+    u_buf_t *ubuf;              /* Destination of u_json_encode_buf() ... */
+    int fd;                     /* ... or u_json_encode_fd(). */
+} u_json_wr_t;
+
 /* Internal representation of any JSON value. */
 struct u_json_s
 {
     u_json_type_t type;
+    unsigned int flags;         /* U_JSON_F_* */
+
+    char *fqn;                  /* Fully qualified name of this (sub)object,
+                                   set only while the tree is indexed. */
+    char *key;                  /* Local name, if applicable (i.e. !anon) */
+    char *val;                  /* If applicable, i.e. (!OBJECT && !ARRAY),
+                                   or text of a lazy container. */
+    size_t klen, vlen;          /* Length of .key and .val */
 
-    char fqn[U_JSON_FQN_SZ];    /* Fully qualified name of this (sub)object. */
-    char key[U_TOKEN_SZ];       /* Local name, if applicable (i.e. !anon) */
-    char val[U_TOKEN_SZ];       /* If applicable, i.e. (!OBJECT && !ARRAY) */
+    /* Arena the node and its strings come from (NULL if on the heap). */
+    u_json_arena_t *arena;
 
     /* Parent container. */
     struct u_json_s *parent;            
@@ -34,8 +99,40 @@ struct u_json_s
     unsigned int depth;         /* Depth of this node in the decoded tree. */
 
     /* Cacheing machinery. */
-    unsigned int icur, count;   /* Aux stuff used when indexing arrays. */
+    unsigned int icur;          /* Aux stuff used when indexing arrays. */
+    unsigned int count;         /* Number of children. */
     u_hmap_t *map;              /* Alias reference to the global cache. */
+
+    /* Children by position (arrays) or hashed by key (objects), built on 
+     * first random access. */
+    struct u_json_s **vec;
+    unsigned int vsz;           /* Slots available in .vec */
+};
+
+/* Objects with less children than this are searched by key linearly. */
+#ifndef U_JSON_KMAP_MIN
+#define U_JSON_KMAP_MIN     8
+#endif  /* !U_JSON_KMAP_MIN */
+
+/* A step of a compiled path. */
+typedef struct
+{
+    enum { 
+        U_JSON_PTR_KEY,         /* ".k": object member */
+        U_JSON_PTR_IDX,         /* "[i]": array element */
+        U_JSON_PTR_ANY          /* "/t": either of them (RFC 6901) */
+    } kind;
+    const char *key;            /* Member name ... */
+    size_t klen;                /* ... its length ... */
+    size_t hash;                /* ... and hash. */
+    unsigned int idx;           /* Element position ... */
+    int has_idx;                /* ... if the step can be read as one. */
+} u_json_ptr_step_t;
+
+struct u_json_ptr_s
+{
+    size_t nsteps;
+    u_json_ptr_step_t *steps;
 };
 
 /* Pointer to the name part of .fqn */
@@ -84,9 +181,11 @@ static void u_json_do_free (u_json_t *jo, size_t l, void *opaque);
 static void u_json_do_index (u_json_t *jo, size_t l, void *map);
 
 /* Encode/Decode/Validate. */
-static int u_json_do_encode (u_json_t *jo, u_string_t *s);
-static int u_json_do_parse (const char *json, u_json_t **pjo, 
+static int u_json_do_encode (u_json_t *jo, int flags, u_json_wr_t *w);
+static int u_json_do_parse (const char *json, int flags, u_json_t **pjo, 
         char status[U_LEXER_ERR_SZ]);
+static int u_json_do_parse_lexer (u_lexer_t *jl, size_t len, int flags, 
+        u_json_t **pjo, char status[U_LEXER_ERR_SZ]);
 
 /* Needed by hmap_easy* because we are storing pointer data not owned by the
  * hmap. */
@@ -99,6 +198,59 @@ static int u_json_new_atom (u_json_type_t type, const char *key,
 
 static int u_json_set_depth (u_json_t *jo, unsigned int depth);
 
+/* Variable length strings and arena. */
+static int u_json_new_ex (u_json_arena_t *arena, u_json_t **pjo);
+static int u_json_set_str (u_json_t *jo, char **ps, size_t *plen, 
+        const char *s, size_t len);
+static void u_json_free_str (u_json_t *jo, char *s);
+static int u_json_set_match (u_json_t *jo, char **ps, size_t *plen, 
+        char *m, size_t len, unsigned int unesc);
+static size_t u_json_unescape (char *s, size_t len);
+static unsigned long u_json_hex4 (const char *p);
+static int u_json_encode_esc (u_json_wr_t *w, const char *str, size_t len);
+static int u_json_wr (u_json_wr_t *w, const char *s, size_t len);
+static int u_json_wr_indent (u_json_wr_t *w, size_t depth);
+static int u_json_wr_close (u_json_wr_t *w, u_json_t *jo, int spaced);
+static int u_json_wr_grow (u_json_wr_t *w, const char *s, size_t len);
+static int u_json_wr_full (u_json_wr_t *w, const char *s, size_t len);
+static int u_json_wr_flush (u_json_wr_t *w, const char *s, size_t len);
+static int u_json_wr_out (u_json_wr_t *w);
+static char *u_json_itoa (long v, char *end);
+static int u_json_arena_new (size_t hint, u_json_arena_t **pa);
+static void *u_json_arena_alloc (u_json_arena_t *a, size_t sz, size_t align);
+static void u_json_arena_free (u_json_arena_t *a);
+static void u_json_do_unindex (u_json_t *jo, size_t l, void *opaque);
+
+/* Child vector of arrays, and key hash of objects. */
+static int u_json_vec_build (u_json_t *jo);
+static int u_json_vec_grow (u_json_t *jo, unsigned int n);
+static void u_json_vec_drop (u_json_t *jo);
+static int u_json_kmap_build (u_json_t *jo);
+static void u_json_kmap_put (u_json_t *jo, u_json_t *c);
+static void u_json_kmap_del (u_json_t *jo, u_json_t *c);
+static u_json_t *u_json_kmap_get (u_json_t *jo, const char *key, size_t klen,
+        size_t hash);
+static size_t u_json_kmap_hash (const char *key, size_t klen);
+static size_t u_json_kmap_chash (u_json_t *c);
+static int u_json_kmap_eq (u_json_t *c, const char *key, size_t klen);
+static const char *u_json_kmap_key (u_json_t *c, size_t *plen, char **ptmp);
+
+/* Compiled paths. */
+static int u_json_ptr_fqn (const char *path, u_json_ptr_t *ptr, char *buf);
+static int u_json_ptr_rfc (const char *path, u_json_ptr_t *ptr, char *buf);
+static int u_json_ptr_idx (const char *s, size_t len, unsigned int *pidx);
+
+/* Lazy decoding. */
+static int u_json_lazy_decode (const char *json, u_json_t **pjo, 
+        char status[U_LEXER_ERR_SZ]);
+static int u_json_lazy_load (u_json_t *jo);
+static int u_json_lazy_load_all (u_json_t *jo);
+static char *u_json_lazy_skip (char *s, char *e, unsigned int depth);
+static char *u_json_lazy_str (char *s, char *e);
+
+/* Empty key or value. */
+static char u_json_nil[] = "";
+
 /**
     \defgroup json JSON
     \{
@@ -121,6 +273,70 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth);
     \endcode
 
 
+    By default each node is allocated on its own, and the same goes for its
+    key and value strings.  Should you decode large documents, or a lot of 
+    them, ::u_json_decode_ex with the ::U_JSON_DECODE_ARENA flag carves all 
+    nodes and strings of the document out of a single per-document arena,
+    which makes decoding cheaper (a handful of allocations per document 
+    instead of a few per node) and ::u_json_free a single release:
+
+    \code
+    dbg_err_if (u_json_decode_ex(big_json, U_JSON_DECODE_ARENA, &jo));
+    ...
+    u_json_free(jo);
+    \endcode
+
+    An arena-backed tree can be modified as any other: nodes added to it
+    are released along with the arena owner, while nodes removed from it
+    are given back (though their memory is reused only once the whole
+    document is free'd).
+
+    If only a few values are going to be read out of a large document, the 
+    ::U_JSON_DECODE_LAZY flag (which implies ::U_JSON_DECODE_ARENA) defers 
+    the decoding of containers to their first access: the text is validated
+    and copied into the arena, then each object or array is turned into
+    nodes one level at a time, as it is entered (via ::u_json_child_first, 
+    ::u_json_array_get_nth, ::u_json_pointer_get, ...), while the subtrees 
+    which are never visited only cost a scan for their closing bracket.
+
+    \code
+    dbg_err_if (u_json_decode_ex(big_json, U_JSON_DECODE_LAZY, &jo));
+    dbg_err_if (u_json_pointer_compile("/records/1000/name", &ptr));
+    name = u_json_get_val(u_json_pointer_get(jo, ptr));
+    \endcode
+
+    When the JSON text lives in a buffer which can be modified, and which 
+    outlives the tree, ::u_json_decode_insitu avoids copying it altogether: 
+    strings are unescaped in place and the nodes point to them.
+
+    \code
+    // 'buf' holds 'len' bytes of JSON text, plus one spare byte
+    dbg_err_if (u_json_decode_insitu(buf, len, &jo));
+    \endcode
+
+    Streams which are too large to be held in memory (or which arrive in
+    pieces, e.g. from a socket) can be parsed without building the tree at
+    all: the ::u_json_sax_t parser is fed with chunks of any size, and 
+    reports each event (object/array start and end, key, string, number, 
+    boolean and null) to the supplied callbacks:
+
+    \code
+    static int on_key (const char *s, size_t len, void *arg)
+    {
+        u_con("key: %.*s", (int) len, s);
+        return 0;   // non-0 stops the parser
+    }
+    ...
+    u_json_sax_cbs_t cbs = { .on_key = on_key };
+
+    dbg_err_if (u_json_sax_new(&cbs, NULL, &p));
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+        dbg_err_ifm (u_json_sax_feed(p, buf, n), "%s", u_json_sax_geterr(p));
+    dbg_err_ifm (u_json_sax_end(p), "%s", u_json_sax_geterr(p));
+    u_json_sax_free(p);
+    \endcode
+
+
     \section validate Validating
 
         Should you just need to check the supplied string for syntax compliance
@@ -133,16 +349,15 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth);
         u_con("Syntax error: %s", status);
     \endcode
 
-    You should not use the validating interface on untrusted input.
-    In fact no maximum nesting depth is enforced on validation -- on the 
-    contrary, the parsing interface has the compile-time define 
-    ::U_JSON_MAX_DEPTH for such purpose -- so a malicious user could make your 
-    application stack explode by simply supplying a big-enough string made by 
-    all \c '[' chars.
-    The intended use of the validating interface is for checking your 
-    hand-crafted JSON strings before pushing them out, i.e. those you've
-    created without going through all the ::u_json_new -> ::u_json_add -> 
-    ::u_json_encode chain.
+    The validator does not go through the lexer: a first pass locates the
+    structural characters, the strings and the scalar values 64 bytes at a 
+    time (using SSE2 or AVX2 instructions when the CPU has them), and the 
+    grammar is then checked on the resulting tape of offsets, without any 
+    recursion.  It is hence way faster than decoding, and no maximum nesting 
+    depth is enforced (the parsing interface instead has the compile-time 
+    define ::U_JSON_MAX_DEPTH), which makes it suitable for rejecting 
+    malformed input early, e.g. via ::u_json_validate_ex on a request body
+    which is not NUL-terminated.
 
 
     \section cache Indexing
@@ -180,6 +395,27 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth);
     by means of ::u_json_deindex -- which invalidates any subsequent cached 
     access attempt.
 
+    Indexing names and hashes every node of the tree, which does not pay off
+    when just a few of them are read.  A path can instead be compiled once
+    (in the same naming scheme, or as a RFC 6901 JSON Pointer) and then 
+    resolved against any tree, visiting only the nodes along the way:
+
+    \code
+    u_json_ptr_t *ptr = NULL;
+
+    // at start-up
+    dbg_err_if (u_json_pointer_compile(".I2[1][1]", &ptr));  // or "/I2/1/1"
+    ...
+    // for each request
+    dbg_err_if (u_json_get_int(u_json_pointer_get(jo, ptr), &l));  // l = 1
+    ...
+    u_json_pointer_free(ptr);
+    \endcode
+
+    The tree is not frozen: array elements and object members are reached
+    through a vector and a key hash which are built at the first access, and
+    then kept up to date by ::u_json_add and ::u_json_remove.
+
 
     \section build Building and Encoding
 
@@ -199,14 +435,24 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth);
     u_json_encode(root, &s);
     \endcode
 
+    The ::u_json_encode_ex variant selects a compact (no white spaces) or a
+    pretty printed (indented) layout, while ::u_json_encode_buf,
+    ::u_json_encode_mem and ::u_json_encode_fd send the same text to a 
+    ::u_buf_t, to a caller supplied memory area, or to a file descriptor in
+    fixed size pieces:
+    \code
+    // {"integer":999} straight to the socket
+    dbg_err_if (u_json_encode_fd(root, U_JSON_ENCODE_COMPACT, sd, 0));
+    \endcode
+
 
     \section iter Iterators
 
     The last basic concept that the user needs to know to work effectively with
     the JSON module is iteration.  Iterators allow efficient and safe traversal
-    of container types (i.e. arrays and objects), where a naive walk strategy 
-    based on ::u_json_array_get_nth would instead lead to performance collapse 
-    as access time is quadratic in the number of elements in the container.
+    of container types (i.e. arrays and objects).  Arrays can also be walked 
+    by position via ::u_json_array_get_nth, which takes constant time once
+    its first call has built a vector of the array elements.
 
     \code
     long i, e;
@@ -277,10 +523,11 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth);
       </tr>
       <tr>
         <td>Set limits on the length and character contents of strings ?</td>
-        <td><b>YES</b></td>
+        <td><b>NO</b></td>
         <td>
-            String length for both keys and values are upper-bounded by
-            the compile-time constant ::U_TOKEN_SZ.
+            Keys and values are stored with their exact length.  Only the 
+            fully qualified names used by the indexing interface are bounded
+            by the compile-time constant ::U_JSON_FQN_SZ.
         </td>
       </tr>
     </table>
@@ -300,26 +547,7 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth);
  */
 int u_json_new (u_json_t **pjo)
 {
-    u_json_t *jo = NULL;
-
-    dbg_return_if (pjo == NULL, ~0);
-
-    warn_err_sif ((jo = u_zalloc(sizeof *jo)) == NULL);
-    TAILQ_INIT(&jo->children);
-    jo->type = U_JSON_TYPE_UNKNOWN;
-    jo->key[0] = jo->val[0] = jo->fqn[0] = '\0';
-    jo->parent = NULL;
-    jo->map = NULL;
-    jo->count = 0;
-    jo->depth = 0;
-
-    *pjo = jo;
-
-    return 0;
-err:
-    if (jo)
-        u_free(jo);
-    return ~0;
+    return u_json_new_ex(NULL, pjo);
 }
 
 /**
@@ -348,6 +576,13 @@ int u_json_set_type (u_json_t *jo, u_json_type_t type)
         case U_JSON_TYPE_FALSE:
         case U_JSON_TYPE_NULL:
         case U_JSON_TYPE_UNKNOWN:
+            /* The child vector is maintained for arrays only, and lazy 
+             * containers are decoded according to their type. */
+            if (type != jo->type)
+            {
+                dbg_return_if (U_JSON_LOAD(jo), ~0);
+                u_json_vec_drop(jo);
+            }
             jo->type = type;
             break;
         default:
@@ -417,7 +652,7 @@ int u_json_set_val_ex (u_json_t *jo, const char *val, char check)
             goto end;
     }
 
-    dbg_return_if (u_strlcpy(jo->val, val, sizeof jo->val), ~0);
+    dbg_err_if (u_json_set_str(jo, &jo->val, &jo->vlen, val, strlen(val)));
 
     /* Fall through. */       
 end:
@@ -445,7 +680,15 @@ int u_json_set_key (u_json_t *jo, const char *key)
     dbg_return_if (jo == NULL, ~0);
     dbg_return_ifm (jo->map, ~0, "Cannot set key of a cached object");
 
-    dbg_return_if (u_strlcpy(jo->key, key ? key : "", sizeof jo->key), ~0);
+    if (key == NULL)
+        key = "";
+
+    dbg_return_if (u_json_set_str(jo, &jo->key, &jo->klen, key, strlen(key)),
+            ~0);
+
+    /* The parent key hash (if any) must be built again. */
+    if (jo->parent && jo->parent->type == U_JSON_TYPE_OBJECT)
+        u_json_vec_drop(jo->parent);
 
     return 0;
 }
@@ -481,6 +724,7 @@ int u_json_add (u_json_t *head, u_json_t *jo)
     dbg_return_if (!U_JSON_OBJ_IS_CONTAINER(head), ~0);
     dbg_return_ifm (head->map, ~0, "Cannot add new child to a cached object");
     dbg_return_if (jo == NULL, ~0);
+    dbg_return_if (U_JSON_LOAD(head), ~0);
 
 #ifdef U_JSON_OBJ_DEBUG
     u_con("chld (%p): %s {%s} added at depth %u", 
@@ -492,9 +736,29 @@ int u_json_add (u_json_t *head, u_json_t *jo)
     TAILQ_INSERT_TAIL(&head->children, jo, siblings);
     jo->parent = head;
 
-    /* Adjust children counter for array-type parents. */
-    if (head->type == U_JSON_TYPE_ARRAY)
-        head->count += 1;
+    /* Nodes which don't belong to the arena of their new parent must be 
+     * visited one by one when the tree is free'd. */
+    if (head->arena && jo->arena != head->arena)
+        head->arena->nforeign += 1;
+
+    head->count += 1;
+
+    /* Adjust children vector (arrays) or key hash (objects), if built.  
+     * Should they fail to grow, drop them: they will be built again on next 
+     * random access. */
+    if (head->vec == NULL)
+        ;
+    else if (head->type == U_JSON_TYPE_ARRAY)
+    {
+        if (head->count > head->vsz && u_json_vec_grow(head, head->count))
+            u_json_vec_drop(head);
+        else
+            head->vec[head->count - 1] = jo;
+    }
+    else if (head->count * 2 <= head->vsz)
+        u_json_kmap_put(head, jo);
+    else if (u_json_kmap_build(head))
+        u_json_vec_drop(head);
 
     return 0;
 }
@@ -515,7 +779,81 @@ int u_json_add (u_json_t *head, u_json_t *jo)
  */
 int u_json_decode (const char *json, u_json_t **pjo)
 {
-    return u_json_do_parse(json, pjo, NULL);
+    return u_json_do_parse(json, 0, pjo, NULL);
+}
+
+/**
+ *  \brief  Break down a JSON string into pieces (with options)
+ *
+ *  Same as ::u_json_decode, with decoding behaviour tuned by \p flags.
+ *
+ *  With ::U_JSON_DECODE_LAZY, \p json is validated and copied into the 
+ *  arena of the returned tree, but containers are only scanned for their 
+ *  bounds: their children are decoded when first accessed (e.g. via 
+ *  ::u_json_child_first, ::u_json_array_get_nth, ::u_json_pointer_get or 
+ *  ::u_json_encode), one level at a time.
+ *
+ *  \param  json    A NUL-terminated string containing some serialized JSON
+ *  \param  flags   Bitwise inclusive OR of decode flags, i.e. 
+ *                  ::U_JSON_DECODE_ARENA, ::U_JSON_DECODE_LAZY, or \c 0 
+ *  \param  pjo     Result argument which will point to the internal 
+ *                  representation of the parsed \p json string
+ *
+ *  \retval ~0  on failure
+ *  \retval  0  on success
+ */
+int u_json_decode_ex (const char *json, int flags, u_json_t **pjo)
+{
+    dbg_return_if (pjo == NULL, ~0);
+    dbg_return_ifm (flags & ~(U_JSON_DECODE_ARENA | U_JSON_DECODE_LAZY), ~0,
+            "bad flags %x", flags);
+
+    if (flags & U_JSON_DECODE_LAZY)
+        return u_json_lazy_decode(json, pjo, NULL);
+
+    return u_json_do_parse(json, flags, pjo, NULL);
+}
+
+/**
+ *  \brief  Decode a JSON string in place
+ *
+ *  Decode the \p len bytes of JSON text at \p json without copying them:
+ *  string keys and values are unescaped where they lie and the resulting 
+ *  nodes (which come from a per-document arena, as with 
+ *  ::U_JSON_DECODE_ARENA) reference them directly.  Hence \p json is 
+ *  modified, and must not be released or changed until the returned tree
+ *  is ::u_json_free'd.
+ *
+ *  Differently from the other decoding interfaces, keys and values returned
+ *  by ::u_json_get_val and friends are unescaped (e.g. \c "\u00e8" 
+ *  becomes its UTF-8 encoding).  They are escaped back by ::u_json_encode.
+ *  Unpaired surrogates (e.g. \c "\uD83D" alone) are replaced by U+FFFD, 
+ *  while strings containing \c "\u0000" can't be decoded in place, as they
+ *  would be truncated by their NUL terminator.
+ *
+ *  \param  json    The JSON text, which must have room for \p len + 1 bytes:
+ *                  the byte past the text is overwritten with a NUL
+ *  \param  len     Length of the JSON text
+ *  \param  pjo     Result argument which will point to the internal 
+ *                  representation of the parsed \p json string
+ *
+ *  \retval ~0  on failure
+ *  \retval  0  on success
+ */
+int u_json_decode_insitu (char *json, size_t len, u_json_t **pjo)
+{
+    u_lexer_t *jl = NULL;
+
+    dbg_return_if (json == NULL, ~0);
+    dbg_return_if (pjo == NULL, ~0);
+
+    /* Terminate the text (the lexer expects a NUL past its end). */
+    json[len] = '\0';
+
+    /* The lexer uses the text where it lies. */
+    dbg_return_if (u_lexer_new_ref(json, len, &jl), ~0);
+
+    return u_json_do_parse_lexer(jl, len, U_JSON_DECODE_INSITU, pjo, NULL);
 }
 
 /**
@@ -523,6 +861,7 @@ int u_json_decode (const char *json, u_json_t **pjo)
  *
  *  Validate the supplied JSON string \p json.  In case \p json contains 
  *  invalid syntax, the parser/lexer error message is returned into \p status.
+ *  See ::u_json_validate_ex for details.
  *
  *  \param  json    A NUL-terminated string containing some serialized JSON
  *  \param  status  In case of error, this result argument will contain an
@@ -533,14 +872,17 @@ int u_json_decode (const char *json, u_json_t **pjo)
  */
 int u_json_validate (const char *json, char status[U_LEXER_ERR_SZ])
 {
-    /* Just try to validate the input string (do not build the tree). */
-    return u_json_do_parse(json, NULL, status);
+    dbg_return_if (json == NULL, ~0);
+
+    return u_json_validate_ex(json, strlen(json), status);
 }
 
 /**
  *  \brief  Dispose any resource allocated to a JSON object
  *
  *  Dispose any resource allocated to the supplied JSON object \p jo
+ *  and its children.  In case \p jo is an arena-backed document (see
+ *  ::U_JSON_DECODE_ARENA) this boils down to releasing the arena.
  *
  *  \param  jo  Pointer to the ::u_json_t object that must be free'd
  *
@@ -548,7 +890,7 @@ int u_json_validate (const char *json, char status[U_LEXER_ERR_SZ])
  */
 void u_json_free (u_json_t *jo)
 {
-    size_t dummy = 0;
+    u_json_t *cur, *next, *c;
 
     if (jo == NULL)
         return;
@@ -560,8 +902,30 @@ void u_json_free (u_json_t *jo)
         jo->map = NULL;
     }
  
-    /* Walk the tree in post order and free each node while we traverse. */
-    u_json_walk(jo, U_JSON_WALK_POSTORDER, dummy, u_json_do_free, NULL);
+    /* Post-order visit of the subtree rooted at 'jo' (and not its siblings),
+     * unlinking each node from its parent before releasing it, so that the 
+     * parent is revisited when its last child is gone.  Subtrees made only 
+     * of arena nodes are not descended into: the arena owner takes them
+     * all away. */
+    for (cur = jo; cur != NULL; cur = next)
+    {
+        if ((cur->arena == NULL || cur->arena->nforeign) && 
+                (c = TAILQ_FIRST(&cur->children)) != NULL)
+        {
+            next = c;
+            continue;
+        }
+
+        if (cur == jo)
+            next = NULL;
+        else
+        {
+            next = cur->parent;
+            TAILQ_REMOVE(&next->children, cur, siblings);
+        }
+
+        u_json_do_free(cur, 0, NULL);
+    }
 
     return;
 }
@@ -580,19 +944,167 @@ void u_json_free (u_json_t *jo)
  */
 int u_json_encode (u_json_t *jo, char **ps)
 {
-    u_string_t *s = NULL;
+    return u_json_encode_ex(jo, 0, ps, NULL);
+}
+
+/**
+ *  \brief  Encode a JSON object with options
+ *
+ *  Encode the supplied JSON object \p jo to the result string pointed by 
+ *  \p *ps (to be free'd by the caller via ::u_free).  The default layout,
+ *  as produced by ::u_json_encode, is <tt>{ "k": [ 1, 2 ] }</tt>; \p flags
+ *  can select ::U_JSON_ENCODE_COMPACT (<tt>{"k":[1,2]}</tt>) or 
+ *  ::U_JSON_ENCODE_PRETTY (one member or element per line, indented by 
+ *  four spaces per nesting level).
+ *
+ *  The tree is walked iteratively, so that neither the number of siblings
+ *  nor the nesting depth are bounded by the process stack.
+ *
+ *  \param  jo      Pointer to the ::u_json_t object that must be encoded
+ *  \param  flags   ::U_JSON_ENCODE_COMPACT, ::U_JSON_ENCODE_PRETTY or 0
+ *  \param  ps      serialized JSON text corresponding to \p jo
+ *  \param  plen    if not \c NULL, holds the length of \p *ps on success
+ *
+ *  \retval ~0  on failure
+ *  \retval  0  on success
+ */
+int u_json_encode_ex (u_json_t *jo, int flags, char **ps, size_t *plen)
+{
+    u_json_wr_t w;
 
     dbg_return_if (jo == NULL, ~0);
     dbg_return_if (ps == NULL, ~0);
 
-    dbg_err_if (u_string_create(NULL, 0, &s));
-    dbg_err_if (u_json_do_encode(jo, s));
-    *ps = u_string_detach_cstr(s);
+    memset(&w, 0, sizeof w);
+    w.drain = u_json_wr_grow;
+
+    dbg_err_if (u_json_do_encode(jo, flags, &w));
+
+    /* Room for the terminating NUL is always kept (see u_json_wr_grow). */
+    w.buf[w.len] = '\0';
+
+    *ps = w.buf;
+    if (plen)
+        *plen = w.len;
+
+    return 0;
+err:
+    U_FREE(w.buf);
+    return ~0;
+}
+
+/**
+ *  \brief  Encode a JSON object appending it to a buffer
+ *
+ *  Same as ::u_json_encode_ex, but the serialized JSON text is appended to
+ *  the supplied ::u_buf_t \p ubuf.
+ *
+ *  \param  jo      Pointer to the ::u_json_t object that must be encoded
+ *  \param  flags   ::U_JSON_ENCODE_COMPACT, ::U_JSON_ENCODE_PRETTY or 0
+ *  \param  ubuf    the buffer which the JSON text is appended to
+ *
+ *  \retval ~0  on failure (in which case \p ubuf may hold part of the text)
+ *  \retval  0  on success
+ */
+int u_json_encode_buf (u_json_t *jo, int flags, u_buf_t *ubuf)
+{
+    u_json_wr_t w;
+    char win[U_JSON_ENCODE_BUFSZ];
+
+    dbg_return_if (jo == NULL, ~0);
+    dbg_return_if (ubuf == NULL, ~0);
+
+    memset(&w, 0, sizeof w);
+    w.buf = win;
+    w.sz = sizeof win;
+    w.drain = u_json_wr_flush;
+    w.ubuf = ubuf;
+
+    dbg_err_if (u_json_do_encode(jo, flags, &w));
+    dbg_err_if (u_json_wr_out(&w));
+
+    return 0;
+err:
+    return ~0;
+}
+
+/**
+ *  \brief  Encode a JSON object into a caller supplied memory area
+ *
+ *  Same as ::u_json_encode_ex, but the NUL-terminated JSON text is written
+ *  to the \p sz bytes at \p buf, without any memory allocation.
+ *
+ *  \param  jo      Pointer to the ::u_json_t object that must be encoded
+ *  \param  flags   ::U_JSON_ENCODE_COMPACT, ::U_JSON_ENCODE_PRETTY or 0
+ *  \param  buf     the memory area which receives the JSON text
+ *  \param  sz      size of \p buf
+ *  \param  plen    if not \c NULL, holds the length of the text on success
+ *
+ *  \retval ~0  on failure, e.g. if \p buf is too small
+ *  \retval  0  on success
+ */
+int u_json_encode_mem (u_json_t *jo, int flags, char *buf, size_t sz, 
+        size_t *plen)
+{
+    u_json_wr_t w;
+
+    dbg_return_if (jo == NULL, ~0);
+    dbg_return_if (buf == NULL, ~0);
+    dbg_return_if (sz == 0, ~0);
+
+    memset(&w, 0, sizeof w);
+    w.buf = buf;
+    w.sz = sz - 1;      /* Keep room for the NUL. */
+    w.drain = u_json_wr_full;
+
+    dbg_err_if (u_json_do_encode(jo, flags, &w));
+
+    buf[w.len] = '\0';
+    if (plen)
+        *plen = w.len;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/**
+ *  \brief  Encode a JSON object streaming it to a file descriptor
+ *
+ *  Same as ::u_json_encode_ex, but the serialized JSON text is written to 
+ *  \p fd each time \p bufsz bytes have been produced, so that the memory 
+ *  needed does not depend on the size of the output.
+ *
+ *  \param  jo      Pointer to the ::u_json_t object that must be encoded
+ *  \param  flags   ::U_JSON_ENCODE_COMPACT, ::U_JSON_ENCODE_PRETTY or 0
+ *  \param  fd      the file descriptor which the JSON text is written to
+ *  \param  bufsz   flush size in bytes, or 0 for ::U_JSON_ENCODE_BUFSZ
+ *
+ *  \retval ~0  on failure (in which case part of the text may have been
+ *              written already)
+ *  \retval  0  on success
+ */
+int u_json_encode_fd (u_json_t *jo, int flags, int fd, size_t bufsz)
+{
+    u_json_wr_t w;
+
+    dbg_return_if (jo == NULL, ~0);
+    dbg_return_if (fd < 0, ~0);
+
+    memset(&w, 0, sizeof w);
+    w.sz = bufsz ? bufsz : U_JSON_ENCODE_BUFSZ;
+    w.drain = u_json_wr_flush;
+    w.fd = fd;
+
+    dbg_err_sif ((w.buf = u_malloc(w.sz)) == NULL);
+    dbg_err_if (u_json_do_encode(jo, flags, &w));
+    dbg_err_if (u_json_wr_out(&w));
+
+    u_free(w.buf);
 
     return 0;
 err:
-    if (s)
-        u_string_free(s);
+    U_FREE(w.buf);
     return ~0;
 }
 
@@ -619,6 +1131,9 @@ void u_json_walk (u_json_t *jo, int strategy, size_t l,
     if (jo == NULL)
         return;
 
+    /* Lazy containers are decoded before being handed to the callback. */
+    dbg_if (U_JSON_LOAD(jo));
+
     if (strategy == U_JSON_WALK_PREORDER && cb)
         cb(jo, l, cb_args);
 
@@ -669,7 +1184,7 @@ void u_json_print (u_json_t *jo)
  */
 int u_json_index (u_json_t *jo)
 {
-    size_t u;   /* Unused. */
+    size_t u = 0;   /* Unused. */
     u_hmap_opts_t *opts = NULL;
     u_hmap_t *hmap = NULL;
 
@@ -677,6 +1192,9 @@ int u_json_index (u_json_t *jo)
     nop_return_if (jo->map, 0);     /* If already cached, return ok. */
     dbg_return_if (jo->parent, ~0); /* Cache can be created on top-objs only. */
 
+    /* Containers can't be decoded once cached: do it now for all of them. */
+    dbg_return_if (u_json_lazy_load_all(jo), ~0);
+
     /* Create the associative array. */
     dbg_err_if (u_hmap_opts_new(&opts));
     dbg_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_POINTER));
@@ -715,11 +1233,15 @@ err:
  */
 int u_json_unindex (u_json_t *jo)
 {
+    size_t u = 0;
+
     dbg_return_if (jo == NULL, ~0);
     nop_return_if (jo->map == NULL, 0);
 
     u_hmap_easy_free(jo->map);
-    jo->map = NULL;
+
+    /* Drop cache references and names from every node. */
+    u_json_walk(jo, U_JSON_WALK_PREORDER, u, u_json_do_unindex, NULL);
 
     return 0;
 }
@@ -757,7 +1279,7 @@ u_json_t *u_json_cache_get (u_json_t *jo, const char *name)
 
     /* If 'name' is relative, we need to prefix it with the parent name 
      * space. */
-    dbg_if (u_snprintf(fqn, sizeof fqn, "%s%s", jo->fqn, name));
+    dbg_if (u_snprintf(fqn, sizeof fqn, "%s%s", jo->fqn ? jo->fqn : "", name));
 
     return (u_json_t *) u_hmap_easy_get(jo->map, fqn);
 }
@@ -783,13 +1305,13 @@ int u_json_cache_set_tv (u_json_t *jo, const char *name,
 {
     u_json_t *res;
 
-    dbg_return_if (U_JSON_OBJ_IS_CONTAINER(jo), ~0);
     dbg_return_if (type == U_JSON_TYPE_OBJECT || type == U_JSON_TYPE_ARRAY, ~0);
     /* 'jo' and 'name' will be checked by u_json_cache_get(); 
      * 'val' consistency is checked after type has been set. */
 
-    /* Retrieve the node. */
+    /* Retrieve the (leaf) node. */
     dbg_err_if ((res = u_json_cache_get(jo, name)) == NULL);
+    dbg_err_if (U_JSON_OBJ_IS_CONTAINER(res));
 
     /* First set type (in case !unknown) so that we know how to check the
      * subsequent value setting. */
@@ -799,7 +1321,11 @@ int u_json_cache_set_tv (u_json_t *jo, const char *name,
     /* Set value.  The caller must have supplied some non-NULL 'val' in case 
      * the final underlying type is a string or a number. */
     if (res->type == U_JSON_TYPE_STRING || res->type == U_JSON_TYPE_NUMBER)
-        dbg_err_if (val == NULL || u_strlcpy(res->val, val, sizeof res->val));
+    {
+        dbg_err_if (val == NULL);
+        dbg_err_if (u_json_set_str(res, &res->val, &res->vlen, 
+                    val, strlen(val)));
+    }
 
     return 0;
 err:
@@ -811,31 +1337,37 @@ unsigned int u_json_array_count (u_json_t *jo)
 {
     dbg_return_if (jo == NULL, 0);
     dbg_return_if (jo->type != U_JSON_TYPE_ARRAY, 0);
+    dbg_return_if (U_JSON_LOAD(jo), 0);
 
     return jo->count;
 }
 
-/** \brief  Get n-th element from \p jo array.  */
+/**
+ *  \brief  Get n-th element from \p jo array.
+ *
+ *  Get the element at position \p n (starting from \c 0) of the array \p jo.
+ *  The first call builds a vector of the array children, which is then kept
+ *  up to date by ::u_json_add and ::u_json_remove, so that any subsequent 
+ *  access takes constant time.
+ *
+ *  \param  jo  Pointer to an array-type ::u_json_t object
+ *  \param  n   Position of the requested element
+ *
+ *  \return the requested element, or \c NULL if \p n is out of bounds
+ */
 u_json_t *u_json_array_get_nth (u_json_t *jo, unsigned int n)
 {
     u_json_t *elem;
 
     dbg_return_if (jo == NULL, NULL);
     dbg_return_if (jo->type != U_JSON_TYPE_ARRAY, NULL);
+    dbg_return_if (U_JSON_LOAD(jo), NULL);
     dbg_return_if (n >= jo->count, NULL);
 
-    /* Use cache if available. */
-    if (jo->map)
-    {
-        char elem_fqn[U_JSON_FQN_SZ] = { '\0' };
-        dbg_if (u_snprintf(elem_fqn, sizeof elem_fqn, "%s[%u]", jo->fqn, n));
-        return u_json_cache_get(jo, elem_fqn);
-    }
-    
-    /* Too bad if we don't have cache in place: we have to go through the 
-     * list which is quadratic even with the following silly optimisation.
-     * So it's ok for a couple of lookups, but if done systematically it's
-     * an overkill.  Freeze instead ! */
+    if (jo->vec != NULL || u_json_vec_build(jo) == 0)
+        return jo->vec[n];
+
+    /* No memory for the vector: go through the list from the nearest end. */
     if (n > (jo->count / 2))
     {
         unsigned int r = jo->count - (n + 1);
@@ -977,6 +1509,108 @@ int u_json_cache_get_bool (u_json_t *jo, const char *name, char *pval)
     return u_json_get_bool(res, pval);
 }
 
+/**
+ *  \brief  Compile a path to a JSON node
+ *
+ *  Parse the supplied \p path once and for all, so that it can be resolved
+ *  against any number of trees via ::u_json_pointer_get.  Two syntaxes are
+ *  understood:
+ *      - the cache naming scheme (see \ref cache), i.e. ".a.b[3].c", where 
+ *        a member name extends up to the next '.' or '[';
+ *      - the JSON Pointer syntax of RFC 6901, i.e. "/a/b/3/c", where '~1' 
+ *        and '~0' stand for '/' and '~' in member names, and each token 
+ *        selects either an object member or an array element (depending
+ *        on the node found at that point).
+ *
+ *  \param  path    The path string, beginning with '.' or '/' (or empty,
+ *                  which is the RFC 6901 path to the root node)
+ *  \param  pptr    Result argument carrying the compiled path, to be free'd
+ *                  via ::u_json_pointer_free
+ *
+ *  \retval  0  on success
+ *  \retval ~0  on failure (e.g. malformed \p path)
+ */
+int u_json_pointer_compile (const char *path, u_json_ptr_t **pptr)
+{
+    size_t len, n;
+    const char *s;
+    u_json_ptr_t *ptr = NULL;
+
+    dbg_return_if (path == NULL, ~0);
+    dbg_return_if (pptr == NULL, ~0);
+
+    /* One step at most per separator: steps and (unescaped) member names 
+     * share the same block. */
+    for (len = n = 0, s = path; *s != '\0'; s++, len++)
+        n += (*s == '.' || *s == '[' || *s == '/');
+
+    warn_err_sif ((ptr = u_zalloc(sizeof *ptr + n * sizeof *ptr->steps + 
+                    len + 1)) == NULL);
+    ptr->steps = (u_json_ptr_step_t *) (ptr + 1);
+
+    if (path[0] == '.')
+        dbg_err_ifm (u_json_ptr_fqn(path, ptr, (char *) (ptr->steps + n)), 
+                "bad path: %s", path);
+    else
+        dbg_err_ifm (u_json_ptr_rfc(path, ptr, (char *) (ptr->steps + n)),
+                "bad JSON pointer: %s", path);
+
+    *pptr = ptr;
+
+    return 0;
+err:
+    U_FREE(ptr);
+    return ~0;
+}
+
+/**
+ *  \brief  Resolve a compiled path
+ *
+ *  Retrieve the node reached by following the compiled path \p ptr from 
+ *  \p jo (which needs not be the root of its tree).  Only the nodes along 
+ *  the path are visited: array elements are reached through the vector
+ *  used by ::u_json_array_get_nth, and object members through a key hash
+ *  which is built on first access, and kept up to date as the object is
+ *  modified.  No ::u_json_index is needed, nor used.
+ *
+ *  \param  jo      Pointer to the ::u_json_t object that must be searched
+ *  \param  ptr     A path compiled via ::u_json_pointer_compile
+ *
+ *  \return the retrieved JSON (sub)object on success; \c NULL in case the
+ *          path does not lead anywhere in \p jo
+ */
+u_json_t *u_json_pointer_get (u_json_t *jo, const u_json_ptr_t *ptr)
+{
+    size_t i;
+    const u_json_ptr_step_t *st;
+
+    dbg_return_if (jo == NULL, NULL);
+    dbg_return_if (ptr == NULL, NULL);
+
+    for (i = 0; i < ptr->nsteps && jo != NULL; i++)
+    {
+        st = &ptr->steps[i];
+        dbg_return_if (U_JSON_LOAD(jo), NULL);
+
+        if (jo->type == U_JSON_TYPE_OBJECT && st->kind != U_JSON_PTR_IDX)
+            jo = u_json_kmap_get(jo, st->key, st->klen, st->hash);
+        else if (jo->type == U_JSON_TYPE_ARRAY && st->kind != U_JSON_PTR_KEY 
+                && st->has_idx && st->idx < jo->count)
+            jo = u_json_array_get_nth(jo, st->idx);
+        else
+            return NULL;
+    }
+
+    return jo;
+}
+
+/** \brief  Free a path compiled via ::u_json_pointer_compile. */
+void u_json_pointer_free (u_json_ptr_t *ptr)
+{
+    U_FREE(ptr);
+    return;
+}
+
 /**
  *  \brief  Remove an object from its JSON container.
  *
@@ -997,9 +1631,23 @@ int u_json_remove (u_json_t *jo)
 
     if ((p = jo->parent))
     {            
-        /* Fix counters when parent is an array. */
-        if (p->type == U_JSON_TYPE_ARRAY)
-            p->count -= 1;
+        /* Fix counter and vector (arrays) or key hash (objects).  Array
+         * elements are more often removed from the tail, so look for it 
+         * from there. */
+        if (p->vec && p->type == U_JSON_TYPE_ARRAY)
+        {
+            unsigned int i = p->count;
+
+            while (p->vec[--i] != jo)
+                ;
+
+            memmove(p->vec + i, p->vec + i + 1, 
+                    (p->count - i - 1) * sizeof *p->vec);
+        }
+        else if (p->vec)
+            u_json_kmap_del(p, jo);
+
+        p->count -= 1;
 
         /* Evict from the parent container. */
         TAILQ_REMOVE(&p->children, jo, siblings);
@@ -1049,12 +1697,13 @@ int u_json_new_real (const char *key, double val, u_json_t **pjo)
 /** \brief  Create new JSON number object from long integer. */
 int u_json_new_int (const char *key, long val, u_json_t **pjo)
 {
-    char sval[U_TOKEN_SZ];
+    char sval[32];
 
-    dbg_return_if (u_snprintf(sval, sizeof sval, "%ld", val), ~0);
+    sval[sizeof sval - 1] = '\0';
 
-    /* Assume 'sval' correctly formatted (no need to validate). */
-    return u_json_new_atom(U_JSON_TYPE_NUMBER, key, sval, 0, pjo);
+    /* Assume the result correctly formatted (no need to validate). */
+    return u_json_new_atom(U_JSON_TYPE_NUMBER, key, 
+            u_json_itoa(val, sval + sizeof sval - 1), 0, pjo);
 }
 
 /** \brief  Create new JSON null object. */
@@ -1078,6 +1727,7 @@ u_json_t *u_json_child_first (u_json_t *jo)
 {
     dbg_return_if (jo == NULL, NULL);
     dbg_return_if (!U_JSON_OBJ_IS_CONTAINER(jo), NULL);
+    dbg_return_if (U_JSON_LOAD(jo), NULL);
 
     return TAILQ_FIRST(&jo->children);
 }
@@ -1088,6 +1738,7 @@ u_json_t *u_json_child_last (u_json_t *jo)
 {
     dbg_return_if (jo == NULL, NULL);
     dbg_return_if (!U_JSON_OBJ_IS_CONTAINER(jo), NULL);
+    dbg_return_if (U_JSON_LOAD(jo), NULL);
 
     return TAILQ_LAST(&jo->children, u_json_chld_s);
 }
@@ -1134,65 +1785,109 @@ u_json_t *u_json_it_prev (u_json_it_t *it)
  *  \}
  */ 
 
-static int u_json_do_encode (u_json_t *jo, u_string_t *s)
+/* Literal string 'lit' to the encoder output. */
+#define U_JSON_WR_LIT(w, lit)   u_json_wr(w, lit, sizeof(lit) - 1)
+
+/* Pre-order walk of 'jo' along the child/sibling/parent links, so that the
+ * parent chain of the current node is the stack of the open containers. */
+static int u_json_do_encode (u_json_t *jo, int flags, u_json_wr_t *w)
 {
-    if (jo == NULL)
-        return 0;
+    u_json_t *cur = jo, *next = NULL;
+    size_t depth = 0;
+    int pretty = (flags & U_JSON_ENCODE_PRETTY),
+        spaced = !(flags & (U_JSON_ENCODE_COMPACT | U_JSON_ENCODE_PRETTY));
 
-    /* Optional key. */
-    if (strlen(jo->key))
-        dbg_err_if (u_string_aprintf(s, "\"%s\": ", jo->key));
+    dbg_return_if ((flags & U_JSON_ENCODE_COMPACT) && pretty, ~0);
 
-    /* Value. */
-    switch (jo->type)
+    for (;;)
     {
-        case U_JSON_TYPE_STRING:
-            dbg_err_if (u_string_aprintf(s, "\"%s\"", jo->val));
-            break;
-        case U_JSON_TYPE_NUMBER:
-            dbg_err_if (u_string_aprintf(s, "%s", jo->val));
-            break;
-        case U_JSON_TYPE_OBJECT:
-            dbg_err_if (u_string_aprintf(s, "{ "));
-            break;
-        case U_JSON_TYPE_ARRAY:
-            dbg_err_if (u_string_aprintf(s, "[ "));
-            break;
-        case U_JSON_TYPE_TRUE:
-            dbg_err_if (u_string_aprintf(s, "true"));
-            break;
-        case U_JSON_TYPE_FALSE:
-            dbg_err_if (u_string_aprintf(s, "false"));
-            break;
-        case U_JSON_TYPE_NULL:
-            dbg_err_if (u_string_aprintf(s, "null"));
-            break;
-        default:
-            dbg_err("!");
-    }
+        /* Key, if in an object (or if the encoded node has one). */
+        if ((cur == jo) ? cur->klen != 0 : 
+                cur->parent->type == U_JSON_TYPE_OBJECT)
+        {
+            if (cur->flags & U_JSON_F_KEY_UNESC)
+                dbg_err_if (u_json_encode_esc(w, cur->key, cur->klen));
+            else
+            {
+                dbg_err_if (U_JSON_WR_LIT(w, "\""));
+                dbg_err_if (u_json_wr(w, cur->key, cur->klen));
+                dbg_err_if (U_JSON_WR_LIT(w, "\""));
+            }
 
-    /* Explore depth. */
-    dbg_err_if (u_json_do_encode(TAILQ_FIRST(&jo->children), s));
+            dbg_err_if (spaced || pretty ? U_JSON_WR_LIT(w, ": ") :
+                    U_JSON_WR_LIT(w, ":"));
+        }
 
-    /* Close matching paren. */
-    switch (jo->type)
-    {
-        case U_JSON_TYPE_ARRAY:
-            dbg_err_if (u_string_aprintf(s, " ]"));
-            break;
-        case U_JSON_TYPE_OBJECT:
-            dbg_err_if (u_string_aprintf(s, " }"));
-            break;
-        default:
-            break;
-    }
+        /* Value. */
+        switch (cur->type)
+        {
+            case U_JSON_TYPE_STRING:
+                if (cur->flags & U_JSON_F_VAL_UNESC)
+                {
+                    dbg_err_if (u_json_encode_esc(w, cur->val, cur->vlen));
+                    break;
+                }
+                dbg_err_if (U_JSON_WR_LIT(w, "\""));
+                dbg_err_if (u_json_wr(w, cur->val, cur->vlen));
+                dbg_err_if (U_JSON_WR_LIT(w, "\""));
+                break;
+            case U_JSON_TYPE_NUMBER:
+                dbg_err_if (u_json_wr(w, cur->val, cur->vlen));
+                break;
+            case U_JSON_TYPE_OBJECT:
+                dbg_err_if (u_json_wr(w, "{ ", spaced ? 2 : 1));
+                break;
+            case U_JSON_TYPE_ARRAY:
+                dbg_err_if (u_json_wr(w, "[ ", spaced ? 2 : 1));
+                break;
+            case U_JSON_TYPE_TRUE:
+                dbg_err_if (U_JSON_WR_LIT(w, "true"));
+                break;
+            case U_JSON_TYPE_FALSE:
+                dbg_err_if (U_JSON_WR_LIT(w, "false"));
+                break;
+            case U_JSON_TYPE_NULL:
+                dbg_err_if (U_JSON_WR_LIT(w, "null"));
+                break;
+            default:
+                dbg_err("!");
+        }
+
+        /* Go down to the first child, if any ... */
+        if (U_JSON_OBJ_IS_CONTAINER(cur))
+        {
+            dbg_err_if (U_JSON_LOAD(cur));
+
+            if ((next = TAILQ_FIRST(&cur->children)) != NULL)
+            {
+                depth += 1;
+                dbg_err_if (pretty && u_json_wr_indent(w, depth));
+                cur = next;
+                continue;
+            }
+
+            dbg_err_if (u_json_wr_close(w, cur, spaced));
+        }
+
+        /* ... else to the next sibling, closing the containers which have
+         * been completed on the way up. */
+        for (; cur != jo; cur = cur->parent)
+        {
+            if ((next = TAILQ_NEXT(cur, siblings)) != NULL)
+                break;
+
+            depth -= 1;
+            dbg_err_if (pretty && u_json_wr_indent(w, depth));
+            dbg_err_if (u_json_wr_close(w, cur->parent, spaced));
+        }
 
-    /* When needed, add comma to separate siblings. */
-    if (TAILQ_NEXT(jo, siblings))
-        dbg_err_if (u_string_aprintf(s, ", "));
+        if (cur == jo)
+            break;
 
-    /* Explore horizontally. */
-    dbg_err_if (u_json_do_encode(TAILQ_NEXT(jo, siblings), s));
+        dbg_err_if (u_json_wr(w, ", ", spaced ? 2 : 1));
+        dbg_err_if (pretty && u_json_wr_indent(w, depth));
+        cur = next;
+    }
 
     return 0;
 err:
@@ -1279,7 +1974,8 @@ static int u_json_match_string_first (u_lexer_t *jl)
 /* number ::= INT[FRAC][EXP] */
 static int u_json_match_number (u_lexer_t *jl, u_json_t *jo)
 {
-    char match[U_TOKEN_SZ];
+    size_t mlen;
+    const char *match;
 
     /* INT is mandatory */
     dbg_err_if (u_json_match_int(jl));
@@ -1297,18 +1993,17 @@ static int u_json_match_number (u_lexer_t *jl, u_json_t *jo)
 
     /* Take care of the fact that the match includes the first non-number char
      * (see u_json_match_{int,exp,frac} for details). */
-    (void) u_lexer_get_match(jl, match);
-    match[strlen(match) - 1] = '\0';
+    dbg_err_if ((match = u_lexer_get_match_ref(jl, &mlen)) == NULL);
 
     /* Push the matched number into the supplied json object. */
     if (jo)
     {
         dbg_err_if (u_json_set_type(jo, U_JSON_TYPE_NUMBER));
-        dbg_err_if (u_json_set_val(jo, match));
+        dbg_err_if (u_json_set_str(jo, &jo->val, &jo->vlen, match, mlen - 1));
     }
 
 #ifdef U_JSON_LEX_DEBUG
-    u_con("matched number: %s", u_lexer_get_match(jl, match));
+    u_con("matched number: %.*s", (int) (mlen - 1), match);
 #endif  /* U_JSON_LEX_DEBUG */
 
     return 0;
@@ -1498,7 +2193,7 @@ static int u_json_match_array (u_lexer_t *jl, u_json_t *jo)
         if (jo)
         {
             /* Create a new object to store next array element. */
-            dbg_err_if (u_json_new(&elem));
+            dbg_err_if (u_json_new_ex(jo->arena, &elem));
             dbg_err_if (u_json_set_type(elem, U_JSON_TYPE_UNKNOWN));
             dbg_err_if (u_json_set_depth(elem, jo->depth + 1));
         }
@@ -1590,7 +2285,8 @@ err:
 static int u_json_match_pair (u_lexer_t *jl, u_json_t *jo)
 {
     size_t mlen;
-    char c, match[U_TOKEN_SZ];
+    char c;
+    char *match;
     u_json_t *pair = NULL;
 
     dbg_return_if (jl == NULL, ~0);
@@ -1606,18 +2302,14 @@ static int u_json_match_pair (u_lexer_t *jl, u_json_t *jo)
     /* Initialize new json object to store the key/value pair. */
     if (jo)
     {
-        dbg_err_if (u_json_new(&pair));
+        dbg_err_if (u_json_new_ex(jo->arena, &pair));
         dbg_err_if (u_json_set_depth(pair, jo->depth + 1));
-    }
-
-    (void) u_lexer_get_match(jl, match);
-
-    /* Trim trailing '"'. */
-    if ((mlen = strlen(match)) >= 1)
-        match[mlen - 1] = '\0';
 
-    if (jo)
-        dbg_err_if (u_json_set_key(pair, match));
+        /* Trim trailing '"'. */
+        dbg_err_if ((match = u_lexer_get_match_ref(jl, &mlen)) == NULL);
+        dbg_err_if (u_json_set_match(pair, &pair->key, &pair->klen, 
+                    match, mlen - 1, U_JSON_F_KEY_UNESC));
+    }
 
     /* Consume trailing white spaces, if any. */
     if (isspace((int) u_lexer_peek(jl)))
@@ -1651,7 +2343,8 @@ err:
 static int u_json_match_string (u_lexer_t *jl, u_json_t *jo)
 {
     size_t mlen;
-    char c, match[U_TOKEN_SZ];
+    char c;
+    char *match;
 
     /* In case string is matched as an lval (i.e. the key side of a 'pair'),
      * there is no json object. */
@@ -1701,8 +2394,10 @@ static int u_json_match_string (u_lexer_t *jl, u_json_t *jo)
     /* Consume last '"'. */
     U_LEXER_NEXT(jl, &c);
 
+    dbg_err_if ((match = u_lexer_get_match_ref(jl, &mlen)) == NULL);
+
 #ifdef U_JSON_LEX_DEBUG
-    u_con("matched string: \'%s\'", u_lexer_get_match(jl, match));
+    u_con("matched string: \'%.*s\'", (int) (mlen - 1), match);
 #endif  /* U_JSON_LEX_DEBUG */
 
     /* In case the string is matched as an rval, the caller shall
@@ -1711,14 +2406,9 @@ static int u_json_match_string (u_lexer_t *jl, u_json_t *jo)
     {
         dbg_err_if (u_json_set_type(jo, U_JSON_TYPE_STRING));
 
-        /* Remove trailing '"' from match. */
-        (void) u_lexer_get_match(jl, match);
-
         /* Trim trailing '"'. */
-        if ((mlen = strlen(match)) >= 1)
-            match[mlen - 1] = '\0';
-
-        dbg_err_if (u_json_set_val(jo, match));
+        dbg_err_if (u_json_set_match(jo, &jo->val, &jo->vlen, match, mlen - 1,
+                    U_JSON_F_VAL_UNESC));
     }
 
     return 0;
@@ -1764,8 +2454,19 @@ static void u_json_do_free (u_json_t *jo, size_t l, void *opaque)
 {
     u_unused_args(l, opaque);
 
-    if (jo)
+    if (jo == NULL)
+        return;
+
+    if (jo->arena == NULL)
+    {
+        u_json_free_str(jo, jo->fqn);
+        u_json_free_str(jo, jo->key);
+        u_json_free_str(jo, jo->val);
+        U_FREE(jo->vec);
         u_free(jo);
+    }
+    else if (jo->arena->owner == jo)
+        u_json_arena_free(jo->arena);
 
     return;
 }
@@ -1796,23 +2497,26 @@ static void u_json_do_index (u_json_t *jo, size_t l, void *map)
 {
     u_json_t *p;
     u_hmap_t *hmap = (u_hmap_t *) map;
+    char fqn[U_JSON_FQN_SZ];
 
     u_unused_args(l);
 
     if ((p = jo->parent) == NULL)
     {
         /* Root node is named '.', its name and fully qualified name match. */
-        (void) u_strlcpy(jo->fqn, ".", sizeof jo->fqn);
+        (void) u_strlcpy(fqn, ".", sizeof fqn);
     }
     else if (p->type == U_JSON_TYPE_OBJECT)
     {
-        /* Nodes in object containers are named after their key. */
-        dbg_if (u_snprintf(jo->fqn, sizeof jo->fqn, "%s.%s", p->fqn, jo->key));
+        /* Nodes in object containers are named after their key.  The root
+         * name already ends with a '.', i.e. ".k" and not "..k". */
+        dbg_if (u_snprintf(fqn, sizeof fqn, p->parent ? "%s.%s" : "%s%s", 
+                    p->fqn, jo->key));
     }
     else if (p->type == U_JSON_TYPE_ARRAY)
     {
         /* Nodes in array containers are named after their ordinal position. */
-        dbg_if (u_snprintf(jo->fqn, sizeof jo->fqn, "%s[%u]", p->fqn, p->icur));
+        dbg_if (u_snprintf(fqn, sizeof fqn, "%s[%u]", p->fqn, p->icur));
 
         /* Increment the counting index in the parent array. */
         p->icur += 1;
@@ -1823,7 +2527,14 @@ static void u_json_do_index (u_json_t *jo, size_t l, void *map)
             jo->icur = 0;
     }
     else
+    {
         u_warn("Expecting an object, an array, or a top-level node.");
+        fqn[0] = '\0';
+    }
+
+    /* Names are computed only when indexing, and sized to fit. */
+    u_json_free_str(jo, jo->fqn), jo->fqn = NULL;
+    dbg_return_if (u_json_set_str(jo, &jo->fqn, NULL, fqn, strlen(fqn)), );
 
     /* Insert node into the hmap. */
     dbg_if (u_hmap_easy_put(hmap, jo->fqn, (const void *) jo));
@@ -1891,10 +2602,9 @@ err:
     return ~0;
 }
 
-static int u_json_do_parse (const char *json, u_json_t **pjo, 
+static int u_json_do_parse (const char *json, int flags, u_json_t **pjo, 
         char status[U_LEXER_ERR_SZ])
 {
-    u_json_t *jo = NULL;
     u_lexer_t *jl = NULL;
 
     /* When 'pjo' is NULL, assume this is a validating-only parser. */
@@ -1902,10 +2612,35 @@ static int u_json_do_parse (const char *json, u_json_t **pjo,
 
     /* Create a disposable lexer context associated to the supplied
      * 'json' string. */
-    dbg_err_if (u_lexer_new(json, &jl));
+    dbg_return_if (u_lexer_new(json, &jl), ~0);
+
+    return u_json_do_parse_lexer(jl, strlen(json), flags, pjo, status);
+}
+
+/* Parse the 'len' bytes of JSON text of the lexer 'jl', which is disposed of
+ * on return. */
+static int u_json_do_parse_lexer (u_lexer_t *jl, size_t len, int flags, 
+        u_json_t **pjo, char status[U_LEXER_ERR_SZ])
+{
+    u_json_t *jo = NULL;
+    u_json_arena_t *arena = NULL;
+
+    /* Create top level json object, in its own arena if so requested. */
+    if (pjo && (flags & (U_JSON_DECODE_ARENA | U_JSON_DECODE_INSITU)))
+    {
+        dbg_err_if (u_json_arena_new(len, &arena));
+        arena->insitu = (flags & U_JSON_DECODE_INSITU) ? 1 : 0;
+
+        if (u_json_new_ex(arena, &jo))
+        {
+            u_json_arena_free(arena);
+            dbg_err("arena node allocation failed");
+        }
 
-    /* Create top level json object. */
-    dbg_err_if (pjo && u_json_new(&jo));
+        arena->owner = jo;
+    }
+    else
+        dbg_err_if (pjo && u_json_new(&jo));
 
     /* Consume any trailing white space before starting actual parsing. */
     if (u_lexer_eat_ws(jl) == -1)
@@ -1956,3 +2691,1069 @@ static int u_json_set_depth (u_json_t *jo, unsigned int depth)
 err:
     return ~0;
 }
+
+/* Create a node, carved from 'arena' if not NULL. */
+static int u_json_new_ex (u_json_arena_t *arena, u_json_t **pjo)
+{
+    u_json_t *jo = NULL;
+
+    dbg_return_if (pjo == NULL, ~0);
+
+    if (arena)
+    {
+        dbg_err_if ((jo = u_json_arena_alloc(arena, sizeof *jo, 
+                        sizeof(void *))) == NULL);
+        memset(jo, 0, sizeof *jo);
+    }
+    else
+        warn_err_sif ((jo = u_zalloc(sizeof *jo)) == NULL);
+
+    TAILQ_INIT(&jo->children);
+    jo->type = U_JSON_TYPE_UNKNOWN;
+    jo->flags = 0;
+    jo->key = jo->val = u_json_nil;
+    jo->klen = jo->vlen = 0;
+    jo->fqn = NULL;
+    jo->arena = arena;
+    jo->parent = NULL;
+    jo->map = NULL;
+    jo->count = 0;
+    jo->vec = NULL;
+    jo->vsz = 0;
+    jo->depth = 0;
+
+    *pjo = jo;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Replace the string at '*ps' (of length '*plen' if 'plen' is not NULL) with 
+ * a NUL-terminated copy of the 'len' bytes at 's', taken from the node arena 
+ * or the heap. */
+static int u_json_set_str (u_json_t *jo, char **ps, size_t *plen, 
+        const char *s, size_t len)
+{
+    char *t;
+
+    if (len == 0)
+        t = u_json_nil;
+    else if (jo->arena)
+        dbg_err_if ((t = u_json_arena_alloc(jo->arena, len + 1, 1)) == NULL);
+    else
+        warn_err_sif ((t = u_malloc(len + 1)) == NULL);
+
+    if (len)
+    {
+        memcpy(t, s, len);
+        t[len] = '\0';
+    }
+
+    u_json_free_str(jo, *ps);
+
+    *ps = t;
+    if (plen)
+        *plen = len;
+
+    /* Whatever is set by the user is in JSON escaped form. */
+    if (ps == &jo->key)
+        jo->flags &= ~U_JSON_F_KEY_UNESC;
+    else if (ps == &jo->val)
+        jo->flags &= ~U_JSON_F_VAL_UNESC;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Store the 'len' bytes token matched at 'm' into the node: strings (i.e.
+ * non-0 'unesc' flag) of in situ documents are unescaped and referenced in 
+ * place, anything else is copied.  Strings holding \u0000 are rejected. */
+static int u_json_set_match (u_json_t *jo, char **ps, size_t *plen, 
+        char *m, size_t len, unsigned int unesc)
+{
+    char *s;
+
+    if (!unesc || jo->arena == NULL || !jo->arena->insitu)
+        return u_json_set_str(jo, ps, plen, m, len);
+
+    /* The lexer references the (mutable) buffer supplied by the user and has
+     * already gone past the string, up to the closing '"' which is replaced
+     * by the NUL terminator. */
+    s = m;
+
+    if (memchr(s, '\\', len) != NULL)
+    {
+        len = u_json_unescape(s, len);
+
+        /* An escaped NUL would silently truncate the string. */
+        warn_err_ifm (memchr(s, '\0', len) != NULL, 
+                "\\u0000 can't be decoded in situ");
+    }
+
+    s[len] = '\0';
+
+    *ps = s;
+    *plen = len;
+    jo->flags |= unesc;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Value of the 4 hex digits at 'p'. */
+static unsigned long u_json_hex4 (const char *p)
+{
+    int i;
+    unsigned long v = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        v <<= 4;
+        v |= isdigit((int) p[i]) ? p[i] - '0' : (tolower((int) p[i]) - 'a' + 10);
+    }
+
+    return v;
+}
+
+/* Decode JSON escapes in 's' (already validated by u_json_match_string) to 
+ * UTF-8.  The result is never longer than the source.  Returns its length. */
+static size_t u_json_unescape (char *s, size_t len)
+{
+    size_t i, j;
+    unsigned long cp, lo;
+    char *e;
+
+    /* Nothing to do until the first escape. */
+    if ((e = memchr(s, '\\', len)) == NULL)
+        return len;
+
+    for (i = j = (size_t) (e - s); i < len; )
+    {
+        if (s[i] != '\\')
+        {
+            s[j++] = s[i++];
+            continue;
+        }
+
+        switch (s[i + 1])
+        {
+            case 'b': s[j++] = '\b'; i += 2; continue;
+            case 'f': s[j++] = '\f'; i += 2; continue;
+            case 'n': s[j++] = '\n'; i += 2; continue;
+            case 'r': s[j++] = '\r'; i += 2; continue;
+            case 't': s[j++] = '\t'; i += 2; continue;
+            case 'u': break;
+            default:  s[j++] = s[i + 1]; i += 2; continue;  /* " \ / */
+        }
+
+        cp = u_json_hex4(s + i + 2);
+        i += 6;
+
+        /* Join surrogate pairs. */
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 <= len && 
+                s[i] == '\\' && s[i + 1] == 'u')
+        {
+            lo = u_json_hex4(s + i + 2);
+
+            if (lo >= 0xDC00 && lo <= 0xDFFF)
+            {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                i += 6;
+            }
+        }
+
+        /* Lone surrogates have no valid UTF-8 encoding: use U+FFFD (the
+         * replacement character) in their place. */
+        if (cp >= 0xD800 && cp <= 0xDFFF)
+            cp = 0xFFFD;
+
+        if (cp < 0x80)
+            s[j++] = (char) cp;
+        else if (cp < 0x800)
+        {
+            s[j++] = (char) (0xC0 | (cp >> 6));
+            s[j++] = (char) (0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            s[j++] = (char) (0xE0 | (cp >> 12));
+            s[j++] = (char) (0x80 | ((cp >> 6) & 0x3F));
+            s[j++] = (char) (0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            s[j++] = (char) (0xF0 | (cp >> 18));
+            s[j++] = (char) (0x80 | ((cp >> 12) & 0x3F));
+            s[j++] = (char) (0x80 | ((cp >> 6) & 0x3F));
+            s[j++] = (char) (0x80 | (cp & 0x3F));
+        }
+    }
+
+    return j;
+}
+
+/* Write the 'len' bytes at 'str' as a quoted JSON string, escaping as 
+ * needed. */
+static int u_json_encode_esc (u_json_wr_t *w, const char *str, size_t len)
+{
+    size_t i, j;
+    unsigned char c;
+    char esc[7];
+    static const char hex[] = "0123456789abcdef";
+
+    dbg_err_if (U_JSON_WR_LIT(w, "\""));
+
+    for (i = j = 0; i < len; i++)
+    {
+        if ((c = (unsigned char) str[i]) >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        /* Flush the verbatim run, then the escaped char. */
+        dbg_err_if (i > j && u_json_wr(w, str + j, i - j));
+        j = i + 1;
+
+        switch (c)
+        {
+            case '"':  dbg_err_if (U_JSON_WR_LIT(w, "\\\"")); break;
+            case '\\': dbg_err_if (U_JSON_WR_LIT(w, "\\\\")); break;
+            case '\b': dbg_err_if (U_JSON_WR_LIT(w, "\\b")); break;
+            case '\f': dbg_err_if (U_JSON_WR_LIT(w, "\\f")); break;
+            case '\n': dbg_err_if (U_JSON_WR_LIT(w, "\\n")); break;
+            case '\r': dbg_err_if (U_JSON_WR_LIT(w, "\\r")); break;
+            case '\t': dbg_err_if (U_JSON_WR_LIT(w, "\\t")); break;
+            default:
+                memcpy(esc, "\\u00", 4);
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xf];
+                dbg_err_if (u_json_wr(w, esc, 6));
+                break;
+        }
+    }
+
+    dbg_err_if (i > j && u_json_wr(w, str + j, i - j));
+    dbg_err_if (U_JSON_WR_LIT(w, "\""));
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Append 'len' bytes to the encoder output. */
+static int u_json_wr (u_json_wr_t *w, const char *s, size_t len)
+{
+    if (len > w->sz - w->len)
+        return w->drain(w, s, len);
+
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+
+    return 0;
+}
+
+/* Pretty printing: new line, then 4 spaces per nesting level. */
+static int u_json_wr_indent (u_json_wr_t *w, size_t depth)
+{
+    size_t n;
+    static const char nl[] = "\n                                "
+        "                                ";
+
+    n = U_MIN(depth * 4, sizeof nl - 2);
+    dbg_err_if (u_json_wr(w, nl, n + 1));
+
+    for (depth = depth * 4 - n; depth; depth -= n)
+    {
+        n = U_MIN(depth, sizeof nl - 2);
+        dbg_err_if (u_json_wr(w, nl + 1, n));
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Closing bracket of container 'jo'. */
+static int u_json_wr_close (u_json_wr_t *w, u_json_t *jo, int spaced)
+{
+    const char *s = (jo->type == U_JSON_TYPE_OBJECT) ? " }" : " ]";
+
+    return spaced ? u_json_wr(w, s, 2) : u_json_wr(w, s + 1, 1);
+}
+
+/* String output: double the window (always keeping a spare byte for the
+ * terminating NUL), then append. */
+static int u_json_wr_grow (u_json_wr_t *w, const char *s, size_t len)
+{
+    char *nbuf;
+    size_t sz;
+
+    for (sz = w->sz ? (w->sz + 1) * 2 : U_JSON_ENCODE_BUFSZ; 
+            sz - 1 - w->len < len; sz *= 2)
+        ;
+
+    dbg_err_sif ((nbuf = u_realloc(w->buf, sz)) == NULL);
+    w->buf = nbuf;
+    w->sz = sz - 1;
+
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Caller's memory area: there is no more room. */
+static int u_json_wr_full (u_json_wr_t *w, const char *s, size_t len)
+{
+    u_unused_args(w, s, len);
+
+    u_dbg("encode buffer too small");
+
+    return ~0;
+}
+
+/* Buffer or file descriptor output: drain the window, then append 's' to
+ * it (a buffer takes 's' straight away if it would not fit anyway, a file
+ * descriptor gets it one window at a time). */
+static int u_json_wr_flush (u_json_wr_t *w, const char *s, size_t len)
+{
+    dbg_err_if (u_json_wr_out(w));
+
+    if (w->ubuf && len >= w->sz)
+        return u_buf_append(w->ubuf, s, len);
+
+    for (; len > w->sz; s += w->sz, len -= w->sz)
+    {
+        memcpy(w->buf, s, w->sz);
+        w->len = w->sz;
+        dbg_err_if (u_json_wr_out(w));
+    }
+
+    memcpy(w->buf, s, len);
+    w->len = len;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Hand the window contents over to the destination, and empty it. */
+static int u_json_wr_out (u_json_wr_t *w)
+{
+    if (w->len == 0)
+        return 0;
+
+    if (w->ubuf)
+        dbg_return_if (u_buf_append(w->ubuf, w->buf, w->len), ~0);
+    else
+        dbg_return_sif (u_write(w->fd, w->buf, w->len) < 0, ~0);
+
+    w->len = 0;
+
+    return 0;
+}
+
+/* Write the decimal representation of 'v' backwards from 'end', two digits
+ * at a time, and return a pointer to its first char. */
+static char *u_json_itoa (long v, char *end)
+{
+    unsigned long u, d;
+    static const char dig[] = 
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+
+    /* Magnitude, also for LONG_MIN. */
+    u = (v < 0) ? 0UL - (unsigned long) v : (unsigned long) v;
+
+    for (; u >= 100; u /= 100)
+    {
+        d = (u % 100) * 2;
+        *--end = dig[d + 1];
+        *--end = dig[d];
+    }
+
+    if (u >= 10)
+    {
+        *--end = dig[u * 2 + 1];
+        *--end = dig[u * 2];
+    }
+    else
+        *--end = (char) ('0' + u);
+
+    if (v < 0)
+        *--end = '-';
+
+    return end;
+}
+
+/* Strings from the arena go away with it. */
+static void u_json_free_str (u_json_t *jo, char *s)
+{
+    if (jo->arena == NULL && s != NULL && s != u_json_nil)
+        u_free(s);
+
+    return;
+}
+
+static void u_json_do_unindex (u_json_t *jo, size_t l, void *opaque)
+{
+    u_unused_args(l, opaque);
+
+    u_json_free_str(jo, jo->fqn);
+    jo->fqn = NULL;
+    jo->map = NULL;
+
+    return;
+}
+
+/* 'hint' is the input text size: the DOM takes roughly the same. */
+static int u_json_arena_new (size_t hint, u_json_arena_t **pa)
+{
+    u_json_arena_t *a = NULL;
+
+    warn_err_sif ((a = u_zalloc(sizeof *a)) == NULL);
+
+    a->chunks = NULL;
+    a->owner = NULL;
+    a->nforeign = 0;
+    a->next_sz = U_MIN(U_MAX(hint, U_JSON_ARENA_CHUNK_MIN), 
+            U_JSON_ARENA_CHUNK_MAX);
+
+    *pa = a;
+
+    return 0;
+err:
+    return ~0;
+}
+
+static void *u_json_arena_alloc (u_json_arena_t *a, size_t sz, size_t align)
+{
+    size_t off, csz;
+    u_json_chunk_t *c = a->chunks, *nc;
+
+    /* Fast path: bump the free area bounds in the current chunk. */
+    if (c != NULL)
+    {
+        off = (align == 1) ? c->lo : (c->lo + align - 1) & ~(align - 1);
+
+        if (off + sz <= c->hi)
+        {
+            if (align == 1)
+                return (char *) (c + 1) + (c->hi -= sz);
+
+            c->lo = off + sz;
+            return (char *) (c + 1) + off;
+        }
+    }
+
+    /* Big blocks get a chunk of their own, linked behind the current one so 
+     * that its free space can still be used.  Otherwise start a new chunk 
+     * twice the size of the previous. */
+    if (c != NULL && sz > a->next_sz / 4)
+        csz = sz;
+    else
+    {
+        csz = U_MAX(a->next_sz, sz);
+        a->next_sz = U_MIN(a->next_sz * 2, U_JSON_ARENA_CHUNK_MAX);
+    }
+
+    warn_err_sif ((nc = u_malloc(sizeof *nc + csz)) == NULL);
+    nc->lo = sz;
+    nc->hi = csz;
+
+    if (c != NULL && csz == sz)
+        nc->next = c->next, c->next = nc;
+    else
+        nc->next = c, a->chunks = nc;
+
+    return nc + 1;
+err:
+    return NULL;
+}
+
+static void u_json_arena_free (u_json_arena_t *a)
+{
+    u_json_chunk_t *c, *n;
+
+    for (c = a->chunks; c != NULL; c = n)
+    {
+        n = c->next;
+        u_free(c);
+    }
+
+    u_free(a);
+
+    return;
+}
+
+/* Fill the child vector of array 'jo' from its children list. */
+static int u_json_vec_build (u_json_t *jo)
+{
+    unsigned int i = 0;
+    u_json_t *elem;
+
+    dbg_err_if (u_json_vec_grow(jo, jo->count));
+
+    TAILQ_FOREACH (elem, &jo->children, siblings)
+        jo->vec[i++] = elem;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Make room for at least 'n' children in the vector of 'jo' (doubling its
+ * size).  Arena nodes take it from the arena: the outgrown vectors are 
+ * given back only with the whole document, which costs at most as much as
+ * the final one. */
+static int u_json_vec_grow (u_json_t *jo, unsigned int n)
+{
+    u_json_t **v;
+    unsigned int sz = U_MAX(jo->vsz, 8);
+
+    while (sz < n)
+    {
+        dbg_err_if (sz > UINT_MAX / 2);
+        sz *= 2;
+    }
+
+    if (jo->arena)
+    {
+        dbg_err_if ((v = u_json_arena_alloc(jo->arena, sz * sizeof *v, 
+                        sizeof *v)) == NULL);
+        if (jo->vec)
+            memcpy(v, jo->vec, U_MIN(jo->count, jo->vsz) * sizeof *v);
+    }
+    else
+        warn_err_sif ((v = u_realloc(jo->vec, sz * sizeof *v)) == NULL);
+
+    jo->vec = v;
+    jo->vsz = sz;
+
+    return 0;
+err:
+    return ~0;
+}
+
+static void u_json_vec_drop (u_json_t *jo)
+{
+    if (jo->arena == NULL)
+        U_FREE(jo->vec);
+
+    jo->vec = NULL;
+    jo->vsz = 0;
+
+    return;
+}
+
+/* Fill the key hash of object 'jo' (linear probing, at least half empty). */
+static int u_json_kmap_build (u_json_t *jo)
+{
+    u_json_t *c, **v;
+    unsigned int sz = 16;
+
+    while (sz < jo->count * 2)
+    {
+        dbg_err_if (sz > UINT_MAX / 2);
+        sz *= 2;
+    }
+
+    /* A new table is needed in any case (the arena copy of an outgrown one
+     * goes along with the document). */
+    if (jo->arena)
+    {
+        dbg_err_if ((v = u_json_arena_alloc(jo->arena, sz * sizeof *v, 
+                        sizeof *v)) == NULL);
+        memset(v, 0, sz * sizeof *v);
+    }
+    else
+        warn_err_sif ((v = u_calloc(sz, sizeof *v)) == NULL);
+
+    u_json_vec_drop(jo);
+    jo->vec = v;
+    jo->vsz = sz;
+
+    TAILQ_FOREACH (c, &jo->children, siblings)
+        u_json_kmap_put(jo, c);
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Members sharing the same key are found in the order they were added. */
+static void u_json_kmap_put (u_json_t *jo, u_json_t *c)
+{
+    size_t i, mask = jo->vsz - 1;
+
+    for (i = u_json_kmap_chash(c) & mask; jo->vec[i] != NULL; 
+            i = (i + 1) & mask)
+        ;
+
+    jo->vec[i] = c;
+
+    return;
+}
+
+/* Backward shift deletion: the slots following the one which is freed are
+ * moved back, as long as this does not take them before their home slot. */
+static void u_json_kmap_del (u_json_t *jo, u_json_t *c)
+{
+    u_json_t *e;
+    size_t i, j, h, mask = jo->vsz - 1;
+
+    for (i = u_json_kmap_chash(c) & mask; jo->vec[i] != c; 
+            i = (i + 1) & mask)
+        ;
+
+    for (j = (i + 1) & mask; (e = jo->vec[j]) != NULL; j = (j + 1) & mask)
+    {
+        h = u_json_kmap_chash(e) & mask;
+
+        /* Move 'e' to the hole at 'i' if its home is not in (i, j]. */
+        if (((j - h) & mask) >= ((j - i) & mask))
+        {
+            jo->vec[i] = e;
+            i = j;
+        }
+    }
+
+    jo->vec[i] = NULL;
+
+    return;
+}
+
+static u_json_t *u_json_kmap_get (u_json_t *jo, const char *key, size_t klen,
+        size_t hash)
+{
+    u_json_t *c;
+    size_t i, mask;
+
+    /* Small objects are not worth a hash. */
+    if (jo->vec == NULL && 
+            (jo->count < U_JSON_KMAP_MIN || u_json_kmap_build(jo)))
+    {
+        TAILQ_FOREACH (c, &jo->children, siblings)
+        {
+            if (u_json_kmap_eq(c, key, klen))
+                return c;
+        }
+
+        return NULL;
+    }
+
+    for (mask = jo->vsz - 1, i = hash & mask; (c = jo->vec[i]) != NULL; 
+            i = (i + 1) & mask)
+    {
+        if (u_json_kmap_eq(c, key, klen))
+            return c;
+    }
+
+    return NULL;
+}
+
+/* FNV-1a */
+static size_t u_json_kmap_hash (const char *key, size_t klen)
+{
+    size_t i;
+    uint32_t h = 2166136261U;
+
+    for (i = 0; i < klen; i++)
+    {
+        h ^= (unsigned char) key[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static size_t u_json_kmap_chash (u_json_t *c)
+{
+    size_t h, len;
+    char *tmp;
+    const char *key = u_json_kmap_key(c, &len, &tmp);
+
+    h = u_json_kmap_hash(key, len);
+    U_FREE(tmp);
+
+    return h;
+}
+
+static int u_json_kmap_eq (u_json_t *c, const char *key, size_t klen)
+{
+    int eq;
+    size_t len;
+    char *tmp;
+    const char *k;
+
+    /* Escapes only make keys shorter. */
+    if (c->klen < klen)
+        return 0;
+
+    k = u_json_kmap_key(c, &len, &tmp);
+    eq = (len == klen && memcmp(k, key, klen) == 0);
+    U_FREE(tmp);
+
+    return eq;
+}
+
+/* Members are looked up by their decoded name, while keys are kept in JSON
+ * escaped form unless the document was decoded in situ.  Unescape into a
+ * temporary copy (to be free'd by the caller) the few that need it. */
+static const char *u_json_kmap_key (u_json_t *c, size_t *plen, char **ptmp)
+{
+    char *t;
+
+    *ptmp = NULL;
+    *plen = c->klen;
+
+    if ((c->flags & U_JSON_F_KEY_UNESC) || 
+            memchr(c->key, '\\', c->klen) == NULL ||
+            (t = u_zalloc(c->klen + 6)) == NULL)
+        return c->key;
+
+    /* (Zero padded, should a key set by the user end in a bad escape.) */
+    memcpy(t, c->key, c->klen);
+    *plen = u_json_unescape(t, c->klen);
+
+    return (*ptmp = t);
+}
+
+/* ".a.b[3].c": the root '.' may be followed by a member name straight 
+ * away; member names go to 'buf' (they are not NUL-terminated). */
+static int u_json_ptr_fqn (const char *path, u_json_ptr_t *ptr, char *buf)
+{
+    size_t len;
+    const char *s = path + 1, *e;
+    u_json_ptr_step_t *st;
+
+    for (;;)
+    {
+        /* Member name, up to the next separator (may be empty only after
+         * an explicit '.'). */
+        len = strcspn(s, ".[");
+
+        if (len || (s != path + 1 && s[-1] == '.'))
+        {
+            st = &ptr->steps[ptr->nsteps++];
+            st->kind = U_JSON_PTR_KEY;
+            st->key = memcpy(buf, s, len);
+            st->klen = len;
+            st->hash = u_json_kmap_hash(buf, len);
+            buf += len, s += len;
+        }
+
+        if (*s == '\0')
+            break;
+        else if (*s == '.')
+            s += 1;
+        else    /* '[' */
+        {
+            dbg_err_if ((e = strchr(s, ']')) == NULL);
+
+            st = &ptr->steps[ptr->nsteps++];
+            st->kind = U_JSON_PTR_IDX;
+            dbg_err_if (u_json_ptr_idx(s + 1, e - s - 1, &st->idx));
+            st->has_idx = 1;
+
+            /* What follows must be another separator. */
+            s = e + 1;
+            dbg_err_if (*s != '\0' && *s != '.' && *s != '[');
+            if (*s == '.')
+                s += 1;
+            else if (*s == '\0')
+                break;
+        }
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* "/a/b/3/c" with "~1" -> '/' and "~0" -> '~' */
+static int u_json_ptr_rfc (const char *path, u_json_ptr_t *ptr, char *buf)
+{
+    const char *s = path;
+    u_json_ptr_step_t *st;
+
+    while (*s != '\0')
+    {
+        dbg_err_if (*s++ != '/');
+
+        st = &ptr->steps[ptr->nsteps++];
+        st->kind = U_JSON_PTR_ANY;
+        st->key = buf;
+
+        for (; *s != '\0' && *s != '/'; s++)
+        {
+            if (*s != '~')
+                *buf++ = *s;
+            else if (s[1] == '0' || s[1] == '1')
+                *buf++ = (*++s == '0') ? '~' : '/';
+            else
+                dbg_err_if (1);
+        }
+
+        st->klen = buf - st->key;
+        st->hash = u_json_kmap_hash(st->key, st->klen);
+        st->has_idx = (u_json_ptr_idx(st->key, st->klen, &st->idx) == 0);
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Array index: decimal digits, no leading zeroes. */
+static int u_json_ptr_idx (const char *s, size_t len, unsigned int *pidx)
+{
+    size_t i;
+    unsigned int d, idx = 0;
+
+    nop_err_if (len == 0 || (len > 1 && s[0] == '0'));
+
+    for (i = 0; i < len; i++)
+    {
+        nop_err_if (!isdigit((unsigned char) s[i]));
+        d = s[i] - '0';
+        nop_err_if (idx > (UINT_MAX - d) / 10);
+        idx = idx * 10 + d;
+    }
+
+    *pidx = idx;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Validate 'json', then copy it into the arena of the (lazy) root node. */
+static int u_json_lazy_decode (const char *json, u_json_t **pjo, 
+        char status[U_LEXER_ERR_SZ])
+{
+    size_t len;
+    char *s, *e;
+    u_json_t *jo = NULL;
+    u_json_arena_t *arena = NULL;
+
+    dbg_return_if (json == NULL, ~0);
+
+    len = strlen(json);
+    dbg_err_if (u_json_validate_ex(json, len, status));
+
+    dbg_err_if (u_json_arena_new(0, &arena));
+
+    if (u_json_new_ex(arena, &jo))
+    {
+        u_json_arena_free(arena);
+        dbg_err("arena node allocation failed");
+    }
+
+    arena->owner = jo;
+
+    dbg_err_if ((s = u_json_arena_alloc(arena, len + 1, 1)) == NULL);
+    memcpy(s, json, len + 1);
+
+    /* The validator has already checked that the text is an object or an 
+     * array (possibly followed by junk): find its end, and make sure that
+     * it is not nested too deep. */
+    s += strspn(s, " \t\r\n");
+    dbg_err_if ((e = u_json_lazy_skip(s, s + strlen(s), 0)) == NULL);
+
+    jo->type = (*s == '{') ? U_JSON_TYPE_OBJECT : U_JSON_TYPE_ARRAY;
+    jo->flags |= U_JSON_F_LAZY;
+    jo->val = s;
+    jo->vlen = e - s;
+
+    *pjo = jo;
+
+    return 0;
+err:
+    u_json_free(jo);
+    return ~0;
+}
+
+/* Decode the direct children of the lazy container 'jo'.  The text has been
+ * validated, so that it can be walked without further checks.  Children are
+ * collected aside and attached only once all of them have been created, so 
+ * that on failure 'jo' is left as it was.  Strings are then terminated where
+ * they lie, by overwriting their closing quote (as well as the delimiter 
+ * following a number): this is no longer part of the text of any lazy 
+ * container. */
+static int u_json_lazy_load (u_json_t *jo)
+{
+    char *p = jo->val + 1, *e = jo->val + jo->vlen - 1, *k = NULL;
+    size_t klen = 0;
+    u_json_t *c = NULL;
+    struct u_json_chld_s kids;
+
+    dbg_return_ifm (jo->map, ~0, "Cannot decode children of a cached object");
+
+    TAILQ_INIT(&kids);
+
+    for (;;)
+    {
+        p += strspn(p, " \t\r\n");
+
+        if (p >= e)
+            break;
+
+        if (jo->type == U_JSON_TYPE_OBJECT)
+        {
+            k = p + 1;
+            dbg_err_if ((p = u_json_lazy_str(p, e)) == NULL);
+            klen = p - k;
+            p += 1;
+            p += strspn(p, " \t\r\n") + 1;      /* ':' */
+            p += strspn(p, " \t\r\n");
+        }
+
+        dbg_err_if (u_json_new_ex(jo->arena, &c));
+        TAILQ_INSERT_TAIL(&kids, c, siblings);
+        dbg_err_if (u_json_set_depth(c, jo->depth + 1));
+
+        if (k != NULL)
+            c->key = k, c->klen = klen;
+
+        switch (*p)
+        {
+            case '"':
+                c->type = U_JSON_TYPE_STRING;
+                c->val = p + 1;
+                dbg_err_if ((p = u_json_lazy_str(p, e)) == NULL);
+                c->vlen = p - c->val;
+                p += 1;
+                break;
+            case '{':
+            case '[':
+                c->type = (*p == '{') ? U_JSON_TYPE_OBJECT : U_JSON_TYPE_ARRAY;
+                c->flags |= U_JSON_F_LAZY;
+                c->val = p;
+                dbg_err_if ((p = u_json_lazy_skip(p, e, c->depth)) == NULL);
+                c->vlen = p - c->val;
+                break;
+            case 't':
+                c->type = U_JSON_TYPE_TRUE;
+                p += 4;
+                break;
+            case 'f':
+                c->type = U_JSON_TYPE_FALSE;
+                p += 5;
+                break;
+            case 'n':
+                c->type = U_JSON_TYPE_NULL;
+                p += 4;
+                break;
+            default:
+                c->type = U_JSON_TYPE_NUMBER;
+                c->val = p;
+                p += strcspn(p, " \t\r\n,]}");
+                c->vlen = p - c->val;
+                break;
+        }
+
+        p += strspn(p, " \t\r\n");
+        if (*p == ',')
+            p += 1;
+    }
+
+    /* From now on 'jo' is a plain container, and nothing can fail. */
+    jo->flags &= ~U_JSON_F_LAZY;
+    jo->val = u_json_nil;
+    jo->vlen = 0;
+
+    while ((c = TAILQ_FIRST(&kids)) != NULL)
+    {
+        TAILQ_REMOVE(&kids, c, siblings);
+
+        if (c->key != u_json_nil)
+            c->key[c->klen] = '\0';
+
+        if (c->type == U_JSON_TYPE_STRING || c->type == U_JSON_TYPE_NUMBER)
+            c->val[c->vlen] = '\0';
+
+        dbg_if (u_json_add(jo, c));
+    }
+
+    return 0;
+err:
+    while ((c = TAILQ_FIRST(&kids)) != NULL)
+    {
+        TAILQ_REMOVE(&kids, c, siblings);
+        u_json_free(c);
+    }
+
+    return ~0;
+}
+
+/* Decode all the lazy containers found in the tree rooted at 'jo'. */
+static int u_json_lazy_load_all (u_json_t *jo)
+{
+    u_json_t *c;
+
+    dbg_return_if (U_JSON_LOAD(jo), ~0);
+
+    TAILQ_FOREACH (c, &jo->children, siblings)
+        dbg_return_if (u_json_lazy_load_all(c), ~0);
+
+    return 0;
+}
+
+/* Return the end of the container at 's' (i.e. past its closing bracket), 
+ * 'depth' being the depth of its node.  Only quotes (with escapes) and 
+ * brackets are looked at, but any value found too deep is rejected as the
+ * parser would do. */
+static char *u_json_lazy_skip (char *s, char *e, unsigned int depth)
+{
+    size_t d = 0;
+
+    for (; s < e; s++)
+    {
+        switch (*s)
+        {
+            case ' ': case '\t': case '\r': case '\n': case ',': case ':':
+                continue;
+            case '}': case ']':
+                if (--d == 0)
+                    return s + 1;
+                continue;
+        }
+
+        /* Anything else starts (or continues) a value at depth+d. */
+        warn_err_ifm (depth + d >= U_JSON_MAX_DEPTH,
+            "Maximum allowed nesting is %u.", U_JSON_MAX_DEPTH);
+
+        if (*s == '"')
+            dbg_err_if ((s = u_json_lazy_str(s, e)) == NULL);
+        else if (*s == '{' || *s == '[')
+            d += 1;
+    }
+
+    /* Unbalanced brackets. */
+err:
+    return NULL;
+}
+
+/* Return the closing quote of the string opening at 's'. */
+static char *u_json_lazy_str (char *s, char *e)
+{
+    char *q, *b;
+
+    for (q = s + 1; (q = memchr(q, '"', e - q)) != NULL; q++)
+    {
+        /* Escaped if preceded by an odd number of backslashes. */
+        for (b = q; b[-1] == '\\'; b--)
+            ;
+
+        if ((q - b) % 2 == 0)
+            return q;
+    }
+
+    return NULL;
+}
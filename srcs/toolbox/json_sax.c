@@ -0,0 +1,685 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <toolbox/json.h>
+#include <toolbox/carpal.h>
+#include <toolbox/misc.h>
+#include <toolbox/memory.h>
+
+/* Upper bound for tokens (strings and numbers) which span across two or
+ * more chunks, and must hence be buffered. */
+#ifndef U_JSON_SAX_TOKEN_MAX
+#define U_JSON_SAX_TOKEN_MAX    (1024 * 1024)
+#endif  /* !U_JSON_SAX_TOKEN_MAX */
+
+/* Parser states: where we are in the u_json_match_* grammar. */
+enum {
+    S_DOC,          /* Between top level texts: expect '{' or '['. */
+    S_OBJ_FIRST,    /* After '{': expect a key or '}'. */
+    S_OBJ_NEXT,     /* After ',' in an object: expect a key. */
+    S_COLON,        /* After a key: expect ':'. */
+    S_VALUE,        /* After ':': expect a value. */
+    S_ARR_FIRST,    /* After '[': expect a value or ']'. */
+    S_ARR_NEXT,     /* After ',' in an array: expect a value. */
+    S_AFTER,        /* After a value: expect ',' or the closing bracket. */
+    S_STRING,       /* Inside a string. */
+    S_ESC,          /* After a '\' in a string. */
+    S_UHEX,         /* Inside the hex digits of a "\u" escape. */
+    S_NUMBER,       /* Inside a number (see N_* below). */
+    S_LITERAL,      /* Inside "true", "false" or "null". */
+    S_ERROR         /* Sticky error. */
+};
+
+/* Number sub-states: INT[FRAC][EXP] */
+enum {
+    N_MINUS,        /* After the optional minus sign. */
+    N_ZERO,         /* After a leading '0'. */
+    N_INT,          /* In [1-9][0-9]* */
+    N_DOT,          /* After '.' */
+    N_FRAC,         /* In the frac digits. */
+    N_E,            /* After [eE] */
+    N_ESIGN,        /* After the exp sign. */
+    N_EXP           /* In the exp digits. */
+};
+
+struct u_json_sax_s
+{
+    u_json_sax_cbs_t cbs;       /* User callbacks ... */
+    void *arg;                  /* ... and their argument. */
+
+    int state, nstate;          /* Parser state, and number sub-state. */
+    char stack[U_JSON_MAX_DEPTH];   /* Open containers ('{' or '['). */
+    size_t sp;                  /* Nesting level. */
+
+    char iskey;                 /* The string being scanned is a key. */
+    unsigned int uhex;          /* Hex digits left in a "\u" escape. */
+    const char *lit;            /* Literal being matched ... */
+    size_t litpos;              /* ... and how far. */
+
+    /* Token started in a previous chunk. */
+    char pending;
+    char *tok;
+    size_t tlen, tsz;
+
+    size_t off;                 /* Stream offset of the current chunk ... */
+    size_t cur;                 /* ... and of the current char in it. */
+    char err[U_LEXER_ERR_SZ];   /* Error string. */
+};
+
+static int u_json_sax_value (u_json_sax_t *p, char c);
+static int u_json_sax_push (u_json_sax_t *p, char c);
+static int u_json_sax_pop (u_json_sax_t *p, char c);
+static int u_json_sax_token (u_json_sax_t *p, const char *buf, size_t start,
+        size_t end);
+static int u_json_sax_save (u_json_sax_t *p, const char *buf, size_t start,
+        size_t end);
+static int u_json_sax_number_next (int *ns, char c);
+static int u_json_sax_err (u_json_sax_t *p, const char *fmt, ...);
+
+/**
+ *  \addtogroup json
+ *  \{
+ */
+
+/**
+ *  \brief  Create a streaming (SAX-style) JSON parser
+ *
+ *  Create an event-driven parser which reports the JSON texts supplied
+ *  through ::u_json_sax_feed to the user callbacks in \p cbs, without
+ *  building any tree.  The input is accepted in chunks of any size and split
+ *  at any point, and the parser memory is bounded by the maximum nesting
+ *  level (::U_JSON_MAX_DEPTH) and the size of the longest token which spans
+ *  across chunks.  The stream can carry any number of top level objects or
+ *  arrays, e.g. newline delimited JSON records.
+ *
+ *  \param  cbs     Callbacks (any of them may be \c NULL)
+ *  \param  arg     Opaque argument supplied to the callbacks
+ *  \param  pp      Result argument holding the parser
+ *
+ *  \retval ~0  on failure
+ *  \retval  0  on success
+ */
+int u_json_sax_new (const u_json_sax_cbs_t *cbs, void *arg, u_json_sax_t **pp)
+{
+    u_json_sax_t *p = NULL;
+
+    dbg_return_if (cbs == NULL, ~0);
+    dbg_return_if (pp == NULL, ~0);
+
+    warn_err_sif ((p = u_zalloc(sizeof *p)) == NULL);
+
+    p->cbs = *cbs;
+    p->arg = arg;
+    p->state = S_DOC;
+    p->sp = 0;
+    p->tok = NULL;
+    p->tlen = p->tsz = 0;
+    p->pending = 0;
+    p->off = p->cur = 0;
+    p->err[0] = '\0';
+
+    *pp = p;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/**
+ *  \brief  Dispose a streaming JSON parser
+ *
+ *  \param  p   A parser created with ::u_json_sax_new
+ *
+ *  \return nothing
+ */
+void u_json_sax_free (u_json_sax_t *p)
+{
+    if (p == NULL)
+        return;
+
+    U_FREE(p->tok);
+    u_free(p);
+
+    return;
+}
+
+/**
+ *  \brief  Feed the next chunk of input to a streaming JSON parser
+ *
+ *  Scan the \p len bytes at \p buf, invoking the callbacks for each event.
+ *  Keys, strings and numbers are reported as they appear in the JSON text
+ *  (i.e. escapes are not decoded, as with ::u_json_decode) by pointer and
+ *  length; the pointer is only valid inside the callback, and the text is
+ *  not NUL-terminated.
+ *
+ *  After an error, or in case a callback returns non-0, the parser stops
+ *  and any further feed fails.
+ *
+ *  \param  p   A parser created with ::u_json_sax_new
+ *  \param  buf Next chunk of JSON text
+ *  \param  len Length of \p buf
+ *
+ *  \retval ~0  on syntax error, or if a callback asked to stop
+ *  \retval  0  on success
+ */
+int u_json_sax_feed (u_json_sax_t *p, const char *buf, size_t len)
+{
+    size_t i = 0, ts = 0;
+    char c;
+
+    dbg_return_if (p == NULL, ~0);
+    dbg_return_if (buf == NULL && len, ~0);
+    nop_return_if (p->state == S_ERROR, ~0);
+
+    while (i < len)
+    {
+        c = buf[i];
+        p->cur = i;
+
+        switch (p->state)
+        {
+            case S_STRING:
+                /* Run to the next char which needs attention. */
+                while (c != '"' && c != '\\' && !iscntrl((unsigned char) c))
+                {
+                    if (++i == len)
+                        goto end;
+                    c = buf[i];
+                }
+
+                p->cur = i;
+
+                if (c == '\\')
+                    p->state = S_ESC;
+                else if (c == '"')
+                {
+                    if (u_json_sax_token(p, buf, ts, i))
+                        goto err;
+                    p->state = p->iskey ? S_COLON : S_AFTER;
+                }
+                else
+                {
+                    (void) u_json_sax_err(p, "control character in string");
+                    goto err;
+                }
+                break;
+
+            case S_ESC:
+                switch (c)
+                {
+                    case 'u':
+                        p->uhex = 4;
+                        p->state = S_UHEX;
+                        break;
+                    case '"': case '\\': case '/': case 'b':
+                    case 'f': case 'n':  case 'r': case 't':
+                        p->state = S_STRING;
+                        break;
+                    default:
+                        (void) u_json_sax_err(p, "invalid char %c in escape",
+                                c);
+                        goto err;
+                }
+                break;
+
+            case S_UHEX:
+                if (!isxdigit((unsigned char) c))
+                {
+                    (void) u_json_sax_err(p, 
+                            "non hex digit %c in escaped unicode", c);
+                    goto err;
+                }
+
+                if (--p->uhex == 0)
+                    p->state = S_STRING;
+                break;
+
+            case S_NUMBER:
+                if (u_json_sax_number_next(&p->nstate, c))
+                    break;
+
+                /* 'c' is past the number: check it is complete, report it
+                 * and process 'c' in the next state. */
+                if (p->nstate == N_MINUS || p->nstate == N_DOT ||
+                        p->nstate == N_E || p->nstate == N_ESIGN)
+                {
+                    (void) u_json_sax_err(p, "bad number syntax at %c", c);
+                    goto err;
+                }
+
+                if (u_json_sax_token(p, buf, ts, i))
+                    goto err;
+
+                p->state = S_AFTER;
+                continue;
+
+            case S_LITERAL:
+                if (c != p->lit[p->litpos])
+                {
+                    (void) u_json_sax_err(p, "expect \'%c\', got %c",
+                            p->lit[p->litpos], c);
+                    goto err;
+                }
+
+                if (p->lit[++p->litpos] != '\0')
+                    break;
+
+                p->state = S_AFTER;
+
+                if (p->lit[0] == 'n')
+                {
+                    if (p->cbs.on_null && p->cbs.on_null(p->arg))
+                        goto abort;
+                }
+                else if (p->cbs.on_bool && p->cbs.on_bool(p->lit[0] == 't',
+                            p->arg))
+                    goto abort;
+                break;
+
+            default:
+                /* Structural states: white spaces don't matter here. */
+                if (isspace((unsigned char) c))
+                    break;
+
+                switch (p->state)
+                {
+                    case S_DOC:
+                        if (c != '{' && c != '[')
+                        {
+                            (void) u_json_sax_err(p, 
+                                    "Expect \'{\' or \'[\', got \'%c\'.", c);
+                            goto err;
+                        }
+
+                        if (u_json_sax_push(p, c))
+                            goto err;
+                        break;
+
+                    case S_OBJ_NEXT:
+                    case S_OBJ_FIRST:
+                        if (c == '"')
+                        {
+                            p->iskey = 1;
+                            p->state = S_STRING;
+                            ts = i + 1;
+                        }
+                        else if (c == '}')
+                        {
+                            if (p->state == S_OBJ_NEXT)
+                                u_warn("Trailing \',\' at the end of object !");
+
+                            if (u_json_sax_pop(p, c))
+                                goto err;
+                        }
+                        else
+                        {
+                            (void) u_json_sax_err(p, "expect key, got %c", c);
+                            goto err;
+                        }
+                        break;
+
+                    case S_COLON:
+                        if (c != ':')
+                        {
+                            (void) u_json_sax_err(p, "expect \':\', got %c", c);
+                            goto err;
+                        }
+
+                        p->state = S_VALUE;
+                        break;
+
+                    case S_ARR_NEXT:
+                    case S_ARR_FIRST:
+                        if (c == ']')
+                        {
+                            if (p->state == S_ARR_NEXT)
+                                u_warn("Trailing \',\' at the end of array !");
+
+                            if (u_json_sax_pop(p, c))
+                                goto err;
+                            break;
+                        }
+                        /* Fall through. */
+                    case S_VALUE:
+                        if (u_json_sax_value(p, c))
+                            goto err;
+
+                        /* Strings start past the quote, numbers right here. */
+                        ts = (c == '"') ? i + 1 : i;
+                        break;
+
+                    case S_AFTER:
+                        if (c == ',')
+                        {
+                            p->state = (p->stack[p->sp - 1] == '{') ?
+                                S_OBJ_NEXT : S_ARR_NEXT;
+                        }
+                        else if (c == '}' || c == ']')
+                        {
+                            if (u_json_sax_pop(p, c))
+                                goto err;
+                        }
+                        else
+                        {
+                            (void) u_json_sax_err(p, 
+                                    "expect \',\' or \'%c\', got %c",
+                                    p->stack[p->sp - 1] == '{' ? '}' : ']', c);
+                            goto err;
+                        }
+                        break;
+                }
+        }
+
+        i += 1;
+    }
+
+end:
+    /* Put aside the token which continues in the next chunk. */
+    switch (p->state)
+    {
+        case S_STRING: case S_ESC: case S_UHEX: case S_NUMBER:
+            if (u_json_sax_save(p, buf, ts, len))
+                goto err;
+            break;
+        default:
+            break;
+    }
+
+    p->off += len;
+    p->cur = 0;
+
+    return 0;
+abort:
+    (void) u_json_sax_err(p, "stopped by callback");
+err:
+    p->state = S_ERROR;
+    return ~0;
+}
+
+/**
+ *  \brief  Tell a streaming JSON parser that input is over
+ *
+ *  \param  p   A parser created with ::u_json_sax_new
+ *
+ *  \retval  0  if the input ended after a complete top level text
+ *  \retval ~0  if it was truncated, or if the parser is in error state
+ */
+int u_json_sax_end (u_json_sax_t *p)
+{
+    dbg_return_if (p == NULL, ~0);
+    nop_return_if (p->state == S_ERROR, ~0);
+
+    if (p->state != S_DOC)
+    {
+        (void) u_json_sax_err(p, "unexpected end of text");
+        p->state = S_ERROR;
+        return ~0;
+    }
+
+    return 0;
+}
+
+/**
+ *  \brief  Return the error string of a streaming JSON parser
+ *
+ *  \param  p   A parser created with ::u_json_sax_new
+ *
+ *  \return the error string, empty if no error occurred
+ */
+const char *u_json_sax_geterr (u_json_sax_t *p)
+{
+    dbg_return_if (p == NULL, NULL);
+
+    return p->err;
+}
+
+/**
+ *  \}
+ */
+
+/* Start a value with first char 'c'. */
+static int u_json_sax_value (u_json_sax_t *p, char c)
+{
+    /* Same limit as the tree parser. */
+    if (p->sp >= U_JSON_MAX_DEPTH)
+    {
+        (void) u_json_sax_err(p, "Maximum allowed nesting is %u.",
+                U_JSON_MAX_DEPTH);
+        return ~0;
+    }
+
+    switch (c)
+    {
+        case '"':
+            p->iskey = 0;
+            p->state = S_STRING;
+            return 0;
+        case '{':
+        case '[':
+            return u_json_sax_push(p, c);
+        case 't':
+            p->lit = "true";
+            break;
+        case 'f':
+            p->lit = "false";
+            break;
+        case 'n':
+            p->lit = "null";
+            break;
+        default:
+            if (c != '-' && !isdigit((unsigned char) c))
+            {
+                (void) u_json_sax_err(p, "value not found at \'%c\'", c);
+                return ~0;
+            }
+
+            p->nstate = (c == '-') ? N_MINUS : ((c == '0') ? N_ZERO : N_INT);
+            p->state = S_NUMBER;
+            return 0;
+    }
+
+    p->litpos = 1;
+    p->state = S_LITERAL;
+
+    return 0;
+}
+
+/* Open a container. */
+static int u_json_sax_push (u_json_sax_t *p, char c)
+{
+    int rc;
+
+    p->stack[p->sp++] = c;
+
+    if (c == '{')
+    {
+        p->state = S_OBJ_FIRST;
+        rc = p->cbs.on_object_start ? p->cbs.on_object_start(p->arg) : 0;
+    }
+    else
+    {
+        p->state = S_ARR_FIRST;
+        rc = p->cbs.on_array_start ? p->cbs.on_array_start(p->arg) : 0;
+    }
+
+    if (rc)
+        (void) u_json_sax_err(p, "stopped by callback");
+
+    return rc;
+}
+
+/* Close the innermost container with 'c'. */
+static int u_json_sax_pop (u_json_sax_t *p, char c)
+{
+    int rc;
+    char o = p->stack[p->sp - 1];
+
+    if ((o == '{' && c != '}') || (o == '[' && c != ']'))
+    {
+        (void) u_json_sax_err(p, "expect \'%c\', got %c",
+                o == '{' ? '}' : ']', c);
+        return ~0;
+    }
+
+    p->sp -= 1;
+    p->state = (p->sp == 0) ? S_DOC : S_AFTER;
+
+    if (c == '}')
+        rc = p->cbs.on_object_end ? p->cbs.on_object_end(p->arg) : 0;
+    else
+        rc = p->cbs.on_array_end ? p->cbs.on_array_end(p->arg) : 0;
+
+    if (rc)
+        (void) u_json_sax_err(p, "stopped by callback");
+
+    return rc;
+}
+
+/* Report the token at [start, end) in 'buf', prefixed by the part of it
+ * that came with previous chunks, if any. */
+static int u_json_sax_token (u_json_sax_t *p, const char *buf, size_t start,
+        size_t end)
+{
+    int rc;
+    const char *t = buf + start;
+    size_t tlen = end - start;
+    int (*cb) (const char *, size_t, void *);
+
+    if (p->pending)
+    {
+        dbg_err_if (u_json_sax_save(p, buf, start, end));
+        t = p->tok, tlen = p->tlen;
+        p->pending = 0, p->tlen = 0;
+    }
+
+    if (p->state == S_NUMBER)
+        cb = p->cbs.on_number;
+    else
+        cb = p->iskey ? p->cbs.on_key : p->cbs.on_string;
+
+    if (cb && (rc = cb(t, tlen, p->arg)))
+    {
+        (void) u_json_sax_err(p, "stopped by callback");
+        return rc;
+    }
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Append [start, end) from 'buf' to the pending token buffer. */
+static int u_json_sax_save (u_json_sax_t *p, const char *buf, size_t start,
+        size_t end)
+{
+    char *t;
+    size_t sz, len = end - start;
+
+    if (p->tlen + len > p->tsz)
+    {
+        if (p->tlen + len > U_JSON_SAX_TOKEN_MAX)
+        {
+            (void) u_json_sax_err(p, "token longer than %u bytes",
+                    U_JSON_SAX_TOKEN_MAX);
+            return ~0;
+        }
+
+        for (sz = p->tsz ? p->tsz : 256; sz < p->tlen + len; sz *= 2)
+            ;
+        sz = U_MIN(sz, U_JSON_SAX_TOKEN_MAX);
+
+        warn_err_sif ((t = u_realloc(p->tok, sz)) == NULL);
+        p->tok = t, p->tsz = sz;
+    }
+
+    if (len)
+        memcpy(p->tok + p->tlen, buf + start, len);
+    p->tlen += len;
+    p->pending = 1;
+
+    return 0;
+err:
+    return ~0;
+}
+
+/* Return 1 if 'c' continues the number in sub-state '*ns' (updating it). */
+static int u_json_sax_number_next (int *ns, char c)
+{
+    int d = isdigit((unsigned char) c);
+
+    switch (*ns)
+    {
+        case N_MINUS:
+            if (!d)
+                return 0;
+            *ns = (c == '0') ? N_ZERO : N_INT;
+            return 1;
+        case N_INT:
+            if (d)
+                return 1;
+            /* Fall through. */
+        case N_ZERO:
+            if (c == '.')
+                *ns = N_DOT;
+            else if (c == 'e' || c == 'E')
+                *ns = N_E;
+            else
+                return 0;
+            return 1;
+        case N_DOT:
+            if (!d)
+                return 0;
+            *ns = N_FRAC;
+            return 1;
+        case N_FRAC:
+            if (d)
+                return 1;
+            if (c != 'e' && c != 'E')
+                return 0;
+            *ns = N_E;
+            return 1;
+        case N_E:
+            if (c == '+' || c == '-')
+            {
+                *ns = N_ESIGN;
+                return 1;
+            }
+            /* Fall through. */
+        case N_ESIGN:
+            if (!d)
+                return 0;
+            *ns = N_EXP;
+            return 1;
+        case N_EXP:
+            return d;
+    }
+
+    return 0;
+}
+
+/* Set the error string, prefixed with the stream offset of the error. */
+static int u_json_sax_err (u_json_sax_t *p, const char *fmt, ...)
+{
+    va_list ap;
+    size_t n;
+
+    /* Don't overwrite the first error. */
+    nop_return_if (p->err[0] != '\0', 0);
+
+    n = (size_t) snprintf(p->err, sizeof p->err, "offset %zu: ", 
+            p->off + p->cur);
+
+    va_start(ap, fmt);
+    (void) vsnprintf(p->err + U_MIN(n, sizeof p->err - 1),
+            sizeof p->err - U_MIN(n, sizeof p->err - 1), fmt, ap);
+    va_end(ap);
+
+    return 0;
+}
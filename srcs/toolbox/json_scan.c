@@ -0,0 +1,815 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include <toolbox/json.h>
+#include <toolbox/carpal.h>
+#include <toolbox/misc.h>
+#include <toolbox/memory.h>
+
+/* SIMD kernels are built with GCC/clang on x86, unless told otherwise. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(U_JSON_NO_SIMD)
+  #define U_JSON_SCAN_X86
+  #include <immintrin.h>
+#endif
+
+/* Bytes scanned by stage 1 before handing the tape to stage 2 (a multiple
+ * of 64): stage 1 runs on a cache-hot window, and the tape stays small. */
+#ifndef U_JSON_SCAN_WIN
+#define U_JSON_SCAN_WIN     1024
+#endif  /* !U_JSON_SCAN_WIN */
+
+/* Char classes. */
+enum {
+    C_QUOTE = 0x01,     /* '"' */
+    C_BSLASH = 0x02,    /* '\' */
+    C_OP = 0x04,        /* '{', '}', '[', ']', ':' and ',' */
+    C_WS = 0x08,        /* ' ', '\t', '\n' and '\r' */
+    C_CTL = 0x10        /* iscntrl(), i.e. [0x00-0x1f] and 0x7f */
+};
+
+/* Classification of a 64 bytes block: bit i is set if char i is in the
+ * class. */
+typedef struct
+{
+    uint64_t quote, bslash, op, ws, ctl;
+} u_json_masks_t;
+
+/* Grammar states (same as the u_json_match_* functions). */
+enum {
+    S_DOC,          /* Expect '{' or '['. */
+    S_OBJ_FIRST,    /* After '{': expect a key or '}'. */
+    S_OBJ_NEXT,     /* After ',' in an object: expect a key. */
+    S_COLON,        /* After a key: expect ':'. */
+    S_VALUE,        /* After ':': expect a value. */
+    S_ARR_FIRST,    /* After '[': expect a value or ']'. */
+    S_ARR_NEXT,     /* After ',' in an array: expect a value. */
+    S_AFTER,        /* After a value: expect ',' or the closing bracket. */
+    S_TRAIL         /* Top level text is over. */
+};
+
+/* Validator state across windows. */
+typedef struct
+{
+    const char *s;          /* JSON text ... */
+    size_t len;             /* ... and its length. */
+
+    /* Stage 1 carries. */
+    uint64_t in_str;        /* All ones if the last block ended in a string. */
+    uint64_t esc;           /* 1 if the first char of the block is escaped. */
+    uint64_t prev_other;    /* 1 if the last block ended in a scalar. */
+    size_t bad;             /* Offset of a control char in a string. */
+    size_t bslash;          /* Offset past the last backslash seen. */
+
+    /* Stage 2. */
+    int state;
+    size_t str;             /* Offset of the open string (0 if none). */
+    char iskey;             /* The open string is a key. */
+    char *stack;            /* Open containers ('{' or '['). */
+    size_t sp, ssz;
+    char stack0[64];
+
+    char *status;           /* Error string (may be NULL). */
+} u_json_scan_t;
+
+typedef void (*u_json_classify_t) (const char *p, u_json_masks_t *m);
+
+static void u_json_classify_scalar (const char *p, u_json_masks_t *m);
+#ifdef U_JSON_SCAN_X86
+static void u_json_classify_sse2 (const char *p, u_json_masks_t *m);
+static void u_json_classify_avx2 (const char *p, u_json_masks_t *m);
+#endif  /* U_JSON_SCAN_X86 */
+
+static size_t u_json_stage1 (u_json_scan_t *st, size_t off, size_t len,
+        size_t *tape);
+static int u_json_stage2 (u_json_scan_t *st, const size_t *tape, size_t n);
+static uint64_t u_json_scan_escaped (uint64_t bslash, uint64_t *carry);
+static uint64_t u_json_scan_prefix_xor (uint64_t x);
+static int u_json_scan_string (u_json_scan_t *st, size_t from, size_t to);
+static int u_json_scan_atom (u_json_scan_t *st, size_t off);
+static int u_json_scan_push (u_json_scan_t *st, char c);
+static int u_json_scan_pop (u_json_scan_t *st, size_t off, char c);
+static unsigned int u_json_scan_ctz (uint64_t x);
+static int u_json_scan_err (u_json_scan_t *st, size_t off, const char *fmt,
+        ...);
+
+/* Classes of each char, for the scalar kernel and for stage 2. */
+static unsigned char u_json_cls[256];
+
+/* Scanner in use (resolved on first use) and its kernel. */
+static u_json_scanner_t u_json_scanner = U_JSON_SCANNER_AUTO;
+static u_json_classify_t u_json_classify = NULL;
+
+/**
+ *  \addtogroup json
+ *  \{
+ */
+
+/**
+ *  \brief  Validate a JSON text of given length
+ *
+ *  Check that the \p len bytes at \p json (which need not be NUL-terminated)
+ *  are a syntactically valid JSON text, i.e. the same that ::u_json_decode
+ *  would accept, without building the tree.
+ *
+ *  The check is done in two stages: first the structural characters, the
+ *  string delimiters and the beginning of the scalar values are located 64
+ *  bytes at a time (with SIMD instructions where available, see
+ *  ::u_json_set_scanner), building a tape of offsets; then the grammar is
+ *  checked following the tape, which lets it jump over the contents of
+ *  the strings.  Both stages use no recursion, so that there is no limit
+ *  on the nesting level.
+ *
+ *  \param  json    the JSON text
+ *  \param  len     length of \p json
+ *  \param  status  if not \c NULL, it will hold the error string on failure
+ *
+ *  \retval  0  if \p json is a valid JSON text
+ *  \retval ~0  on syntax error, or on failure
+ */
+int u_json_validate_ex (const char *json, size_t len,
+        char status[U_LEXER_ERR_SZ])
+{
+    int rc = ~0;
+    size_t off, n, tape[U_JSON_SCAN_WIN + 1];
+    u_json_scan_t st;
+
+    dbg_return_if (json == NULL, ~0);
+
+    if (u_json_classify == NULL)
+        (void) u_json_set_scanner(U_JSON_SCANNER_AUTO);
+
+    memset(&st, 0, sizeof st);
+    st.s = json;
+    st.len = len;
+    st.bad = len;
+    st.state = S_DOC;
+    st.stack = st.stack0;
+    st.ssz = sizeof st.stack0;
+    st.status = status;
+
+    if (status)
+        status[0] = '\0';
+
+    for (off = 0; off < len && st.state != S_TRAIL; off += U_JSON_SCAN_WIN)
+    {
+        n = u_json_stage1(&st, off, U_MIN(U_JSON_SCAN_WIN, len - off), tape);
+
+        if (u_json_stage2(&st, tape, n))
+            goto end;
+
+        if (st.bad < len && st.state != S_TRAIL)
+        {
+            (void) u_json_scan_err(&st, st.bad, "control character in string");
+            goto end;
+        }
+    }
+
+    switch (st.state)
+    {
+        case S_TRAIL:
+            rc = 0;
+            break;
+        case S_DOC:
+            (void) u_json_scan_err(&st, len, "Empty JSON text !");
+            break;
+        default:
+            (void) u_json_scan_err(&st, len, st.str ? "unterminated string" :
+                    "unexpected end of text");
+            break;
+    }
+
+end:
+    if (st.stack != st.stack0)
+        u_free(st.stack);
+
+    return rc;
+}
+
+/**
+ *  \brief  Choose the structural scanner of ::u_json_validate_ex
+ *
+ *  Select the implementation of the first validation stage.  By default
+ *  (::U_JSON_SCANNER_AUTO) the fastest one supported by the running CPU
+ *  is picked; any of them gives the same results.  The setting is process
+ *  wide, and should be changed before any validation is under way.
+ *
+ *  \param  sc  one of ::u_json_scanner_t
+ *
+ *  \retval  0  on success
+ *  \retval ~0  if \p sc is not supported by the library build or the CPU
+ */
+int u_json_set_scanner (u_json_scanner_t sc)
+{
+    int c;
+
+    /* Char classes. */
+    if (u_json_cls['"'] == 0)
+    {
+        for (c = 0; c < 0x20; c++)
+            u_json_cls[c] = C_CTL;
+        u_json_cls[0x7f] = C_CTL;
+        u_json_cls[' '] = C_WS;
+        u_json_cls['\t'] = u_json_cls['\n'] = u_json_cls['\r'] = C_WS | C_CTL;
+        u_json_cls['{'] = u_json_cls['}'] = C_OP;
+        u_json_cls['['] = u_json_cls[']'] = C_OP;
+        u_json_cls[':'] = u_json_cls[','] = C_OP;
+        u_json_cls['\\'] = C_BSLASH;
+        u_json_cls['"'] = C_QUOTE;
+    }
+
+#ifdef U_JSON_SCAN_X86
+    __builtin_cpu_init();
+
+    if (sc == U_JSON_SCANNER_AUTO)
+    {
+        if (__builtin_cpu_supports("avx2"))
+            sc = U_JSON_SCANNER_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            sc = U_JSON_SCANNER_SSE2;
+        else
+            sc = U_JSON_SCANNER_SCALAR;
+    }
+
+    switch (sc)
+    {
+        case U_JSON_SCANNER_AVX2:
+            nop_return_if (!__builtin_cpu_supports("avx2"), ~0);
+            u_json_classify = u_json_classify_avx2;
+            break;
+        case U_JSON_SCANNER_SSE2:
+            nop_return_if (!__builtin_cpu_supports("sse2"), ~0);
+            u_json_classify = u_json_classify_sse2;
+            break;
+        case U_JSON_SCANNER_SCALAR:
+            u_json_classify = u_json_classify_scalar;
+            break;
+        default:
+            dbg_return_ifm (1, ~0, "unknown scanner %d", sc);
+    }
+#else   /* !U_JSON_SCAN_X86 */
+    if (sc == U_JSON_SCANNER_AUTO)
+        sc = U_JSON_SCANNER_SCALAR;
+
+    nop_return_if (sc != U_JSON_SCANNER_SCALAR, ~0);
+    u_json_classify = u_json_classify_scalar;
+#endif  /* U_JSON_SCAN_X86 */
+
+    u_json_scanner = sc;
+
+    return 0;
+}
+
+/**
+ *  \brief  Return the structural scanner in use
+ *
+ *  \return the ::u_json_scanner_t used by ::u_json_validate_ex (never
+ *          ::U_JSON_SCANNER_AUTO)
+ */
+u_json_scanner_t u_json_get_scanner (void)
+{
+    if (u_json_classify == NULL)
+        (void) u_json_set_scanner(U_JSON_SCANNER_AUTO);
+
+    return u_json_scanner;
+}
+
+/**
+ *  \}
+ */
+
+/* Stage 1: append to 'tape' the offsets of the structural chars, of the
+ * quotes delimiting strings, and of the first char of scalars (numbers and
+ * literals) in the 'len' bytes at 'off', and return their number. */
+static size_t u_json_stage1 (u_json_scan_t *st, size_t off, size_t len,
+        size_t *tape)
+{
+    size_t i, n = 0;
+    uint64_t quote, in, other, m, ctl;
+    u_json_masks_t k;
+    char pad[64];
+    const char *p;
+
+    for (i = 0; i < len; i += 64)
+    {
+        /* The last partial block is padded with white spaces. */
+        if (len - i < 64)
+        {
+            memset(pad, ' ', sizeof pad);
+            memcpy(pad, st->s + off + i, len - i);
+            p = pad;
+        }
+        else
+            p = st->s + off + i;
+
+        u_json_classify(p, &k);
+
+        if (k.bslash)
+            st->bslash = off + i + 64;
+
+        /* Unescaped quotes delimit strings: the prefix XOR of their
+         * positions marks the strings (opening quote included). */
+        quote = k.quote & ~u_json_scan_escaped(k.bslash, &st->esc);
+        in = u_json_scan_prefix_xor(quote) ^ st->in_str;
+        st->in_str = (uint64_t) ((int64_t) in >> 63);
+
+        /* Control chars are not allowed in strings: keep track of the first
+         * one, and of the tape up to it. */
+        if ((ctl = k.ctl & in) != 0)
+        {
+            m = ctl & (0 - ctl);
+            st->bad = off + i + u_json_scan_ctz(ctl);
+            in &= m - 1, quote &= m - 1, k.op &= m - 1, k.ws |= ~(m - 1);
+            len = i;
+        }
+
+        /* Scalars: runs of chars which are not structural, white space or
+         * quotes, outside strings. */
+        other = ~(k.op | k.ws | quote | in);
+        m = (k.op & ~in) | quote | (other & ~((other << 1) | st->prev_other));
+        st->prev_other = other >> 63;
+
+        for (; m; m &= m - 1)
+            tape[n++] = off + i + u_json_scan_ctz(m);
+    }
+
+    return n;
+}
+
+/* Stage 2: check the grammar following the tape. */
+static int u_json_stage2 (u_json_scan_t *st, const size_t *tape, size_t n)
+{
+    size_t i, off;
+    char c;
+
+    for (i = 0; i < n; i++)
+    {
+        off = tape[i];
+        c = st->s[off];
+
+        /* The tape goes from the opening to the closing quote. */
+        if (st->str)
+        {
+            if (u_json_scan_string(st, st->str, off))
+                return ~0;
+
+            st->str = 0;
+            st->state = st->iskey ? S_COLON : S_AFTER;
+            continue;
+        }
+
+        switch (st->state)
+        {
+            case S_DOC:
+                if (c != '{' && c != '[')
+                    return u_json_scan_err(st, off,
+                            "Expect \'{\' or \'[\', got \'%c\'.", c);
+
+                if (u_json_scan_push(st, c))
+                    return ~0;
+                break;
+
+            case S_OBJ_FIRST:
+            case S_OBJ_NEXT:
+                if (c == '"')
+                {
+                    st->str = off + 1;
+                    st->iskey = 1;
+                }
+                else if (c == '}')
+                {
+                    if (st->state == S_OBJ_NEXT)
+                        u_warn("Trailing \',\' at the end of object !");
+
+                    if (u_json_scan_pop(st, off, c))
+                        return ~0;
+                }
+                else
+                    return u_json_scan_err(st, off, "expect key, got %c", c);
+                break;
+
+            case S_COLON:
+                if (c != ':')
+                    return u_json_scan_err(st, off, "expect \':\', got %c", c);
+
+                st->state = S_VALUE;
+                break;
+
+            case S_ARR_FIRST:
+            case S_ARR_NEXT:
+                if (c == ']')
+                {
+                    if (st->state == S_ARR_NEXT)
+                        u_warn("Trailing \',\' at the end of array !");
+
+                    if (u_json_scan_pop(st, off, c))
+                        return ~0;
+                    break;
+                }
+                /* Fall through. */
+            case S_VALUE:
+                if (c == '"')
+                {
+                    st->str = off + 1;
+                    st->iskey = 0;
+                }
+                else if (c == '{' || c == '[')
+                {
+                    if (u_json_scan_push(st, c))
+                        return ~0;
+                }
+                else if (u_json_cls[(unsigned char) c] & C_OP)
+                    return u_json_scan_err(st, off,
+                            "value not found at \'%c\'", c);
+                else if (u_json_scan_atom(st, off))
+                    return ~0;
+                break;
+
+            case S_AFTER:
+                if (c == ',')
+                    st->state = (st->stack[st->sp - 1] == '{') ?
+                        S_OBJ_NEXT : S_ARR_NEXT;
+                else if (c == '}' || c == ']')
+                {
+                    if (u_json_scan_pop(st, off, c))
+                        return ~0;
+                }
+                else
+                    return u_json_scan_err(st, off,
+                            "expect \',\' or \'%c\', got %c",
+                            st->stack[st->sp - 1] == '{' ? '}' : ']', c);
+                break;
+
+            case S_TRAIL:
+                /* As the decoder, just warn. */
+                u_warn("Unparsed trailing text at position %zu", off);
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Offsets of the escaped chars given the backslashes of a block: each
+ * backslash which is not escaped itself escapes the following char. */
+static uint64_t u_json_scan_escaped (uint64_t bslash, uint64_t *carry)
+{
+    uint64_t b, esc = *carry;
+
+    bslash &= ~*carry;
+    *carry = 0;
+
+    for (; bslash; bslash &= ~(b | (b << 1)))
+    {
+        b = bslash & (0 - bslash);
+
+        if (b >> 63)
+        {
+            *carry = 1;
+            break;
+        }
+
+        esc |= b << 1;
+    }
+
+    return esc;
+}
+
+/* Bit i of the result is the XOR of bits 0..i of 'x'. */
+static uint64_t u_json_scan_prefix_xor (uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+
+    return x;
+}
+
+/* Check escapes in the string contents at [from, to). */
+static int u_json_scan_string (u_json_scan_t *st, size_t from, size_t to)
+{
+    size_t i;
+    const char *s = st->s, *b;
+
+    /* Most strings are not even worth a look. */
+    if (from >= st->bslash)
+        return 0;
+
+    while ((b = memchr(s + from, '\\', to - from)) != NULL)
+    {
+        from = (size_t) (b - s) + 2;
+
+        switch (b[1])
+        {
+            case '"': case '\\': case '/': case 'b':
+            case 'f': case 'n':  case 'r': case 't':
+                break;
+            case 'u':
+                for (i = 2; i < 6; i++)
+                {
+                    if (b + i >= s + to || !isxdigit((unsigned char) b[i]))
+                        return u_json_scan_err(st, (size_t) (b - s) + i,
+                                "non hex digit in escaped unicode");
+                }
+                from += 4;
+                break;
+            default:
+                return u_json_scan_err(st, (size_t) (b - s) + 1,
+                        "invalid char %c in escape", b[1]);
+        }
+
+        if (from >= to)
+            break;
+    }
+
+    return 0;
+}
+
+/* Check the number or literal at 'off': it must end right before a white
+ * space, a structural char, a quote or the end of text. */
+static int u_json_scan_atom (u_json_scan_t *st, size_t off)
+{
+    size_t i = off, len = st->len;
+    const char *s = st->s, *lit = NULL;
+
+    switch (s[i])
+    {
+        case 't': lit = "true"; break;
+        case 'f': lit = "false"; break;
+        case 'n': lit = "null"; break;
+    }
+
+    if (lit)
+    {
+        for (; *lit; lit++, i++)
+            if (i == len || s[i] != *lit)
+                return u_json_scan_err(st, i, "bad literal");
+    }
+    else
+    {
+        /* INT */
+        if (s[i] == '-')
+            i++;
+
+        if (i < len && s[i] == '0')
+            i++;
+        else if (i < len && s[i] >= '1' && s[i] <= '9')
+            while (++i < len && isdigit((unsigned char) s[i]))
+                ;
+        else
+            return u_json_scan_err(st, i, "bad int syntax");
+
+        /* [FRAC] */
+        if (i < len && s[i] == '.')
+        {
+            if (++i == len || !isdigit((unsigned char) s[i]))
+                return u_json_scan_err(st, i, "bad frac syntax");
+
+            while (++i < len && isdigit((unsigned char) s[i]))
+                ;
+        }
+
+        /* [EXP] */
+        if (i < len && (s[i] == 'e' || s[i] == 'E'))
+        {
+            if (++i < len && (s[i] == '+' || s[i] == '-'))
+                i++;
+
+            if (i == len || !isdigit((unsigned char) s[i]))
+                return u_json_scan_err(st, i, "bad exp syntax");
+
+            while (++i < len && isdigit((unsigned char) s[i]))
+                ;
+        }
+    }
+
+    if (i < len && !(u_json_cls[(unsigned char) s[i]] & (C_OP | C_WS | C_QUOTE)))
+        return u_json_scan_err(st, i, "unexpected char %c after value", s[i]);
+
+    st->state = S_AFTER;
+
+    return 0;
+}
+
+/* Open a container. */
+static int u_json_scan_push (u_json_scan_t *st, char c)
+{
+    char *ns;
+    size_t nsz;
+
+    if (st->sp == st->ssz)
+    {
+        nsz = st->ssz * 2;
+
+        if (st->stack == st->stack0)
+        {
+            dbg_err_sif ((ns = u_malloc(nsz)) == NULL);
+            memcpy(ns, st->stack0, st->sp);
+        }
+        else
+            dbg_err_sif ((ns = u_realloc(st->stack, nsz)) == NULL);
+
+        st->stack = ns;
+        st->ssz = nsz;
+    }
+
+    st->stack[st->sp++] = c;
+    st->state = (c == '{') ? S_OBJ_FIRST : S_ARR_FIRST;
+
+    return 0;
+err:
+    return u_json_scan_err(st, (size_t) -1, "out of memory");
+}
+
+/* Close the innermost container with 'c'. */
+static int u_json_scan_pop (u_json_scan_t *st, size_t off, char c)
+{
+    char o = st->stack[st->sp - 1];
+
+    if ((o == '{') != (c == '}'))
+        return u_json_scan_err(st, off, "expect \'%c\', got %c",
+                o == '{' ? '}' : ']', c);
+
+    st->sp -= 1;
+    st->state = (st->sp == 0) ? S_TRAIL : S_AFTER;
+
+    return 0;
+}
+
+/* Set the status string (if any), prefixed with the offset of the error,
+ * and return ~0. */
+static int u_json_scan_err (u_json_scan_t *st, size_t off, const char *fmt,
+        ...)
+{
+    va_list ap;
+    size_t n = 0;
+
+    if (st->status == NULL)
+        return ~0;
+
+    if (off != (size_t) -1 && 
+            u_snprintf(st->status, U_LEXER_ERR_SZ, "offset %zu: ", off) == 0)
+        n = strlen(st->status);
+
+    va_start(ap, fmt);
+    (void) vsnprintf(st->status + n, U_LEXER_ERR_SZ - n, fmt, ap);
+    va_end(ap);
+
+    return ~0;
+}
+
+/* Index of the lowest bit set in 'x' (not 0). */
+static unsigned int u_json_scan_ctz (uint64_t x)
+{
+#ifdef __GNUC__
+    return (unsigned int) __builtin_ctzll(x);
+#else
+    unsigned int n = 0;
+
+    for (; (x & 0xff) == 0; x >>= 8)
+        n += 8;
+    for (; (x & 1) == 0; x >>= 1)
+        n += 1;
+
+    return n;
+#endif  /* __GNUC__ */
+}
+
+static void u_json_classify_scalar (const char *p, u_json_masks_t *m)
+{
+    unsigned int i, c;
+    uint64_t b;
+
+    memset(m, 0, sizeof *m);
+
+    for (i = 0; i < 64; i++)
+    {
+        if ((c = u_json_cls[(unsigned char) p[i]]) == 0)
+            continue;
+
+        b = (uint64_t) 1 << i;
+
+        if (c & C_QUOTE)
+            m->quote |= b;
+        if (c & C_BSLASH)
+            m->bslash |= b;
+        if (c & C_OP)
+            m->op |= b;
+        if (c & C_WS)
+            m->ws |= b;
+        if (c & C_CTL)
+            m->ctl |= b;
+    }
+
+    return;
+}
+
+#ifdef U_JSON_SCAN_X86
+
+/* 16 bytes at a time.  '[' and ']' differ from '{' and '}' by bit 5 only,
+ * and controls are the bytes which are left as-is by an unsigned minimum
+ * with 0x1f (plus 0x7f). */
+__attribute__((target("sse2")))
+static void u_json_classify_sse2 (const char *p, u_json_masks_t *m)
+{
+    unsigned int i;
+    uint64_t q, b, o, w, c;
+    __m128i x, y;
+
+    memset(m, 0, sizeof *m);
+
+    for (i = 0; i < 64; i += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *) (p + i));
+
+        q = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x,
+                    _mm_set1_epi8('"')));
+        b = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x,
+                    _mm_set1_epi8('\\')));
+
+        y = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        o = (uint16_t) _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(y, _mm_set1_epi8('{')),
+                    _mm_cmpeq_epi8(y, _mm_set1_epi8('}'))),
+                _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(':')),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8(',')))));
+
+        w = (uint16_t) _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+                _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('\r')))));
+
+        c = (uint16_t) _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1f)), x),
+                _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f))));
+
+        m->quote |= q << i;
+        m->bslash |= b << i;
+        m->op |= o << i;
+        m->ws |= w << i;
+        m->ctl |= c << i;
+    }
+
+    return;
+}
+
+/* Same as above, 32 bytes at a time. */
+__attribute__((target("avx2")))
+static void u_json_classify_avx2 (const char *p, u_json_masks_t *m)
+{
+    unsigned int i;
+    uint64_t q, b, o, w, c;
+    __m256i x, y;
+
+    memset(m, 0, sizeof *m);
+
+    for (i = 0; i < 64; i += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *) (p + i));
+
+        q = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x,
+                    _mm256_set1_epi8('"')));
+        b = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x,
+                    _mm256_set1_epi8('\\')));
+
+        y = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        o = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(y, _mm256_set1_epi8('{')),
+                    _mm256_cmpeq_epi8(y, _mm256_set1_epi8('}'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(':')),
+                    _mm256_cmpeq_epi8(x, _mm256_set1_epi8(',')))));
+
+        w = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                    _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                    _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')))));
+
+        c = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(0x1f)),
+                    x),
+                _mm256_cmpeq_epi8(x, _mm256_set1_epi8(0x7f))));
+
+        m->quote |= q << i;
+        m->bslash |= b << i;
+        m->op |= o << i;
+        m->ws |= w << i;
+        m->ctl |= c << i;
+    }
+
+    return;
+}
+
+#endif  /* U_JSON_SCAN_X86 */
@@ -18,6 +18,7 @@ struct u_lexer_s
     size_t lmatch;  /* Offset of current left side match. */
     size_t rmatch;  /* Offset of current right side match. */
     char err[U_LEXER_ERR_SZ];   /* Error string. */
+    char ref;       /* Set if 's' is referenced instead of owned. */
 };
 
 static void u_lexer_incr (u_lexer_t *l);
@@ -68,6 +69,47 @@ err:
     return ~0;
 }
 
+/**
+ *  \brief  Create a new lexer context referencing the string \p s.
+ *
+ *  Same as ::u_lexer_new, except that the string is not copied: \p s must
+ *  stay valid for the lifetime of the lexer context.  Matches obtained via
+ *  ::u_lexer_get_match_ref point into \p s, hence they may be used to change
+ *  it in place (the lexer never does).
+ *
+ *  \param  s   Pointer to the string that has to be parsed, NUL-terminated
+ *              at offset \p len.
+ *  \param  len Length of \p s.
+ *  \param  pl  Handler for the associated lexer instance as a result argument.
+ *
+ *  \retval  0  on success
+ *  \retval ~0  on failure
+ */
+int u_lexer_new_ref (char *s, size_t len, u_lexer_t **pl)
+{
+    u_lexer_t *l = NULL;
+
+    dbg_return_if (s == NULL, ~0);
+    dbg_return_if (s[len] != '\0', ~0);
+    dbg_return_if (pl == NULL, ~0);
+    
+    warn_err_sif ((l = u_zalloc(sizeof *l)) == NULL);
+
+    /* Use the string where it lies. */
+    l->s = s;
+    l->slen = len;
+    l->ref = 1;
+
+    l->pos = l->rmatch = l->lmatch = 0;
+    l->err[0] = '\0';
+
+    *pl = l;
+
+    return 0;
+err:
+    return ~0;
+}
+
 /**
  *  \brief  Return a pointer to the substring that has not yet been parsed.
  *
@@ -92,7 +134,7 @@ void u_lexer_free (u_lexer_t *l)
     /* Don't moan on NULL objects. */
     if (l)
     {
-        if (l->s)
+        if (l->s && !l->ref)
             u_free(l->s);
         u_free(l);
     }
@@ -263,6 +305,30 @@ char *u_lexer_get_match (u_lexer_t *l, char match[U_TOKEN_SZ])
     return match;
 }
 
+/** 
+ *  \brief  Reference the matched sub-string in place.
+ *
+ *  Same as ::u_lexer_get_match, but with no copy and no ::U_TOKEN_SZ limit
+ *  on the match length: the returned pointer references the lexer string,
+ *  hence it is not NUL-terminated and stays valid until \p l is free'd.
+ *  It may be written through only when the lexer string is referenced (see
+ *  ::u_lexer_new_ref), since the string belongs to the caller in that case.
+ *
+ *  \param  l       An active lexer context.
+ *  \param  plen    Result argument holding the length of the match.
+ *
+ *  \return the first char of the matched substring, or \c NULL on error
+ */
+char *u_lexer_get_match_ref (u_lexer_t *l, size_t *plen)
+{
+    dbg_return_if (plen == NULL, NULL);
+    dbg_return_if (l->rmatch < l->lmatch, NULL);
+
+    *plen = u_lexer_strlen_match(l);
+
+    return l->s + l->lmatch;
+}
+
 /**
  *  \brief  Expect to find the supplied character under lexer cursor.
  *
@@ -0,0 +1,745 @@
+/*
+ * Copyright (c) 2005-2012 by KoanLogic s.r.l. - All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <toolbox/memory.h>
+#include <toolbox/carpal.h>
+#include <toolbox/misc.h>
+#include <toolbox/hmap.h>
+#include <toolbox/rcmap.h>
+
+#ifndef __ATOMIC_ACQUIRE
+  #error "the rcmap module needs the __atomic builtins (gcc >= 4.7 or clang)"
+#endif
+
+#define U_RCMAP_CACHELINE   64
+#define U_RCMAP_MIN_SIZE    16  /* initial number of buckets (power of two) */
+
+#define __LOAD(p, mo)       __atomic_load_n((p), __ATOMIC_##mo)
+#define __STORE(p, v, mo)   __atomic_store_n((p), (v), __ATOMIC_##mo)
+#define __FENCE()           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* chain node: never modified once reachable by readers */
+typedef struct u_rcmap_node_s
+{
+    size_t hash;
+    u_hmap_o_t *o;
+    struct u_rcmap_node_s *next;
+} u_rcmap_node_t;
+
+/* bucket array, replaced as a whole on resize */
+typedef struct u_rcmap_tab_s
+{
+    size_t mask;
+    u_rcmap_node_t **b;
+} u_rcmap_tab_t;
+
+/* per-thread reader state, on its own cache line: slots are allocated on a
+ * U_RCMAP_CACHELINE boundary (see __reader_new) and the trailing pad keeps
+ * whatever follows off the line */
+typedef struct u_rcmap_rd_s
+{
+    size_t epoch;               /* (epoch << 1) | 1 while inside a read
+                                   section, 0 otherwise */
+    unsigned int nest;          /* read section nesting (owner only) */
+    int used;                   /* slot belongs to a live thread */
+    struct u_rcmap_rd_s *next;
+
+    char pad[U_RCMAP_CACHELINE];
+} u_rcmap_rd_t;
+
+/* retired memory waiting for readers to move past its epoch */
+typedef struct u_rcmap_limbo_s
+{
+    size_t epoch;
+    void (*f_free) (u_rcmap_t *rcmap, void *p);
+    void *p;
+    struct u_rcmap_limbo_s *next;
+} u_rcmap_limbo_t;
+
+struct u_rcmap_s
+{
+    /* read by everybody, written by writers only */
+    u_rcmap_tab_t *tab;         /* current table */
+    size_t epoch;               /* global epoch */
+    size_t n;                   /* number of elements */
+    u_hmap_t *hproto;           /* empty template map: options, hashing,
+                                   key comparison and objects */
+    pthread_key_t rd_key;       /* thread -> reader slot */
+
+    /* writers only */
+    pthread_mutex_t lock;       /* serializes writers (and registrations) */
+    u_rcmap_rd_t *readers;
+    u_rcmap_limbo_t *limbo;
+
+    unsigned char key_ok, lock_ok;
+};
+
+static u_rcmap_rd_t *__reader (u_rcmap_t *rcmap);
+static u_rcmap_rd_t *__reader_new (void);
+static void __reader_release (void *arg);
+static u_rcmap_node_t *__node_new (size_t hash, u_hmap_o_t *o,
+        u_rcmap_node_t *next);
+static u_rcmap_tab_t *__tab_new (size_t size);
+static void __tab_free (u_rcmap_t *rcmap, u_rcmap_tab_t *tab, int objs);
+static int __find (u_rcmap_t *rcmap, u_rcmap_tab_t *tab, const void *key,
+        size_t hash, u_rcmap_node_t ***pb, u_rcmap_node_t **pn);
+static int __unlink (u_rcmap_t *rcmap, u_rcmap_node_t **b, u_rcmap_node_t *n,
+        u_rcmap_node_t *rep);
+static int __grow (u_rcmap_t *rcmap);
+static int __retire (u_rcmap_t *rcmap, void (*f_free)(u_rcmap_t *, void *),
+        void *p);
+static void __reclaim (u_rcmap_t *rcmap);
+static void __free_node (u_rcmap_t *rcmap, void *p);
+static void __free_node_obj (u_rcmap_t *rcmap, void *p);
+static void __free_tab (u_rcmap_t *rcmap, void *p);
+
+/**
+    \defgroup rcmap RCU HMap
+    \{
+        The \ref rcmap module provides a hash map for read-mostly data shared
+        among threads (configuration, routing tables, ...) whose readers
+        never block and never write to shared memory.
+
+        Writers are serialized by a mutex and never modify what readers may
+        be looking at: a bucket chain is updated by copying the nodes in
+        front of the changed one and publishing the new head with an atomic
+        store, and a resize publishes a whole new table.  Replaced nodes,
+        objects and tables are reclaimed by epochs: each reader thread owns
+        a slot (on its own cache line) where it announces the epoch it
+        entered its read section in, and memory retired during an epoch is
+        freed by a later writer once every reader has moved on by two
+        epochs.
+
+        Keys and values are handled just like in \ref hmap, through the same
+        ::u_hmap_opts_t (datatypes, sizes, hash and comparison functions,
+        ::U_HMAP_OPTS_NO_OVERWRITE); size, type and discard policy are
+        ignored.  Values returned by ::u_rcmap_get stay valid until the
+        read section is left, even if they are concurrently replaced or
+        deleted:
+
+    \code
+    u_hmap_opts_t *opts = NULL;
+    u_rcmap_t *routes = NULL;
+    const char *gw;
+
+    dbg_err_if (u_hmap_opts_new(&opts));
+    dbg_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_STRING));
+    dbg_err_if (u_rcmap_new(opts, &routes));
+
+    // writer
+    dbg_err_if (u_rcmap_put(routes, "10.0.0.0/8", "192.168.1.254"));
+
+    // readers
+    dbg_err_if (u_rcmap_read_lock(routes));
+    if ((gw = u_rcmap_get(routes, "10.0.0.0/8")) != NULL)
+        use(gw);
+    u_rcmap_read_unlock(routes);
+    \endcode
+
+        Read sections may be nested but must be short: while a thread stays
+        inside one, retired memory piles up.
+ */
+
+/**
+ *  \brief  Create a new RCU hmap
+ *
+ *  \param  opts    key and value options (may be NULL for string keys and
+ *                  pointer values, see ::u_hmap_new)
+ *  \param  prcmap  result argument
+ *
+ *  \retval U_HMAP_ERR_NONE on success
+ *  \retval U_HMAP_ERR_FAIL on failure
+ */
+int u_rcmap_new (u_hmap_opts_t *opts, u_rcmap_t **prcmap)
+{
+    u_rcmap_t *r = NULL;
+
+    dbg_return_if (prcmap == NULL, U_HMAP_ERR_FAIL);
+
+    dbg_err_sif ((r = u_zalloc(sizeof(u_rcmap_t))) == NULL);
+
+    dbg_err_if (u_hmap_new(opts, &r->hproto));
+    dbg_err_if (pthread_mutex_init(&r->lock, NULL));
+    r->lock_ok = 1;
+    dbg_err_if (pthread_key_create(&r->rd_key, __reader_release));
+    r->key_ok = 1;
+    dbg_err_if ((r->tab = __tab_new(U_RCMAP_MIN_SIZE)) == NULL);
+
+    *prcmap = r;
+
+    return U_HMAP_ERR_NONE;
+err:
+    u_rcmap_free(r);
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ *  \brief  Free an RCU hmap
+ *
+ *  Free \p rcmap along with its objects.  No thread may be using it.
+ *
+ *  \param  rcmap   the RCU hmap
+ */
+void u_rcmap_free (u_rcmap_t *rcmap)
+{
+    u_rcmap_limbo_t *l;
+    u_rcmap_rd_t *rd;
+
+    nop_return_if (rcmap == NULL, );
+
+    while ((l = rcmap->limbo) != NULL)
+    {
+        rcmap->limbo = l->next;
+        l->f_free(rcmap, l->p);
+        u_free(l);
+    }
+
+    if (rcmap->tab)
+        __tab_free(rcmap, rcmap->tab, 1);
+
+    /* no destructor runs after the key is gone */
+    if (rcmap->key_ok)
+        (void) pthread_key_delete(rcmap->rd_key);
+
+    while ((rd = rcmap->readers) != NULL)
+    {
+        rcmap->readers = rd->next;
+        free(rd);   /* from posix_memalign(3), see __reader_new */
+    }
+
+    if (rcmap->lock_ok)
+        (void) pthread_mutex_destroy(&rcmap->lock);
+
+    U_FREEF(rcmap->hproto, u_hmap_free);
+    u_free(rcmap);
+}
+
+/**
+ *  \brief  Insert a (key, value) pair
+ *
+ *  Insert \p key and \p val into \p rcmap, replacing any previous value
+ *  unless ::U_HMAP_OPTS_NO_OVERWRITE is set.  Readers see either the old or
+ *  the new value; the old one is freed when no reader can hold it anymore.
+ *
+ *  \param  rcmap   the RCU hmap
+ *  \param  key     the key
+ *  \param  val     the value
+ *
+ *  \retval U_HMAP_ERR_NONE     on success
+ *  \retval U_HMAP_ERR_EXISTS   if key already exists and overwrite is disabled
+ *  \retval U_HMAP_ERR_FAIL     on other failures
+ */
+int u_rcmap_put (u_rcmap_t *rcmap, const void *key, const void *val)
+{
+    u_rcmap_node_t **b, *n, *nn = NULL;
+    u_hmap_o_t *o = NULL;
+    size_t hash;
+    int rc = U_HMAP_ERR_FAIL, locked = 0;
+
+    dbg_return_if (rcmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+
+    hash = u_hmap_hash(rcmap->hproto, key);
+
+    dbg_err_if (pthread_mutex_lock(&rcmap->lock));
+    locked = 1;
+
+    /* objects may come from the template's slab: writers only */
+    dbg_err_if ((o = u_hmap_o_new(rcmap->hproto, key, val)) == NULL);
+
+    if (__find(rcmap, rcmap->tab, key, hash, &b, &n) == U_HMAP_ERR_NONE)
+    {
+        if (u_hmap_has_option(rcmap->hproto, U_HMAP_OPTS_NO_OVERWRITE))
+        {
+            rc = U_HMAP_ERR_EXISTS;
+            goto err;
+        }
+
+        dbg_err_if ((nn = __node_new(hash, o, n->next)) == NULL);
+        dbg_err_if (__unlink(rcmap, b, n, nn));
+    }
+    else
+    {
+        dbg_err_if ((nn = __node_new(hash, o, *b)) == NULL);
+        __STORE(b, nn, RELEASE);
+        __STORE(&rcmap->n, rcmap->n + 1, RELAXED);
+
+        /* keep chains short: a failed resize only costs lookup speed */
+        if (rcmap->n > rcmap->tab->mask + 1)
+            dbg_if (__grow(rcmap));
+    }
+
+    __reclaim(rcmap);
+    (void) pthread_mutex_unlock(&rcmap->lock);
+
+    return U_HMAP_ERR_NONE;
+err:
+    u_free(nn);
+    u_hmap_o_dispose(rcmap->hproto, o);
+    if (locked)
+        (void) pthread_mutex_unlock(&rcmap->lock);
+    return rc;
+}
+
+/**
+ *  \brief  Delete a key
+ *
+ *  Delete \p key from \p rcmap.  Its object is freed when no reader can
+ *  hold it anymore.
+ *
+ *  \param  rcmap   the RCU hmap
+ *  \param  key     the key
+ *
+ *  \retval U_HMAP_ERR_NONE     on success
+ *  \retval U_HMAP_ERR_FAIL     if not found or on failure
+ */
+int u_rcmap_del (u_rcmap_t *rcmap, const void *key)
+{
+    u_rcmap_node_t **b, *n;
+    int rc = U_HMAP_ERR_FAIL;
+
+    dbg_return_if (rcmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (key == NULL, U_HMAP_ERR_FAIL);
+
+    dbg_return_if (pthread_mutex_lock(&rcmap->lock), U_HMAP_ERR_FAIL);
+
+    if (__find(rcmap, rcmap->tab, key, u_hmap_hash(rcmap->hproto, key),
+                &b, &n) == U_HMAP_ERR_NONE &&
+            __unlink(rcmap, b, n, n->next) == 0)
+    {
+        __STORE(&rcmap->n, rcmap->n - 1, RELAXED);
+        __reclaim(rcmap);
+        rc = U_HMAP_ERR_NONE;
+    }
+
+    (void) pthread_mutex_unlock(&rcmap->lock);
+
+    return rc;
+}
+
+/**
+ *  \brief  Count objects
+ *
+ *  \param  rcmap   the RCU hmap
+ *
+ *  \return the number of objects in \p rcmap, or -1 on error
+ */
+ssize_t u_rcmap_count (u_rcmap_t *rcmap)
+{
+    dbg_return_if (rcmap == NULL, -1);
+
+    return (ssize_t) __LOAD(&rcmap->n, RELAXED);
+}
+
+/**
+ *  \brief  Enter a read section
+ *
+ *  Enter a read section on \p rcmap for the calling thread.  Values
+ *  obtained from ::u_rcmap_get remain valid until the matching
+ *  ::u_rcmap_read_unlock.  Sections may be nested.
+ *
+ *  \param  rcmap   the RCU hmap
+ *
+ *  \retval 0   on success
+ *  \retval ~0  on failure (thread registration failed)
+ */
+int u_rcmap_read_lock (u_rcmap_t *rcmap)
+{
+    u_rcmap_rd_t *rd;
+
+    dbg_return_if (rcmap == NULL, ~0);
+    dbg_return_if ((rd = __reader(rcmap)) == NULL, ~0);
+
+    if (rd->nest++ == 0)
+    {
+        /* announce the epoch, then make sure that writers either see it or
+         * we see everything they unlinked before advancing past it */
+        __STORE(&rd->epoch, (__LOAD(&rcmap->epoch, ACQUIRE) << 1) | 1,
+                RELAXED);
+        __FENCE();
+    }
+
+    return 0;
+}
+
+/**
+ *  \brief  Leave a read section
+ *
+ *  \param  rcmap   the RCU hmap
+ */
+void u_rcmap_read_unlock (u_rcmap_t *rcmap)
+{
+    u_rcmap_rd_t *rd;
+
+    dbg_return_if (rcmap == NULL, );
+    dbg_return_if ((rd = pthread_getspecific(rcmap->rd_key)) == NULL, );
+    dbg_return_if (rd->nest == 0, );
+
+    if (--rd->nest == 0)
+        __STORE(&rd->epoch, 0, RELEASE);
+}
+
+/**
+ *  \brief  Look up a key
+ *
+ *  Look up \p key in \p rcmap.  Must be called inside a read section: the
+ *  returned value must not be used after ::u_rcmap_read_unlock.
+ *
+ *  \param  rcmap   the RCU hmap
+ *  \param  key     the key
+ *
+ *  \return the value associated with \p key, or \c NULL if not found (or
+ *          if called outside a read section)
+ */
+void *u_rcmap_get (u_rcmap_t *rcmap, const void *key)
+{
+    u_rcmap_rd_t *rd;
+    u_rcmap_tab_t *t;
+    u_rcmap_node_t *n;
+    size_t hash;
+
+    dbg_return_if (rcmap == NULL, NULL);
+    dbg_return_if (key == NULL, NULL);
+
+    rd = pthread_getspecific(rcmap->rd_key);
+    dbg_return_ifm (rd == NULL || rd->nest == 0, NULL,
+            "u_rcmap_get() called outside a read section");
+
+    hash = u_hmap_hash(rcmap->hproto, key);
+    t = __LOAD(&rcmap->tab, ACQUIRE);
+
+    for (n = __LOAD(&t->b[hash & t->mask], ACQUIRE); n; n = n->next)
+    {
+        if (n->hash == hash &&
+                !u_hmap_key_comp(rcmap->hproto, key, u_hmap_o_get_key(n->o)))
+            return u_hmap_o_get_val(n->o);
+    }
+
+    return NULL;
+}
+
+/**
+ *  \brief  Execute a function on all values
+ *
+ *  Call \p f on each value of a snapshot of \p rcmap, from within a read
+ *  section (writers are not blocked).
+ *
+ *  \param  rcmap   the RCU hmap
+ *  \param  f       function to be called, stops the iteration on non-zero
+ *  \param  arg     opaque argument passed to \p f
+ *
+ *  \retval U_HMAP_ERR_NONE on success
+ *  \retval U_HMAP_ERR_FAIL on failure
+ */
+int u_rcmap_foreach (u_rcmap_t *rcmap,
+        int f(const void *val, const void *arg), void *arg)
+{
+    u_rcmap_tab_t *t;
+    u_rcmap_node_t *n;
+    size_t i;
+
+    dbg_return_if (rcmap == NULL, U_HMAP_ERR_FAIL);
+    dbg_return_if (f == NULL, U_HMAP_ERR_FAIL);
+
+    dbg_return_if (u_rcmap_read_lock(rcmap), U_HMAP_ERR_FAIL);
+
+    t = __LOAD(&rcmap->tab, ACQUIRE);
+
+    for (i = 0; i <= t->mask; ++i)
+    {
+        for (n = __LOAD(&t->b[i], ACQUIRE); n; n = n->next)
+            dbg_err_if (f(u_hmap_o_get_val(n->o), arg));
+    }
+
+    u_rcmap_read_unlock(rcmap);
+
+    return U_HMAP_ERR_NONE;
+err:
+    u_rcmap_read_unlock(rcmap);
+    return U_HMAP_ERR_FAIL;
+}
+
+/**
+ *  \}
+ */
+
+/* Allocate a zeroed reader slot starting on a cache line boundary (bypasses
+ * the u_malloc hooks, which give no alignment guarantee beyond malloc's) */
+static u_rcmap_rd_t *__reader_new (void)
+{
+    void *p = NULL;
+    int rc;
+
+    dbg_ifb ((rc = posix_memalign(&p, U_RCMAP_CACHELINE,
+                    sizeof(u_rcmap_rd_t))) != 0)
+    {
+        u_dbg("posix_memalign: %s", strerror(rc));
+        return NULL;
+    }
+
+    return memset(p, 0, sizeof(u_rcmap_rd_t));
+}
+
+/* Get (registering it on first use) the reader slot of the calling thread */
+static u_rcmap_rd_t *__reader (u_rcmap_t *rcmap)
+{
+    u_rcmap_rd_t *rd;
+
+    if ((rd = pthread_getspecific(rcmap->rd_key)) != NULL)
+        return rd;
+
+    dbg_return_if (pthread_mutex_lock(&rcmap->lock), NULL);
+
+    /* reuse the slot of a thread which has gone */
+    for (rd = rcmap->readers; rd; rd = rd->next)
+    {
+        if (!__LOAD(&rd->used, ACQUIRE))
+            break;
+    }
+
+    if (rd == NULL)
+    {
+        dbg_err_if ((rd = __reader_new()) == NULL);
+        rd->next = rcmap->readers;
+        rcmap->readers = rd;
+    }
+
+    rd->nest = 0;
+    __STORE(&rd->epoch, 0, RELAXED);
+    __STORE(&rd->used, 1, RELAXED);
+
+    dbg_ifb (pthread_setspecific(rcmap->rd_key, rd))
+    {
+        __STORE(&rd->used, 0, RELAXED);
+        rd = NULL;
+    }
+
+    (void) pthread_mutex_unlock(&rcmap->lock);
+
+    return rd;
+err:
+    (void) pthread_mutex_unlock(&rcmap->lock);
+    return NULL;
+}
+
+/* Thread exit: give the reader slot back */
+static void __reader_release (void *arg)
+{
+    u_rcmap_rd_t *rd = (u_rcmap_rd_t *) arg;
+
+    rd->nest = 0;
+    __STORE(&rd->epoch, 0, RELEASE);
+    __STORE(&rd->used, 0, RELEASE);
+}
+
+static u_rcmap_node_t *__node_new (size_t hash, u_hmap_o_t *o,
+        u_rcmap_node_t *next)
+{
+    u_rcmap_node_t *n;
+
+    dbg_return_sif ((n = u_malloc(sizeof(u_rcmap_node_t))) == NULL, NULL);
+
+    n->hash = hash;
+    n->o = o;
+    n->next = next;
+
+    return n;
+}
+
+static u_rcmap_tab_t *__tab_new (size_t size)
+{
+    u_rcmap_tab_t *t = NULL;
+
+    dbg_err_sif ((t = u_zalloc(sizeof(u_rcmap_tab_t))) == NULL);
+    dbg_err_sif ((t->b = u_calloc(size, sizeof(u_rcmap_node_t *))) == NULL);
+    t->mask = size - 1;
+
+    return t;
+err:
+    if (t)
+        u_free(t);
+    return NULL;
+}
+
+/* Free a table and its nodes (and objects if objs is set) */
+static void __tab_free (u_rcmap_t *rcmap, u_rcmap_tab_t *tab, int objs)
+{
+    u_rcmap_node_t *n, *next;
+    size_t i;
+
+    for (i = 0; i <= tab->mask; ++i)
+    {
+        for (n = tab->b[i]; n; n = next)
+        {
+            next = n->next;
+            if (objs)
+                u_hmap_o_dispose(rcmap->hproto, n->o);
+            u_free(n);
+        }
+    }
+
+    u_free(tab->b);
+    u_free(tab);
+}
+
+/* Find key in tab: *pb is its bucket, *pn its node (writers only) */
+static int __find (u_rcmap_t *rcmap, u_rcmap_tab_t *tab, const void *key,
+        size_t hash, u_rcmap_node_t ***pb, u_rcmap_node_t **pn)
+{
+    u_rcmap_node_t *n;
+
+    *pb = &tab->b[hash & tab->mask];
+
+    for (n = **pb; n; n = n->next)
+    {
+        if (n->hash == hash &&
+                !u_hmap_key_comp(rcmap->hproto, key, u_hmap_o_get_key(n->o)))
+        {
+            *pn = n;
+            return U_HMAP_ERR_NONE;
+        }
+    }
+
+    return U_HMAP_ERR_FAIL;
+}
+
+/* Replace node n in bucket b with the chain rep (n's successors, possibly
+ * preceded by a new node) by publishing a copy of the nodes in front of n;
+ * the old prefix, n and its object are retired */
+static int __unlink (u_rcmap_t *rcmap, u_rcmap_node_t **b, u_rcmap_node_t *n,
+        u_rcmap_node_t *rep)
+{
+    u_rcmap_node_t *old = *b, *head = NULL, **tail = &head, *p, *c, *next;
+
+    for (p = old; p != n; p = p->next)
+    {
+        dbg_err_if ((c = __node_new(p->hash, p->o, NULL)) == NULL);
+        *tail = c;
+        tail = &c->next;
+    }
+    *tail = rep;
+
+    __STORE(b, head, RELEASE);
+
+    /* a failed retirement leaks instead of freeing under the readers' feet */
+    for (p = old; p != n; p = next)
+    {
+        next = p->next;
+        dbg_if (__retire(rcmap, __free_node, p));
+    }
+    dbg_if (__retire(rcmap, __free_node_obj, n));
+
+    return 0;
+err:
+    for (; head != rep; head = next)
+    {
+        next = head->next;
+        u_free(head);
+    }
+    return ~0;
+}
+
+static int __grow (u_rcmap_t *rcmap)
+{
+    u_rcmap_tab_t *t = rcmap->tab, *nt = NULL;
+    u_rcmap_node_t *n, *c;
+    size_t i;
+
+    dbg_err_if ((nt = __tab_new((t->mask + 1) << 1)) == NULL);
+
+    for (i = 0; i <= t->mask; ++i)
+    {
+        for (n = t->b[i]; n; n = n->next)
+        {
+            dbg_err_if ((c = __node_new(n->hash, n->o,
+                            nt->b[n->hash & nt->mask])) == NULL);
+            nt->b[n->hash & nt->mask] = c;
+        }
+    }
+
+    __STORE(&rcmap->tab, nt, RELEASE);
+    dbg_if (__retire(rcmap, __free_tab, t));
+
+    return 0;
+err:
+    if (nt)
+        __tab_free(rcmap, nt, 0);
+    return ~0;
+}
+
+/* Queue p for release once no reader can reach it */
+static int __retire (u_rcmap_t *rcmap, void (*f_free)(u_rcmap_t *, void *),
+        void *p)
+{
+    u_rcmap_limbo_t *l;
+
+    dbg_return_sif ((l = u_malloc(sizeof(u_rcmap_limbo_t))) == NULL, ~0);
+
+    l->epoch = rcmap->epoch;
+    l->f_free = f_free;
+    l->p = p;
+    l->next = rcmap->limbo;
+    rcmap->limbo = l;
+
+    return 0;
+}
+
+/* Advance the epoch if every reader inside a read section has seen the
+ * current one, then free what was retired two or more epochs ago */
+static void __reclaim (u_rcmap_t *rcmap)
+{
+    u_rcmap_limbo_t *l, **pl;
+    u_rcmap_rd_t *rd;
+    size_t v, e = rcmap->epoch;
+
+    nop_return_if (rcmap->limbo == NULL, );
+
+    /* pairs with the fence in u_rcmap_read_lock() */
+    __FENCE();
+
+    for (rd = rcmap->readers; rd; rd = rd->next)
+    {
+        v = __LOAD(&rd->epoch, ACQUIRE);
+        if ((v & 1) && (v >> 1) != e)
+            break;
+    }
+
+    if (rd == NULL)
+        __STORE(&rcmap->epoch, ++e, RELEASE);
+
+    for (pl = &rcmap->limbo; (l = *pl) != NULL; )
+    {
+        if (l->epoch + 2 > e)
+        {
+            pl = &l->next;
+            continue;
+        }
+
+        *pl = l->next;
+        l->f_free(rcmap, l->p);
+        u_free(l);
+    }
+}
+
+static void __free_node (u_rcmap_t *rcmap, void *p)
+{
+    u_unused_args(rcmap);
+    u_free(p);
+}
+
+static void __free_node_obj (u_rcmap_t *rcmap, void *p)
+{
+    u_hmap_o_dispose(rcmap->hproto, ((u_rcmap_node_t *) p)->o);
+    u_free(p);
+}
+
+static void __free_tab (u_rcmap_t *rcmap, void *p)
+{
+    __tab_free(rcmap, (u_rcmap_tab_t *) p, 0);
+}
@@ -0,0 +1,391 @@
+#include <sys/time.h>
+#include <pthread.h>
+#include <u/libu.h>
+
+int test_suite_chmap_register (u_test_t *t);
+
+static int test_basic (u_test_case_t *tc);
+static int test_threads (u_test_case_t *tc);
+static int test_scaling (u_test_case_t *tc);
+static int test_stats (u_test_case_t *tc);
+
+static size_t __int_hash (const void *key);
+static int __int_comp (const void *k1, const void *k2);
+static int __get_int (const void *val, void *arg);
+static int __sum (const void *val, const void *arg);
+static int __chmap_new (size_t nshards, int options, u_chmap_t **pchmap);
+static void *__writer (void *arg);
+static void *__reader (void *arg);
+static void *__mixed (void *arg);
+static double __elapsed (struct timeval *t0);
+
+enum { NUM_KEYS = 65536 };
+
+typedef struct
+{
+    u_chmap_t *chmap;
+    int id, nthreads, nops;
+    unsigned int seed;
+    int rc;
+} worker_t;
+
+/* foreach argument: const itself, the accumulator it references is not */
+typedef struct
+{
+    long *sum;
+} sum_arg_t;
+
+static size_t __int_hash (const void *key)
+{
+    return (size_t) *((const int *) key);
+}
+
+static int __int_comp (const void *k1, const void *k2)
+{
+    int a = *((const int *) k1), b = *((const int *) k2);
+
+    return (a < b) ? -1 : (a > b);
+}
+
+static int __get_int (const void *val, void *arg)
+{
+    *((int *) arg) = *((const int *) val);
+    return 0;
+}
+
+static int __sum (const void *val, const void *arg)
+{
+    *((const sum_arg_t *) arg)->sum += *((const int *) val);
+    return 0;
+}
+
+/* int -> int map with the given number of shards (and hmap options) */
+static int __chmap_new (size_t nshards, int options, u_chmap_t **pchmap)
+{
+    u_hmap_opts_t *opts = NULL;
+
+    dbg_err_if (u_hmap_opts_new(&opts));
+    dbg_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    dbg_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    dbg_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    dbg_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    dbg_err_if (u_hmap_opts_set_hashfunc(opts, &__int_hash));
+    dbg_err_if (u_hmap_opts_set_compfunc(opts, &__int_comp));
+    dbg_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    if (options)
+        dbg_err_if (u_hmap_opts_set_option(opts, options));
+    dbg_err_if (u_chmap_new(opts, nshards, pchmap));
+
+    u_hmap_opts_free(opts);
+
+    return 0;
+err:
+    u_hmap_opts_free(opts);
+    return ~0;
+}
+
+static int test_basic (u_test_case_t *tc)
+{
+    u_chmap_t *chmap = NULL;
+    long sum = 0;
+    sum_arg_t sa;
+    int i, v;
+
+    u_test_err_if (__chmap_new(0, 0, &chmap));
+
+    for (i = 0; i < 1000; ++i)
+        u_test_err_if (u_chmap_put(chmap, &i, &i));
+
+    u_test_err_if (u_chmap_count(chmap) != 1000);
+
+    /* overwrite */
+    i = 10, v = 20;
+    u_test_err_if (u_chmap_put(chmap, &i, &v));
+    u_test_err_if (u_chmap_get(chmap, &i, __get_int, &v));
+    u_test_err_if (v != 20);
+
+    /* delete */
+    i = 0;
+    u_test_err_if (u_chmap_del(chmap, &i));
+    u_test_err_if (u_chmap_get(chmap, &i, NULL, NULL) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_chmap_del(chmap, &i) == U_HMAP_ERR_NONE);
+
+    /* sum(1..999) - 10 + 20 */
+    sa.sum = &sum;
+    u_test_err_if (u_chmap_foreach(chmap, __sum, &sa));
+    u_test_err_if (sum != 999 * 1000 / 2 + 10);
+
+    u_chmap_clear(chmap);
+    u_test_err_if (u_chmap_count(chmap) != 0);
+
+    u_chmap_free(chmap);
+
+    return U_TEST_SUCCESS;
+err:
+    u_chmap_free(chmap);
+    return U_TEST_FAILURE;
+}
+
+/* each thread owns the keys equal to its id modulo the number of threads */
+static void *__writer (void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    int i, v;
+
+    for (i = w->id; i < NUM_KEYS; i += w->nthreads)
+        dbg_err_if (u_chmap_put(w->chmap, &i, &i));
+
+    for (i = w->id; i < NUM_KEYS; i += w->nthreads)
+    {
+        dbg_err_if (u_chmap_get(w->chmap, &i, __get_int, &v));
+        dbg_err_if (v != i);
+
+        if (i % 2)
+            dbg_err_if (u_chmap_del(w->chmap, &i));
+    }
+
+    w->rc = 0;
+    return NULL;
+err:
+    w->rc = ~0;
+    return NULL;
+}
+
+static int test_threads (u_test_case_t *tc)
+{
+    enum { NUM_THREADS = 8 };
+    pthread_t tid[NUM_THREADS];
+    worker_t w[NUM_THREADS];
+    u_chmap_t *chmap = NULL;
+    int i, v, started = 0;
+
+    u_test_err_if (__chmap_new(0, 0, &chmap));
+
+    for (; started < NUM_THREADS; ++started)
+    {
+        w[started].chmap = chmap;
+        w[started].id = started;
+        w[started].nthreads = NUM_THREADS;
+        w[started].rc = ~0;
+        u_test_err_if (pthread_create(&tid[started], NULL, __writer,
+                    &w[started]));
+    }
+
+    for (; started > 0; --started)
+    {
+        (void) pthread_join(tid[started - 1], NULL);
+        u_test_err_if (w[started - 1].rc);
+    }
+
+    /* only even keys survive */
+    u_test_err_if (u_chmap_count(chmap) != NUM_KEYS / 2);
+
+    for (i = 0; i < NUM_KEYS; ++i)
+    {
+        if (i % 2)
+            u_test_err_if (u_chmap_get(chmap, &i, NULL, NULL) == 0);
+        else
+        {
+            u_test_err_if (u_chmap_get(chmap, &i, __get_int, &v));
+            u_test_err_if (v != i);
+        }
+    }
+
+    u_chmap_free(chmap);
+
+    return U_TEST_SUCCESS;
+err:
+    while (started > 0)
+        (void) pthread_join(tid[--started], NULL);
+    u_chmap_free(chmap);
+    return U_TEST_FAILURE;
+}
+
+/* 90% lookups, 10% updates on random keys */
+static void *__mixed (void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    int i, k, v;
+
+    for (i = 0; i < w->nops; ++i)
+    {
+        w->seed = w->seed * 1103515245 + 12345;
+        k = (int) ((w->seed >> 8) % NUM_KEYS);
+
+        if ((w->seed >> 4) % 10 == 0)
+            dbg_err_if (u_chmap_put(w->chmap, &k, &i));
+        else
+            dbg_err_if (u_chmap_get(w->chmap, &k, __get_int, &v));
+    }
+
+    w->rc = 0;
+    return NULL;
+err:
+    w->rc = ~0;
+    return NULL;
+}
+
+/* seconds elapsed since t0 */
+static double __elapsed (struct timeval *t0)
+{
+    struct timeval t1, d;
+
+    (void) gettimeofday(&t1, NULL);
+    u_timersub(&t1, t0, &d);
+
+    return d.tv_sec + d.tv_usec / 1000000.0;
+}
+
+/* Throughput with 1 to 64 threads of a single-lock map (1 shard) against
+ * sharded ones */
+static int test_scaling (u_test_case_t *tc)
+{
+    enum { MAX_THREADS = 64, NUM_OPS = 400000 };
+    static const size_t shards[] = { 1, 16, 64 };
+    pthread_t tid[MAX_THREADS];
+    worker_t w[MAX_THREADS];
+    u_chmap_t *chmap = NULL;
+    struct timeval t0;
+    size_t s;
+    double secs;
+    int i, nthreads, started = 0;
+
+    for (s = 0; s < sizeof shards / sizeof shards[0]; ++s)
+    {
+        u_test_err_if (__chmap_new(shards[s], 0, &chmap));
+
+        for (i = 0; i < NUM_KEYS; ++i)
+            u_test_err_if (u_chmap_put(chmap, &i, &i));
+
+        for (nthreads = 1; nthreads <= MAX_THREADS; nthreads <<= 1)
+        {
+            (void) gettimeofday(&t0, NULL);
+
+            for (; started < nthreads; ++started)
+            {
+                w[started].chmap = chmap;
+                w[started].nops = NUM_OPS / nthreads;
+                w[started].seed = (unsigned int) started + 1;
+                w[started].rc = ~0;
+                u_test_err_if (pthread_create(&tid[started], NULL, __mixed,
+                            &w[started]));
+            }
+
+            for (; started > 0; --started)
+            {
+                (void) pthread_join(tid[started - 1], NULL);
+                u_test_err_if (w[started - 1].rc);
+            }
+
+            secs = __elapsed(&t0);
+
+            u_test_case_printf(tc, "%2zu shard(s) %2d thread(s): %10.0f ops/s",
+                    shards[s], nthreads,
+                    NUM_OPS / (secs > 0 ? secs : 1e-6));
+        }
+
+        u_chmap_free(chmap);
+        chmap = NULL;
+    }
+
+    return U_TEST_SUCCESS;
+err:
+    while (started > 0)
+        (void) pthread_join(tid[--started], NULL);
+    u_chmap_free(chmap);
+    return U_TEST_FAILURE;
+}
+
+/* lookups only: one in four misses */
+static void *__reader (void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    int i, k;
+
+    for (i = 0; i < w->nops; ++i)
+    {
+        k = (i + w->id * 977) % NUM_KEYS;
+
+        if (u_chmap_get(w->chmap, &k, NULL, NULL) != U_HMAP_ERR_NONE)
+            dbg_err_if (k % 4 != 3);
+    }
+
+    w->rc = 0;
+    return NULL;
+err:
+    w->rc = ~0;
+    return NULL;
+}
+
+/* hit and miss counters bumped by concurrent readers (all on the same
+ * shard) must add up exactly */
+static int test_stats (u_test_case_t *tc)
+{
+    enum { NUM_THREADS = 8, NUM_OPS = 100000 };
+    pthread_t tid[NUM_THREADS];
+    worker_t w[NUM_THREADS];
+    u_chmap_t *chmap = NULL;
+    u_hmap_stats_t st;
+    int i, started = 0;
+
+    u_test_err_if (__chmap_new(1, U_HMAP_OPTS_STATS, &chmap));
+
+    for (i = 0; i < NUM_KEYS; ++i)
+    {
+        if (i % 4 != 3)
+            u_test_err_if (u_chmap_put(chmap, &i, &i));
+    }
+
+    for (; started < NUM_THREADS; ++started)
+    {
+        w[started].chmap = chmap;
+        w[started].id = started;
+        w[started].nthreads = NUM_THREADS;
+        w[started].nops = NUM_OPS;
+        w[started].rc = ~0;
+        u_test_err_if (pthread_create(&tid[started], NULL, __reader,
+                    &w[started]));
+    }
+
+    for (; started > 0; --started)
+    {
+        (void) pthread_join(tid[started - 1], NULL);
+        u_test_err_if (w[started - 1].rc);
+    }
+
+    u_test_err_if (u_chmap_stats(chmap, &st));
+    u_test_err_if (st.count != NUM_KEYS / 4 * 3);
+    u_test_err_if (st.puts != NUM_KEYS / 4 * 3);
+    u_test_err_ifm (st.hits + st.misses != NUM_THREADS * NUM_OPS,
+            "%llu hits + %llu misses", (unsigned long long) st.hits,
+            (unsigned long long) st.misses);
+    u_test_err_if (st.misses != NUM_THREADS * NUM_OPS / 4);
+
+    u_chmap_free(chmap);
+
+    return U_TEST_SUCCESS;
+err:
+    while (started > 0)
+        (void) pthread_join(tid[--started], NULL);
+    u_chmap_free(chmap);
+    return U_TEST_FAILURE;
+}
+
+int test_suite_chmap_register (u_test_t *t)
+{
+    u_test_suite_t *ts = NULL;
+
+    con_err_if (u_test_suite_new("Concurrent Hash Map", &ts));
+
+    con_err_if (u_test_case_register("Basic", test_basic, ts));
+    con_err_if (u_test_case_register("Threads", test_threads, ts));
+    con_err_if (u_test_case_register("Scaling", test_scaling, ts));
+    con_err_if (u_test_case_register("Statistics", test_stats, ts));
+
+    con_err_if (u_test_suite_dep_register("Hash Map", ts));
+
+    return u_test_suite_add(ts, t);
+err:
+    u_test_suite_free(ts);
+    return ~0;
+}
@@ -1,9 +1,14 @@
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <u/libu.h>
 #include <string.h>
 
 int test_suite_hmap_register (u_test_t *t);
 
-static size_t __sample_hash (const void *key, size_t size);
+static size_t __sample_hash (const void *key);
 static int __sample_comp(const void *key1, const void *key2);
 static u_string_t *__sample_str(u_hmap_o_t *obj);
 
@@ -188,9 +193,9 @@ err:
     return U_TEST_FAILURE;
 }
 
-static size_t __sample_hash(const void *key, size_t size)
+static size_t __sample_hash(const void *key)
 {
-    return (*((const int *) key) % size);
+    return *((const int *) key);
 }
 
 static int __sample_comp(const void *key1, const void *key2)
@@ -686,6 +691,7 @@ static int test_linear (u_test_case_t *tc)
     u_hmap_opts_t *opts = NULL;
     u_hmap_t *hmap = NULL;
     int i = 0;
+    const char *v;
     char key[MAX_STR], 
          val[MAX_STR];
 
@@ -694,6 +700,7 @@ static int test_linear (u_test_case_t *tc)
     u_test_err_if (u_hmap_opts_new(&opts));
 
     u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
     u_test_err_if (u_hmap_opts_set_size(opts, 1000));
     u_test_err_if (u_hmap_opts_set_type(opts, U_HMAP_TYPE_LINEAR));
 
@@ -705,11 +712,126 @@ static int test_linear (u_test_case_t *tc)
         u_test_err_if (u_hmap_easy_put(hmap, key, val));
     }
 
+    /* delete even keys (backward shift): overwriting odd ones must find 
+     * them past the holes left behind */
     for (i = 0; i < NUM_ELEMS; ++i) {
         u_snprintf(key, MAX_STR, "key%d", i);
-        u_test_err_if (u_hmap_easy_del(hmap, key)); 
+        if (i % 2 == 0)
+            u_test_err_if (u_hmap_easy_del(hmap, key)); 
+        else
+            u_test_err_if (u_hmap_easy_put(hmap, key, "odd"));
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS / 2);
+
+    for (i = 0; i < NUM_ELEMS; ++i) {
+        u_snprintf(key, MAX_STR, "key%d", i);
+        v = u_hmap_easy_get(hmap, key);
+        if (i % 2 == 0)
+            u_test_err_if (v != NULL);
+        else
+        {
+            u_test_err_if (v == NULL || strcmp(v, "odd"));
+            u_test_err_if (u_hmap_easy_del(hmap, key)); 
+        }
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != 0);
+
+    U_FREEF(hmap, u_hmap_easy_free);
+
+    /* bounded cache: a crowded table with a steady flow of discards */
+    u_test_err_if (u_hmap_opts_set_size(opts, 128));
+    u_test_err_if (u_hmap_opts_set_policy(opts, U_HMAP_PCY_LRU));
+    u_test_err_if (u_hmap_opts_set_max(opts, 100));
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    for (i = 0; i < 10000; ++i) {
+        u_snprintf(key, MAX_STR, "key%d", i);
+        u_test_err_if (u_hmap_easy_put(hmap, key, key));
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != 100);
+    u_test_err_if (u_hmap_easy_get(hmap, "key9899") != NULL);
+    u_test_err_if (u_hmap_easy_get(hmap, "key9900") == NULL);
+
+    u_hmap_easy_free(hmap);
+    u_hmap_opts_free(opts);
+    
+    return U_TEST_SUCCESS;
+
+err:
+    U_FREEF(hmap, u_hmap_easy_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_robinhood (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 100000, MAX_STR = 256 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    int i = 0;
+    const char *v;
+    char key[MAX_STR], 
+         val[MAX_STR];
+
+    u_dbg("test_robinhood()");
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_hmap_opts_set_size(opts, 3));
+    u_test_err_if (u_hmap_opts_set_type(opts, U_HMAP_TYPE_ROBINHOOD));
+
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i) {
+        u_snprintf(key, MAX_STR, "key%d", i);
+        u_snprintf(val, MAX_STR, "val%d", i);
+        u_test_err_if (u_hmap_easy_put(hmap, key, val));
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS);
+
+    /* delete even keys (backward shift) and overwrite odd ones */
+    for (i = 0; i < NUM_ELEMS; ++i) {
+        u_snprintf(key, MAX_STR, "key%d", i);
+        if (i % 2 == 0)
+            u_test_err_if (u_hmap_easy_del(hmap, key)); 
+        else
+            u_test_err_if (u_hmap_easy_put(hmap, key, "odd"));
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS / 2);
+
+    for (i = 0; i < NUM_ELEMS; ++i) {
+        u_snprintf(key, MAX_STR, "key%d", i);
+        v = u_hmap_easy_get(hmap, key);
+        if (i % 2 == 0)
+            u_test_err_if (v != NULL);
+        else
+            u_test_err_if (v == NULL || strcmp(v, "odd"));
+    }
+
+    U_FREEF(hmap, u_hmap_easy_free);
+
+    /* bounded cache: discarded keys must not be found anymore */
+    u_test_err_if (u_hmap_opts_set_policy(opts, U_HMAP_PCY_LRU));
+    u_test_err_if (u_hmap_opts_set_max(opts, 100));
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    for (i = 0; i < 1000; ++i) {
+        u_snprintf(key, MAX_STR, "key%d", i);
+        u_test_err_if (u_hmap_easy_put(hmap, key, key));
     }
 
+    u_test_err_if (u_hmap_count(hmap) != 100);
+    u_test_err_if (u_hmap_easy_get(hmap, "key899") != NULL);
+    u_test_err_if (u_hmap_easy_get(hmap, "key900") == NULL);
+
     u_hmap_easy_free(hmap);
     u_hmap_opts_free(opts);
     
@@ -722,6 +844,1980 @@ err:
     return U_TEST_FAILURE;
 }
 
+/* seconds elapsed since t0 */
+static double __elapsed (struct timeval *t0)
+{
+    struct timeval t1, d;
+
+    (void) gettimeofday(&t1, NULL);
+    u_timersub(&t1, t0, &d);
+
+    return d.tv_sec + d.tv_usec / 1000000.0;
+}
+
+/* what non-strong custom hashes used to cost: decimal print + string hash */
+static size_t __int_hash_snprintf (const void *key)
+{
+    char buf[32];
+    const unsigned char *k = (const unsigned char *) buf;
+    size_t h = 0;
+
+    (void) u_snprintf(buf, sizeof buf, "%d", *((const int *) key));
+
+    while (*k)
+    {
+        h += *k++;
+        h += (h << 10);
+        h ^= (h >> 6);
+    }
+
+    h += (h << 3);
+    h ^= (h >> 11);
+
+    return (h + (h << 15));
+}
+
+static int __int_keys_run (u_test_case_t *tc, const char *label,
+        size_t (*f_hash)(const void *), int strong)
+{
+    enum { NUM_ELEMS = 200000, NUM_GETS = 5 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    struct timeval t0;
+    double secs;
+    int i, j;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_size(opts, NUM_ELEMS));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, f_hash));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__sample_comp));
+    if (strong)
+        u_test_err_if (u_hmap_opts_set_option(opts, U_HMAP_OPTS_HASH_STRONG));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    (void) gettimeofday(&t0, NULL);
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &i), NULL));
+
+    for (j = 0; j < NUM_GETS; ++j)
+    {
+        for (i = 0; i < NUM_ELEMS; ++i)
+        {
+            u_test_err_if (u_hmap_get(hmap, &i, &obj));
+            u_test_err_if (*((int *) u_hmap_o_get_val(obj)) != i);
+        }
+    }
+
+    secs = __elapsed(&t0);
+
+    u_test_case_printf(tc, "%-28s %10.0f ops/s", label,
+            (NUM_ELEMS * (NUM_GETS + 1)) / (secs > 0 ? secs : 1e-6));
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* integer keyed map: identity hash through the avalanche mixer vs. the old
+ * snprintf() based rehashing */
+static int test_int_keys (u_test_case_t *tc)
+{
+    u_test_err_if (__int_keys_run(tc, "identity (mixed)",
+                &__sample_hash, 0));
+    u_test_err_if (__int_keys_run(tc, "identity (strong, no mix)",
+                &__sample_hash, 1));
+    u_test_err_if (__int_keys_run(tc, "snprintf rehash (legacy)",
+                &__int_hash_snprintf, 1));
+
+    return U_TEST_SUCCESS;
+err:
+    return U_TEST_FAILURE;
+}
+
+/* LFU eviction order (ties broken by age) on every map type, then a large
+ * cache under churn to exercise the constant time bucket moves */
+static int test_lfu (u_test_case_t *tc)
+{
+    enum { MAX_STR = 64, CACHE_SZ = 10000, NUM_OPS = 500000 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    char key[MAX_STR];
+    struct timeval t0;
+    double secs;
+    int t, i;
+
+    u_dbg("test_lfu()");
+
+    for (t = U_HMAP_TYPE_CHAIN; t <= U_HMAP_TYPE_LAST; t++)
+    {
+        u_test_err_if (u_hmap_opts_new(&opts));
+        u_test_err_if (u_hmap_opts_set_type(opts, t));
+        u_test_err_if (u_hmap_opts_set_val_type(opts,
+                    U_HMAP_OPTS_DATATYPE_STRING));
+        u_test_err_if (u_hmap_opts_set_policy(opts, U_HMAP_PCY_LFU));
+        u_test_err_if (u_hmap_opts_set_max(opts, 3));
+        u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+        u_test_err_if (u_hmap_easy_put(hmap, "a", "A"));
+        u_test_err_if (u_hmap_easy_put(hmap, "b", "B"));
+        u_test_err_if (u_hmap_easy_put(hmap, "c", "C"));
+
+        u_test_err_if (u_hmap_easy_get(hmap, "a") == NULL);
+        u_test_err_if (u_hmap_easy_get(hmap, "a") == NULL);
+        u_test_err_if (u_hmap_easy_get(hmap, "b") == NULL);
+
+        /* "c" is the least frequently used */
+        u_test_err_if (u_hmap_easy_put(hmap, "d", "D"));
+        u_test_err_if (u_hmap_easy_get(hmap, "c") != NULL);
+
+        /* a deleted entry must not be picked as a victim */
+        u_test_err_if (u_hmap_easy_del(hmap, "d"));
+        u_test_err_if (u_hmap_easy_put(hmap, "d", "D"));
+        u_test_err_if (u_hmap_easy_put(hmap, "e", "E"));
+        u_test_err_if (u_hmap_easy_get(hmap, "d") != NULL);
+        u_test_err_if (u_hmap_easy_get(hmap, "b") == NULL);
+        u_test_err_if (u_hmap_easy_get(hmap, "a") == NULL);
+        u_test_err_if (u_hmap_count(hmap) != 3);
+
+        U_FREEF(hmap, u_hmap_easy_free);
+        U_FREEF(opts, u_hmap_opts_free);
+    }
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_set_policy(opts, U_HMAP_PCY_LFU));
+    u_test_err_if (u_hmap_opts_set_max(opts, CACHE_SZ));
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    (void) gettimeofday(&t0, NULL);
+
+    for (i = 0; i < NUM_OPS; ++i)
+    {
+        /* skewed key space: low keys are hit much more often */
+        u_snprintf(key, MAX_STR, "k%d", (i % 7) ? i % 1000 : i);
+
+        if (u_hmap_easy_get(hmap, key) == NULL)
+            u_test_err_if (u_hmap_easy_put(hmap, key, key));
+    }
+
+    secs = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap) != CACHE_SZ);
+    u_test_err_if (u_hmap_easy_get(hmap, "k1") == NULL);
+
+    u_test_case_printf(tc, "LFU churn (max %d): %10.0f ops/s", CACHE_SZ,
+            NUM_OPS / (secs > 0 ? secs : 1e-6));
+
+    u_hmap_easy_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_easy_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* lower int value -> discarded first */
+static int __pcy_int_cmp (void *o1, void *o2)
+{
+    int i1 = *((int *) o1), i2 = *((int *) o2);
+
+    return i1 < i2 ? -1 : ((i1 > i2) ? 1 : 0);
+}
+
+/* CUSTOM policy: evict in priority order, re-prioritize in place and time a
+ * large cache (each put used to scan the whole policy queue) */
+static int test_custom_pcy (u_test_case_t *tc)
+{
+    enum { MAX_STR = 64, NUM_ELEMS = 1000, MAX = 100, BIG = 100000 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    char key[MAX_STR];
+    struct timeval t0;
+    double secs;
+    int i, v, *pv;
+
+    u_dbg("test_custom_pcy()");
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_policy(opts, U_HMAP_PCY_CUSTOM));
+    u_test_err_if (u_hmap_opts_set_policy_cmp(opts, __pcy_int_cmp));
+    u_test_err_if (u_hmap_opts_set_max(opts, MAX));
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    /* values are a permutation of [0, NUM_ELEMS) */
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        u_snprintf(key, MAX_STR, "k%d", i);
+        v = (i * 7919) % NUM_ELEMS;
+        u_test_err_if (u_hmap_easy_put(hmap, key, &v));
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != MAX);
+
+    /* all survivors but the last inserted are among the highest values */
+    for (i = 0; i < NUM_ELEMS - 1; ++i)
+    {
+        u_snprintf(key, MAX_STR, "k%d", i);
+        v = (i * 7919) % NUM_ELEMS;
+        pv = u_hmap_easy_get(hmap, key);
+        u_test_err_if ((v >= NUM_ELEMS - MAX + 1) != (pv != NULL));
+    }
+
+    /* demote the best object: it must be the next victim */
+    u_snprintf(key, MAX_STR, "k%d", 1);     /* 7919 % 1000 == 919 */
+    u_test_err_if ((pv = u_hmap_easy_get(hmap, key)) == NULL);
+    *pv = -1;
+    u_test_err_if (u_hmap_pcy_update(hmap, key));
+    v = NUM_ELEMS;
+    u_test_err_if (u_hmap_easy_put(hmap, "new", &v));
+    u_test_err_if (u_hmap_easy_get(hmap, key) != NULL);
+    u_test_err_if (u_hmap_pcy_update(hmap, key) == U_HMAP_ERR_NONE);
+
+    /* deleted objects leave the heap */
+    u_test_err_if (u_hmap_easy_del(hmap, "new"));
+    u_test_err_if (u_hmap_count(hmap) != MAX - 1);
+
+    U_FREEF(hmap, u_hmap_easy_free);
+
+    u_test_err_if (u_hmap_opts_set_size(opts, BIG));
+    u_test_err_if (u_hmap_opts_set_max(opts, BIG));
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    (void) gettimeofday(&t0, NULL);
+
+    for (i = 0; i < 4 * BIG; ++i)
+    {
+        u_snprintf(key, MAX_STR, "k%d", i);
+        v = ((i % BIG) * 7919) % BIG;
+        u_test_err_if (u_hmap_easy_put(hmap, key, &v));
+    }
+
+    secs = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap) != BIG);
+
+    u_test_case_printf(tc, "CUSTOM puts (max %d): %10.0f ops/s", BIG,
+            4 * BIG / (secs > 0 ? secs : 1e-6));
+
+    u_hmap_easy_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_easy_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* synthetic cache trace: skewed accesses to a hot key set, interrupted by
+ * periodic scans of keys which are never requested again */
+static int *__trace_new (size_t n, int nhot, int scan_every, int scan_len)
+{
+    unsigned int x = 2463534242U;
+    int *trace, scan = 0;
+    size_t i;
+    double u;
+    int j;
+
+    dbg_err_sif ((trace = u_calloc(n, sizeof(int))) == NULL);
+
+    for (i = 0; i < n; )
+    {
+        if (i && (i % scan_every) == 0)
+        {
+            /* scan keys are encoded as negative numbers */
+            for (j = 0; j < scan_len && i < n; ++j)
+                trace[i++] = -(++scan);
+            continue;
+        }
+
+        /* xorshift32 */
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        u = x / 4294967296.0;
+        trace[i++] = (int) (nhot * u * u * u);
+    }
+
+    return trace;
+err:
+    return NULL;
+}
+
+/* replay a trace through a cache: a miss is followed by a put */
+static int __trace_run (u_test_case_t *tc, u_hmap_pcy_type_t pcy,
+        const char *label, const int *trace, size_t n, int max, double *ratio)
+{
+    enum { MAX_STR = 64 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    char key[MAX_STR];
+    struct timeval t0;
+    size_t i, hits = 0;
+    double secs;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_val_freefunc(opts, NULL));
+    u_test_err_if (u_hmap_opts_set_size(opts, 2 * max));
+    u_test_err_if (u_hmap_opts_set_max(opts, max));
+    u_test_err_if (u_hmap_opts_set_policy(opts, pcy));
+    u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+    (void) gettimeofday(&t0, NULL);
+
+    for (i = 0; i < n; ++i)
+    {
+        u_snprintf(key, MAX_STR, "%d", trace[i]);
+
+        if (u_hmap_easy_get(hmap, key))
+            hits++;
+        else
+            u_test_err_if (u_hmap_easy_put(hmap, key, "x"));
+    }
+
+    secs = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap) != max);
+
+    *ratio = (double) hits / n;
+
+    u_test_case_printf(tc, "%-10s hit ratio %5.2f%%  %10.0f ops/s", label,
+            100 * *ratio, n / (secs > 0 ? secs : 1e-6));
+
+    u_hmap_easy_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_easy_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* compare discard policies on a trace mixing a skewed working set and
+ * full scans: the scan resistant ones must beat LRU */
+static int test_pcy_trace (u_test_case_t *tc)
+{
+    enum { NUM_OPS = 500000, NUM_HOT = 5000, SCAN_EVERY = 20000,
+        SCAN_LEN = 4000, MAX = 1000 };
+    struct {
+        u_hmap_pcy_type_t pcy;
+        const char *label;
+        int scan_resistant;
+    } pcys[] = {
+        { U_HMAP_PCY_FIFO,      "FIFO",         0 },
+        { U_HMAP_PCY_LRU,       "LRU",          0 },
+        { U_HMAP_PCY_LFU,       "LFU",          0 },
+        { U_HMAP_PCY_CLOCK,     "CLOCK",        0 },
+        { U_HMAP_PCY_SLRU,      "SLRU",         1 },
+        { U_HMAP_PCY_2Q,        "2Q",           1 },
+        { U_HMAP_PCY_WTINYLFU,  "W-TinyLFU",    1 }
+    };
+    double ratio, lru = 0;
+    int *trace = NULL;
+    size_t i;
+
+    u_dbg("test_pcy_trace()");
+
+    u_test_err_if ((trace = __trace_new(NUM_OPS, NUM_HOT, SCAN_EVERY,
+                    SCAN_LEN)) == NULL);
+
+    for (i = 0; i < sizeof pcys / sizeof pcys[0]; ++i)
+    {
+        u_test_err_if (__trace_run(tc, pcys[i].pcy, pcys[i].label, trace,
+                    NUM_OPS, MAX, &ratio));
+
+        if (pcys[i].pcy == U_HMAP_PCY_LRU)
+            lru = ratio;
+        else if (pcys[i].scan_resistant)
+            u_test_err_if (ratio <= lru);
+    }
+
+    u_free(trace);
+
+    return U_TEST_SUCCESS;
+err:
+    u_free(trace);
+
+    return U_TEST_FAILURE;
+}
+
+static size_t __hash_calls;
+
+/* FNV-1a string hash, counting its invocations */
+static size_t __count_hash (const void *key)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    size_t h = 2166136261U;
+
+    for (++__hash_calls; *p != '\0'; ++p)
+        h = (h ^ *p) * 16777619U;
+
+    return h;
+}
+
+/* the key of a lookup is hashed once, whatever the policy does with it; 2Q
+ * and W-TinyLFU evictions reuse the hash of the victim */
+static int test_pcy_hash (u_test_case_t *tc)
+{
+    enum { NUM_KEYS = 100, ROUNDS = 10, MAX_STR = 64 };
+    u_hmap_pcy_type_t pcys[] = {
+        U_HMAP_PCY_NONE, U_HMAP_PCY_LRU, U_HMAP_PCY_LFU, U_HMAP_PCY_CLOCK,
+        U_HMAP_PCY_SLRU, U_HMAP_PCY_2Q, U_HMAP_PCY_WTINYLFU
+    };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    char key[MAX_STR];
+    size_t i;
+    int j, k;
+
+    u_dbg("test_pcy_hash()");
+
+    for (i = 0; i < sizeof pcys / sizeof pcys[0]; ++i)
+    {
+        u_test_err_if (u_hmap_opts_new(&opts));
+        u_test_err_if (u_hmap_opts_set_val_freefunc(opts, NULL));
+        u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__count_hash));
+        u_test_err_if (u_hmap_opts_set_size(opts, 4 * NUM_KEYS));
+        u_test_err_if (u_hmap_opts_set_max(opts, 2 * NUM_KEYS));
+        u_test_err_if (u_hmap_opts_set_policy(opts, pcys[i]));
+        u_test_err_if (u_hmap_easy_new(opts, &hmap));
+
+        for (k = 0; k < NUM_KEYS; ++k)
+        {
+            u_snprintf(key, MAX_STR, "key%d", k);
+            u_test_err_if (u_hmap_easy_put(hmap, key, "x"));
+        }
+
+        __hash_calls = 0;
+
+        for (j = 0; j < ROUNDS; ++j)
+        {
+            for (k = 0; k < NUM_KEYS; ++k)
+            {
+                u_snprintf(key, MAX_STR, "key%d", k);
+                u_test_err_if (u_hmap_easy_get(hmap, key) == NULL);
+            }
+        }
+
+        u_test_err_ifm (__hash_calls != ROUNDS * NUM_KEYS, "policy %d: %zu "
+                "hashes for %d lookups", (int) pcys[i], __hash_calls,
+                ROUNDS * NUM_KEYS);
+
+        if (pcys[i] == U_HMAP_PCY_2Q || pcys[i] == U_HMAP_PCY_WTINYLFU)
+        {
+            __hash_calls = 0;
+
+            /* each put past the first hundred evicts */
+            for (k = 0; k < 3 * NUM_KEYS; ++k)
+            {
+                u_snprintf(key, MAX_STR, "new%d", k);
+                u_test_err_if (u_hmap_easy_put(hmap, key, "x"));
+            }
+
+            u_test_err_ifm (__hash_calls != 3 * NUM_KEYS, "policy %d: %zu "
+                    "hashes for %d puts", (int) pcys[i], __hash_calls,
+                    3 * NUM_KEYS);
+        }
+
+        u_hmap_easy_free(hmap), hmap = NULL;
+        u_hmap_opts_free(opts), opts = NULL;
+    }
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_easy_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* monotonic clock in nanoseconds (microsecond resolution as a fallback) */
+static double __now_ns (void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    (void) gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+#endif
+}
+
+static int __dbl_cmp (const void *a, const void *b)
+{
+    double x = *((const double *) a), y = *((const double *) b);
+
+    return (x < y) ? -1 : (x > y);
+}
+
+/* insert n integer keys timing each put, then check lookups, overwrites and
+ * deletes (also while a migration is in progress) */
+static int __resize_run (u_test_case_t *tc, int incremental, int n,
+        double *lat)
+{
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    double t;
+    int i, v;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__sample_hash));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__sample_comp));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_hmap_opts_set_incremental_resize(opts, incremental));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < n; ++i)
+    {
+        t = __now_ns();
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &i), NULL));
+        lat[i] = __now_ns() - t;
+
+        /* every 1000 puts look back at older keys */
+        if (i % 1000 == 999)
+        {
+            v = i / 2;
+            u_test_err_if (u_hmap_get(hmap, &v, &obj));
+            u_test_err_if (*((int *) u_hmap_o_get_val(obj)) != v);
+        }
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != n);
+
+    /* overwrite odd keys, delete those multiple of 4 */
+    for (i = 0; i < n; ++i)
+    {
+        v = -i;
+        if (i % 2)
+            u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &v), NULL));
+        else if (i % 4 == 0)
+            u_test_err_if (u_hmap_del(hmap, &i, NULL));
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        if (i % 4 == 0)
+        {
+            u_test_err_if (u_hmap_get(hmap, &i, &obj) == U_HMAP_ERR_NONE);
+            continue;
+        }
+
+        u_test_err_if (u_hmap_get(hmap, &i, &obj));
+        v = *((int *) u_hmap_o_get_val(obj));
+        u_test_err_if (v != ((i % 2) ? -i : i));
+    }
+
+    u_test_err_if (u_hmap_count(hmap) != n - (n + 3) / 4);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* put latency percentiles with stop-the-world and incremental resizing: the
+ * latter must flatten the tail */
+static int test_incremental_resize (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 1000000 };
+    double *lat = NULL, tail[2];
+    int incr;
+
+    u_dbg("test_incremental_resize()");
+
+    u_test_err_if ((lat = u_malloc(NUM_ELEMS * sizeof(double))) == NULL);
+
+    for (incr = 0; incr < 2; ++incr)
+    {
+        u_test_err_if (__resize_run(tc, incr, NUM_ELEMS, lat));
+
+        qsort(lat, NUM_ELEMS, sizeof(double), __dbl_cmp);
+
+        u_test_case_printf(tc, "%-14s put latency (ns): p50 %6.0f  p99 %6.0f"
+                "  p99.99 %9.0f  max %10.0f", incr ? "incremental" : "all at once",
+                lat[NUM_ELEMS / 2], lat[NUM_ELEMS / 100 * 99],
+                lat[NUM_ELEMS / 10000 * 9999], lat[NUM_ELEMS - 1]);
+
+        tail[incr] = lat[NUM_ELEMS - 1];
+    }
+
+    /* the largest rehash moves ~300k objects at once, while each incremental
+     * step moves a handful */
+    u_test_err_if (tail[1] >= tail[0]);
+
+    u_free(lat);
+
+    return U_TEST_SUCCESS;
+err:
+    u_free(lat);
+
+    return U_TEST_FAILURE;
+}
+
+/* key and value for k: every fourth value is too long to be stored inline */
+static void __slab_kv (unsigned int k, char *key, size_t ksz, char *val,
+        size_t vsz)
+{
+    (void) u_snprintf(key, ksz, "key%u", k);
+
+    if (k % 4)
+        (void) u_snprintf(val, vsz, "val%u", k);
+    else
+        (void) u_snprintf(val, vsz, "val%u-%s", k, "0123456789abcdef"
+                "0123456789abcdef0123456789abcdef0123456789abcdef");
+}
+
+/* LRU cache under churn: puts (most of them evicting), overwrites, lookups
+ * and deletes */
+static int __slab_run (u_test_case_t *tc, u_hmap_type_t type, int slab)
+{
+    enum { CACHE_SZ = 10000, NUM_OPS = 1000000 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    struct timeval t0;
+    char key[32], val[128];
+    unsigned int k;
+    double secs;
+    int i;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_policy(opts, U_HMAP_PCY_LRU));
+    u_test_err_if (u_hmap_opts_set_max(opts, CACHE_SZ));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_hmap_opts_set_slab(opts, slab));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    (void) gettimeofday(&t0, NULL);
+
+    for (i = 0; i < NUM_OPS; ++i)
+    {
+        k = ((unsigned int) i * 2654435761U) % (4 * CACHE_SZ);
+        __slab_kv(k, key, sizeof key, val, sizeof val);
+
+        if (i % 16 == 0)
+            (void) u_hmap_del(hmap, key, NULL);
+        else if (i % 4 == 0)
+        {
+            if (u_hmap_get(hmap, key, &obj) == U_HMAP_ERR_NONE)
+                u_test_err_if (strcmp(u_hmap_o_get_val(obj), val));
+        }
+        else
+            u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, val),
+                        NULL));
+    }
+
+    secs = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap) > CACHE_SZ);
+
+    u_test_case_printf(tc, "%-9s %-6s %10.0f ops/s",
+            type == U_HMAP_TYPE_CHAIN ? "chain" : "robinhood",
+            slab ? "slab" : "malloc", NUM_OPS / (secs > 0 ? secs : 1e-6));
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* slab allocation gives the same results as plain allocation, with inline
+ * and out of line data, and recycles rejected objects too */
+static int test_slab (u_test_case_t *tc)
+{
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    int slab, i;
+    double d = 3.5;
+
+    for (slab = 0; slab < 2; ++slab)
+    {
+        u_test_err_if (__slab_run(tc, U_HMAP_TYPE_CHAIN, slab));
+        u_test_err_if (__slab_run(tc, U_HMAP_TYPE_ROBINHOOD, slab));
+    }
+
+    /* opaque data, resizes and no overwrite */
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(double)));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__sample_hash));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__sample_comp));
+    u_test_err_if (u_hmap_opts_set_slab(opts, 1));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < 10000; ++i)
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &d), NULL));
+
+    i = 7, d = 1.0;
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &d), NULL) !=
+            U_HMAP_ERR_EXISTS);
+    u_test_err_if (u_hmap_get(hmap, &i, &obj));
+    u_test_err_if (*((double *) u_hmap_o_get_val(obj)) != 3.5);
+
+    u_hmap_clear(hmap);
+    u_test_err_if (u_hmap_count(hmap));
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &d), NULL));
+    u_test_err_if (u_hmap_get(hmap, &i, &obj));
+    u_test_err_if (*((double *) u_hmap_o_get_val(obj)) != 1.0);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* batch get against single gets on a map much larger than the caches, in
+ * groups of BATCH random keys */
+static int __batch_run (u_test_case_t *tc, u_hmap_type_t type)
+{
+    enum { NUM_ELEMS = 500000, NUM_GETS = 1000000, BATCH = 64 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t **objs = NULL, *objs2[BATCH];
+    char (*keys)[16] = NULL;
+    const void *bkeys[BATCH];
+    struct timeval t0;
+    double secs[2];
+    unsigned int seed = 1;
+    int i, j, k, rcs[BATCH];
+
+    u_test_err_if ((keys = u_malloc(NUM_ELEMS * sizeof(*keys))) == NULL);
+    u_test_err_if ((objs = u_malloc(NUM_ELEMS * sizeof(*objs))) == NULL);
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    /* load */
+    for (i = 0; i < NUM_ELEMS; i += BATCH)
+    {
+        for (j = 0; j < BATCH && i + j < NUM_ELEMS; ++j)
+        {
+            (void) u_snprintf(keys[i + j], sizeof keys[0], "key%d", i + j);
+            k = i + j;
+            u_test_err_if ((objs[i + j] = u_hmap_o_new(hmap, keys[i + j],
+                            &k)) == NULL);
+        }
+        u_test_err_if (u_hmap_put_batch(hmap, &objs[i], j, NULL, rcs) != j);
+    }
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS);
+
+    /* existing keys are rejected */
+    k = -1;
+    u_test_err_if ((objs2[0] = u_hmap_o_new(hmap, keys[0], &k)) == NULL);
+    u_test_err_if (u_hmap_put_batch(hmap, objs2, 1, NULL, rcs) != 0);
+    u_test_err_if (rcs[0] != U_HMAP_ERR_EXISTS);
+
+    for (j = 0; j < 2; ++j)
+    {
+        seed = 1;
+        (void) gettimeofday(&t0, NULL);
+
+        for (i = 0; i < NUM_GETS; i += BATCH)
+        {
+            for (k = 0; k < BATCH; ++k)
+            {
+                seed = seed * 1103515245 + 12345;
+                bkeys[k] = keys[(seed >> 4) % NUM_ELEMS];
+            }
+
+            if (j == 0)
+            {
+                for (k = 0; k < BATCH; ++k)
+                    u_test_err_if (u_hmap_get(hmap, bkeys[k], &objs2[k]));
+            }
+            else
+                u_test_err_if (u_hmap_get_batch(hmap, bkeys, BATCH, objs2)
+                        != BATCH);
+
+            for (k = 0; k < BATCH; ++k)
+                u_test_err_if (strcmp(u_hmap_o_get_key(objs2[k]), bkeys[k]));
+        }
+
+        secs[j] = __elapsed(&t0);
+    }
+
+    u_test_case_printf(tc, "%-9s single: %10.0f gets/s  batch: %10.0f gets/s",
+            type == U_HMAP_TYPE_CHAIN ? "chain" : "robinhood",
+            NUM_GETS / (secs[0] > 0 ? secs[0] : 1e-6),
+            NUM_GETS / (secs[1] > 0 ? secs[1] : 1e-6));
+
+    /* delete even keys (twice: the second time nothing is left) */
+    for (i = 0; i < 2; ++i)
+    {
+        for (j = 0; j < NUM_ELEMS; j += 2 * BATCH)
+        {
+            for (k = 0; k < BATCH && j + 2 * k < NUM_ELEMS; ++k)
+                bkeys[k] = keys[j + 2 * k];
+            u_test_err_if (u_hmap_del_batch(hmap, bkeys, k, NULL) !=
+                    (i ? 0 : k));
+        }
+    }
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS / 2);
+
+    bkeys[0] = keys[0];
+    bkeys[1] = keys[1];
+    u_test_err_if (u_hmap_get_batch(hmap, bkeys, 2, objs2) != 1);
+    u_test_err_if (objs2[0] != NULL || objs2[1] == NULL);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+    u_free(objs);
+    u_free(keys);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+    u_free(objs);
+    u_free(keys);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_batch (u_test_case_t *tc)
+{
+    u_test_err_if (__batch_run(tc, U_HMAP_TYPE_CHAIN));
+    u_test_err_if (__batch_run(tc, U_HMAP_TYPE_ROBINHOOD));
+
+    return U_TEST_SUCCESS;
+err:
+    return U_TEST_FAILURE;
+}
+
+static int __strcmp (const void *k1, const void *k2)
+{
+    return strcmp((const char *) k1, (const char *) k2);
+}
+
+/* string keyed map using built-in hash 'hash' */
+static int __hash_map_new (u_hmap_hash_t hash, int random_seed,
+        u_hmap_t **phmap)
+{
+    u_hmap_opts_t *opts = NULL;
+
+    dbg_err_if (u_hmap_opts_new(&opts));
+    dbg_err_if (u_hmap_opts_set_hash_type(opts, hash));
+    dbg_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_STRING));
+    if (random_seed)
+        dbg_err_if (u_hmap_opts_set_option(opts,
+                    U_HMAP_OPTS_HASH_RANDOM_SEED));
+    dbg_err_if (u_hmap_new(opts, phmap));
+
+    u_hmap_opts_free(opts);
+
+    return 0;
+err:
+    u_hmap_opts_free(opts);
+    return ~0;
+}
+
+/* hash throughput of each built-in function, and lookups with and without
+ * the key length, over keys of 8 to 256 bytes */
+static int __hash_bench (u_test_case_t *tc)
+{
+    enum { NUM_KEYS = 1024, MAX_LEN = 256, NUM_ROUNDS = 200 };
+    static const char *names[] = { "wyhash", "xxh64", "oaat" };
+    u_hmap_t *hmap[U_HMAP_HASH_LAST + 1] = { NULL };
+    char *keys = NULL, *k;
+    struct timeval t0;
+    u_hmap_o_t *obj;
+    size_t len, h = 0, x;
+    double secs[U_HMAP_HASH_LAST + 1], gsecs[2];
+    int i, r, j;
+
+    u_test_err_if ((keys = u_malloc(NUM_KEYS * (MAX_LEN + 1))) == NULL);
+
+    for (j = 0; j <= U_HMAP_HASH_LAST; ++j)
+        u_test_err_if (__hash_map_new((u_hmap_hash_t) j, 0, &hmap[j]));
+
+    for (len = 8; len <= MAX_LEN; len <<= 1)
+    {
+        for (i = 0; i < NUM_KEYS; ++i)
+        {
+            k = keys + i * (MAX_LEN + 1);
+            for (x = 0; x < len; ++x)
+                k[x] = 'a' + (char) ((i * 31 + x * 7 + x / 3) % 26);
+            (void) u_snprintf(k, len + 1, "%d", i); /* unique prefix */
+            k[strlen(k)] = 'z';
+            k[len] = '\0';
+        }
+
+        for (j = 0; j <= U_HMAP_HASH_LAST; ++j)
+        {
+            (void) gettimeofday(&t0, NULL);
+            for (r = 0; r < NUM_ROUNDS; ++r)
+                for (i = 0; i < NUM_KEYS; ++i)
+                    h += u_hmap_hash(hmap[j], keys + i * (MAX_LEN + 1));
+            secs[j] = __elapsed(&t0);
+        }
+
+        /* lookups on the default hash: u_hmap_get() scans the key for its
+         * length, u_hmap_get_n() is given it */
+        u_hmap_clear(hmap[0]);
+        for (i = 0; i < NUM_KEYS; ++i)
+            u_test_err_if (u_hmap_put(hmap[0], u_hmap_o_new(hmap[0],
+                            keys + i * (MAX_LEN + 1), "v"), NULL));
+
+        for (j = 0; j < 2; ++j)
+        {
+            (void) gettimeofday(&t0, NULL);
+            for (r = 0; r < NUM_ROUNDS; ++r)
+            {
+                for (i = 0; i < NUM_KEYS; ++i)
+                {
+                    k = keys + i * (MAX_LEN + 1);
+                    if (j == 0)
+                        u_test_err_if (u_hmap_get(hmap[0], k, &obj));
+                    else
+                        u_test_err_if (u_hmap_get_n(hmap[0], k, len, &obj));
+                }
+            }
+            gsecs[j] = __elapsed(&t0);
+        }
+
+        for (j = 0; j <= U_HMAP_HASH_LAST; ++j)
+            secs[j] = ((double) NUM_KEYS * NUM_ROUNDS * len) /
+                (secs[j] > 0 ? secs[j] : 1e-6) / (1024 * 1024);
+
+        u_test_case_printf(tc, "%3zu bytes: %s %7.0f MB/s  %s %7.0f MB/s  "
+                "%s %7.0f MB/s | get %9.0f/s  get_n %9.0f/s", len,
+                names[0], secs[0], names[1], secs[1], names[2], secs[2],
+                NUM_KEYS * NUM_ROUNDS / (gsecs[0] > 0 ? gsecs[0] : 1e-6),
+                NUM_KEYS * NUM_ROUNDS / (gsecs[1] > 0 ? gsecs[1] : 1e-6));
+    }
+
+    u_dbg("%zu", h);    /* keep the hashing loops */
+
+    for (j = 0; j <= U_HMAP_HASH_LAST; ++j)
+        u_hmap_free(hmap[j]);
+    u_free(keys);
+
+    return U_TEST_SUCCESS;
+err:
+    for (j = 0; j <= U_HMAP_HASH_LAST; ++j)
+        U_FREEF(hmap[j], u_hmap_free);
+    u_free(keys);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_hash_functions (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 10000 };
+    const char *hdr = "Content-Length: 42\r\nHost: example.org";
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL, *hmap2 = NULL;
+    u_hmap_o_t *obj;
+    char key[64];
+    int i, j;
+
+    /* every function on a resizing map, with a random seed */
+    for (j = 0; j <= U_HMAP_HASH_LAST; ++j)
+    {
+        u_test_err_if (__hash_map_new((u_hmap_hash_t) j, 1, &hmap));
+
+        for (i = 0; i < NUM_ELEMS; ++i)
+        {
+            (void) u_snprintf(key, sizeof key, "%0*d", i % 40 + 1, i);
+            u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, key),
+                        NULL));
+        }
+
+        for (i = 0; i < NUM_ELEMS; ++i)
+        {
+            (void) u_snprintf(key, sizeof key, "%0*d", i % 40 + 1, i);
+            u_test_err_if (u_hmap_get(hmap, key, &obj));
+            u_test_err_if (strcmp(u_hmap_o_get_val(obj), key));
+            u_test_err_if (u_hmap_get_n(hmap, key, strlen(key), &obj));
+            u_test_err_if (strcmp(u_hmap_o_get_val(obj), key));
+        }
+
+        U_FREEF(hmap, u_hmap_free);
+    }
+
+    /* seeds change the hash */
+    u_test_err_if (__hash_map_new(U_HMAP_HASH_WYHASH, 1, &hmap));
+    u_test_err_if (__hash_map_new(U_HMAP_HASH_WYHASH, 1, &hmap2));
+    u_test_err_if (u_hmap_hash(hmap, "key") == u_hmap_hash(hmap2, "key"));
+    U_FREEF(hmap2, u_hmap_free);
+
+    /* keys inside a larger buffer */
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, "Host", "h"), NULL));
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, "Content-Length", "c"),
+                NULL));
+    u_test_err_if (u_hmap_get_n(hmap, hdr, 14, &obj));
+    u_test_err_if (strcmp(u_hmap_o_get_val(obj), "c"));
+    u_test_err_if (u_hmap_get_n(hmap, strstr(hdr, "Host"), 4, &obj));
+    u_test_err_if (strcmp(u_hmap_o_get_val(obj), "h"));
+    u_test_err_if (u_hmap_get_n(hmap, hdr, 7, &obj) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_get_n(hmap, "Hosts", 5, &obj) == U_HMAP_ERR_NONE);
+    U_FREEF(hmap, u_hmap_free);
+
+    /* custom comparison: the key is copied */
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__strcmp));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, "Host", "h"), NULL));
+    u_test_err_if (u_hmap_get_n(hmap, strstr(hdr, "Host"), 4, &obj));
+    u_test_err_if (u_hmap_get_n(hmap, hdr, 4, &obj) == U_HMAP_ERR_NONE);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    u_test_err_if (__hash_bench(tc));
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(hmap2, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* mark the initial keys ("k<n>") as seen */
+static int __scan_mark (u_hmap_o_t *obj, void *arg)
+{
+    const char *key = (const char *) u_hmap_o_get_key(obj);
+
+    if (key[0] == 'k')
+        ((char *) arg)[atoi(key + 1)] = 1;
+
+    return U_HMAP_SCAN_KEEP;
+}
+
+/* delete the keys added during the scan and the even initial ones */
+static int __scan_expire (u_hmap_o_t *obj, void *arg)
+{
+    const char *key = (const char *) u_hmap_o_get_key(obj);
+
+    u_unused_args(arg);
+
+    return (key[0] != 'k' || atoi(key + 1) % 2 == 0) ?
+        U_HMAP_SCAN_DEL : U_HMAP_SCAN_KEEP;
+}
+
+static int __scan_run (u_test_case_t *tc, u_hmap_type_t type, int incremental)
+{
+    enum { NUM_ELEMS = 2000, COUNT = 16, PUTS = 20 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    char seen[NUM_ELEMS], key[32];
+    size_t cursor = 0;
+    int i, calls = 0, added = 0;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_incremental_resize(opts, incremental));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "k%d", i);
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, "v"), NULL));
+    }
+
+    /* the map keeps growing between calls */
+    memset(seen, 0, sizeof seen);
+
+    do {
+        cursor = u_hmap_scan(hmap, cursor, COUNT, __scan_mark, seen);
+        ++calls;
+
+        for (i = 0; i < PUTS; ++i, ++added)
+        {
+            (void) u_snprintf(key, sizeof key, "n%d", added);
+            u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, "v"),
+                        NULL));
+        }
+    } while (cursor != 0);
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (!seen[i]);
+
+    /* expire a bit at a time */
+    do {
+        cursor = u_hmap_scan(hmap, cursor, COUNT, __scan_expire, NULL);
+    } while (cursor != 0);
+
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS / 2);
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "k%d", i);
+        u_test_err_if ((u_hmap_get(hmap, key, &obj) == U_HMAP_ERR_NONE) !=
+                (i % 2));
+    }
+
+    u_test_case_printf(tc, "%-11s %d objects seen in %d calls with %d puts "
+            "in between", type == U_HMAP_TYPE_ROBINHOOD ? "robinhood" :
+            (type == U_HMAP_TYPE_LINEAR ? "linear" :
+             (incremental ? "chain/incr" : "chain")), NUM_ELEMS, calls, added);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* every object present for the whole scan is visited despite resizes */
+static int test_scan (u_test_case_t *tc)
+{
+    u_test_err_if (__scan_run(tc, U_HMAP_TYPE_CHAIN, 0));
+    u_test_err_if (__scan_run(tc, U_HMAP_TYPE_CHAIN, 1));
+    u_test_err_if (__scan_run(tc, U_HMAP_TYPE_LINEAR, 0));
+    u_test_err_if (__scan_run(tc, U_HMAP_TYPE_ROBINHOOD, 0));
+
+    return U_TEST_SUCCESS;
+err:
+    return U_TEST_FAILURE;
+}
+
+/* clock of the TTL tests (milliseconds) */
+static uint64_t __ttl_clock;
+
+static uint64_t __ttl_now (void)
+{
+    return __ttl_clock;
+}
+
+static int __ttl_run (u_test_case_t *tc, u_hmap_type_t type,
+        u_hmap_pcy_type_t pcy)
+{
+    enum { NUM_ELEMS = 4000, PUTS = 100 };
+    const uint64_t day = 24 * 3600 * 1000ULL;
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    char key[32];
+    ssize_t n;
+    int i, live, expired = 0;
+
+    __ttl_clock = 1000000;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_policy(opts, pcy));
+    u_test_err_if (u_hmap_opts_set_max(opts, 2 * NUM_ELEMS));
+    u_test_err_if (u_hmap_opts_set_size(opts, 16));
+    u_test_err_if (u_hmap_opts_set_slab(opts, type == U_HMAP_TYPE_CHAIN));
+    u_test_err_if (u_hmap_opts_set_clockfunc(opts, __ttl_now));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    /* one in four never expires, the others within 1 to 7 seconds (the hmap
+     * is resized on the way) */
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "k%d", i);
+        obj = u_hmap_o_new(hmap, key, "v");
+
+        if (i % 4 == 0)
+            u_test_err_if (u_hmap_put(hmap, obj, NULL));
+        else
+            u_test_err_if (u_hmap_put_ttl(hmap, obj, (i % 4) * 1000 + i,
+                        NULL));
+    }
+
+    /* expired objects are invisible before being reaped */
+    __ttl_clock += 2500;
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "k%d", i);
+        live = (i % 4 == 0 || (i % 4) * 1000 + i > 2500);
+        expired += !live;
+        u_test_err_if ((u_hmap_get(hmap, key, &obj) == U_HMAP_ERR_NONE) !=
+                live);
+    }
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS);
+
+    /* and don't prevent insertions, even without overwrite (the put reaps
+     * the first four to expire, k1 to k13, then replaces k2) */
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, "k2", "new"), NULL));
+    u_test_err_if (u_hmap_get(hmap, "k2", &obj));
+    u_test_err_if (strcmp(u_hmap_o_get_val(obj), "new"));
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS - 4);
+
+    /* reap the others on demand, a few or all */
+    u_test_err_if (u_hmap_expire(hmap, __ttl_clock, 5) != 5);
+    u_test_err_if (u_hmap_expire(hmap, __ttl_clock, 0) != expired - 10);
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS - expired + 1);
+    u_test_err_if (u_hmap_expire(hmap, __ttl_clock, 0) != 0);
+
+    /* timers beyond the wheel range */
+    u_test_err_if (u_hmap_put_ttl(hmap, u_hmap_o_new(hmap, "day", "v"), day,
+                NULL));
+    u_test_err_if (u_hmap_put_ttl(hmap, u_hmap_o_new(hmap, "month", "v"),
+                30 * day, NULL));
+
+    /* puts reap the rest a few at a time */
+    __ttl_clock += 2 * day;
+    n = u_hmap_count(hmap);
+
+    for (i = 0; i < PUTS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "p%d", i);
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, "v"), NULL));
+    }
+    u_test_err_if (u_hmap_count(hmap) != n + PUTS - 4 * PUTS);
+
+    u_test_err_if (u_hmap_expire(hmap, __ttl_clock, 0) <= 0);
+    u_test_err_if (u_hmap_get(hmap, "day", &obj) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_get(hmap, "month", &obj));
+
+    __ttl_clock += 29 * day;
+    u_test_err_if (u_hmap_expire(hmap, __ttl_clock, 0) != 1);
+    u_test_err_if (u_hmap_get(hmap, "month", &obj) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS / 4 + 1 + PUTS);
+
+    u_test_case_printf(tc, "%-9s %-5s %d objects, %d expired",
+            type == U_HMAP_TYPE_ROBINHOOD ? "robinhood" :
+            (type == U_HMAP_TYPE_LINEAR ? "linear" : "chain"),
+            pcy == U_HMAP_PCY_NONE ? "none" : "lru", NUM_ELEMS + 2 + PUTS,
+            NUM_ELEMS + 1 - NUM_ELEMS / 4);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* expiration with the timing wheel, alone and along with a policy */
+static int test_ttl (u_test_case_t *tc)
+{
+    u_test_err_if (__ttl_run(tc, U_HMAP_TYPE_CHAIN, U_HMAP_PCY_NONE));
+    u_test_err_if (__ttl_run(tc, U_HMAP_TYPE_CHAIN, U_HMAP_PCY_LRU));
+    u_test_err_if (__ttl_run(tc, U_HMAP_TYPE_LINEAR, U_HMAP_PCY_NONE));
+    u_test_err_if (__ttl_run(tc, U_HMAP_TYPE_ROBINHOOD, U_HMAP_PCY_LRU));
+
+    return U_TEST_SUCCESS;
+err:
+    return U_TEST_FAILURE;
+}
+
+/* foreach argument: const itself, the counter it references is not */
+typedef struct
+{
+    size_t *n;
+} count_arg_t;
+
+static int __save_count (const void *val, const void *arg)
+{
+    u_unused_args(val);
+    ++*((const count_arg_t *) arg)->n;
+    return 0;
+}
+
+/* string keys and values: snapshot, full and mapped reloads */
+static int __save_run (u_test_case_t *tc, u_hmap_type_t type)
+{
+    enum { NUM_ELEMS = 20000, BATCH = 16 };
+    const char *path = "hmap.snap";
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL, *hmap2 = NULL;
+    u_hmap_o_t *obj, *objs[BATCH];
+    const void *keys[BATCH];
+    char key[32], val[32], bkeys[BATCH][32];
+    struct timeval t0;
+    double secs[2];
+    count_arg_t ca;
+    size_t n = 0;
+    int i, j;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_set_option(opts,
+                U_HMAP_OPTS_HASH_RANDOM_SEED));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        (void) u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, val), NULL));
+    }
+    u_test_err_if (u_hmap_del(hmap, "key0", NULL));
+    u_test_err_if (u_hmap_save(hmap, path));
+    u_hmap_free(hmap);
+    hmap = NULL;
+
+    /* rebuilt (the random seed comes from the file) */
+    (void) gettimeofday(&t0, NULL);
+    u_test_err_if (u_hmap_load(path, opts, &hmap));
+    secs[0] = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap) != NUM_ELEMS - 1);
+    for (i = 1; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        (void) u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if (u_hmap_get(hmap, key, &obj));
+        u_test_err_if (strcmp(u_hmap_o_get_val(obj), val));
+    }
+    u_test_err_if (u_hmap_get(hmap, "key0", &obj) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, "key0", "v"), NULL));
+
+    /* mapped: lookups straight from the file, no changes */
+    u_test_err_if (u_hmap_opts_set_mmap(opts, 1));
+    (void) gettimeofday(&t0, NULL);
+    u_test_err_if (u_hmap_load(path, opts, &hmap2));
+    secs[1] = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap2) != NUM_ELEMS - 1);
+    for (i = 1; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        (void) u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if (u_hmap_get(hmap2, key, &obj));
+        u_test_err_if (strcmp(u_hmap_o_get_key(obj), key));
+        u_test_err_if (strcmp(u_hmap_o_get_val(obj), val));
+        u_test_err_if (strcmp(u_hmap_easy_get(hmap2, key), val));
+    }
+    u_test_err_if (u_hmap_get(hmap2, "key0", &obj) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_get_n(hmap2, "key12345678", 5, &obj));
+    u_test_err_if (strcmp(u_hmap_o_get_val(obj), "val12"));
+
+    for (j = 0; j < BATCH; ++j)
+    {
+        (void) u_snprintf(bkeys[j], sizeof bkeys[0], "key%d", j * 1000);
+        keys[j] = bkeys[j];
+    }
+    u_test_err_if (u_hmap_get_batch(hmap2, keys, BATCH, objs) != BATCH - 1);
+    u_test_err_if (objs[0] != NULL);
+    u_test_err_if (strcmp(u_hmap_o_get_val(objs[1]), "val1000"));
+
+    ca.n = &n;
+    u_test_err_if (u_hmap_foreach_arg(hmap2, __save_count, &ca));
+    u_test_err_if (n != NUM_ELEMS - 1);
+
+    obj = u_hmap_o_new(hmap2, "new", "v");
+    u_test_err_if (u_hmap_put(hmap2, obj, NULL) == U_HMAP_ERR_NONE);
+    u_hmap_o_dispose(hmap2, obj);
+    u_test_err_if (u_hmap_del(hmap2, "key1", NULL) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_get(hmap2, "key1", &obj));
+
+    /* a mapped hmap saves like any other */
+    u_test_err_if (u_hmap_save(hmap2, path));
+    u_hmap_free(hmap2);
+    hmap2 = NULL;
+    u_test_err_if (u_hmap_load(path, opts, &hmap2));
+    u_test_err_if (u_hmap_count(hmap2) != NUM_ELEMS - 1);
+    u_test_err_if (strcmp(u_hmap_easy_get(hmap2, "key1"), "val1"));
+
+    u_test_case_printf(tc, "%-9s %d objects, load: %.4fs, mmap: %.4fs",
+            type == U_HMAP_TYPE_ROBINHOOD ? "robinhood" :
+            (type == U_HMAP_TYPE_LINEAR ? "linear" : "chain"),
+            NUM_ELEMS - 1, secs[0], secs[1]);
+
+    u_hmap_free(hmap2);
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+    (void) unlink(path);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap2, u_hmap_free);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+    (void) unlink(path);
+
+    return U_TEST_FAILURE;
+}
+
+/* opaque keys with a custom hash, damaged files */
+static int __save_opaque (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 1000 };
+    const char *path = "hmap.snap";
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    struct stat st;
+    char c;
+    int i, fd = -1;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(double)));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__sample_hash));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__sample_comp));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        double d = i / 2.0;
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &d), NULL));
+    }
+    u_test_err_if (u_hmap_save(hmap, path));
+    u_hmap_free(hmap);
+    hmap = NULL;
+
+    /* values are aligned in the mapping */
+    u_test_err_if (u_hmap_opts_set_mmap(opts, 1));
+    u_test_err_if (u_hmap_load(path, opts, &hmap));
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        u_test_err_if (u_hmap_get(hmap, &i, &obj));
+        u_test_err_if ((size_t) u_hmap_o_get_val(obj) % sizeof(double));
+        u_test_err_if (*((double *) u_hmap_o_get_val(obj)) != i / 2.0);
+    }
+    u_hmap_free(hmap);
+    hmap = NULL;
+
+    /* lookups need the same hash function */
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__int_hash_snprintf));
+    u_test_err_if (u_hmap_load(path, opts, &hmap) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__sample_hash));
+
+    /* flip a byte of a record */
+    u_test_err_if ((fd = open(path, O_RDWR)) < 0);
+    u_test_err_if (fstat(fd, &st));
+    u_test_err_if (pread(fd, &c, 1, st.st_size / 2) != 1);
+    c ^= 0x20;
+    u_test_err_if (pwrite(fd, &c, 1, st.st_size / 2) != 1);
+    u_test_err_if (u_hmap_load(path, opts, &hmap) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_opts_set_mmap(opts, 0));
+    u_test_err_if (u_hmap_load(path, opts, &hmap) == U_HMAP_ERR_NONE);
+
+    /* and truncate the file */
+    c ^= 0x20;
+    u_test_err_if (pwrite(fd, &c, 1, st.st_size / 2) != 1);
+    u_test_err_if (u_hmap_load(path, opts, &hmap));
+    u_hmap_free(hmap);
+    hmap = NULL;
+    u_test_err_if (ftruncate(fd, st.st_size - 1));
+    u_test_err_if (u_hmap_load(path, opts, &hmap) == U_HMAP_ERR_NONE);
+    (void) close(fd);
+    fd = -1;
+
+    /* pointers can't be saved */
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_POINTER));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+    u_test_err_if (u_hmap_save(hmap, path) == U_HMAP_ERR_NONE);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+    (void) unlink(path);
+
+    return U_TEST_SUCCESS;
+err:
+    if (fd >= 0)
+        (void) close(fd);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+    (void) unlink(path);
+
+    return U_TEST_FAILURE;
+}
+
+/* frozen copies of string, opaque and pointer hmaps */
+static int test_freeze (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 50000, BATCH = 16 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL, *frozen = NULL, *frozen2 = NULL;
+    u_hmap_o_t *obj, *objs[BATCH];
+    const void *keys[BATCH];
+    char key[32], val[32], bkeys[BATCH][32];
+    static int ptrs[4];
+    count_arg_t ca;
+    size_t n = 0;
+    int i, j;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    /* empty */
+    u_test_err_if (u_hmap_freeze(hmap, &frozen));
+    u_test_err_if (u_hmap_count(frozen) != 0);
+    u_test_err_if (u_hmap_get(frozen, "key1", &obj) == U_HMAP_ERR_NONE);
+    u_hmap_free(frozen);
+    frozen = NULL;
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        (void) u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, val), NULL));
+    }
+
+    u_test_err_if (u_hmap_freeze(hmap, &frozen));
+    u_hmap_free(hmap);
+    hmap = NULL;
+
+    u_test_err_if (u_hmap_count(frozen) != NUM_ELEMS);
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        (void) u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if (u_hmap_get(frozen, key, &obj));
+        u_test_err_if (strcmp(u_hmap_o_get_key(obj), key));
+        u_test_err_if (strcmp(u_hmap_o_get_val(obj), val));
+        u_test_err_if (strcmp(u_hmap_easy_get(frozen, key), val));
+
+        /* absent keys land on some slot too */
+        (void) u_snprintf(key, sizeof key, "nokey%d", i);
+        u_test_err_if (u_hmap_get(frozen, key, &obj) == U_HMAP_ERR_NONE);
+    }
+    u_test_err_if (u_hmap_get_n(frozen, "key12345678", 5, &obj));
+    u_test_err_if (strcmp(u_hmap_o_get_val(obj), "val12"));
+
+    for (j = 0; j < BATCH; ++j)
+    {
+        (void) u_snprintf(bkeys[j], sizeof bkeys[0], "key%d",
+                j ? j * 1000 : NUM_ELEMS);
+        keys[j] = bkeys[j];
+    }
+    u_test_err_if (u_hmap_get_batch(frozen, keys, BATCH, objs) != BATCH - 1);
+    u_test_err_if (objs[0] != NULL);
+    u_test_err_if (strcmp(u_hmap_o_get_val(objs[1]), "val1000"));
+
+    ca.n = &n;
+    u_test_err_if (u_hmap_foreach_arg(frozen, __save_count, &ca));
+    u_test_err_if (n != NUM_ELEMS);
+
+    /* read-only */
+    obj = u_hmap_o_new(frozen, "new", "v");
+    u_test_err_if (u_hmap_put(frozen, obj, NULL) == U_HMAP_ERR_NONE);
+    u_hmap_o_dispose(frozen, obj);
+    u_test_err_if (u_hmap_del(frozen, "key1", NULL) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_get(frozen, "key1", &obj));
+
+    /* a frozen hmap freezes again */
+    u_test_err_if (u_hmap_freeze(frozen, &frozen2));
+    u_test_err_if (strcmp(u_hmap_easy_get(frozen2, "key777"), "val777"));
+    u_hmap_free(frozen2);
+    frozen2 = NULL;
+    u_hmap_free(frozen);
+    frozen = NULL;
+
+    /* opaque keys and values with a custom hash */
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(double)));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__sample_hash));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__sample_comp));
+    u_test_err_if (u_hmap_opts_set_type(opts, U_HMAP_TYPE_ROBINHOOD));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        double d = i / 2.0;
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &d), NULL));
+    }
+    u_test_err_if (u_hmap_freeze(hmap, &frozen));
+    u_hmap_free(hmap);
+    hmap = NULL;
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        u_test_err_if (u_hmap_get(frozen, &i, &obj));
+        u_test_err_if ((size_t) u_hmap_o_get_val(obj) % sizeof(double));
+        u_test_err_if (*((double *) u_hmap_o_get_val(obj)) != i / 2.0);
+    }
+    i = NUM_ELEMS;
+    u_test_err_if (u_hmap_get(frozen, &i, &obj) == U_HMAP_ERR_NONE);
+    u_hmap_free(frozen);
+    frozen = NULL;
+
+    /* pointer values are shared */
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_POINTER));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+    for (i = 0; i < 4; ++i)
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &i, &ptrs[i]),
+                    NULL));
+    u_test_err_if (u_hmap_freeze(hmap, &frozen));
+    for (i = 0; i < 4; ++i)
+    {
+        u_test_err_if (u_hmap_get(frozen, &i, &obj));
+        u_test_err_if (u_hmap_o_get_val(obj) != &ptrs[i]);
+    }
+
+    u_hmap_free(frozen);
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(frozen2, u_hmap_free);
+    U_FREEF(frozen, u_hmap_free);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+/* allocator keeping track of the bytes in use, to compare footprints */
+static size_t __mem_used;
+
+static void *__mem_malloc (size_t sz)
+{
+    size_t *p;
+
+    if ((p = malloc(sz + 16)) == NULL)
+        return NULL;
+
+    p[0] = sz;
+    __mem_used += sz;
+
+    return (char *) p + 16;
+}
+
+static void *__mem_calloc (size_t n, size_t sz)
+{
+    void *p;
+
+    if (sz && n > (size_t) -1 / sz)
+        return NULL;
+
+    if ((p = __mem_malloc(n * sz)) != NULL)
+        memset(p, 0, n * sz);
+
+    return p;
+}
+
+static void *__mem_realloc (void *q, size_t sz)
+{
+    size_t *p, old;
+
+    if (q == NULL)
+        return __mem_malloc(sz);
+
+    p = (size_t *) ((char *) q - 16);
+    old = p[0];
+
+    if ((p = realloc(p, sz + 16)) == NULL)
+        return NULL;
+
+    p[0] = sz;
+    __mem_used += sz - old;
+
+    return (char *) p + 16;
+}
+
+static void __mem_free (void *q)
+{
+    size_t *p;
+
+    if (q == NULL)
+        return;
+
+    p = (size_t *) ((char *) q - 16);
+    __mem_used -= p[0];
+    free(p);
+}
+
+/* lookup latency and memory of a frozen hmap vs. the updatable ones; all
+ * allocations must happen (and be released) with the counting allocator
+ * in place */
+static int __freeze_bench (u_test_case_t *tc, u_hmap_type_t type)
+{
+    enum { NUM_ELEMS = 200000, NUM_GETS = 1000000 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL, *frozen = NULL, *h;
+    u_hmap_o_t *obj;
+    char key[32];
+    struct timeval t0;
+    double secs;
+    size_t base, mem[2];
+    unsigned int seed = 1;
+    int i, k, v;
+
+    base = __mem_used;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, &i), NULL));
+    }
+    mem[0] = __mem_used - base;
+
+    (void) gettimeofday(&t0, NULL);
+    u_test_err_if (u_hmap_freeze(hmap, &frozen));
+    secs = __elapsed(&t0);
+    mem[1] = __mem_used - base - mem[0];
+
+    u_test_case_printf(tc, "%-9s %6.1f bytes/key, frozen %6.1f bytes/key "
+            "(built in %.3fs)", type == U_HMAP_TYPE_ROBINHOOD ? "robinhood" :
+            (type == U_HMAP_TYPE_LINEAR ? "linear" : "chain"),
+            (double) mem[0] / NUM_ELEMS, (double) mem[1] / NUM_ELEMS, secs);
+
+    for (h = hmap; h; h = (h == hmap) ? frozen : NULL)
+    {
+        (void) gettimeofday(&t0, NULL);
+
+        for (i = 0; i < NUM_GETS; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            k = (int) ((seed >> 8) % NUM_ELEMS);
+            (void) u_snprintf(key, sizeof key, "key%d", k);
+            u_test_err_if (u_hmap_get(h, key, &obj));
+            memcpy(&v, u_hmap_o_get_val(obj), sizeof v);
+            u_test_err_if (v != k);
+        }
+
+        secs = __elapsed(&t0);
+        u_test_case_printf(tc, "%-9s %6.1f ns/lookup",
+                h == frozen ? "frozen" : "", secs * 1e9 / NUM_GETS);
+    }
+
+    u_hmap_free(frozen);
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(frozen, u_hmap_free);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_freeze_bench (u_test_case_t *tc)
+{
+    int rc = 0;
+
+    u_memory_set_malloc(__mem_malloc);
+    u_memory_set_calloc(__mem_calloc);
+    u_memory_set_realloc(__mem_realloc);
+    u_memory_set_free(__mem_free);
+
+    rc |= __freeze_bench(tc, U_HMAP_TYPE_CHAIN);
+    rc |= __freeze_bench(tc, U_HMAP_TYPE_LINEAR);
+    rc |= __freeze_bench(tc, U_HMAP_TYPE_ROBINHOOD);
+
+    u_memory_set_malloc(malloc);
+    u_memory_set_calloc(calloc);
+    u_memory_set_realloc(realloc);
+    u_memory_set_free(free);
+
+    return rc ? U_TEST_FAILURE : U_TEST_SUCCESS;
+}
+
+/* counters and table picture returned by u_hmap_stats() */
+static int __stats_run (u_test_case_t *tc, u_hmap_type_t type,
+        u_hmap_pcy_type_t policy)
+{
+    enum { NUM_ELEMS = 20000, MAX = 1000 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL, *frozen = NULL;
+    u_hmap_o_t *obj;
+    u_hmap_stats_t st;
+    char key[32];
+    size_t stored, over;
+    int i;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_type(opts, type));
+    u_test_err_if (u_hmap_opts_set_policy(opts, policy));
+    u_test_err_if (u_hmap_opts_set_max(opts, MAX));
+    u_test_err_if (u_hmap_opts_set_size(opts, 2 * MAX));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_hmap_opts_set_option(opts, U_HMAP_OPTS_STATS));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, "v"), NULL));
+    }
+    stored = (size_t) u_hmap_count(hmap);
+
+    /* the last 'stored' keys are there whatever the policy (overwrite them
+     * if nothing was evicted: linear probing may not find a key past the
+     * holes left by evictions when inserting) */
+    over = (policy == U_HMAP_PCY_NONE) ? stored : 0;
+    for (i = NUM_ELEMS - (int) stored; i < NUM_ELEMS; ++i)
+    {
+        (void) u_snprintf(key, sizeof key, "key%d", i);
+        u_test_err_if (u_hmap_get(hmap, key, &obj));
+        if (over)
+            u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, key, "w"),
+                        NULL));
+    }
+    u_test_err_if (u_hmap_get(hmap, "nokey", &obj) == U_HMAP_ERR_NONE);
+    u_test_err_if (u_hmap_get_n(hmap, "key1234567", 7, &obj) ==
+            U_HMAP_ERR_NONE && policy != U_HMAP_PCY_NONE);
+
+    u_test_err_if (u_hmap_stats(hmap, &st));
+
+    u_test_case_printf(tc, "%-9s %-5s hits %llu, misses %llu, puts %llu, "
+            "overwrites %llu, evictions %llu, resizes %llu (%.3fms), "
+            "load %.2f, probes max %lu mean %.2f",
+            type == U_HMAP_TYPE_ROBINHOOD ? "robinhood" :
+            (type == U_HMAP_TYPE_LINEAR ? "linear" : "chain"),
+            policy == U_HMAP_PCY_NONE ? "none" : "lru",
+            (unsigned long long) st.hits, (unsigned long long) st.misses,
+            (unsigned long long) st.puts, (unsigned long long) st.overwrites,
+            (unsigned long long) st.evictions,
+            (unsigned long long) st.resizes, st.resize_ns / 1e6, st.load,
+            (unsigned long) st.probe_max, st.probe_mean);
+
+    u_test_err_if (st.hits + st.misses != stored + 2);
+    u_test_err_if (st.puts != NUM_ELEMS + over);
+    u_test_err_if (st.overwrites != over);
+    u_test_err_if (st.evictions != NUM_ELEMS - stored);
+    u_test_err_if (st.policy != policy);
+    u_test_err_if (st.count != stored);
+    u_test_err_if (st.load <= 0);
+    u_test_err_if (type != U_HMAP_TYPE_CHAIN && st.load > 1);
+    u_test_err_if (st.probe_max < 1 || st.probe_mean < 1 ||
+            st.probe_mean > st.probe_max);
+
+    /* tables only grow without a policy (or when it cannot keep them from
+     * filling up) */
+    if (policy == U_HMAP_PCY_NONE)
+        u_test_err_if (st.resizes == 0);
+
+    /* a frozen copy finds every key at the first probe */
+    u_test_err_if (u_hmap_freeze(hmap, &frozen));
+    u_test_err_if (u_hmap_stats(frozen, &st));
+    u_test_err_if (st.count != stored || st.load != 1);
+    u_test_err_if (st.probe_max != 1 || st.probe_mean != 1);
+
+    u_hmap_free(frozen);
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(frozen, u_hmap_free);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_stats (u_test_case_t *tc)
+{
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    u_hmap_stats_t st;
+    int i, j;
+
+    for (i = U_HMAP_TYPE_CHAIN; i <= U_HMAP_TYPE_LAST; ++i)
+        for (j = 0; j < 2; ++j)
+            u_test_err_if (__stats_run(tc, (u_hmap_type_t) i,
+                        j ? U_HMAP_PCY_LRU : U_HMAP_PCY_NONE));
+
+    /* counters are off by default, the table picture is always there */
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+    u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, "k", "v"), NULL));
+    u_test_err_if (u_hmap_get(hmap, "k", &obj));
+    u_test_err_if (u_hmap_stats(hmap, &st));
+    u_test_err_if (st.hits || st.puts || st.resizes);
+    u_test_err_if (st.count != 1 || st.size == 0 || st.probe_max != 1);
+
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_save (u_test_case_t *tc)
+{
+    u_test_err_if (__save_run(tc, U_HMAP_TYPE_CHAIN));
+    u_test_err_if (__save_run(tc, U_HMAP_TYPE_ROBINHOOD));
+    u_test_err_if (__save_opaque(tc));
+
+    return U_TEST_SUCCESS;
+err:
+    return U_TEST_FAILURE;
+}
+
 /** 
  * keys have limited scope
  * values have wide scope 
@@ -800,6 +2896,26 @@ int test_suite_hmap_register (u_test_t *t)
     /* tests */
     con_err_if (u_test_case_register("Resize", test_resize, ts));
     con_err_if (u_test_case_register("Linear Probing", test_linear, ts));
+    con_err_if (u_test_case_register("Robin Hood Hashing", test_robinhood, ts));
+    con_err_if (u_test_case_register("Integer Keys Hashing", test_int_keys, ts));
+    con_err_if (u_test_case_register("LFU Policy", test_lfu, ts));
+    con_err_if (u_test_case_register("Custom Policy", test_custom_pcy, ts));
+    con_err_if (u_test_case_register("Policies Trace Replay", test_pcy_trace,
+                ts));
+    con_err_if (u_test_case_register("Policy Hashing", test_pcy_hash, ts));
+    con_err_if (u_test_case_register("Incremental Resize",
+                test_incremental_resize, ts));
+    con_err_if (u_test_case_register("Slab Allocation", test_slab, ts));
+    con_err_if (u_test_case_register("Batch Operations", test_batch, ts));
+    con_err_if (u_test_case_register("Hash Functions", test_hash_functions,
+                ts));
+    con_err_if (u_test_case_register("Scan", test_scan, ts));
+    con_err_if (u_test_case_register("TTL Expiration", test_ttl, ts));
+    con_err_if (u_test_case_register("Save/Load", test_save, ts));
+    con_err_if (u_test_case_register("Frozen", test_freeze, ts));
+    con_err_if (u_test_case_register("Frozen Benchmark", test_freeze_bench,
+                ts));
+    con_err_if (u_test_case_register("Statistics", test_stats, ts));
     con_err_if (u_test_case_register("Scoping", test_scope, ts));
 
     /* hmap depends on the strings module */
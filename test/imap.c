@@ -0,0 +1,295 @@
+#include <sys/time.h>
+#include <u/libu.h>
+
+int test_suite_imap_register (u_test_t *t);
+
+static int test_basic (u_test_case_t *tc);
+static int test_churn (u_test_case_t *tc);
+#ifndef NO_HMAP
+static int test_bench (u_test_case_t *tc);
+
+static size_t __u64_hash (const void *key);
+static int __u64_comp (const void *k1, const void *k2);
+static double __elapsed (struct timeval *t0);
+#endif  /* !NO_HMAP */
+
+static int __sum (uint64_t key, uint64_t val, void *arg);
+static uint64_t __rand (uint64_t *state);
+
+/* user instance: keys to a small struct */
+typedef struct
+{
+    uint32_t a, b;
+} pair_t;
+
+U_IMAP_GENERATE(pair_map, pair_t);
+
+static int __sum (uint64_t key, uint64_t val, void *arg)
+{
+    *((uint64_t *) arg) += key + val;
+    return 0;
+}
+
+/* xorshift64 */
+static uint64_t __rand (uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static int test_basic (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 100000 };
+    static char one[] = "one", two[] = "two", zero[] = "zero", max[] = "max",
+                uno[] = "uno";
+    u_imap_t *m = NULL;
+    u_imap64_t *m64 = NULL;
+    pair_map_t *pm = NULL;
+    pair_t p;
+    uint64_t i, v, sum = 0;
+    void *pv;
+
+    /* void * values, grown from the minimum size */
+    u_test_err_if (u_imap_new(0, &m));
+    u_test_err_if (u_imap_get(m, 1, &pv) == 0);
+    u_test_err_if (u_imap_put(m, 1, one));
+    u_test_err_if (u_imap_put(m, 2, two));
+    u_test_err_if (u_imap_put(m, 0, zero));   /* the empty slot marker */
+    u_test_err_if (u_imap_put(m, UINT64_MAX, max));
+    u_test_err_if (u_imap_count(m) != 4);
+
+    u_test_err_if (u_imap_get(m, 0, &pv) || strcmp(pv, "zero"));
+    u_test_err_if (u_imap_get(m, UINT64_MAX, &pv) || strcmp(pv, "max"));
+    u_test_err_if (u_imap_put(m, 1, uno));
+    u_test_err_if (u_imap_get(m, 1, &pv) || strcmp(pv, "uno"));
+    u_test_err_if (u_imap_count(m) != 4);
+
+    u_test_err_if (u_imap_del(m, 0, &pv) || strcmp(pv, "zero"));
+    u_test_err_if (u_imap_get(m, 0, NULL) == 0);
+    u_test_err_if (u_imap_del(m, 0, NULL) == 0);
+    u_test_err_if (u_imap_del(m, 3, NULL) == 0);
+    u_test_err_if (u_imap_count(m) != 3);
+
+    u_imap_clear(m);
+    u_test_err_if (u_imap_count(m) != 0);
+    u_test_err_if (u_imap_get(m, 2, NULL) == 0);
+
+    /* uint64_t values, sized in advance */
+    u_test_err_if (u_imap64_new(NUM_ELEMS, &m64));
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_imap64_put(m64, i * 7, i));
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        u_test_err_if (u_imap64_get(m64, i * 7, &v));
+        u_test_err_if (v != i);
+        u_test_err_if (u_imap64_get(m64, i * 7 + 1, NULL) == 0);
+    }
+
+    u_test_err_if (u_imap64_foreach(m64, __sum, &sum));
+    u_test_err_if (sum != (uint64_t) NUM_ELEMS * (NUM_ELEMS - 1) / 2 * 8);
+
+    /* any assignable value type */
+    u_test_err_if (pair_map_new(0, &pm));
+    p.a = 1, p.b = 2;
+    u_test_err_if (pair_map_put(pm, 12, p));
+    p.a = p.b = 0;
+    u_test_err_if (pair_map_get(pm, 12, &p) || p.a != 1 || p.b != 2);
+
+    pair_map_free(pm);
+    u_imap64_free(m64);
+    u_imap_free(m);
+
+    return U_TEST_SUCCESS;
+err:
+    pair_map_free(pm);
+    u_imap64_free(m64);
+    u_imap_free(m);
+
+    return U_TEST_FAILURE;
+}
+
+/* random puts and deletes in a small key space, checked against a plain
+ * array: backward shift deletion must keep every remaining key reachable */
+static int test_churn (u_test_case_t *tc)
+{
+    enum { NUM_KEYS = 4096, NUM_OPS = 1000000 };
+    static uint64_t ref[NUM_KEYS];  /* value + 1, 0 if missing */
+    u_imap64_t *m = NULL;
+    uint64_t st = 88172645463325252ULL, r, k, v;
+    size_t i, n = 0;
+
+    memset(ref, 0, sizeof ref);
+    u_test_err_if (u_imap64_new(0, &m));
+
+    for (i = 0; i < NUM_OPS; ++i)
+    {
+        r = __rand(&st);
+        k = (r >> 8) % NUM_KEYS;
+
+        /* delete more often than insert, so that the map shrinks too */
+        if (r % 5 < 2)
+        {
+            u_test_err_if (u_imap64_put(m, k, i));
+            n += (ref[k] == 0);
+            ref[k] = i + 1;
+        }
+        else
+        {
+            u_test_err_if ((u_imap64_del(m, k, &v) == 0) != (ref[k] != 0));
+            u_test_err_if (ref[k] && v != ref[k] - 1);
+            n -= (ref[k] != 0);
+            ref[k] = 0;
+        }
+
+        u_test_err_if (u_imap64_count(m) != n);
+
+        /* check every key now and then */
+        if (i % 100000 == 0)
+        {
+            for (k = 0; k < NUM_KEYS; ++k)
+            {
+                if (ref[k])
+                    u_test_err_if (u_imap64_get(m, k, &v) || v != ref[k] - 1);
+                else
+                    u_test_err_if (u_imap64_get(m, k, NULL) == 0);
+            }
+        }
+    }
+
+    u_imap64_free(m);
+
+    return U_TEST_SUCCESS;
+err:
+    u_imap64_free(m);
+
+    return U_TEST_FAILURE;
+}
+
+#ifndef NO_HMAP
+static size_t __u64_hash (const void *key)
+{
+    return (size_t) *((const uint64_t *) key);
+}
+
+static int __u64_comp (const void *k1, const void *k2)
+{
+    return *((const uint64_t *) k1) != *((const uint64_t *) k2);
+}
+
+static double __elapsed (struct timeval *t0)
+{
+    struct timeval t1, d;
+
+    (void) gettimeofday(&t1, NULL);
+    u_timersub(&t1, t0, &d);
+
+    return d.tv_sec + d.tv_usec / 1000000.0;
+}
+
+/* uint64_t -> pointer: u_imap_t vs. an opaque key hmap with custom hash and
+ * comparison functions (the generic way to do it) */
+static int test_bench (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 500000 };
+    u_hmap_opts_t *opts = NULL;
+    u_hmap_t *hmap = NULL;
+    u_hmap_o_t *obj;
+    u_imap_t *m = NULL;
+    struct timeval t0;
+    uint64_t st, k, *keys = NULL;
+    double t[2][3];
+    size_t i;
+    void *v;
+
+    /* scattered keys */
+    u_test_err_if ((keys = u_malloc(NUM_ELEMS * sizeof(uint64_t))) == NULL);
+    for (st = 1, i = 0; i < NUM_ELEMS; ++i)
+        keys[i] = __rand(&st);
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(uint64_t)));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__u64_hash));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__u64_comp));
+    u_test_err_if (u_hmap_new(opts, &hmap));
+    u_test_err_if (u_imap_new(0, &m));
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_hmap_put(hmap, u_hmap_o_new(hmap, &keys[i], keys),
+                    NULL));
+    t[0][0] = __elapsed(&t0);
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        k = keys[(i * 7919) % NUM_ELEMS];
+        u_test_err_if (u_hmap_get(hmap, &k, &obj));
+    }
+    t[0][1] = __elapsed(&t0);
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_hmap_del(hmap, &keys[i], NULL));
+    t[0][2] = __elapsed(&t0);
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_imap_put(m, keys[i], keys));
+    t[1][0] = __elapsed(&t0);
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_imap_get(m, keys[(i * 7919) % NUM_ELEMS], &v));
+    t[1][1] = __elapsed(&t0);
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NUM_ELEMS; ++i)
+        u_test_err_if (u_imap_del(m, keys[i], NULL));
+    t[1][2] = __elapsed(&t0);
+
+    u_test_err_if (u_hmap_count(hmap) != 0 || u_imap_count(m) != 0);
+
+    for (i = 0; i < 3; ++i)
+        u_test_case_printf(tc, "%-3s hmap %6.1f ns/op, imap %6.1f ns/op "
+                "(%.1fx)", i == 0 ? "put" : (i == 1 ? "get" : "del"),
+                t[0][i] * 1e9 / NUM_ELEMS, t[1][i] * 1e9 / NUM_ELEMS,
+                t[0][i] / (t[1][i] > 0 ? t[1][i] : 1e-9));
+
+    u_imap_free(m);
+    u_hmap_free(hmap);
+    u_hmap_opts_free(opts);
+    u_free(keys);
+
+    return U_TEST_SUCCESS;
+err:
+    u_imap_free(m);
+    U_FREEF(hmap, u_hmap_free);
+    U_FREEF(opts, u_hmap_opts_free);
+    U_FREE(keys);
+
+    return U_TEST_FAILURE;
+}
+#endif  /* !NO_HMAP */
+
+int test_suite_imap_register (u_test_t *t)
+{
+    u_test_suite_t *ts = NULL;
+
+    con_err_if (u_test_suite_new("Integer Map", &ts));
+
+    con_err_if (u_test_case_register("Basic", test_basic, ts));
+    con_err_if (u_test_case_register("Churn", test_churn, ts));
+#ifndef NO_HMAP
+    con_err_if (u_test_case_register("Benchmark", test_bench, ts));
+#endif  /* !NO_HMAP */
+
+    return u_test_suite_add(ts, t);
+err:
+    u_test_suite_free(ts);
+    return ~0;
+}
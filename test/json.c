@@ -1,3 +1,5 @@
+#include <limits.h>
+#include <sys/time.h>
 #include <u/libu.h>
 
 int test_suite_json_register (u_test_t *t);
@@ -8,6 +10,59 @@ static int test_build_nested_object (u_test_case_t *tc);
 static int test_build_simple_array (u_test_case_t *tc);
 static int test_iterators (u_test_case_t *tc);
 static int test_max_nesting (u_test_case_t *tc);
+static int test_long_strings (u_test_case_t *tc);
+static int test_arena (u_test_case_t *tc);
+static int test_arena_mem (u_test_case_t *tc);
+static int test_insitu (u_test_case_t *tc);
+static int test_sax (u_test_case_t *tc);
+static int test_sax_stream (u_test_case_t *tc);
+static int test_encode_modes (u_test_case_t *tc);
+static int test_encode_big (u_test_case_t *tc);
+static int test_validate (u_test_case_t *tc);
+static int test_validate_fuzz (u_test_case_t *tc);
+static int test_validate_speed (u_test_case_t *tc);
+static int test_array_nth (u_test_case_t *tc);
+static int test_pointer (u_test_case_t *tc);
+static int test_pointer_keys (u_test_case_t *tc);
+static int test_lazy (u_test_case_t *tc);
+static int test_lazy_big (u_test_case_t *tc);
+
+static void *__mem_malloc (size_t sz);
+static void *__mem_calloc (size_t n, size_t sz);
+static void *__mem_realloc (void *q, size_t sz);
+static void __mem_free (void *q);
+static void __mem_count (int on);
+static char *__big_doc (size_t nrec);
+
+/* SAX callbacks appending events to a trace */
+typedef struct { char s[1024]; size_t depth, nobj, ndocs; long sum; } trace_t;
+
+static void __tr (trace_t *tr, const char *pfx, const char *s, size_t len);
+static int __tr_ostart (void *arg);
+static int __tr_oend (void *arg);
+static int __tr_astart (void *arg);
+static int __tr_aend (void *arg);
+static int __tr_key (const char *s, size_t len, void *arg);
+static int __tr_string (const char *s, size_t len, void *arg);
+static int __tr_number (const char *s, size_t len, void *arg);
+static int __tr_bool (char val, void *arg);
+static int __tr_null (void *arg);
+static int __sax_run (const char *doc, size_t chunk, trace_t *tr);
+
+/* validate 'doc' with every scanner, expecting 'exp' (0 valid, else 1) */
+static int __validate_all (const char *doc, size_t len, int exp);
+
+/* compile 'path' and resolve it against 'jo' */
+static u_json_t *__ptr_get (u_json_t *jo, const char *path);
+
+static const u_json_sax_cbs_t __tr_cbs = {
+    __tr_ostart, __tr_oend, __tr_astart, __tr_aend, 
+    __tr_key, __tr_string, __tr_number, __tr_bool, __tr_null
+};
+
+/* allocator counting live (and peak) bytes and malloc calls (size kept in a
+ * header) */
+static size_t __mem_used, __mem_peak, __mem_calls;
 
 static int test_codec (u_test_case_t *tc)
 {
@@ -251,6 +306,1620 @@ err:
     return U_TEST_FAILURE;
 }
 
+static int test_long_strings (u_test_case_t *tc)
+{
+    int i, flags[] = { 0, U_JSON_DECODE_ARENA };
+    char *s = NULL, *doc = NULL, lk[200 + 1], lv[3 * U_TOKEN_SZ + 1], 
+         ln[U_TOKEN_SZ + 1];
+    u_json_t *jo = NULL, *tmp = NULL;
+
+    /* key, string and number longer than U_TOKEN_SZ */
+    memset(lk, 'k', sizeof lk - 1), lk[sizeof lk - 1] = '\0';
+    memset(lv, 'v', sizeof lv - 1), lv[sizeof lv - 1] = '\0';
+    memset(ln, '7', sizeof ln - 1), ln[sizeof ln - 1] = '\0';
+    lv[10] = '\\', lv[11] = 'n';
+
+    u_test_err_if ((doc = u_malloc(sizeof lk + sizeof lv + sizeof ln + 32)) 
+            == NULL);
+    (void) sprintf(doc, "{ \"%s\": \"%s\", \"n\": %s }", lk, lv, ln);
+
+    for (i = 0; i < 2; i++)
+    {
+        u_test_err_if (u_json_decode_ex(doc, flags[i], &jo));
+        u_test_err_if (strcmp(u_json_get_val(u_json_child_first(jo)), lv));
+        u_test_err_if (u_json_encode(jo, &s));
+        u_test_err_ifm (strcmp(s, doc), "%s and %s differ !", doc, s);
+        u_free(s), s = NULL;
+        u_json_free(jo), jo = NULL;
+    }
+
+    /* the same built by hand */
+    u_test_err_if (u_json_new_object(NULL, &jo));
+    u_test_err_if (u_json_new_string(lk, lv, &tmp));
+    u_test_err_if (u_json_add(jo, tmp));
+    u_test_err_if (u_json_new_number("n", "1", &tmp));
+    u_test_err_if (u_json_add(jo, tmp));
+    tmp = NULL;
+    u_test_err_if (u_json_new_number("n", "x", &tmp) == 0);
+    u_test_err_if (u_json_set_val_ex(u_json_child_last(jo), ln, 1));
+    u_test_err_if (u_json_encode(jo, &s));
+    u_test_err_ifm (strcmp(s, doc), "%s and %s differ !", doc, s);
+
+    u_free(s);
+    u_free(doc);
+    u_json_free(jo);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(s);
+    U_FREE(doc);
+    u_json_free(jo);
+    u_json_free(tmp);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_arena (u_test_case_t *tc)
+{
+    long l;
+    char *s = NULL;
+    u_json_t *jo = NULL, *tmp = NULL, *sub = NULL;
+    const char *doc = "{ \"a\": [ 1, 2, { \"b\": \"x\" } ], \"c\": null }";
+    const char *ex = "{ \"a\": [ 1, 2, { \"b\": \"a much longer value\" } ], "
+        "\"d\": [ 3, { \"e\": [  ] } ] }";
+
+    u_test_err_if (u_json_decode_ex(doc, U_JSON_DECODE_ARENA, &jo));
+
+    /* cached access, value overwrite */
+    u_test_err_if (u_json_index(jo));
+    u_test_err_if (u_json_cache_get_int(jo, ".a[1]", &l) || l != 2);
+    u_test_err_if (u_json_cache_set_tv(jo, ".a[2].b", U_JSON_TYPE_UNKNOWN,
+                "a much longer value"));
+    u_test_err_if (u_json_remove(u_json_cache_get(jo, ".c")) == 0);
+    u_test_err_if (u_json_unindex(jo));
+
+    /* remove an arena node, graft heap nodes and another arena document */
+    u_test_err_if (u_json_remove(u_json_child_last(jo)));
+    u_test_err_if (u_json_new_array("d", &tmp));
+    u_test_err_if (u_json_add(jo, tmp));
+    u_test_err_if (u_json_new_int(NULL, 3, &tmp));
+    u_test_err_if (u_json_add(u_json_child_last(jo), tmp));
+    tmp = NULL;
+    u_test_err_if (u_json_decode_ex("{ \"e\": [ ] }", U_JSON_DECODE_ARENA, 
+                &sub));
+    u_test_err_if (u_json_add(u_json_child_last(jo), sub));
+    sub = NULL;
+
+    u_test_err_if (u_json_encode(jo, &s));
+    u_test_err_ifm (strcmp(s, ex), "expecting \'%s\', got \'%s\'", ex, s);
+
+    /* reindex after changes */
+    u_test_err_if (u_json_index(jo));
+    u_test_err_if (u_json_cache_get_int(jo, ".d[0]", &l) || l != 3);
+    u_test_err_if (u_json_cache_get(jo, ".d[1].e") == NULL);
+
+    u_free(s);
+    u_json_free(jo);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(s);
+    u_json_free(jo);
+    u_json_free(tmp);
+    u_json_free(sub);
+
+    return U_TEST_FAILURE;
+}
+
+static void *__mem_malloc (size_t sz)
+{
+    size_t *p;
+
+    if ((p = malloc(sz + 2 * sizeof(size_t))) == NULL)
+        return NULL;
+
+    p[0] = sz;
+    __mem_used += sz;
+    __mem_peak = U_MAX(__mem_peak, __mem_used);
+    __mem_calls += 1;
+
+    return p + 2;
+}
+
+static void *__mem_calloc (size_t n, size_t sz)
+{
+    void *p;
+
+    if ((p = __mem_malloc(n * sz)) != NULL)
+        memset(p, 0, n * sz);
+
+    return p;
+}
+
+static void *__mem_realloc (void *q, size_t sz)
+{
+    size_t *p, old;
+
+    if (q == NULL)
+        return __mem_malloc(sz);
+
+    p = (size_t *) q - 2;
+    old = p[0];
+
+    if ((p = realloc(p, sz + 2 * sizeof(size_t))) == NULL)
+        return NULL;
+
+    p[0] = sz;
+    __mem_used += sz - old;
+    __mem_peak = U_MAX(__mem_peak, __mem_used);
+    __mem_calls += 1;
+
+    return p + 2;
+}
+
+static void __mem_free (void *q)
+{
+    size_t *p;
+
+    if (q == NULL)
+        return;
+
+    p = (size_t *) q - 2;
+    __mem_used -= p[0];
+    free(p);
+}
+
+static void __mem_count (int on)
+{
+    u_memory_set_malloc(on ? __mem_malloc : malloc);
+    u_memory_set_calloc(on ? __mem_calloc : calloc);
+    u_memory_set_realloc(on ? __mem_realloc : realloc);
+    u_memory_set_free(on ? __mem_free : free);
+}
+
+/* [ { "id": 0, "name": "user-0", "active": true, "score": 0.5, 
+ *     "tags": [ "a", "b" ] }, ... ] */
+static char *__big_doc (size_t nrec)
+{
+    size_t i;
+    u_string_t *s = NULL;
+
+    dbg_err_if (u_string_create("[ ", 2, &s));
+
+    for (i = 0; i < nrec; i++)
+    {
+        dbg_err_if (u_string_aprintf(s, "%s{ \"id\": %zu, \"name\": "
+                    "\"user-%zu\", \"active\": %s, \"score\": %zu.5, "
+                    "\"tags\": [ \"a\", \"b\" ] }", i ? ", " : "", i, i, 
+                    (i % 2) ? "true" : "false", i % 100));
+    }
+
+    dbg_err_if (u_string_aprintf(s, " ]"));
+
+    return u_string_detach_cstr(s);
+err:
+    if (s)
+        u_string_free(s);
+    return NULL;
+}
+
+/* memory taken by a decoded ~10MB document, with and without arena */
+static int test_arena_mem (u_test_case_t *tc)
+{
+    enum { NREC = 100000 };
+    int i, flags[] = { 0, U_JSON_DECODE_ARENA };
+    size_t base, mem[2], calls[2], fixed;
+    char *doc = NULL;
+    u_json_t *jo = NULL;
+
+    u_test_err_if ((doc = __big_doc(NREC)) == NULL);
+
+    for (i = 0; i < 2; i++)
+    {
+        __mem_count(1);
+        base = __mem_used, __mem_calls = 0;
+
+        if (u_json_decode_ex(doc, flags[i], &jo))
+        {
+            __mem_count(0);
+            u_test_err_ifm (1, "decode failed");
+        }
+
+        /* the lexer copy of the input text is gone by now */
+        mem[i] = __mem_used - base, calls[i] = __mem_calls;
+
+        u_json_free(jo), jo = NULL;
+        __mem_count(0);
+
+        u_test_err_ifm (__mem_used != base, "leaked %zu bytes", 
+                __mem_used - base);
+    }
+
+    /* lower bound for nodes with fixed size key, value and fqn buffers */
+    fixed = (NREC * 8 + 1) * (U_JSON_FQN_SZ + 2 * U_TOKEN_SZ);
+
+    u_test_case_printf(tc, "%zu bytes document: heap %zu bytes in %zu "
+            "allocations, arena %zu bytes in %zu allocations (fixed size "
+            "buffers alone would take %zu bytes)", strlen(doc), mem[0], 
+            calls[0], mem[1], calls[1], fixed);
+
+    u_test_err_if (mem[1] > fixed / 3);
+    u_test_err_if (mem[1] > mem[0] + mem[0] / 20);
+    u_test_err_if (calls[1] > calls[0] / 1000);
+
+    u_free(doc);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(doc);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_insitu (u_test_case_t *tc)
+{
+    enum { NREC = 10000 };
+    long l;
+    double d;
+    u_json_it_t jit;
+    size_t i, len, mem[2];
+    char *s = NULL, *big = NULL, *cp = NULL, buf[256];
+    u_json_t *jo = NULL, *cur;
+    const char *doc = "{ \"k\\u00e8y\": \"a\\\"b\\\\c\\/d\\n\\u0041\\u00e9"
+        "\\u20ac\\ud83d\\ude00\\u0001\", \"n\": -1.5e3, \"e\": \"\", "
+        "\"x\": [ \"\\t\", 7 ] }";
+    const char *ex = "{ \"k\xc3\xa8y\": \"a\\\"b\\\\c/d\\nA\xc3\xa9\xe2\x82\xac"
+        "\xf0\x9f\x98\x80\\u0001\", \"n\": -1.5e3, \"e\": \"\", "
+        "\"x\": [ \"\\t\", 7 ] }";
+
+    (void) u_strlcpy(buf, doc, sizeof buf);
+    u_test_err_if (u_json_decode_insitu(buf, strlen(doc), &jo));
+
+    /* strings are unescaped and referenced in place */
+    cur = u_json_child_first(jo);
+    u_test_err_if (strcmp(u_json_get_val(cur), 
+                "a\"b\\c/d\nA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\x01"));
+    u_test_err_if (u_json_get_val(cur) < buf || 
+            u_json_get_val(cur) >= buf + sizeof buf);
+    u_test_err_if (u_json_it(cur, &jit));
+    (void) u_json_it_next(&jit);
+    u_test_err_if (u_json_get_real(u_json_it_next(&jit), &d) || d != -1500);
+
+    /* and escaped back on encoding */
+    u_test_err_if (u_json_encode(jo, &s));
+    u_test_err_ifm (strcmp(s, ex), "expecting \'%s\', got \'%s\'", ex, s);
+    u_free(s), s = NULL;
+
+    /* values set afterwards are in JSON form, as usual */
+    u_test_err_if (u_json_set_val(cur, "\\u00e8"));
+    u_test_err_if (u_json_index(jo));
+    u_test_err_if (u_json_cache_get_int(jo, ".x[1]", &l) || l != 7);
+    u_test_err_if (strcmp(u_json_cache_get_val(jo, ".k\xc3\xa8y"), "\\u00e8"));
+    u_json_free(jo), jo = NULL;
+
+    /* only 'len' bytes are parsed */
+    (void) u_strlcpy(buf, "[ 1, 2 ]xyz", sizeof buf);
+    u_test_err_if (u_json_decode_insitu(buf, 8, &jo));
+    u_test_err_if (u_json_array_count(jo) != 2);
+    u_json_free(jo), jo = NULL;
+    (void) u_strlcpy(buf, "[ 1, 2 ]", sizeof buf);
+    u_test_err_if (u_json_decode_insitu(buf, 6, &jo) == 0);
+
+    /* unpaired surrogates are replaced by U+FFFD... */
+    (void) u_strlcpy(buf, "[ \"a\\ud83db\", \"\\ude00\", \"\\ud83d\\u0041\" ]", 
+            sizeof buf);
+    u_test_err_if (u_json_decode_insitu(buf, strlen(buf), &jo));
+    u_test_err_if (u_json_encode_ex(jo, U_JSON_ENCODE_COMPACT, &s, NULL));
+    u_test_err_ifm (strcmp(s, "[\"a\xef\xbf\xbd" "b\",\"\xef\xbf\xbd\","
+                "\"\xef\xbf\xbd" "A\"]"), "got \'%s\'", s);
+    u_free(s), s = NULL;
+    u_json_free(jo), jo = NULL;
+
+    /* ...while NULs can't be held by in situ strings */
+    (void) u_strlcpy(buf, "[ \"a\\u0000b\" ]", sizeof buf);
+    u_test_err_if (u_json_decode_insitu(buf, strlen(buf), &jo) == 0);
+    (void) u_strlcpy(buf, "{ \"\\u0000\": 1 }", sizeof buf);
+    u_test_err_if (u_json_decode_insitu(buf, strlen(buf), &jo) == 0);
+
+    /* no copies: less memory (at peak) than the arena decoder */
+    u_test_err_if ((big = __big_doc(NREC)) == NULL);
+    len = strlen(big);
+    u_test_err_if ((cp = u_malloc(len + 1)) == NULL);
+
+    for (i = 0; i < 2; i++)
+    {
+        memcpy(cp, big, len + 1);
+
+        __mem_count(1);
+        mem[i] = __mem_peak = __mem_used;
+
+        if ((i == 0) ? u_json_decode_ex(cp, U_JSON_DECODE_ARENA, &jo) :
+                u_json_decode_insitu(cp, len, &jo))
+        {
+            __mem_count(0);
+            u_test_err_ifm (1, "decode failed");
+        }
+
+        mem[i] = __mem_peak - mem[i];
+        u_json_free(jo), jo = NULL;
+        __mem_count(0);
+    }
+
+    u_test_case_printf(tc, "%zu bytes document: peak memory arena %zu bytes,"
+            " in situ %zu bytes", len, mem[0], mem[1]);
+    u_test_err_if (mem[1] >= mem[0]);
+
+    u_free(cp);
+    u_free(big);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(s);
+    U_FREE(cp);
+    U_FREE(big);
+    u_json_free(jo);
+
+    return U_TEST_FAILURE;
+}
+
+static void __tr (trace_t *tr, const char *pfx, const char *s, size_t len)
+{
+    size_t n = strlen(tr->s);
+
+    (void) u_snprintf(tr->s + n, sizeof tr->s - n, "%s%s%.*s", n ? " " : "", 
+            pfx, (int) len, s);
+}
+
+static int __tr_ostart (void *arg)
+{
+    __tr(arg, "{", "", 0);
+    ((trace_t *) arg)->depth++;
+    return 0;
+}
+
+static int __tr_oend (void *arg)
+{
+    trace_t *tr = arg;
+
+    __tr(tr, "}", "", 0);
+    tr->nobj++;
+    if (--tr->depth == 0)
+        tr->ndocs++;
+    return 0;
+}
+
+static int __tr_astart (void *arg)
+{
+    __tr(arg, "[", "", 0);
+    ((trace_t *) arg)->depth++;
+    return 0;
+}
+
+static int __tr_aend (void *arg)
+{
+    trace_t *tr = arg;
+
+    __tr(tr, "]", "", 0);
+    if (--tr->depth == 0)
+        tr->ndocs++;
+    return 0;
+}
+
+static int __tr_key (const char *s, size_t len, void *arg)
+{
+    __tr(arg, "k:", s, len);
+    return 0;
+}
+
+static int __tr_string (const char *s, size_t len, void *arg)
+{
+    __tr(arg, "s:", s, len);
+    return 0;
+}
+
+static int __tr_number (const char *s, size_t len, void *arg)
+{
+    trace_t *tr = arg;
+    char n[32];
+
+    /* a non-integer number stops the parser when 'sum' is negative */
+    (void) u_snprintf(n, sizeof n, "%.*s", (int) len, s);
+    if (tr->sum < 0 && strchr(n, '.'))
+        return ~0;
+    tr->sum += atol(n);
+
+    __tr(arg, "n:", s, len);
+    return 0;
+}
+
+static int __tr_bool (char val, void *arg)
+{
+    __tr(arg, val ? "t" : "f", "", 0);
+    return 0;
+}
+
+static int __tr_null (void *arg)
+{
+    __tr(arg, "0", "", 0);
+    return 0;
+}
+
+/* feed 'doc' in 'chunk' bytes pieces */
+static int __sax_run (const char *doc, size_t chunk, trace_t *tr)
+{
+    int rc = 0;
+    size_t off, len = strlen(doc);
+    u_json_sax_t *p = NULL;
+
+    dbg_err_if (u_json_sax_new(&__tr_cbs, tr, &p));
+
+    for (off = 0; rc == 0 && off < len; off += chunk)
+        rc = u_json_sax_feed(p, doc + off, U_MIN(chunk, len - off));
+
+    if (rc == 0)
+        rc = u_json_sax_end(p);
+
+    u_json_sax_free(p);
+
+    return rc;
+err:
+    return ~0;
+}
+
+static int test_sax (u_test_case_t *tc)
+{
+    size_t i, chunk;
+    u_json_t *jo = NULL;
+    trace_t tr;
+    char ns[(U_JSON_MAX_DEPTH + 1) * 2 + 1];
+    const char *doc = "{ \"a\\\"b\": [ 1, -0.5e+3, \"x\\u00e8y\", true, false, "
+        "null, {}, [ ] ], \"c\": { \"d\": \"\" } }\n[ 20 ]";
+    const char *ex = "{ k:a\\\"b [ n:1 n:-0.5e+3 s:x\\u00e8y t f 0 { } [ ] ] "
+        "k:c { k:d s: } } [ n:20 ]";
+    const char *bad[] = {
+        "[01]", "{\"a\" 1}", "{\"a\": 1]", "[tru]", "[\"\x01\"]", "[1 2]", 
+        "[\"\\x\"]", "[\"\\u12g4\"]", "[1.]", "[-]", "[1e]", "[1e+]", 
+        "\"str\"", "[1", "{\"a\"", "[ 1 ] x", "{ 1: 2 }", NULL
+    };
+
+    /* same events whatever the chunk boundaries */
+    for (chunk = 1; chunk <= strlen(doc); chunk++)
+    {
+        memset(&tr, 0, sizeof tr);
+        u_test_err_ifm (__sax_run(doc, chunk, &tr), "chunk %zu", chunk);
+        u_test_err_ifm (strcmp(tr.s, ex), "chunk %zu: expecting \'%s\', got "
+                "\'%s\'", chunk, ex, tr.s);
+        u_test_err_if (tr.ndocs != 2 || tr.sum != 21);
+    }
+
+    for (i = 0; bad[i] != NULL; i++)
+    {
+        for (chunk = 1; chunk <= strlen(bad[i]); chunk++)
+        {
+            memset(&tr, 0, sizeof tr);
+            u_test_err_ifm (__sax_run(bad[i], chunk, &tr) == 0, 
+                    "%s accepted", bad[i]);
+        }
+    }
+
+    /* same nesting limit as the tree parser */
+    for (i = 0; i < 2; i++)
+    {
+        chunk = U_JSON_MAX_DEPTH + 1 - i;
+        memset(ns, '[', chunk);
+        memset(ns + chunk, ']', chunk);
+        ns[chunk * 2] = '\0';
+
+        memset(&tr, 0, sizeof tr);
+        u_test_err_if ((__sax_run(ns, sizeof ns, &tr) == 0) != i);
+        u_test_err_if ((i == 0) != (u_json_decode(ns, &jo) != 0));
+        u_json_free(jo), jo = NULL;
+    }
+
+    /* stop from a callback */
+    memset(&tr, 0, sizeof tr);
+    tr.sum = -1000;
+    u_test_err_if (__sax_run(doc, 7, &tr) == 0);
+    u_test_err_if (strcmp(tr.s, "{ k:a\\\"b [ n:1"));
+
+    return U_TEST_SUCCESS;
+err:
+    u_json_free(jo);
+    return U_TEST_FAILURE;
+}
+
+/* newline delimited records, and an array of records, in constant memory */
+static int test_sax_stream (u_test_case_t *tc)
+{
+    enum { NREC = 100000, CHUNK = 4096 };
+    size_t i, len, off, peak;
+    char *big = NULL;
+    u_string_t *s = NULL;
+    u_json_sax_t *p = NULL;
+    trace_t tr;
+    int rc = 0;
+
+    u_test_err_if ((big = __big_doc(NREC)) == NULL);
+
+    u_test_err_if (u_string_create(NULL, 0, &s));
+    for (i = 0; i < NREC; i++)
+        u_test_err_if (u_string_aprintf(s, "{ \"id\": %zu, \"v\": [ 1, 2 ] }\n",
+                    i));
+
+    /* the trace buffer is overwritten on and on */
+    memset(&tr, 0, sizeof tr);
+
+    __mem_count(1);
+    peak = __mem_peak = __mem_used;
+
+    rc = u_json_sax_new(&__tr_cbs, &tr, &p);
+
+    len = u_string_len(s);
+    for (off = 0; rc == 0 && off < len; off += CHUNK, tr.s[0] = '\0')
+        rc = u_json_sax_feed(p, u_string_c(s) + off, U_MIN(CHUNK, len - off));
+
+    len = strlen(big);
+    for (off = 0; rc == 0 && off < len; off += CHUNK, tr.s[0] = '\0')
+        rc = u_json_sax_feed(p, big + off, U_MIN(CHUNK, len - off));
+
+    if (rc == 0)
+        rc = u_json_sax_end(p);
+    else if (p)
+        u_test_case_printf(tc, "%s", u_json_sax_geterr(p));
+
+    u_json_sax_free(p);
+    peak = __mem_peak - peak;
+    __mem_count(0);
+
+    u_test_err_if (rc);
+    u_test_err_if (tr.ndocs != NREC + 1 || tr.nobj != 2 * NREC);
+
+    u_test_case_printf(tc, "%zu records: %zu bytes allocated while parsing", 
+            2 * NREC, peak);
+    u_test_err_if (peak > 4096);
+
+    u_string_free(s);
+    u_free(big);
+
+    return U_TEST_SUCCESS;
+err:
+    if (s)
+        u_string_free(s);
+    U_FREE(big);
+
+    return U_TEST_FAILURE;
+}
+
+static int test_encode_modes (u_test_case_t *tc)
+{
+    size_t i, len;
+    int fd = -1;
+    char *s = NULL, mem[128], ival[32];
+    FILE *fp = NULL;
+    u_buf_t *ubuf = NULL;
+    u_json_t *jo = NULL, *leaf = NULL;
+    long iv[] = { 0, 7, -7, 10, 99, 100, -12345, 1000000, LONG_MAX, LONG_MIN };
+    const char *in = 
+        "{\"a\": [1, \"x\\ty\", {}, []], \"\": {\"b\": null}, \"c\": true}";
+    const char *ex[] = {
+        "{ \"a\": [ 1, \"x\\ty\", {  }, [  ] ], \"\": { \"b\": null }, "
+            "\"c\": true }",
+        "{\"a\":[1,\"x\\ty\",{},[]],\"\":{\"b\":null},\"c\":true}",
+        "{\n    \"a\": [\n        1,\n        \"x\\ty\",\n        {},\n"
+            "        []\n    ],\n    \"\": {\n        \"b\": null\n    },\n"
+            "    \"c\": true\n}"
+    };
+    int flags[] = { 0, U_JSON_ENCODE_COMPACT, U_JSON_ENCODE_PRETTY };
+
+    u_test_err_if (u_json_decode(in, &jo));
+
+    for (i = 0; i < 3; i++)
+    {
+        u_test_err_if (u_json_encode_ex(jo, flags[i], &s, &len));
+        u_test_err_ifm (strcmp(s, ex[i]), "expecting \'%s\', got \'%s\'", 
+                ex[i], s);
+        u_test_err_if (len != strlen(ex[i]));
+        u_free(s), s = NULL;
+
+        /* caller's buffer: exact fit, one byte short */
+        len = strlen(ex[i]);
+        u_test_err_if (u_json_encode_mem(jo, flags[i], mem, len + 1, NULL));
+        u_test_err_if (strcmp(mem, ex[i]));
+        u_test_err_if (u_json_encode_mem(jo, flags[i], mem, len, NULL) == 0);
+    }
+
+    u_test_err_if (u_json_encode_ex(jo, U_JSON_ENCODE_COMPACT | 
+                U_JSON_ENCODE_PRETTY, &s, NULL) == 0);
+
+    /* a member only (with its key) */
+    u_test_err_if (u_json_encode_ex(u_json_child_first(jo), 
+                U_JSON_ENCODE_COMPACT, &s, NULL));
+    u_test_err_if (strcmp(s, "\"a\":[1,\"x\\ty\",{},[]]"));
+    u_free(s), s = NULL;
+
+    /* appended to a buffer */
+    u_test_err_if (u_buf_create(&ubuf));
+    u_test_err_if (u_buf_append(ubuf, "x=", 2));
+    u_test_err_if (u_json_encode_buf(jo, U_JSON_ENCODE_COMPACT, ubuf));
+    u_test_err_if ((size_t) u_buf_len(ubuf) != strlen(ex[1]) + 2);
+    u_test_err_if (strncmp((char *) u_buf_ptr(ubuf) + 2, ex[1], 
+                strlen(ex[1])));
+
+    /* streamed through a tiny window */
+    u_test_err_if ((fp = tmpfile()) == NULL);
+    fd = fileno(fp);
+    u_test_err_if (u_json_encode_fd(jo, U_JSON_ENCODE_PRETTY, fd, 5));
+    u_test_err_if (lseek(fd, 0, SEEK_SET) != 0);
+    len = strlen(ex[2]);
+    u_test_err_if (read(fd, mem, sizeof mem) != (ssize_t) len);
+    u_test_err_if (memcmp(mem, ex[2], len));
+
+    /* integers */
+    for (i = 0; i < sizeof iv / sizeof iv[0]; i++)
+    {
+        (void) u_snprintf(ival, sizeof ival, "%ld", iv[i]);
+        u_test_err_if (u_json_new_int(NULL, iv[i], &leaf));
+        u_test_err_ifm (strcmp(u_json_get_val(leaf), ival), 
+                "%s != %s", u_json_get_val(leaf), ival);
+        u_json_free(leaf), leaf = NULL;
+    }
+
+    fclose(fp);
+    u_buf_free(ubuf);
+    u_json_free(jo);
+
+    return U_TEST_SUCCESS;
+err:
+    if (fp)
+        fclose(fp);
+    if (ubuf)
+        u_buf_free(ubuf);
+    u_json_free(leaf);
+    u_json_free(jo);
+    U_FREE(s);
+
+    return U_TEST_FAILURE;
+}
+
+/* wide and deep trees, which used to be encoded recursively */
+static int test_encode_big (u_test_case_t *tc)
+{
+    enum { NELEMS = 1000000, DEPTH = 100000, NREC = 20000, NRUNS = 10 };
+    size_t i, len, len2;
+    char *s = NULL, *big = NULL;
+    u_json_t *jo = NULL, *cur, *leaf = NULL;
+    struct timeval t0, t1, d;
+
+    /* one million siblings */
+    u_test_err_if (u_json_new_array(NULL, &jo));
+    for (i = 0; i < NELEMS; i++)
+    {
+        u_test_err_if (u_json_new_int(NULL, (long) i, &leaf));
+        u_test_err_if (u_json_add(jo, leaf));
+        leaf = NULL;
+    }
+
+    u_test_err_if (u_json_encode_ex(jo, U_JSON_ENCODE_COMPACT, &s, &len));
+    u_test_err_if (strncmp(s, "[0,1,2,", 7));
+    u_test_err_if (strcmp(s + len - 15, ",999998,999999]"));
+    u_free(s), s = NULL;
+    u_json_free(jo), jo = NULL;
+
+    /* nested arrays way deeper than the decoder would accept */
+    u_test_err_if (u_json_new_array(NULL, &jo));
+    for (cur = jo, i = 1; i < DEPTH; i++)
+    {
+        u_test_err_if (u_json_new_array(NULL, &leaf));
+        u_test_err_if (u_json_add(cur, leaf));
+        cur = leaf, leaf = NULL;
+    }
+
+    u_test_err_if (u_json_encode_ex(jo, U_JSON_ENCODE_COMPACT, &s, &len));
+    u_test_err_if (len != 2 * DEPTH);
+    u_test_err_if (s[DEPTH - 1] != '[' || s[DEPTH] != ']');
+    u_free(s), s = NULL;
+    u_json_free(jo), jo = NULL;
+
+    /* throughput on a real-world document */
+    u_test_err_if ((big = __big_doc(NREC)) == NULL);
+    u_test_err_if (u_json_decode(big, &jo));
+
+    (void) gettimeofday(&t0, NULL);
+    for (i = 0; i < NRUNS; i++)
+    {
+        u_test_err_if (u_json_encode(jo, &s));
+        u_free(s), s = NULL;
+    }
+    (void) gettimeofday(&t1, NULL);
+    u_timersub(&t1, &t0, &d);
+
+    /* compact output decodes back to the same */
+    u_test_err_if (u_json_encode_ex(jo, U_JSON_ENCODE_COMPACT, &s, &len));
+    u_json_free(jo), jo = NULL;
+    u_test_err_if (u_json_decode(s, &jo));
+    u_free(s), s = NULL;
+    u_test_err_if (u_json_encode_ex(jo, U_JSON_ENCODE_COMPACT, &s, &len2));
+    u_test_err_if (len2 != len);
+
+    u_test_case_printf(tc, "%zu bytes document encoded in %.2f ms", 
+            strlen(big), (d.tv_sec * 1000.0 + d.tv_usec / 1000.0) / NRUNS);
+
+    u_free(s);
+    u_free(big);
+    u_json_free(jo);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(s);
+    U_FREE(big);
+    u_json_free(leaf);
+    u_json_free(jo);
+
+    return U_TEST_FAILURE;
+}
+
+static int __validate_all (const char *doc, size_t len, int exp)
+{
+    int sc, rc = 0;
+    char status[U_LEXER_ERR_SZ];
+
+    for (sc = U_JSON_SCANNER_SCALAR; sc <= U_JSON_SCANNER_AVX2; sc++)
+    {
+        if (u_json_set_scanner(sc))
+            continue;   /* not available here */
+
+        if ((u_json_validate_ex(doc, len, status) != 0) != exp)
+        {
+            u_con("scanner %d: '%.*s' %s (%s)", sc, (int) len, doc, 
+                    exp ? "accepted" : "rejected", status);
+            rc = ~0;
+        }
+    }
+
+    (void) u_json_set_scanner(U_JSON_SCANNER_AUTO);
+
+    return rc;
+}
+
+static int test_validate (u_test_case_t *tc)
+{
+    enum { NPAD = 70, DEPTH = 100000 };
+    size_t i, j, n;
+    char *buf = NULL, *deep = NULL;
+    u_json_t *jo = NULL;
+    struct { const char *doc; int bad; } tv[] = {
+        { "{}", 0 },
+        { "[]", 0 },
+        { "{ \"a\" : [ 1, -0, 0.5, -1.5e+10, 2E-3, 3e7 ], \"b\": {} }", 0 },
+        { "[ true, false, null, \"\", \"\\\"\", \"\\\\\", \"\\u00e8\\n\" ]", 0 },
+        { "[\"{[:,]}\" ,\"x\"]", 0 },
+        { "\t[\r\n1\n]\n", 0 },
+        { "[1,]", 0 },                  /* tolerated, as the decoder does */
+        { "{\"a\":1,}", 0 },
+        { "[1] x", 0 },                 /* trailing text is just warned */
+        { "", 1 },
+        { "   ", 1 },
+        { "1", 1 },
+        { "\"a\"", 1 },
+        { "[", 1 },
+        { "[1", 1 },
+        { "[\"a", 1 },
+        { "[\"a\\\"]", 1 },
+        { "[01]", 1 },
+        { "[-]", 1 },
+        { "[1.]", 1 },
+        { "[.5]", 1 },
+        { "[1e]", 1 },
+        { "[1e+]", 1 },
+        { "[+1]", 1 },
+        { "[1 2]", 1 },
+        { "[1\"a\"]", 1 },
+        { "[tru]", 1 },
+        { "[truex]", 1 },
+        { "[nul]", 1 },
+        { "[True]", 1 },
+        { "[\"\t\"]", 1 },
+        { "[\"\x01\"]", 1 },
+        { "[\"\x7f\"]", 1 },
+        { "[\x01]", 1 },
+        { "[\"\\x\"]", 1 },
+        { "[\"\\u12g4\"]", 1 },
+        { "[\"\\u12\"]", 1 },
+        { "[\\\"a\"]", 1 },
+        { "{1: 2}", 1 },
+        { "{\"a\" 1}", 1 },
+        { "{\"a\": }", 1 },
+        { "{\"a\"}", 1 },
+        { "{\"a\": 1]", 1 },
+        { "[1}", 1 },
+        { "[,]", 1 },
+        { "[1,,2]", 1 },
+        { "{,}", 1 },
+        { "[:]", 1 },
+        { NULL, 0 }
+    };
+
+    u_test_err_if ((buf = u_malloc(NPAD + 256)) == NULL);
+
+    for (i = 0; tv[i].doc != NULL; i++)
+    {
+        /* same verdict as the decoder */
+        u_test_err_ifm ((u_json_decode(tv[i].doc, &jo) != 0) != tv[i].bad, 
+                "decoder %s %s", tv[i].bad ? "accepts" : "rejects", 
+                tv[i].doc);
+        u_json_free(jo), jo = NULL;
+
+        /* at any alignment: leading white spaces move the text across the
+         * 64 bytes blocks */
+        for (j = 0; j < NPAD; j++)
+        {
+            memset(buf, ' ', j);
+            n = strlen(tv[i].doc);
+            memcpy(buf + j, tv[i].doc, n);
+            u_test_err_if (__validate_all(buf, j + n, tv[i].bad));
+        }
+    }
+
+    /* a string with n backslashes is valid if n is even, wherever the run
+     * lies across blocks */
+    for (n = 0; n < 140; n++)
+    {
+        for (j = 0; j < 64; j += 7)
+        {
+            memset(buf, ' ', j);
+            buf[j] = '[', buf[j + 1] = '"';
+            memset(buf + j + 2, '\\', n);
+            memcpy(buf + j + 2 + n, "\"]", 3);
+            u_test_err_if (__validate_all(buf, strlen(buf), n % 2));
+            u_test_err_if ((u_json_decode(buf, &jo) != 0) != (n % 2));
+            u_json_free(jo), jo = NULL;
+        }
+    }
+
+    /* the NUL terminator does not matter, the length does */
+    u_test_err_if (u_json_validate_ex("[1]]", 3, NULL));
+    u_test_err_if (u_json_validate_ex("[12]", 2, NULL) == 0);
+    u_test_err_if (u_json_validate("[ 1, 2 ]", NULL));
+
+    /* no recursion, hence no nesting limit */
+    u_test_err_if ((deep = u_malloc(2 * DEPTH + 1)) == NULL);
+    memset(deep, '[', DEPTH);
+    memset(deep + DEPTH, ']', DEPTH);
+    deep[2 * DEPTH] = '\0';
+    u_test_err_if (__validate_all(deep, 2 * DEPTH, 0));
+    u_test_err_if (__validate_all(deep, 2 * DEPTH - 1, 1));
+
+    u_free(deep);
+    u_free(buf);
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(deep);
+    U_FREE(buf);
+    u_json_free(jo);
+
+    return U_TEST_FAILURE;
+}
+
+/* random mutations of a valid document: the validator and the decoder must
+ * always agree */
+static int test_validate_fuzz (u_test_case_t *tc)
+{
+    enum { NRUNS = 20000 };
+    size_t i, k, len;
+    unsigned int seed = 1;
+    u_json_t *jo = NULL;
+    int dec;
+    char doc[512];
+    const char *base = "{ \"id\": 12, \"name\": \"a \\\"quoted\\\" \\\\ name\", "
+        "\"tags\": [ \"x\", \"\\u00e8\\t\", [], {} ], \"v\": [ -1.5e3, 0, "
+        "true, false, null ], \"deep\": { \"a\": { \"b\": [ [ 1 ] ] } }, "
+        "\"long\": \"0123456789012345678901234567890123456789012345678901234"
+        "56789\" }";
+    const char alpha[] = "{}[]:,\"\\ \t\n0123456789-+.eEtrufalsn\x01\x7f\xc3x";
+
+    for (i = 0; i < NRUNS; i++)
+    {
+        (void) u_strlcpy(doc, base, sizeof doc);
+        len = strlen(doc);
+
+        /* one to three random chars replaced, or the text cut short */
+        for (k = 0; k < 1 + i % 3; k++)
+        {
+            seed = seed * 1103515245 + 12345;
+            doc[(seed >> 8) % len] = alpha[(seed >> 20) % (sizeof alpha - 1)];
+        }
+
+        if (i % 10 == 0)
+            doc[(seed >> 4) % len] = '\0';
+
+        dec = (u_json_decode(doc, &jo) != 0);
+        u_json_free(jo), jo = NULL;
+
+        u_test_err_ifm (__validate_all(doc, strlen(doc), dec), 
+                "decoder %s '%s'", dec ? "rejects" : "accepts", doc);
+    }
+
+    return U_TEST_SUCCESS;
+err:
+    return U_TEST_FAILURE;
+}
+
+static int test_validate_speed (u_test_case_t *tc)
+{
+    enum { NREC = 20000, NRUNS = 20 };
+    int sc;
+    size_t i, len;
+    char *big = NULL;
+    double ms;
+    u_json_t *jo = NULL;
+    struct timeval t0, t1, d;
+    const char *name[] = { "auto", "scalar", "sse2", "avx2" };
+
+    u_test_err_if ((big = __big_doc(NREC)) == NULL);
+    len = strlen(big);
+
+    (void) gettimeofday(&t0, NULL);
+    u_test_err_if (u_json_decode(big, &jo));
+    (void) gettimeofday(&t1, NULL);
+    u_timersub(&t1, &t0, &d);
+    u_test_case_printf(tc, "%zu bytes document: decode %.1f MB/s", len, 
+            len / (d.tv_sec * 1e6 + d.tv_usec + 1));
+
+    for (sc = U_JSON_SCANNER_SCALAR; sc <= U_JSON_SCANNER_AVX2; sc++)
+    {
+        if (u_json_set_scanner(sc))
+            continue;
+
+        (void) gettimeofday(&t0, NULL);
+        for (i = 0; i < NRUNS; i++)
+            u_test_err_if (u_json_validate_ex(big, len, NULL));
+        (void) gettimeofday(&t1, NULL);
+        u_timersub(&t1, &t0, &d);
+
+        ms = (d.tv_sec * 1000.0 + d.tv_usec / 1000.0) / NRUNS;
+        u_test_case_printf(tc, "validate (%s): %.1f MB/s", name[sc], 
+                len / (ms * 1000.0 + 0.001));
+    }
+
+    (void) u_json_set_scanner(U_JSON_SCANNER_AUTO);
+
+    u_json_free(jo);
+    u_free(big);
+
+    return U_TEST_SUCCESS;
+err:
+    (void) u_json_set_scanner(U_JSON_SCANNER_AUTO);
+    u_json_free(jo);
+    U_FREE(big);
+
+    return U_TEST_FAILURE;
+}
+
+/* random access to big arrays (both heap and arena backed) while they are
+ * being modified, checked against a plain array */
+static int test_array_nth (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 100000, NUM_OPS = 20000 };
+    int arena;
+    long *ref = NULL, v;
+    char *s = NULL, *p;
+    size_t i, n, len;
+    unsigned int k, st = 1;
+    u_json_t *jo = NULL, *e = NULL;
+    u_json_it_t jit;
+    struct timeval t0, t1, d;
+
+    u_test_err_if ((ref = u_malloc((NUM_ELEMS + NUM_OPS) * 
+                    sizeof *ref)) == NULL);
+    u_test_err_if ((s = u_malloc(NUM_ELEMS * 8 + 3)) == NULL);
+
+    for (p = s, *p++ = '[', i = 0; i < NUM_ELEMS; i++)
+        p += sprintf(p, "%s%zu", i ? "," : "", i);
+    *p++ = ']', *p = '\0';
+
+    for (arena = 0; arena < 2; arena++)
+    {
+        u_test_err_if (u_json_decode_ex(s, arena ? U_JSON_DECODE_ARENA : 0, 
+                    &jo));
+        u_test_err_if (u_json_array_count(jo) != NUM_ELEMS);
+        u_test_err_if (u_json_array_get_nth(jo, NUM_ELEMS) != NULL);
+
+        for (n = NUM_ELEMS, i = 0; i < n; i++)
+            ref[i] = (long) i;
+
+        /* scattered reads */
+        (void) gettimeofday(&t0, NULL);
+        for (i = 0; i < NUM_ELEMS; i++)
+        {
+            k = (unsigned int) ((i * 7919) % NUM_ELEMS);
+            u_test_err_if ((e = u_json_array_get_nth(jo, k)) == NULL);
+            u_test_err_if (u_json_get_int(e, &v) || v != ref[k]);
+        }
+        (void) gettimeofday(&t1, NULL);
+        u_timersub(&t1, &t0, &d);
+        u_test_case_printf(tc, "%s: %.1f ns per random access", 
+                arena ? "arena" : "heap", 
+                (d.tv_sec * 1e9 + d.tv_usec * 1e3) / NUM_ELEMS);
+
+        /* removals at random positions interleaved with appends */
+        for (i = 0; i < NUM_OPS; i++)
+        {
+            st = st * 1103515245 + 12345;
+            k = (st >> 8) % n;
+
+            if (st % 3 == 0)
+            {
+                u_test_err_if (u_json_remove(u_json_array_get_nth(jo, k)));
+                memmove(ref + k, ref + k + 1, (n - k - 1) * sizeof *ref);
+                n--;
+            }
+            else
+            {
+                u_test_err_if (u_json_new_int(NULL, -(long) i, &e));
+                u_test_err_if (u_json_add(jo, e));
+                e = NULL;
+                ref[n++] = -(long) i;
+            }
+
+            u_test_err_if (u_json_array_count(jo) != n);
+            u_test_err_if (u_json_get_int(u_json_array_get_nth(jo, k), &v));
+            u_test_err_if (v != ref[k]);
+        }
+
+        /* full check, both by position and through the children list */
+        u_test_err_if (u_json_it(u_json_child_first(jo), &jit));
+        for (k = 0; (e = u_json_it_next(&jit)) != NULL; k++)
+        {
+            u_test_err_if (k >= n || e != u_json_array_get_nth(jo, k));
+            u_test_err_if (u_json_get_int(e, &v) || v != ref[k]);
+        }
+        u_test_err_if (k != n);
+
+        /* no stale vector after a round trip through another type */
+        u_test_err_if (u_json_set_type(jo, U_JSON_TYPE_OBJECT));
+        u_test_err_if (u_json_remove(u_json_child_first(jo)));
+        u_test_err_if (u_json_set_type(jo, U_JSON_TYPE_ARRAY));
+        u_test_err_if (u_json_get_int(u_json_array_get_nth(jo, 0), &v));
+        u_test_err_if (v != ref[1]);
+
+        u_json_free(jo), jo = NULL;
+    }
+
+    /* lazily built on a tree made ex-nihil, then appended to */
+    u_test_err_if (u_json_new_array(NULL, &jo));
+    u_test_err_if (u_json_array_get_nth(jo, 0) != NULL);
+
+    for (len = 0; len < 1000; len++)
+    {
+        u_test_err_if (u_json_new_int(NULL, (long) len, &e));
+        u_test_err_if (u_json_add(jo, e));
+        e = NULL;
+        u_test_err_if (u_json_get_int(u_json_array_get_nth(jo, 
+                        (unsigned int) len / 2), &v) || v != (long) len / 2);
+    }
+
+    /* still works on a frozen tree */
+    u_test_err_if (u_json_index(jo));
+    u_test_err_if (u_json_get_int(u_json_array_get_nth(jo, 999), &v));
+    u_test_err_if (v != 999);
+    u_test_err_if (u_json_unindex(jo));
+
+    u_json_free(jo);
+    u_free(s);
+    u_free(ref);
+
+    return U_TEST_SUCCESS;
+err:
+    u_json_free(e);
+    u_json_free(jo);
+    U_FREE(s);
+    U_FREE(ref);
+
+    return U_TEST_FAILURE;
+}
+
+static u_json_t *__ptr_get (u_json_t *jo, const char *path)
+{
+    u_json_t *res;
+    u_json_ptr_t *ptr = NULL;
+
+    if (u_json_pointer_compile(path, &ptr))
+        return NULL;
+
+    res = u_json_pointer_get(jo, ptr);
+    u_json_pointer_free(ptr);
+
+    return res;
+}
+
+static int test_pointer (u_test_case_t *tc)
+{
+    enum { NUM_RECS = 5000, NUM_RUNS = 20 };
+    size_t i, j;
+    char b, *big = NULL;
+    const char *v;
+    u_json_t *jo = NULL;
+    u_json_ptr_t *ptr[3] = { NULL, NULL, NULL };
+    struct timeval t0, t1, d;
+    double t[2];
+
+    /* the examples of RFC 6901, section 5 */
+    const char *doc = "{ \"foo\": [\"bar\", \"baz\"], \"\": 0, \"a/b\": 1, "
+        "\"c%d\": 2, \"e^f\": 3, \"g|h\": 4, \"i\\\\j\": 5, \"k\\\"l\": 6, "
+        "\" \": 7, \"m~n\": 8 }";
+    struct { const char *path; const char *val; } rfc[] = {
+        { "/foo/0", "bar" },
+        { "/foo/1", "baz" },
+        { "/", "0" },
+        { "/a~1b", "1" },
+        { "/c%d", "2" },
+        { "/e^f", "3" },
+        { "/g|h", "4" },
+        { "/i\\j", "5" },
+        { "/k\"l", "6" },
+        { "/ ", "7" },
+        { "/m~0n", "8" }
+    };
+
+    /* paths in the cache naming scheme, checked against the cache */
+    const char *doc2 = "{ \"a\": { \"b\": [ 0, 1, 2, { \"c\": \"x\", "
+        "\"\": [ [ 10, 11 ], [ 12 ] ] } ] }, \"d\": true, \"d\": false }";
+    const char *fqn[] = {
+        ".", ".a", ".a.b", ".a.b[0]", ".a.b[2]", ".a.b[3]", ".a.b[3].c", 
+        ".d", ".a.b[3].", ".a.b[3].[1][0]", ".a.b[3].[0][1]"
+    };
+    const char *nil[] = {
+        ".x", ".a.b[4]", ".a.b.c", ".a[0]", ".a.b[3].c.d", ".a.b[3].[2]", 
+        ".d[0]", "/a/b/01", "/a/b/-", "/a/b/3/c/0", "/a/x", "/d/0"
+    };
+    const char *bad[] = {
+        "a", ".a[", ".a[]", ".a[1", ".a[-1]", ".a[01]", ".a[1]x", ".a[1x]",
+        ".a[99999999999]", "a/b", "/a~", "/a~2", "/~"
+    };
+
+    u_test_err_if (u_json_decode(doc, &jo));
+
+    u_test_err_if (__ptr_get(jo, "") != jo);
+    u_test_err_if (__ptr_get(jo, "/foo") != u_json_child_first(jo));
+
+    for (i = 0; i < sizeof rfc / sizeof rfc[0]; i++)
+    {
+        u_test_err_ifm ((v = u_json_get_val(__ptr_get(jo, rfc[i].path))) 
+                == NULL || strcmp(v, rfc[i].val), "%s", rfc[i].path);
+    }
+
+    u_json_free(jo), jo = NULL;
+
+    /* members are matched by their decoded name, however they are stored */
+    u_test_err_if ((big = u_strdup(doc)) == NULL);
+    u_test_err_if (u_json_decode_insitu(big, strlen(big), &jo));
+
+    for (i = 0; i < sizeof rfc / sizeof rfc[0]; i++)
+    {
+        u_test_err_ifm ((v = u_json_get_val(__ptr_get(jo, rfc[i].path))) 
+                == NULL || strcmp(v, rfc[i].val), "%s", rfc[i].path);
+    }
+
+    u_json_free(jo), jo = NULL;
+    u_free(big), big = NULL;
+
+    u_test_err_if (u_json_decode("{ \"\\u0041b\": 1, \"\\/\": 2 }", &jo));
+    u_test_err_if ((v = u_json_get_val(__ptr_get(jo, ".Ab"))) == NULL || 
+            strcmp(v, "1"));
+    u_test_err_if ((v = u_json_get_val(__ptr_get(jo, "/~1"))) == NULL || 
+            strcmp(v, "2"));
+    u_json_free(jo), jo = NULL;
+
+    u_test_err_if (u_json_decode(doc2, &jo));
+    u_test_err_if (u_json_index(jo));
+
+    for (i = 0; i < sizeof fqn / sizeof fqn[0]; i++)
+    {
+        u_test_err_ifm (__ptr_get(jo, fqn[i]) == NULL || 
+                __ptr_get(jo, fqn[i]) != u_json_cache_get(jo, fqn[i]), 
+                "%s", fqn[i]);
+    }
+
+    u_test_err_if (u_json_unindex(jo));
+
+    /* the first of duplicate keys */
+    u_test_err_if (u_json_get_bool(__ptr_get(jo, ".d"), &b) || b != 1);
+
+    /* RFC 6901 tokens select both members and elements */
+    u_test_err_if (__ptr_get(jo, "/a/b/3/c") != __ptr_get(jo, ".a.b[3].c"));
+    u_test_err_if (__ptr_get(jo, "/a/b/3//1/0") != 
+            __ptr_get(jo, ".a.b[3].[1][0]"));
+
+    /* relative to an inner node */
+    u_test_err_if (__ptr_get(__ptr_get(jo, ".a"), ".b[3].c") != 
+            __ptr_get(jo, ".a.b[3].c"));
+
+    for (i = 0; i < sizeof nil / sizeof nil[0]; i++)
+        u_test_err_ifm (__ptr_get(jo, nil[i]) != NULL, "%s", nil[i]);
+
+    for (i = 0; i < sizeof bad / sizeof bad[0]; i++)
+    {
+        u_test_err_ifm (u_json_pointer_compile(bad[i], &ptr[0]) == 0, "%s", 
+                bad[i]);
+    }
+
+    u_json_free(jo), jo = NULL;
+
+    /* a few fields out of a big document: compiled paths vs. indexing */
+    u_test_err_if ((big = __big_doc(NUM_RECS)) == NULL);
+    u_test_err_if (u_json_pointer_compile(".[0].id", &ptr[0]));
+    u_test_err_if (u_json_pointer_compile("/2500/name", &ptr[1]));
+    u_test_err_if (u_json_pointer_compile(".[4999].tags[1]", &ptr[2]));
+
+    for (j = 0; j < 2; j++)
+    {
+        (void) gettimeofday(&t0, NULL);
+        for (i = 0; i < NUM_RUNS; i++)
+        {
+            u_test_err_if (u_json_decode(big, &jo));
+
+            if (j == 0)
+            {
+                u_test_err_if (u_json_index(jo));
+                u_test_err_if (u_json_cache_get(jo, ".[0].id") != 
+                        u_json_pointer_get(jo, ptr[0]));
+                u_test_err_if (u_json_cache_get(jo, ".[2500].name") != 
+                        u_json_pointer_get(jo, ptr[1]));
+                u_test_err_if (u_json_cache_get(jo, ".[4999].tags[1]") != 
+                        u_json_pointer_get(jo, ptr[2]));
+            }
+            else
+            {
+                u_test_err_if (u_json_pointer_get(jo, ptr[0]) == NULL);
+                u_test_err_if (u_json_pointer_get(jo, ptr[1]) == NULL);
+                u_test_err_if (u_json_pointer_get(jo, ptr[2]) == NULL);
+            }
+
+            u_json_free(jo), jo = NULL;
+        }
+        (void) gettimeofday(&t1, NULL);
+        u_timersub(&t1, &t0, &d);
+        t[j] = (d.tv_sec * 1e3 + d.tv_usec / 1e3) / NUM_RUNS;
+    }
+
+    u_test_case_printf(tc, "decode + 3 lookups: %.2f ms indexed, %.2f ms "
+            "with compiled paths", t[0], t[1]);
+
+    for (i = 0; i < 3; i++)
+        u_json_pointer_free(ptr[i]);
+    u_free(big);
+
+    return U_TEST_SUCCESS;
+err:
+    for (i = 0; i < 3; i++)
+        u_json_pointer_free(ptr[i]);
+    U_FREE(big);
+    u_json_free(jo);
+
+    return U_TEST_FAILURE;
+}
+
+/* member lookups in a big object (both heap and arena backed) while it is
+ * being modified, checked against a plain array of keys */
+static int test_pointer_keys (u_test_case_t *tc)
+{
+    enum { NUM_KEYS = 2000, NUM_OPS = 50000 };
+    static char live[NUM_KEYS];
+    char key[32], path[40];
+    int arena;
+    size_t i, n;
+    unsigned int k, st = 7;
+    u_json_t *jo = NULL, *e = NULL;
+    u_json_ptr_t *ptr = NULL;
+    long v;
+
+    for (arena = 0; arena < 2; arena++)
+    {
+        /* every key twice: the second ones must stay hidden until the 
+         * first ones are removed */
+        u_test_err_if (u_json_decode_ex("{ }", 
+                    arena ? U_JSON_DECODE_ARENA : 0, &jo));
+        memset(live, 0, sizeof live);
+
+        for (n = 0, i = 0; i < NUM_OPS; i++)
+        {
+            st = st * 1103515245 + 12345;
+            k = (st >> 8) % NUM_KEYS;
+            (void) u_snprintf(key, sizeof key, "k%u", k);
+            (void) u_snprintf(path, sizeof path, "/k%u", k);
+
+            u_test_err_if (u_json_pointer_compile(path, &ptr));
+            e = u_json_pointer_get(jo, ptr);
+            u_test_err_if ((e != NULL) != (live[k] != 0));
+
+            if (live[k] == 2 && st % 4 == 0)
+            {
+                /* rename the first one: the second one shows up */
+                u_test_err_if (u_json_set_key(e, "renamed"));
+                u_test_err_if (u_json_get_int(u_json_pointer_get(jo, ptr), 
+                            &v) || v != -(long) k);
+                u_test_err_if (u_json_set_key(e, key));
+            }
+
+            if (e && st % 3 == 0)
+            {
+                u_test_err_if (u_json_get_int(e, &v) || v != (long) k);
+                u_test_err_if (u_json_remove(e));
+                n--;
+
+                /* the duplicate (if any) takes its place */
+                if (--live[k])
+                {
+                    e = u_json_pointer_get(jo, ptr);
+                    u_test_err_if (u_json_get_int(e, &v) || v != -(long) k);
+                    u_test_err_if (u_json_set_val(e, key + 1));
+                }
+            }
+            else if (live[k] < 2)
+            {
+                u_test_err_if (u_json_new_int(key, live[k] ? -(long) k : 
+                            (long) k, &e));
+                u_test_err_if (u_json_add(jo, e));
+                e = NULL;
+                live[k]++, n++;
+            }
+
+            u_json_pointer_free(ptr), ptr = NULL;
+        }
+
+        for (k = 0; k < NUM_KEYS; k++)
+        {
+            (void) u_snprintf(path, sizeof path, ".k%u", k);
+            u_test_err_if ((__ptr_get(jo, path) != NULL) != (live[k] != 0));
+        }
+
+        u_test_err_if (__ptr_get(jo, ".renamed") != NULL);
+        u_test_case_printf(tc, "%s: %zu members left", arena ? "arena" : 
+                "heap", n);
+
+        u_json_free(jo), jo = NULL;
+    }
+
+    return U_TEST_SUCCESS;
+err:
+    u_json_pointer_free(ptr);
+    u_json_free(jo);
+
+    return U_TEST_FAILURE;
+}
+
+/* lazily decoded trees behave as eagerly decoded ones */
+static int test_lazy (u_test_case_t *tc)
+{
+    int i, j, flags[] = { 0, U_JSON_ENCODE_COMPACT, 0 };
+    long l;
+    char *s[2] = { NULL, NULL }, ns[(U_JSON_MAX_DEPTH + 2) * 2 + 2];
+    const char *v;
+    u_json_t *jo[2] = { NULL, NULL }, *e;
+    u_json_it_t jit;
+
+    const char *tv[] = {
+        "{  }",
+        "[  ]",
+        "[ {  }, {  }, [ [  ], {  } ] ]",
+        "{ \"unicode\": \"This is a \\uDEAD\\uBEEF.\", \"utf8\": \"\xe8\" }",
+        "[1,-2.5e+3,[3,4],{\"a\":0,\"b\":[]},true,false,null]",
+        "\n\t{ \"a\" :\n 1 , \"b\":true ,\"c\"\t:[ null ] }\r\n",
+        "{ \"q\\\"\": \"\\\\\", \"x\": \"\\\"]}\\\\\", \"\": \"\" }",
+        "{ \"NullMatrix\": [ [ null, null ], [ null, null ] ] }",
+        "[ 1, 2, ]",
+        "{ \"a\": { \"b\": 1, }, }",
+        "[ 1 ] trailing",
+        NULL
+    };
+    const char *bad[] = {
+        "", "1", "\"a\"", "[ 1 2 ]", "{ \"a\" 1 }", "[ \"abc ]", "{ 1: 2 }",
+        "[ tru ]", "{ \"a\": [ 1, 2 }", "[ [ 1 ]", NULL
+    };
+
+    for (i = 0; tv[i] != NULL; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            u_test_err_if (u_json_decode(tv[i], &jo[0]));
+            u_test_err_if (u_json_decode_ex(tv[i], U_JSON_DECODE_LAZY, 
+                        &jo[1]));
+
+            /* the last time, some random access before encoding */
+            if (j == 2 && (e = u_json_child_last(jo[1])) != NULL)
+                (void) u_json_child_first(e);
+
+            u_test_err_if (u_json_encode_ex(jo[0], flags[j], &s[0], NULL));
+            u_test_err_if (u_json_encode_ex(jo[1], flags[j], &s[1], NULL));
+            u_test_err_ifm (strcmp(s[0], s[1]), "%s and %s differ", s[0], 
+                    s[1]);
+
+            u_free(s[0]), s[0] = NULL;
+            u_free(s[1]), s[1] = NULL;
+            u_json_free(jo[0]), jo[0] = NULL;
+            u_json_free(jo[1]), jo[1] = NULL;
+        }
+    }
+
+    for (i = 0; bad[i] != NULL; i++)
+    {
+        u_test_err_ifm (u_json_decode_ex(bad[i], U_JSON_DECODE_LAZY, &jo[1])
+                == 0, "%s", bad[i]);
+    }
+
+    /* same nesting limit as the parser, whatever the depth at which the 
+     * offending node is found */
+    for (i = 1; i <= U_JSON_MAX_DEPTH + 2; i++)
+    {
+        memset(ns, '[', i);
+        ns[i] = '0';
+        memset(ns + i + 1, ']', i);
+        ns[2 * i + 1] = '\0';
+
+        j = u_json_decode(ns, &jo[0]);
+        u_json_free(jo[0]), jo[0] = NULL;
+
+        u_test_err_ifm ((u_json_decode_ex(ns, U_JSON_DECODE_LAZY, &jo[1]) 
+                    == 0) != (j == 0), "%s", ns);
+        u_json_free(jo[1]), jo[1] = NULL;
+
+        /* empty innermost container */
+        ns[i] = ' ';
+        j = u_json_decode(ns, &jo[0]);
+        u_json_free(jo[0]), jo[0] = NULL;
+
+        u_test_err_ifm ((u_json_decode_ex(ns, U_JSON_DECODE_LAZY, &jo[1]) 
+                    == 0) != (j == 0), "%s", ns);
+        u_json_free(jo[1]), jo[1] = NULL;
+    }
+
+    /* access through iterators */
+    u_test_err_if (u_json_decode_ex("[ [ 1, 2 ], { \"a\": 3, \"b\": [ 4 ] }, "
+                "5 ]", U_JSON_DECODE_LAZY, &jo[1]));
+    u_test_err_if (u_json_it(u_json_child_first(jo[1]), &jit));
+    u_test_err_if ((e = u_json_it_next(&jit)) == NULL);
+    u_test_err_if (u_json_array_count(e) != 2);
+    u_test_err_if ((e = u_json_it_next(&jit)) == NULL);
+    u_test_err_if ((e = u_json_child_last(e)) == NULL);
+    u_test_err_if (u_json_get_int(u_json_child_first(e), &l) || l != 4);
+    u_test_err_if ((e = u_json_it_next(&jit)) == NULL);
+    u_test_err_if (u_json_get_int(e, &l) || l != 5);
+    u_test_err_if (u_json_it_next(&jit) != NULL);
+
+    /* changes to containers which have not been decoded yet */
+    e = u_json_array_get_nth(jo[1], 0);
+    u_test_err_if (u_json_remove(u_json_array_get_nth(jo[1], 1)));
+    u_test_err_if (u_json_new_int(NULL, 6, &e));
+    u_test_err_if (u_json_add(jo[1], e));
+    u_json_free(jo[1]), jo[1] = NULL;
+
+    u_test_err_if (u_json_decode_ex("{ \"a\": [ 1, [ 2, 3 ] ], \"b\": 4 }", 
+                U_JSON_DECODE_LAZY, &jo[1]));
+    u_test_err_if (u_json_new_int("c", 5, &e));
+    u_test_err_if (u_json_add(jo[1], e));
+    u_test_err_if ((e = u_json_child_first(jo[1])) == NULL);
+    u_test_err_if (u_json_remove(u_json_array_get_nth(e, 0)));
+    u_test_err_if (u_json_encode_ex(jo[1], U_JSON_ENCODE_COMPACT, &s[0], 
+                NULL));
+    u_test_err_ifm (strcmp(s[0], "{\"a\":[[2,3]],\"b\":4,\"c\":5}"), 
+            "%s", s[0]);
+    u_free(s[0]), s[0] = NULL;
+
+    /* indexing decodes the whole tree */
+    u_test_err_if (u_json_index(jo[1]));
+    u_test_err_if (u_json_cache_get_int(jo[1], ".a[0][1]", &l) || l != 3);
+    u_test_err_if (u_json_unindex(jo[1]));
+    u_json_free(jo[1]), jo[1] = NULL;
+
+    /* ... also when none of it has been accessed yet */
+    u_test_err_if (u_json_decode_ex("{ \"a\": [ 1, { \"b\": \"x\" } ], "
+                "\"c\": { \"d\": [ 2, 3 ] } }", U_JSON_DECODE_LAZY, &jo[1]));
+    u_test_err_if (u_json_index(jo[1]));
+    u_test_err_if (u_json_cache_get_int(jo[1], ".c.d[1]", &l) || l != 3);
+    u_test_err_if ((v = u_json_cache_get_val(jo[1], ".a[1].b")) == NULL);
+    u_test_err_if (strcmp(v, "x"));
+    u_test_err_if (u_json_encode_ex(jo[1], U_JSON_ENCODE_COMPACT, &s[0], 
+                NULL));
+    u_test_err_ifm (strcmp(s[0], "{\"a\":[1,{\"b\":\"x\"}],"
+                "\"c\":{\"d\":[2,3]}}"), "%s", s[0]);
+    u_free(s[0]), s[0] = NULL;
+    u_test_err_if (u_json_unindex(jo[1]));
+    u_json_free(jo[1]), jo[1] = NULL;
+
+    return U_TEST_SUCCESS;
+err:
+    U_FREE(s[0]);
+    U_FREE(s[1]);
+    u_json_free(jo[0]);
+    u_json_free(jo[1]);
+
+    return U_TEST_FAILURE;
+}
+
+/* a few fields out of a big document: lazy vs. eager decoding */
+static int test_lazy_big (u_test_case_t *tc)
+{
+    enum { NREC = 20000, NRUNS = 10 };
+    int i, k, flags[] = { U_JSON_DECODE_ARENA, U_JSON_DECODE_LAZY };
+    size_t base, mem[2];
+    char *big = NULL;
+    const char *s;
+    char v[2][3][64];
+    double ms[2];
+    u_json_t *jo = NULL;
+    u_json_ptr_t *ptr[3] = { NULL, NULL, NULL };
+    struct timeval t0, t1, d;
+
+    u_test_err_if ((big = __big_doc(NREC)) == NULL);
+    u_test_err_if (u_json_pointer_compile("/0/name", &ptr[0]));
+    u_test_err_if (u_json_pointer_compile(".[10000].score", &ptr[1]));
+    u_test_err_if (u_json_pointer_compile(".[19999].tags[1]", &ptr[2]));
+
+    for (i = 0; i < 2; i++)
+    {
+        /* memory */
+        __mem_count(1);
+        base = __mem_peak = __mem_used;
+
+        if (u_json_decode_ex(big, flags[i], &jo))
+        {
+            __mem_count(0);
+            u_test_err_ifm (1, "decode failed");
+        }
+
+        for (k = 0; k < 3; k++)
+        {
+            s = u_json_get_val(u_json_pointer_get(jo, ptr[k]));
+            (void) snprintf(v[i][k], sizeof v[i][k], "%s", s ? s : "");
+        }
+
+        mem[i] = __mem_peak - base;
+        u_json_free(jo), jo = NULL;
+        __mem_count(0);
+
+        for (k = 0; k < 3; k++)
+        {
+            u_test_err_if (v[i][k][0] == '\0');
+            u_test_err_if (i == 1 && strcmp(v[0][k], v[1][k]));
+        }
+
+        /* time */
+        (void) gettimeofday(&t0, NULL);
+        for (k = 0; k < NRUNS; k++)
+        {
+            u_test_err_if (u_json_decode_ex(big, flags[i], &jo));
+            u_test_err_if (u_json_pointer_get(jo, ptr[0]) == NULL);
+            u_test_err_if (u_json_pointer_get(jo, ptr[1]) == NULL);
+            u_test_err_if (u_json_pointer_get(jo, ptr[2]) == NULL);
+            u_json_free(jo), jo = NULL;
+        }
+        (void) gettimeofday(&t1, NULL);
+        u_timersub(&t1, &t0, &d);
+        ms[i] = (d.tv_sec * 1e3 + d.tv_usec / 1e3) / NRUNS;
+    }
+
+    u_test_case_printf(tc, "%zu bytes document, 3 lookups: eager %.2f ms "
+            "(%zu bytes), lazy %.2f ms (%zu bytes)", strlen(big), ms[0], 
+            mem[0], ms[1], mem[1]);
+
+    /* the text and the records (as unread nodes) vs. the whole tree */
+    u_test_err_ifm (mem[1] > mem[0] / 3, "%zu vs. %zu bytes", mem[1], mem[0]);
+
+    for (k = 0; k < 3; k++)
+        u_json_pointer_free(ptr[k]);
+    u_free(big);
+
+    return U_TEST_SUCCESS;
+err:
+    for (k = 0; k < 3; k++)
+        u_json_pointer_free(ptr[k]);
+    U_FREE(big);
+    u_json_free(jo);
+
+    return U_TEST_FAILURE;
+}
+
 int test_suite_json_register (u_test_t *t)
 {
     u_test_suite_t *ts = NULL;
@@ -266,6 +1935,27 @@ int test_suite_json_register (u_test_t *t)
                 test_build_nested_object, ts));
     con_err_if (u_test_case_register("Iterators", test_iterators, ts));
     con_err_if (u_test_case_register("Nesting", test_max_nesting, ts));
+    con_err_if (u_test_case_register("Long strings", test_long_strings, ts));
+    con_err_if (u_test_case_register("Arena", test_arena, ts));
+    con_err_if (u_test_case_register("Arena memory", test_arena_mem, ts));
+    con_err_if (u_test_case_register("In situ", test_insitu, ts));
+    con_err_if (u_test_case_register("SAX", test_sax, ts));
+    con_err_if (u_test_case_register("SAX stream", test_sax_stream, ts));
+    con_err_if (u_test_case_register("Encoder modes", test_encode_modes, ts));
+    con_err_if (u_test_case_register("Encoder big trees", test_encode_big, 
+                ts));
+    con_err_if (u_test_case_register("Validator", test_validate, ts));
+    con_err_if (u_test_case_register("Validator fuzz", test_validate_fuzz, 
+                ts));
+    con_err_if (u_test_case_register("Validator speed", test_validate_speed, 
+                ts));
+    con_err_if (u_test_case_register("Array random access", test_array_nth, 
+                ts));
+    con_err_if (u_test_case_register("Pointer", test_pointer, ts));
+    con_err_if (u_test_case_register("Pointer keys", test_pointer_keys, ts));
+    con_err_if (u_test_case_register("Lazy decoding", test_lazy, ts));
+    con_err_if (u_test_case_register("Lazy decoding (big)", test_lazy_big, 
+                ts));
 
     /* JSON depends on the lexer and hmap modules. */
     con_err_if (u_test_suite_dep_register("Lexer", ts));
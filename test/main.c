@@ -14,6 +14,9 @@ int test_suite_pwd_register (u_test_t *t);
 int test_suite_json_register (u_test_t *t);
 int test_suite_lexer_register (u_test_t *t);
 int test_suite_bst_register (u_test_t *t);
+int test_suite_chmap_register (u_test_t *t);
+int test_suite_rcmap_register (u_test_t *t);
+int test_suite_imap_register (u_test_t *t);
 
 int main(int argc, char **argv)
 {
@@ -25,6 +28,7 @@ int main(int argc, char **argv)
     con_err_if (test_suite_misc_register(t));
     con_err_if (test_suite_string_register(t));
     con_err_if (test_suite_lexer_register(t));
+    con_err_if (test_suite_imap_register(t));
 
 #ifndef NO_ARRAY
     con_err_if (test_suite_array_register(t));
@@ -53,6 +57,12 @@ int main(int argc, char **argv)
 #ifndef NO_JSON
     con_err_if (test_suite_json_register(t));
 #endif  /* !NO_JSON */
+#ifndef NO_CHMAP
+    con_err_if (test_suite_chmap_register(t));
+#endif  /* !NO_CHMAP */
+#ifndef NO_RCMAP
+    con_err_if (test_suite_rcmap_register(t));
+#endif  /* !NO_RCMAP */
 #ifndef NO_BST
     con_err_if (test_suite_b64_register(t));
 #endif  /* !NO_BST */
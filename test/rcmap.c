@@ -0,0 +1,265 @@
+#include <sys/time.h>
+#include <pthread.h>
+#include <u/libu.h>
+
+int test_suite_rcmap_register (u_test_t *t);
+
+static int test_basic (u_test_case_t *tc);
+static int test_readers (u_test_case_t *tc);
+
+static size_t __int_hash (const void *key);
+static int __int_comp (const void *k1, const void *k2);
+static int __count (const void *val, const void *arg);
+static void *__reader (void *arg);
+
+enum { NUM_KEYS = 1024 };
+
+/* value: a reader finding key != its own key saw recycled memory */
+typedef struct
+{
+    int key, gen;
+} item_t;
+
+typedef struct
+{
+    u_rcmap_t *rcmap;
+    int *stop;
+    unsigned int seed;
+    long reads;
+    int rc;
+} reader_t;
+
+/* foreach argument: const itself, the counter it references is not */
+typedef struct
+{
+    int *n;
+} count_arg_t;
+
+static size_t __int_hash (const void *key)
+{
+    return (size_t) *((const int *) key);
+}
+
+static int __int_comp (const void *k1, const void *k2)
+{
+    return *((const int *) k1) != *((const int *) k2);
+}
+
+static int __count (const void *val, const void *arg)
+{
+    u_unused_args(val);
+    ++*((const count_arg_t *) arg)->n;
+    return 0;
+}
+
+static int test_basic (u_test_case_t *tc)
+{
+    enum { NUM_ELEMS = 10000 };
+    u_hmap_opts_t *opts = NULL;
+    u_rcmap_t *rcmap = NULL;
+    char key[32], val[32];
+    const char *v;
+    count_arg_t ca;
+    int i, n = 0;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_val_type(opts,
+                U_HMAP_OPTS_DATATYPE_STRING));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_rcmap_new(opts, &rcmap));
+
+    /* several resizes */
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        u_snprintf(key, sizeof key, "key%d", i);
+        u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if (u_rcmap_put(rcmap, key, val));
+    }
+    u_test_err_if (u_rcmap_count(rcmap) != NUM_ELEMS);
+
+    /* lookups are only allowed in a read section */
+    u_test_err_if (u_rcmap_get(rcmap, "key1") != NULL);
+
+    u_test_err_if (u_rcmap_read_lock(rcmap));
+    u_test_err_if (u_rcmap_read_lock(rcmap));   /* nested */
+
+    for (i = 0; i < NUM_ELEMS; ++i)
+    {
+        u_snprintf(key, sizeof key, "key%d", i);
+        u_snprintf(val, sizeof val, "val%d", i);
+        u_test_err_if ((v = u_rcmap_get(rcmap, key)) == NULL);
+        u_test_err_if (strcmp(v, val));
+    }
+    u_test_err_if (u_rcmap_get(rcmap, "nokey") != NULL);
+
+    /* overwrite: the old value stays valid until the section ends */
+    u_test_err_if ((v = u_rcmap_get(rcmap, "key7")) == NULL);
+    u_test_err_if (u_rcmap_put(rcmap, "key7", "seven"));
+    u_test_err_if (strcmp(v, "val7"));
+    u_test_err_if (strcmp(u_rcmap_get(rcmap, "key7"), "seven"));
+
+    /* delete */
+    u_test_err_if (u_rcmap_del(rcmap, "key8"));
+    u_test_err_if (u_rcmap_get(rcmap, "key8") != NULL);
+    u_test_err_if (u_rcmap_del(rcmap, "key8") == U_HMAP_ERR_NONE);
+
+    u_rcmap_read_unlock(rcmap);
+    u_rcmap_read_unlock(rcmap);
+
+    ca.n = &n;
+    u_test_err_if (u_rcmap_foreach(rcmap, __count, &ca));
+    u_test_err_if (n != NUM_ELEMS - 1);
+    u_rcmap_free(rcmap);
+    rcmap = NULL;
+
+    /* no overwrite */
+    u_test_err_if (u_hmap_opts_set_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_rcmap_new(opts, &rcmap));
+    u_test_err_if (u_rcmap_put(rcmap, "k", "first"));
+    u_test_err_if (u_rcmap_put(rcmap, "k", "second") != U_HMAP_ERR_EXISTS);
+    u_test_err_if (u_rcmap_read_lock(rcmap));
+    u_test_err_if (strcmp(u_rcmap_get(rcmap, "k"), "first"));
+    u_rcmap_read_unlock(rcmap);
+
+    u_rcmap_free(rcmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    u_rcmap_free(rcmap);
+    u_hmap_opts_free(opts);
+    return U_TEST_FAILURE;
+}
+
+static void *__reader (void *arg)
+{
+    reader_t *r = (reader_t *) arg;
+    const item_t *it;
+    int j, k;
+
+    while (!__atomic_load_n(r->stop, __ATOMIC_RELAXED))
+    {
+        dbg_err_if (u_rcmap_read_lock(r->rcmap));
+
+        for (j = 0; j < 64; ++j)
+        {
+            r->seed = r->seed * 1103515245 + 12345;
+            k = (int) ((r->seed >> 8) % NUM_KEYS);
+
+            /* key may be missing while the writer deletes it */
+            if ((it = u_rcmap_get(r->rcmap, &k)) != NULL)
+                dbg_err_if (it->key != k);
+            r->reads++;
+        }
+
+        u_rcmap_read_unlock(r->rcmap);
+    }
+
+    r->rc = 0;
+    return NULL;
+err:
+    r->rc = ~0;
+    return NULL;
+}
+
+/* readers check every value they find while a writer keeps replacing and
+ * deleting them: reclaimed memory would show up as a wrong key (or as an
+ * error under a memory checker) */
+static int test_readers (u_test_case_t *tc)
+{
+    enum { NUM_READERS = 4, NUM_WRITES = 200000 };
+    pthread_t tid[NUM_READERS];
+    reader_t r[NUM_READERS];
+    u_hmap_opts_t *opts = NULL;
+    u_rcmap_t *rcmap = NULL;
+    struct timeval t0, t1, d;
+    item_t it;
+    double secs;
+    long reads = 0;
+    int i, stop = 0, started = 0;
+
+    u_test_err_if (u_hmap_opts_new(&opts));
+    u_test_err_if (u_hmap_opts_set_key_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_key_sz(opts, sizeof(int)));
+    u_test_err_if (u_hmap_opts_set_val_type(opts, U_HMAP_OPTS_DATATYPE_OPAQUE));
+    u_test_err_if (u_hmap_opts_set_val_sz(opts, sizeof(item_t)));
+    u_test_err_if (u_hmap_opts_set_compfunc(opts, &__int_comp));
+    u_test_err_if (u_hmap_opts_set_hashfunc(opts, &__int_hash));
+    u_test_err_if (u_hmap_opts_unset_option(opts, U_HMAP_OPTS_NO_OVERWRITE));
+    u_test_err_if (u_rcmap_new(opts, &rcmap));
+
+    for (i = 0; i < NUM_KEYS; ++i)
+    {
+        it.key = i, it.gen = 0;
+        u_test_err_if (u_rcmap_put(rcmap, &i, &it));
+    }
+
+    (void) gettimeofday(&t0, NULL);
+
+    for (; started < NUM_READERS; ++started)
+    {
+        r[started].rcmap = rcmap;
+        r[started].stop = &stop;
+        r[started].seed = (unsigned int) started + 1;
+        r[started].reads = 0;
+        r[started].rc = ~0;
+        u_test_err_if (pthread_create(&tid[started], NULL, __reader,
+                    &r[started]));
+    }
+
+    for (i = 0; i < NUM_WRITES; ++i)
+    {
+        it.key = i % NUM_KEYS, it.gen = i;
+
+        if (i % 8 == 0)
+            (void) u_rcmap_del(rcmap, &it.key);
+        else
+            u_test_err_if (u_rcmap_put(rcmap, &it.key, &it));
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (; started > 0; --started)
+    {
+        (void) pthread_join(tid[started - 1], NULL);
+        u_test_err_if (r[started - 1].rc);
+        reads += r[started - 1].reads;
+    }
+
+    (void) gettimeofday(&t1, NULL);
+    u_timersub(&t1, &t0, &d);
+    secs = d.tv_sec + d.tv_usec / 1000000.0;
+
+    u_test_case_printf(tc, "%d readers: %10.0f reads/s, 1 writer: "
+            "%10.0f writes/s", NUM_READERS, reads / (secs > 0 ? secs : 1e-6),
+            NUM_WRITES / (secs > 0 ? secs : 1e-6));
+
+    u_rcmap_free(rcmap);
+    u_hmap_opts_free(opts);
+
+    return U_TEST_SUCCESS;
+err:
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    while (started > 0)
+        (void) pthread_join(tid[--started], NULL);
+    u_rcmap_free(rcmap);
+    u_hmap_opts_free(opts);
+    return U_TEST_FAILURE;
+}
+
+int test_suite_rcmap_register (u_test_t *t)
+{
+    u_test_suite_t *ts = NULL;
+
+    con_err_if (u_test_suite_new("RCU Hash Map", &ts));
+
+    con_err_if (u_test_case_register("Basic", test_basic, ts));
+    con_err_if (u_test_case_register("Concurrent Readers", test_readers, ts));
+
+    con_err_if (u_test_suite_dep_register("Hash Map", ts));
+
+    return u_test_suite_add(ts, t);
+err:
+    u_test_suite_free(ts);
+    return ~0;
+}